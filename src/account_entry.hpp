@@ -3,23 +3,128 @@
 
 #pragma once
 
+#include "tokenizer.hpp"
+
 #include <algorithm>
 #include <array>
-#include <limits>
+#include <charconv>
+#include <cstdint>
+#include <memory_resource>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 /**
- * @class AccountEntry
- * @brief Single account entry.
+ * @brief Type of the field value.
+ */
+enum class FieldType
+{
+    /** Plain text. */
+    string,
+    /** Unsigned 32-bit number, parsed on load. */
+    number,
+    /** Comma separated list. */
+    list
+};
+
+/**
+ * @struct FieldInfo
+ * @brief Description of a single field, position is the index in the schema.
+ */
+struct FieldInfo
+{
+    /** @brief Field name. */
+    const char* name;
+    /** @brief Type of the value. */
+    FieldType type;
+};
+
+/** @brief Field schema: descriptions of all fields of a line. */
+template <size_t N>
+using FieldSchema = std::array<FieldInfo, N>;
+
+/**
+ * @brief Find position of the field, fails compilation in constant
+ *        expressions if the field is not found.
+ *
+ * @param[in] schema field schema
+ * @param[in] name field name
+ *
+ * @throw std::invalid_argument if field is not found
+ *
+ * @return field index
+ */
+template <size_t N>
+constexpr size_t fieldPosition(const FieldSchema<N>& schema,
+                               std::string_view name)
+{
+    for (size_t i = 0; i < N; ++i)
+    {
+        if (name == schema[i].name)
+        {
+            return i;
+        }
+    }
+    throw std::invalid_argument("Unknown field");
+}
+
+/**
+ * @struct PlainSchema
+ * @brief Schema of N text fields.
  */
 template <size_t N>
-class AccountEntry : std::array<std::string, N>
+struct PlainSchema
+{
+    /**
+     * @brief Create field descriptions.
+     *
+     * @return schema
+     */
+    static constexpr FieldSchema<N> make()
+    {
+        FieldSchema<N> schema{};
+        for (size_t i = 0; i < N; ++i)
+        {
+            schema[i] = {"field", FieldType::string};
+        }
+        return schema;
+    }
+
+    /** @brief Field descriptions. */
+    static constexpr FieldSchema<N> fields = make();
+};
+
+/**
+ * @class BasicAccountEntry
+ * @brief Single account entry, fields are described by the schema S.
+ *
+ * Field values are allocated with the specified allocator, AccountList uses
+ * it to place all fields of the loaded file to a single arena. Numeric
+ * fields are parsed and validated once on construction.
+ */
+template <class S>
+class BasicAccountEntry : std::array<std::pmr::string, S::fields.size()>
 {
   public:
+    /** @brief Field value. */
+    using String = std::pmr::string;
+    /** @brief Allocator of field values. */
+    using Allocator = String::allocator_type;
+    /** @brief Field schema. */
+    using Schema = S;
+
     /** @brief Delimiter between fields in a line. */
     static constexpr char fieldDelimiter = ':';
+    /** @brief Delimiter between items of a list field. */
+    static constexpr char listDelimiter = ',';
+    /** @brief Number of fields. */
+    static constexpr size_t fieldCount = S::fields.size();
+
+    static_assert(fieldCount);
+    static_assert(S::fields[0].type == FieldType::string,
+                  "First field must be a name");
 
     /**
      * @brief Constructor.
@@ -28,10 +133,8 @@ class AccountEntry : std::array<std::string, N>
      *
      * @throw std::runtime_exception if line has invalid format
      */
-    AccountEntry(const std::string& line)
+    BasicAccountEntry(const std::string& line)
     {
-        static_assert(N);
-
         size_t index = 0;
         size_t begin = 0;
         size_t end = 0;
@@ -39,21 +142,64 @@ class AccountEntry : std::array<std::string, N>
         {
             end = line.find(fieldDelimiter, begin);
             this->at(index) = line.substr(begin, end - begin);
-            if (++index == N)
+            if (++index == fieldCount)
             {
                 break;
             }
             begin = end + 1;
         }
-        if (index != N || end != std::string::npos || this->at(0).empty())
+        if (index != fieldCount || end != std::string::npos)
+        {
+            throw std::runtime_error("Invalid format");
+        }
+        validate();
+    }
+
+    /**
+     * @brief Constructor: create entry from a line split by Tokenizer.
+     *
+     * @param[in] line fields of the line
+     * @param[in] alloc allocator of field values
+     *
+     * @throw std::runtime_exception if line has invalid format
+     */
+    BasicAccountEntry(const Tokenizer::Line& line,
+                      const Allocator& alloc = {}) :
+        std::array<String, fieldCount>(makeFields(
+            [&line](size_t i) {
+                return i < line.size() ? line[i] : std::string_view();
+            },
+            alloc, std::make_index_sequence<fieldCount>()))
+    {
+        if (line.size() != fieldCount)
         {
             throw std::runtime_error("Invalid format");
         }
+        validate();
+    }
+
+    /**
+     * @brief Constructor: create entry from separate fields.
+     *
+     * @param[in] fields field values
+     * @param[in] alloc allocator of field values
+     *
+     * @throw std::runtime_exception if entry name is empty or field value
+     *        doesn't match the schema
+     */
+    explicit BasicAccountEntry(
+        const std::array<std::string_view, fieldCount>& fields,
+        const Allocator& alloc = {}) :
+        std::array<String, fieldCount>(makeFields(
+            [&fields](size_t i) { return fields[i]; }, alloc,
+            std::make_index_sequence<fieldCount>()))
+    {
+        validate();
     }
 
-    virtual ~AccountEntry() = default;
+    virtual ~BasicAccountEntry() = default;
 
-    bool operator==(const std::string& entryName) const
+    bool operator==(std::string_view entryName) const
     {
         return name() == entryName;
     }
@@ -63,7 +209,7 @@ class AccountEntry : std::array<std::string, N>
      *
      * @return entry name
      */
-    const std::string& name() const
+    std::string_view name() const
     {
         return get(0);
     }
@@ -73,10 +219,14 @@ class AccountEntry : std::array<std::string, N>
      *
      * @param[in] index field index
      * @param[in] value new value
+     *
+     * @throw std::runtime_exception if value doesn't match the schema
      */
-    void set(size_t index, const std::string& value)
+    void set(size_t index, std::string_view value)
     {
+        const uint32_t num = parseField(index, value);
         this->at(index) = value;
+        numbers[index] = num;
     }
 
     /**
@@ -86,27 +236,57 @@ class AccountEntry : std::array<std::string, N>
      *
      * @return field value
      */
-    const std::string& get(size_t index) const
+    std::string_view get(size_t index) const
     {
         return this->at(index);
     }
 
     /**
-     * @brief Get field value as number.
+     * @brief Get field value as number: numeric fields are taken from the
+     *        schema, others are parsed.
      *
      * @param[in] index field index
      *
+     * @throw std::invalid_argument if field is not a number
+     * @throw std::out_of_range if number is too big
+     *
      * @return field value
      */
-    uint16_t getNumber(size_t index) const
+    uint32_t getNumber(size_t index) const
     {
-        const std::string& txt = get(index);
-        const unsigned long num = stoul(txt);
-        if (num > std::numeric_limits<uint16_t>::max())
+        if (S::fields.at(index).type == FieldType::number)
         {
-            throw std::out_of_range("Invalid numeric value");
+            return numbers[index];
         }
-        return static_cast<uint16_t>(num);
+        return parseNumber(get(index));
+    }
+
+    /**
+     * @brief Get items of a list field.
+     *
+     * @param[in] index field index
+     *
+     * @return non-empty items of the list
+     */
+    std::vector<std::string_view> getList(size_t index) const
+    {
+        const std::string_view list = get(index);
+        std::vector<std::string_view> items;
+        size_t pos = 0;
+        while (pos < list.size())
+        {
+            size_t end = list.find(listDelimiter, pos);
+            if (end == std::string_view::npos)
+            {
+                end = list.size();
+            }
+            if (end != pos)
+            {
+                items.push_back(list.substr(pos, end - pos));
+            }
+            pos = end + 1;
+        }
+        return items;
     }
 
     /**
@@ -127,40 +307,221 @@ class AccountEntry : std::array<std::string, N>
         }
         return text;
     }
+
+  private:
+    /**
+     * @brief Create field values with the allocator.
+     *
+     * @param[in] field function to get source value of the field
+     * @param[in] alloc allocator of field values
+     *
+     * @return field values
+     */
+    template <class F, size_t... I>
+    static std::array<String, fieldCount>
+        makeFields(const F& field, const Allocator& alloc,
+                   std::index_sequence<I...>)
+    {
+        // pmr strings keep their allocator on move, but not on assignment
+        return {String(field(I), alloc)...};
+    }
+
+    /**
+     * @brief Parse unsigned 32-bit number.
+     *
+     * @param[in] text source text
+     *
+     * @throw std::invalid_argument if text is not a number
+     * @throw std::out_of_range if number is too big
+     *
+     * @return number
+     */
+    static uint32_t parseNumber(std::string_view text)
+    {
+        const char* end = text.data() + text.size();
+        uint32_t num = 0;
+        const auto [ptr, ec] = std::from_chars(text.data(), end, num);
+        if (ec == std::errc::result_out_of_range)
+        {
+            throw std::out_of_range("Invalid numeric value");
+        }
+        if (ec != std::errc() || ptr != end)
+        {
+            throw std::invalid_argument("Invalid numeric value");
+        }
+        return num;
+    }
+
+    /**
+     * @brief Check field value against the schema.
+     *
+     * @param[in] index field index
+     * @param[in] value field value
+     *
+     * @throw std::runtime_exception if value doesn't match the schema
+     *
+     * @return numeric value, 0 for non-numeric fields
+     */
+    static uint32_t parseField(size_t index, std::string_view value)
+    {
+        const FieldInfo& field = S::fields.at(index);
+        if (index == 0 && value.empty())
+        {
+            throw std::runtime_error("Invalid format");
+        }
+        if (field.type != FieldType::number)
+        {
+            return 0;
+        }
+        try
+        {
+            return parseNumber(value);
+        }
+        catch (const std::logic_error&)
+        {
+            std::string err = "Invalid value of field ";
+            err += field.name;
+            err += ": ";
+            err += value;
+            throw std::runtime_error(err);
+        }
+    }
+
+    /**
+     * @brief Check all fields and cache numeric values.
+     *
+     * @throw std::runtime_exception if entry doesn't match the schema
+     */
+    void validate()
+    {
+        for (size_t i = 0; i < fieldCount; ++i)
+        {
+            numbers[i] = parseField(i, get(i));
+        }
+    }
+
+    /** @brief Parsed values of numeric fields. */
+    std::array<uint32_t, fieldCount> numbers{};
 };
 
+/** @brief Account entry with N text fields. */
+template <size_t N>
+using AccountEntry = BasicAccountEntry<PlainSchema<N>>;
+
 /**
- * @class GroupEntry
- * @brief Single entry from file /etc/group (4 fields in a row).
+ * @struct GroupSchema
+ * @brief Fields of /etc/group.
+ */
+struct GroupSchema
+{
+    /** @brief Field descriptions. */
+    static constexpr FieldSchema<4> fields = {{
+        {"name", FieldType::string},
+        {"password", FieldType::string},
+        {"gid", FieldType::number},
+        {"members", FieldType::list},
+    }};
+};
+
+/**
+ * @struct PasswdSchema
+ * @brief Fields of /etc/passwd.
  */
-class GroupEntry : public AccountEntry<4>
+struct PasswdSchema
+{
+    /** @brief Field descriptions. */
+    static constexpr FieldSchema<7> fields = {{
+        {"name", FieldType::string},
+        {"password", FieldType::string},
+        {"uid", FieldType::number},
+        {"gid", FieldType::number},
+        {"gecos", FieldType::string},
+        {"home", FieldType::string},
+        {"shell", FieldType::string},
+    }};
+};
+
+/**
+ * @struct ShadowSchema
+ * @brief Fields of /etc/shadow, dates and periods may be empty.
+ */
+struct ShadowSchema
+{
+    /** @brief Field descriptions. */
+    static constexpr FieldSchema<9> fields = {{
+        {"name", FieldType::string},
+        {"password", FieldType::string},
+        {"lastchg", FieldType::string},
+        {"min", FieldType::string},
+        {"max", FieldType::string},
+        {"warn", FieldType::string},
+        {"inactive", FieldType::string},
+        {"expire", FieldType::string},
+        {"reserved", FieldType::string},
+    }};
+};
+
+/**
+ * @struct GshadowSchema
+ * @brief Fields of /etc/gshadow.
+ */
+struct GshadowSchema
+{
+    /** @brief Field descriptions. */
+    static constexpr FieldSchema<4> fields = {{
+        {"name", FieldType::string},
+        {"password", FieldType::string},
+        {"admins", FieldType::list},
+        {"members", FieldType::list},
+    }};
+};
+
+/**
+ * @struct SubIdSchema
+ * @brief Fields of /etc/subuid and /etc/subgid.
+ */
+struct SubIdSchema
+{
+    /** @brief Field descriptions. */
+    static constexpr FieldSchema<3> fields = {{
+        {"name", FieldType::string},
+        {"start", FieldType::number},
+        {"count", FieldType::number},
+    }};
+};
+
+/**
+ * @class MemberListEntry
+ * @brief Entry with a list of group members.
+ */
+template <class S>
+class MemberListEntry : public BasicAccountEntry<S>
 {
   public:
-    using AccountEntry::AccountEntry;
+    using BasicAccountEntry<S>::BasicAccountEntry;
 
-    /** @brief Sequence number of a GID field. */
-    static constexpr size_t fieldGid = 2;
     /** @brief Sequence number of a member list field. */
-    static constexpr size_t fieldMembers = 3;
+    static constexpr size_t fieldMembers =
+        fieldPosition(S::fields, "members");
 
     /**
-     * @brief Get group Id.
+     * @brief Get group member list.
      *
-     * @return group Id
+     * @return group member list
      */
-    uint16_t gid() const
+    std::string_view getMembers() const
     {
-        return getNumber(fieldGid);
+        return this->get(fieldMembers);
     }
 
     /**
-     * @brief Get group member list.
+     * @brief Get names of group members.
      *
-     * @return group member list
+     * @return list of member names
      */
-    const std::string& getMembers() const
+    std::vector<std::string_view> getMemberList() const
     {
-        return get(fieldMembers);
+        return this->getList(fieldMembers);
     }
 
     /**
@@ -168,32 +529,56 @@ class GroupEntry : public AccountEntry<4>
      *
      * @param[in] members plain list of group members
      */
-    void setMembers(const std::string& members)
+    void setMembers(std::string_view members)
+    {
+        this->set(fieldMembers, members);
+    }
+};
+
+/**
+ * @class GroupEntry
+ * @brief Single entry from file /etc/group.
+ */
+class GroupEntry : public MemberListEntry<GroupSchema>
+{
+  public:
+    using MemberListEntry::MemberListEntry;
+
+    /** @brief Sequence number of a GID field. */
+    static constexpr size_t fieldGid = fieldPosition(Schema::fields, "gid");
+    /**
+     * @brief Get group Id.
+     *
+     * @return group Id
+     */
+    uint32_t gid() const
     {
-        set(fieldMembers, members);
+        return getNumber(fieldGid);
     }
 };
 
 /**
  * @class PasswdEntry
- * @brief Single entry from file /etc/passwd (7 fields in a row).
+ * @brief Single entry from file /etc/passwd.
  */
-class PasswdEntry : public AccountEntry<7>
+class PasswdEntry : public BasicAccountEntry<PasswdSchema>
 {
   public:
-    using AccountEntry::AccountEntry;
+    using BasicAccountEntry::BasicAccountEntry;
 
     /** @brief Sequence number of an UID field. */
-    static constexpr size_t fieldUid = 2;
+    static constexpr size_t fieldUid = fieldPosition(Schema::fields, "uid");
     /** @brief Sequence number of a primary GID field. */
-    static constexpr size_t fieldGid = 3;
+    static constexpr size_t fieldGid = fieldPosition(Schema::fields, "gid");
+    /** @brief Sequence number of a home directory field. */
+    static constexpr size_t fieldHome = fieldPosition(Schema::fields, "home");
 
     /**
      * @brief Get user Id.
      *
      * @return user Id
      */
-    uint16_t uid() const
+    uint32_t uid() const
     {
         return getNumber(fieldUid);
     }
@@ -203,11 +588,41 @@ class PasswdEntry : public AccountEntry<7>
      *
      * @return primary group Id
      */
-    uint16_t gid() const
+    uint32_t gid() const
     {
         return getNumber(fieldGid);
     }
+
+    /**
+     * @brief Get home directory.
+     *
+     * @return absolute path to the home directory
+     */
+    std::string_view home() const
+    {
+        return get(fieldHome);
+    }
+};
+
+/** @brief Single entry from file /etc/shadow. */
+using ShadowEntry = BasicAccountEntry<ShadowSchema>;
+
+/**
+ * @class GshadowEntry
+ * @brief Single entry from file /etc/gshadow.
+ */
+class GshadowEntry : public MemberListEntry<GshadowSchema>
+{
+  public:
+    using MemberListEntry::MemberListEntry;
+
+    /** @brief Sequence number of a group password field. */
+    static constexpr size_t fieldPassword =
+        fieldPosition(Schema::fields, "password");
+    /** @brief Sequence number of a group administrators field. */
+    static constexpr size_t fieldAdmins =
+        fieldPosition(Schema::fields, "admins");
 };
 
-/** @brief Single entry from file /etc/shadow (9 fields in a row). */
-using ShadowEntry = AccountEntry<9>;
+/** @brief Single entry from file /etc/subuid or /etc/subgid. */
+using SubIdEntry = BasicAccountEntry<SubIdSchema>;
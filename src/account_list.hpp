@@ -3,15 +3,24 @@
 
 #pragma once
 
+#include "tokenizer.hpp"
+
 #include <algorithm>
 #include <fstream>
+#include <memory>
+#include <memory_resource>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
 /**
  * @class AccountList
  * @brief List of accounts entries.
+ *
+ * Fields of loaded entries are placed to the arena owned by the list, so
+ * loading a file takes a constant number of allocations. Copies of the
+ * list and entries added from other lists use the default allocator.
  */
 template <class T>
 class AccountList : public std::vector<T>
@@ -19,6 +28,31 @@ class AccountList : public std::vector<T>
   public:
     using std::vector<T>::vector;
 
+    AccountList() = default;
+    AccountList(AccountList&&) = default;
+    AccountList& operator=(AccountList&&) = default;
+
+    AccountList(const AccountList& other) : std::vector<T>(other)
+    {}
+
+    ~AccountList()
+    {
+        // entries must be destroyed before the arena
+        this->clear();
+    }
+
+    AccountList& operator=(const AccountList& other)
+    {
+        if (this != &other)
+        {
+            // existing entries may be allocated in the arena, copies of
+            // other entries must not reuse them
+            this->clear();
+            std::vector<T>::operator=(other);
+        }
+        return *this;
+    }
+
     /**
      * @brief Load list from file.
      *
@@ -35,10 +69,23 @@ class AccountList : public std::vector<T>
             {
                 throw std::system_error(errno, std::system_category(), path);
             }
-            std::string line;
-            while (std::getline(file, line))
+            std::string buffer;
+            file.seekg(0, std::ios::end);
+            buffer.resize(file.tellg());
+            file.seekg(0);
+            if (!file.read(buffer.data(), buffer.size()))
             {
-                this->emplace_back(T(line));
+                throw std::system_error(errno, std::system_category(), path);
+            }
+
+            const Tokenizer lines(buffer, T::fieldDelimiter);
+            // a field never takes more than its text and the terminator
+            const auto alloc =
+                allocator(buffer.size() + lines.size() * T::fieldCount);
+            this->reserve(this->size() + lines.size());
+            for (size_t i = 0; i < lines.size(); ++i)
+            {
+                this->emplace_back(lines[i], alloc);
             }
         }
         catch (const std::system_error&)
@@ -82,7 +129,7 @@ class AccountList : public std::vector<T>
      *
      * @return pointer to the entry or nullptr if not found
      */
-    T* get(const std::string& name)
+    T* get(std::string_view name)
     {
         auto it = std::find(this->begin(), this->end(), name);
         return it == this->end() ? nullptr : &*it;
@@ -109,4 +156,26 @@ class AccountList : public std::vector<T>
         this->erase(std::remove_if(this->begin(), this->end(), pred),
                     this->end());
     }
+
+    /**
+     * @brief Get allocator for fields of new entries, the arena is created
+     *        on the first call and is freed with the list.
+     *
+     * @param[in] size expected size of the fields
+     *
+     * @return allocator of the list arena
+     */
+    typename T::Allocator allocator(size_t size)
+    {
+        if (!arena)
+        {
+            arena = std::make_unique<std::pmr::monotonic_buffer_resource>(
+                std::max<size_t>(size, 1));
+        }
+        return arena.get();
+    }
+
+  private:
+    /** @brief Arena for fields of loaded entries. */
+    std::unique_ptr<std::pmr::monotonic_buffer_resource> arena;
 };
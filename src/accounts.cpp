@@ -1,12 +1,32 @@
 // SPDX-License-Identifier: Apache-2.0
 // Copyright (C) 2020 YADRO
 
-#include "account_entry.hpp"
-#include "account_list.hpp"
 #include "accounts.hpp"
-
+#include "accounts_cache.hpp"
+#include "checksum.hpp"
+#include "metadata.hpp"
+#include "progress.hpp"
+#include "report.hpp"
+#include "ro_accounts.hpp"
+#include "root_dir.hpp"
+#include "throttle.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
 #include <set>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
 
 namespace fs = std::filesystem;
 
@@ -18,11 +38,13 @@ static const char* groupFile = "group";
 static const char* passwdFile = "passwd";
 /** @brief Name of the shadow file. */
 static const char* shadowFile = "shadow";
+/** @brief Path to SSH authorized keys file relative to home directory. */
+static const char* keysFile = ".ssh/authorized_keys";
 
 /** @brief Minimal value for UID. Most of the Linux systems (and OpenBMC too)
  *         have defined it to 1000, see UID_MIN from /etc/login.defs.
  */
-static constexpr uint16_t minUserId = 1000;
+static constexpr uint32_t minUserId = 1000;
 
 // clang-format off
 /** @brief List of users, that are created by OpenBMC but can be changed by an
@@ -42,129 +64,642 @@ static const std::set<const char*> allowedGroups = {
 };
 // clang-format on
 
-using Groups = AccountList<GroupEntry>;
-using Passwd = AccountList<PasswdEntry>;
-using Shadow = AccountList<ShadowEntry>;
+// clang-format off
+const std::array<Accounts::Handler, 6> Accounts::handlers = {{
+    {groupFile,  false, &Accounts::backupGroup,   &Accounts::restoreGroup},
+    {"gshadow",  true,  &Accounts::backupGshadow, &Accounts::restoreGshadow},
+    {passwdFile, false, &Accounts::backupPasswd,  &Accounts::restorePasswd},
+    {shadowFile, false, &Accounts::backupShadow,  &Accounts::restoreShadow},
+    {"subuid",   true,  &Accounts::backupSubIds,  &Accounts::restoreSubIds},
+    {"subgid",   true,  &Accounts::backupSubIds,  &Accounts::restoreSubIds},
+}};
+// clang-format on
+
+/**
+ * @brief Get path to SSH authorized keys of the user.
+ *
+ * @param[in] user user entry
+ *
+ * @return path relative to root FS, empty if home directory is not usable
+ */
+static fs::path keysPath(const PasswdEntry& user)
+{
+    const fs::path home = fs::path(user.home()).lexically_normal();
+    if (!home.is_absolute())
+    {
+        return {};
+    }
+    const fs::path rel = home.relative_path();
+    if (rel.empty() || *rel.begin() == "..")
+    {
+        return {};
+    }
+    return rel / keysFile;
+}
+
+/**
+ * @brief Open SSH keys file, symlinks are not followed and the path can't
+ *        escape the root directory.
+ *
+ * @param[in] root root directory
+ * @param[in] rel relative path to the keys file
+ *
+ * @throw std::system_error in case of errors
+ *
+ * @return file descriptor, -1 if there is no regular file
+ */
+static int openKeys(const RootDir& root, const fs::path& rel)
+{
+    const int fd = root.open(rel, O_RDONLY | O_NOFOLLOW);
+    if (fd == -1)
+    {
+        if (errno == ENOENT || errno == ENOTDIR || errno == ELOOP)
+        {
+            return -1;
+        }
+        throw std::system_error(errno, std::system_category(),
+                                root.path() / rel);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Read block of the file, interrupted and short reads are retried.
+ *
+ * @param[in] fd descriptor of the file
+ * @param[in] path path to the file (for error messages)
+ * @param[out] buf buffer for the data
+ * @param[in] size size of the buffer
+ *
+ * @throw std::system_error in case of errors
+ *
+ * @return number of bytes read, less than size only at the end of file
+ */
+static size_t readBlock(int fd, const fs::path& path, char* buf, size_t size)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        const ssize_t len = read(fd, buf + done, size - done);
+        if (len == 0)
+        {
+            break;
+        }
+        if (len < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw std::system_error(errno, std::system_category(), path);
+        }
+        done += len;
+    }
+    return done;
+}
+
+/**
+ * @brief Compare content of two files byte by byte.
+ *
+ * @param[in] fd1 descriptor of the first file
+ * @param[in] path1 path to the first file (for error messages)
+ * @param[in] fd2 descriptor of the second file
+ * @param[in] path2 path to the second file (for error messages)
+ * @param[out] size number of bytes read from both files
+ *
+ * @throw std::system_error in case of errors
+ *
+ * @return true if files have the same content
+ */
+static bool sameContent(int fd1, const fs::path& path1, int fd2,
+                        const fs::path& path2, size_t& size)
+{
+    char buf1[4096];
+    char buf2[sizeof(buf1)];
+    size = 0;
+    while (true)
+    {
+        const size_t len1 = readBlock(fd1, path1, buf1, sizeof(buf1));
+        const size_t len2 = readBlock(fd2, path2, buf2, sizeof(buf2));
+        size += len1 + len2;
+        if (len1 != len2 || memcmp(buf1, buf2, len1) != 0)
+        {
+            return false;
+        }
+        if (len1 < sizeof(buf1))
+        {
+            return true;
+        }
+    }
+}
 
 Accounts::Accounts(const fs::path& srcRoot, const fs::path& dstRoot,
-                   const fs::path& roRoot) :
-    srcDir(srcRoot / accountsDir),
-    dstDir(dstRoot / accountsDir), roDir(roRoot / accountsDir)
+                   const fs::path& roRoot, Throttle* throttle,
+                   AccountsCache* cache) :
+    srcRoot(srcRoot),
+    dstRoot(dstRoot), srcDir(srcRoot / accountsDir),
+    dstDir(dstRoot / accountsDir), roDir(roRoot / accountsDir),
+    throttle(throttle), cache(cache)
+{}
+
+Accounts::~Accounts() = default;
+
+void Accounts::setGroupPolicies(const GroupPolicies& groups)
 {
-    fs::create_directories(dstDir);
+    for (const auto& it : groups)
+    {
+        if (!it.first.empty() &&
+            std::none_of(allowedGroups.begin(), allowedGroups.end(),
+                         [&it](const char* name) { return it.first == name; }))
+        {
+            std::string err = "Group is not allowed to change: ";
+            err += it.first;
+            throw std::invalid_argument(err);
+        }
+    }
+    policies = groups;
+}
+
+MemberSet::Policy Accounts::groupPolicy(std::string_view group) const
+{
+    auto it = policies.find(group);
+    if (it == policies.end())
+    {
+        it = policies.find("");
+    }
+    return it == policies.end() ? MemberSet::Policy::replace : it->second;
 }
 
 void Accounts::backup()
 {
-    backupGroup();
-    backupPasswd();
-    backupShadow();
+    for (const auto& it : handlers)
+    {
+        checkCancel();
+        if (!it.optional || fs::exists(srcDir / it.name))
+        {
+            (this->*it.backup)(it.name);
+        }
+    }
+    checkCancel();
+    backupKeys();
 }
 
 void Accounts::restore()
 {
-    restoreGroup();
-    restorePasswd();
-    restoreShadow();
+    if (!users.empty())
+    {
+        Passwd bk;
+        load(bk, srcDir / passwdFile);
+        for (const auto& it : users)
+        {
+            if (!bk.get(it))
+            {
+                std::string err = "User not found in backup: ";
+                err += it;
+                throw std::runtime_error(err);
+            }
+        }
+    }
+
+    // optional files are missing in backups of systems without them
+    for (const auto& it : handlers)
+    {
+        checkCancel();
+        if (!it.optional || fs::exists(srcDir / it.name))
+        {
+            (this->*it.restore)(it.name);
+        }
+    }
+    checkCancel();
+    restoreKeys();
+}
+
+template <class T>
+void Accounts::load(T& list, const fs::path& file) const
+{
+    list.load(file);
+    if (throttle)
+    {
+        throttle->consume(fs::file_size(file));
+    }
+}
+
+template <class T>
+void Accounts::loadRo(T& list, const char* name) const
+{
+    const fs::path file = roDir / name;
+    if (cache)
+    {
+        list = *cache->get<T>(file, [this](T& data, const fs::path& path) {
+            load(data, path);
+        });
+    }
+    else
+    {
+        load(list, file);
+    }
+}
+
+template <class T>
+void Accounts::keepCurrent(T& list, const char* name) const
+{
+    T cur;
+    load(cur, dstDir / name);
+    for (const auto& entry : cur)
+    {
+        if (!list.get(entry.name()) && !isSelected(entry.name()))
+        {
+            list.push_back(entry);
+        }
+    }
+}
+
+template <class T>
+void Accounts::save(const T& list, const char* name, fs::perms perms) const
+{
+    std::string data;
+    for (const auto& entry : list)
+    {
+        data += entry.toString();
+        data += '\n';
+    }
+
+    // the file may be a symlink planted in the destination, it is replaced
+    // and not followed, parent directories are resolved beneath the root
+    fs::create_directories(dstRoot);
+    RootDir(dstRoot).replaceFile(fs::path(accountsDir) / name, data.data(),
+                                 data.size(), static_cast<mode_t>(perms));
+    if (throttle)
+    {
+        throttle->consume(data.size());
+    }
+}
+
+template <class T>
+void Accounts::commit(const T& list, const char* name, const char* type,
+                      fs::perms perms) const
+{
+    const fs::path file = dstDir / name;
+    if (!report)
+    {
+        save(list, name, perms);
+        return;
+    }
+
+    T cur;
+    if (fs::exists(file))
+    {
+        load(cur, file);
+        const fs::perms p = fs::status(file).permissions();
+        if (p != perms)
+        {
+            report->perms(fs::path(accountsDir) / name, p, perms);
+        }
+    }
+    std::set<std::string, std::less<>> names;
+    for (const auto& entry : list)
+    {
+        names.emplace(entry.name());
+        const auto* c = cur.get(entry.name());
+        if (!c)
+        {
+            report->account(type, std::string(entry.name()),
+                            Report::Change::add);
+        }
+        else if (c->toString() != entry.toString())
+        {
+            report->account(type, std::string(entry.name()),
+                            Report::Change::modify);
+        }
+    }
+    for (const auto& entry : cur)
+    {
+        if (names.find(entry.name()) == names.end())
+        {
+            report->account(type, std::string(entry.name()),
+                            Report::Change::remove);
+        }
+    }
 }
 
-void Accounts::backupGroup()
+const RoAccounts& Accounts::ro()
+{
+    if (roData)
+    {
+        return *roData;
+    }
+    roData = std::make_unique<RoAccounts>();
+
+    const std::vector<fs::path> sources = {
+        roDir / groupFile, roDir / passwdFile, roDir / shadowFile};
+    fs::path cacheFile;
+    std::string policy;
+    if (!cacheDir.empty())
+    {
+        // one cache file per RO file system
+        const std::string ro = fs::absolute(roDir).lexically_normal();
+        char name[32];
+        snprintf(name, sizeof(name), "ro-%08x.cache",
+                 Checksum::update(0, ro.data(), ro.size()));
+        cacheFile = cacheDir / name;
+
+        // filter policy, cache must be rebuilt if it is changed
+        const std::set<std::string> users(allowedUsers.begin(),
+                                          allowedUsers.end());
+        const std::set<std::string> groups(allowedGroups.begin(),
+                                           allowedGroups.end());
+        policy = ro;
+        for (const auto& it : users)
+        {
+            policy += ":u=" + it;
+        }
+        for (const auto& it : groups)
+        {
+            policy += ":g=" + it;
+        }
+
+        if (roData->load(cacheFile, sources, policy))
+        {
+            return *roData;
+        }
+    }
+
+    loadRo(roData->groups, groupFile);
+    loadRo(roData->passwd, passwdFile);
+    loadRo(roData->shadow, shadowFile);
+
+    // Exception for modifiable user accounts
+    roData->passwd.remove(allowedUsers, true);
+    roData->shadow.remove(allowedUsers, true);
+
+    // Groups which can be primary for a user
+    for (const auto& name : allowedGroups)
+    {
+        const GroupEntry* grp = roData->groups.get(name);
+        if (grp)
+        {
+            roData->validGids.insert(grp->gid());
+        }
+    }
+
+    if (!cacheFile.empty())
+    {
+        try
+        {
+            roData->save(cacheFile, sources, policy);
+        }
+        catch (const std::exception& ex)
+        {
+            // cache is optional, backup/restore can continue without it
+            fprintf(stderr, "WARNING! Unable to save accounts cache: %s\n",
+                    ex.what());
+        }
+    }
+
+    return *roData;
+}
+
+void Accounts::checkCancel() const
+{
+    if (cancel)
+    {
+        cancel->check();
+    }
+}
+
+std::vector<fs::path> Accounts::files()
+{
+    const fs::path dir = accountsDir;
+    std::vector<fs::path> list;
+    for (const auto& it : handlers)
+    {
+        list.push_back(dir / it.name);
+    }
+    return list;
+}
+
+bool Accounts::isAccountsFile(const fs::path& rel)
+{
+    const std::vector<fs::path> list = files();
+    if (std::find(list.begin(), list.end(), rel) != list.end())
+    {
+        return true;
+    }
+    const fs::path keys = keysFile;
+    return rel.filename() == keys.filename() &&
+           rel.parent_path().filename() == keys.parent_path();
+}
+
+void Accounts::backupGroup(const char* file)
 {
     Groups bk;
-    bk.load(srcDir / groupFile);
+    load(bk, srcDir / file);
 
     // Remove groups that are not in the white list
     bk.remove(allowedGroups, false);
 
-    bk.save(dstDir / groupFile);
+    save(bk, file, fs::perms::owner_read | fs::perms::owner_write);
 }
 
-void Accounts::backupPasswd()
+void Accounts::backupGshadow(const char* file)
 {
-    Passwd bk;
-    bk.load(srcDir / passwdFile);
+    Gshadow bk;
+    load(bk, srcDir / file);
+
+    // Remove groups that are not in the white list
+    bk.remove(allowedGroups, false);
 
-    Passwd ro;
-    ro.load(roDir / passwdFile);
-    ro.remove(allowedUsers, true); // Exception for modifiable user accounts
+    save(bk, file, fs::perms::owner_read | fs::perms::owner_write);
+}
+
+void Accounts::backupPasswd(const char* file)
+{
+    Passwd bk;
+    load(bk, srcDir / file);
 
     // Remove build-in accounts
-    bk.remove(ro, true);
+    bk.remove(ro().passwd, true);
 
-    bk.save(dstDir / passwdFile);
+    save(bk, file, fs::perms::owner_read | fs::perms::owner_write);
 }
 
-void Accounts::backupShadow()
+void Accounts::backupShadow(const char* file)
 {
     Shadow bk;
-    bk.load(srcDir / shadowFile);
+    load(bk, srcDir / file);
 
-    Shadow ro;
-    ro.load(roDir / shadowFile);
-    ro.remove(allowedUsers, true); // Exception for modifiable user accounts
+    // Remove build-in accounts
+    bk.remove(ro().shadow, true);
+
+    save(bk, file, fs::perms::owner_read | fs::perms::owner_write);
+}
+
+void Accounts::backupSubIds(const char* file)
+{
+    SubIds bk;
+    load(bk, srcDir / file);
 
     // Remove build-in accounts
-    bk.remove(ro, true);
+    bk.remove(ro().passwd, true);
 
-    bk.save(dstDir / shadowFile);
+    save(bk, file, fs::perms::owner_read | fs::perms::owner_write);
 }
 
-void Accounts::restoreGroup()
+void Accounts::backupKeys()
 {
-    Groups bk;
-    bk.load(srcDir / groupFile);
+    Passwd bk;
+    load(bk, dstDir / passwdFile);
 
-    Groups rst;
-    rst.load(roDir / groupFile);
+    // home directories may contain symlinks, they must not lead out of
+    // the root FS
+    const RootDir src(srcRoot);
+    const RootDir dst(dstRoot);
+    for (const auto& user : bk)
+    {
+        checkCancel();
+        const fs::path rel = keysPath(user);
+        if (rel.empty() || FileHandle(openKeys(src, rel)).get() == -1)
+        {
+            continue;
+        }
+        Metadata::copy(src, rel, dst, rel, nullptr, throttle);
+    }
+}
 
+template <class T>
+void Accounts::restoreMembers(T& list, const char* file, size_t field)
+{
+    T bk;
+    load(bk, srcDir / file);
+
+    // current members are kept for not selected users and are the base
+    // for applying changes from the backup
+    const bool applyChanges =
+        std::any_of(policies.begin(), policies.end(), [](const auto& it) {
+            return it.second == MemberSet::Policy::apply;
+        });
+    T cur;
+    if ((!users.empty() || applyChanges) && fs::exists(dstDir / file))
+    {
+        load(cur, dstDir / file);
+    }
+
+    const MemberSet selected(users);
     for (const auto& it : allowedGroups)
     {
-        GroupEntry* r = rst.get(it);
-        const GroupEntry* b = bk.get(it);
-        if (r && b)
+        auto* r = list.get(it);
+        if (!r)
+        {
+            continue;
+        }
+        const auto* b = bk.get(it);
+        const auto* c = cur.get(it);
+        const MemberSet bkMembers =
+            b ? MemberSet(b->getList(field)) : MemberSet();
+        if (!users.empty())
         {
-            // Copy membership information from backup
-            r->setMembers(b->getMembers());
+            // Current members except selected users, selected ones from backup
+            const MemberSet curMembers =
+                c ? MemberSet(c->getList(field)) : MemberSet();
+            r->set(field,
+                   MemberSet::unite(MemberSet::subtract(curMembers, selected),
+                                    MemberSet::intersect(bkMembers, selected))
+                       .toString());
+            continue;
         }
+        if (!b)
+        {
+            continue;
+        }
+        const MemberSet::Policy policy = groupPolicy(it);
+        if (policy == MemberSet::Policy::replace)
+        {
+            // Copy membership information from backup as is
+            r->set(field, b->get(field));
+            continue;
+        }
+        const MemberSet roMembers(r->getList(field));
+        const MemberSet curMembers =
+            c ? MemberSet(c->getList(field)) : roMembers;
+        r->set(field, MemberSet::merge(policy, roMembers, bkMembers, curMembers)
+                          .toString());
     }
+}
 
-    const fs::path outFile = dstDir / groupFile;
-    rst.save(outFile);
+void Accounts::restoreGroup(const char* file)
+{
+    Groups rst = ro().groups;
+    restoreMembers(rst, file, GroupEntry::fieldMembers);
 
-    fs::permissions(outFile,
-                    fs::perms::owner_read | fs::perms::owner_write |
-                        fs::perms::group_read | fs::perms::others_read,
-                    fs::perm_options::replace);
+    commit(rst, file, "group",
+           fs::perms::owner_read | fs::perms::owner_write |
+               fs::perms::group_read | fs::perms::others_read);
 }
 
-void Accounts::restorePasswd()
+void Accounts::restoreGshadow(const char* file)
 {
-    // Create a set with valid GIDs (groups which can be primary for a user)
-    std::set<uint16_t> validGids;
-    Groups groups;
-    groups.load(roDir / groupFile);
-    for (const auto& name : allowedGroups)
+    if (!fs::exists(roDir / file))
     {
-        const GroupEntry* grp = groups.get(name);
-        if (grp)
+        return; // group passwords are not used by the image
+    }
+
+    Gshadow rst;
+    loadRo(rst, file);
+    restoreMembers(rst, file, GshadowEntry::fieldMembers);
+    restoreMembers(rst, file, GshadowEntry::fieldAdmins);
+
+    // group passwords are not bound to users: selective restore keeps the
+    // current ones
+    Gshadow src;
+    if (users.empty())
+    {
+        load(src, srcDir / file);
+    }
+    else if (fs::exists(dstDir / file))
+    {
+        load(src, dstDir / file);
+    }
+    for (const auto& it : allowedGroups)
+    {
+        auto* r = rst.get(it);
+        const auto* s = src.get(it);
+        if (r && s)
         {
-            validGids.insert(grp->gid());
+            r->set(GshadowEntry::fieldPassword,
+                   s->get(GshadowEntry::fieldPassword));
         }
     }
 
+    commit(rst, file, "group password",
+           fs::perms::owner_read | fs::perms::owner_write);
+}
+
+void Accounts::restorePasswd(const char* file)
+{
+    const std::set<uint32_t>& validGids = ro().validGids;
+
     Passwd bk;
-    bk.load(srcDir / passwdFile);
+    load(bk, srcDir / file);
 
-    Passwd rst;
-    rst.load(roDir / passwdFile);
-    rst.remove(allowedUsers, true); // Exception for modifiable user accounts
+    Passwd rst = ro().passwd;
+    if (!users.empty())
+    {
+        keepCurrent(rst, file);
+    }
 
     for (const auto& user : bk)
     {
-        const std::string& name = user.name();
-        if (rst.get(name))
+        checkCancel();
+        const std::string_view name = user.name();
+        if (rst.get(name) || !isSelected(name))
         {
-            continue; // skip build-in accounts
+            continue; // skip build-in and not selected accounts
         }
         if (user.uid() < minUserId)
         {
@@ -182,37 +717,137 @@ void Accounts::restorePasswd()
         rst.push_back(user);
     }
 
-    const fs::path outFile = dstDir / passwdFile;
-    rst.save(outFile);
-
-    fs::permissions(outFile,
-                    fs::perms::owner_read | fs::perms::owner_write |
-                        fs::perms::group_read | fs::perms::others_read,
-                    fs::perm_options::replace);
+    commit(rst, file, "user",
+           fs::perms::owner_read | fs::perms::owner_write |
+               fs::perms::group_read | fs::perms::others_read);
 }
 
-void Accounts::restoreShadow()
+void Accounts::restoreShadow(const char* file)
 {
     Shadow bk;
-    bk.load(srcDir / shadowFile);
+    load(bk, srcDir / file);
 
-    Shadow rst;
-    rst.load(roDir / shadowFile);
-    rst.remove(allowedUsers, true); // Exception for modifiable user accounts
+    Shadow rst = ro().shadow;
+    if (!users.empty())
+    {
+        keepCurrent(rst, file);
+    }
 
     for (const auto& user : bk)
     {
-        const std::string& name = user.name();
-        if (rst.get(name))
+        checkCancel();
+        const std::string_view name = user.name();
+        if (rst.get(name) || !isSelected(name))
         {
-            continue; // skip build-in accounts
+            continue; // skip build-in and not selected accounts
         }
         rst.push_back(user);
     }
 
-    const fs::path outFile = dstDir / shadowFile;
-    rst.save(outFile);
+    commit(rst, file, "password",
+           fs::perms::owner_read | fs::perms::owner_write);
+}
 
-    fs::permissions(outFile, fs::perms::owner_read | fs::perms::owner_write,
-                    fs::perm_options::replace);
+void Accounts::restoreSubIds(const char* file)
+{
+    SubIds bk;
+    load(bk, srcDir / file);
+
+    SubIds rst;
+    if (fs::exists(roDir / file))
+    {
+        loadRo(rst, file);
+        // Exception for modifiable user accounts
+        rst.remove(allowedUsers, true);
+    }
+    if (!users.empty() && fs::exists(dstDir / file))
+    {
+        keepCurrent(rst, file);
+    }
+
+    for (const auto& user : bk)
+    {
+        checkCancel();
+        if (!rst.get(user.name()) && isSelected(user.name()))
+        {
+            rst.push_back(user);
+        }
+    }
+
+    commit(rst, file, "subordinate id",
+           fs::perms::owner_read | fs::perms::owner_write |
+               fs::perms::group_read | fs::perms::others_read);
+}
+
+void Accounts::restoreKeys()
+{
+    Passwd bk;
+    load(bk, srcDir / passwdFile);
+
+    // home directories may contain symlinks, they must not lead out of
+    // the root FS
+    const RootDir src(srcRoot);
+    const RootDir dst(dstRoot);
+    const Passwd& builtIn = ro().passwd;
+    for (const auto& user : bk)
+    {
+        checkCancel();
+        const fs::path rel = keysPath(user);
+        if (rel.empty() || !isSelected(user.name()) ||
+            std::find(builtIn.begin(), builtIn.end(), user.name()) !=
+                builtIn.end())
+        {
+            continue; // build-in users are not restored, their keys too
+        }
+        const FileHandle srcFile(openKeys(src, rel));
+        if (srcFile.get() == -1)
+        {
+            continue;
+        }
+
+        // skip writing if the content is the same
+        const FileHandle dstFile(openKeys(dst, rel));
+        const bool exists = dstFile.get() != -1;
+        struct stat srcSt, dstSt;
+        if (exists && fstat(srcFile.get(), &srcSt) == 0 &&
+            fstat(dstFile.get(), &dstSt) == 0 &&
+            srcSt.st_size == dstSt.st_size)
+        {
+            size_t size;
+            const bool same = sameContent(srcFile.get(), src.path() / rel,
+                                          dstFile.get(), dst.path() / rel,
+                                          size);
+            if (throttle)
+            {
+                throttle->consume(size);
+            }
+            if (same)
+            {
+                continue;
+            }
+        }
+
+        if (report)
+        {
+            report->file(rel, exists ? Report::Change::modify
+                                     : Report::Change::add);
+            continue;
+        }
+
+        const fs::path dir = rel.parent_path();
+        if (!dst.exists(dir))
+        {
+            // SSH requires the directory to be private
+            FileHandle(dst.makeDirs(dir));
+            const FileHandle dirFd(dst.open(dir, O_RDONLY | O_DIRECTORY));
+            if (dirFd.get() == -1 || fchmod(dirFd.get(), S_IRWXU) != 0 ||
+                (fchown(dirFd.get(), user.uid(), user.gid()) != 0 &&
+                 errno != EPERM))
+            {
+                throw std::system_error(errno, std::system_category(),
+                                        dst.path() / dir);
+            }
+        }
+        Metadata::copy(src, rel, dst, rel, nullptr, throttle);
+    }
 }
@@ -3,27 +3,109 @@
 
 #pragma once
 
+#include "member_set.hpp"
+
+#include <array>
 #include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class AccountsCache;
+class CancelToken;
+class Report;
+class Throttle;
+struct RoAccounts;
 
 /**
  * @class Accounts
- * @brief Backup and restore accounts: users, groups and passwords.
+ * @brief Backup and restore accounts: users, groups, passwords,
+ *        subordinate IDs and SSH authorized keys of users.
+ *
+ * Each accounts file is processed by a handler from the registry, optional
+ * files are skipped if they don't exist.
  */
 class Accounts
 {
   public:
+    /** @brief Policies of restoring group members by group name. */
+    using GroupPolicies =
+        std::map<std::string, MemberSet::Policy, std::less<>>;
+
     /**
      * @brief Constructor.
      *
      * @param[in] srcRoot source path to root FS
      * @param[in] dstRoot destination path to root FS
      * @param[in] roRoot path to RO root FS (usually "/run/initramfs/ro")
+     * @param[in] throttle I/O throughput limiter, nullptr to disable
+     * @param[in] cache cache of parsed RO files, nullptr to disable
      *
      * @throw std::exception in case of errors
      */
     Accounts(const std::filesystem::path& srcRoot,
              const std::filesystem::path& dstRoot,
-             const std::filesystem::path& roRoot);
+             const std::filesystem::path& roRoot,
+             Throttle* throttle = nullptr, AccountsCache* cache = nullptr);
+
+    ~Accounts();
+
+    /**
+     * @brief Enable persistent cache of parsed RO accounts tables.
+     *
+     * @param[in] dir path to the cache directory, empty to disable
+     */
+    void setCacheDir(const std::filesystem::path& dir)
+    {
+        cacheDir = dir;
+    }
+
+    /**
+     * @brief Limit restore to the specified users, accounts of other users
+     *        are kept in the current state.
+     *
+     * @param[in] names names of users to restore, empty to restore all
+     */
+    void setUsers(const std::set<std::string>& names)
+    {
+        users.clear();
+        users.insert(names.begin(), names.end());
+    }
+
+    /**
+     * @brief Set policies of restoring members of the allowed groups.
+     *
+     * @param[in] groups policy by group name, empty name sets the default
+     *                   for all groups (replace if not specified)
+     *
+     * @throw std::invalid_argument if group is not allowed to change
+     */
+    void setGroupPolicies(const GroupPolicies& groups);
+
+    /**
+     * @brief Report changes instead of writing accounts files (dry run).
+     *
+     * @param[in] rep report of changes, nullptr to write files
+     */
+    void setReport(Report* rep)
+    {
+        report = rep;
+    }
+
+    /**
+     * @brief Set cancellation token, it is checked before each accounts
+     *        table and entry, so written tables are never partial.
+     *
+     * @param[in] token cancellation token, nullptr to disable
+     */
+    void setCancel(const CancelToken* token)
+    {
+        cancel = token;
+    }
 
     /**
      * @brief Backup accounts files.
@@ -39,54 +121,286 @@ class Accounts
      */
     void restore();
 
+    /**
+     * @brief Get list of accounts files.
+     *
+     * @return paths to the files relative to root FS
+     */
+    static std::vector<std::filesystem::path> files();
+
+    /**
+     * @brief Check if the file is handled by accounts backup: accounts
+     *        file or SSH authorized keys of a user.
+     *
+     * @param[in] rel path to the file relative to root FS
+     *
+     * @return true if the file belongs to accounts
+     */
+    static bool isAccountsFile(const std::filesystem::path& rel);
+
   private:
+    /**
+     * @struct Handler
+     * @brief Handler of an accounts file.
+     */
+    struct Handler
+    {
+        /** @brief Name of the file in accounts directory. */
+        const char* name;
+        /** @brief The file is skipped if it doesn't exist in the source. */
+        bool optional;
+        /** @brief Backup function. */
+        void (Accounts::*backup)(const char* file);
+        /** @brief Restore function. */
+        void (Accounts::*restore)(const char* file);
+    };
+
     /**
      * @brief Backup groups.
      *
+     * @param[in] file name of the file in accounts directory
+     *
      * @throw std::exception in case of errors
      */
-    void backupGroup();
+    void backupGroup(const char* file);
+
+    /**
+     * @brief Backup group passwords and administrators.
+     *
+     * @param[in] file name of the file in accounts directory
+     *
+     * @throw std::exception in case of errors
+     */
+    void backupGshadow(const char* file);
 
     /**
      * @brief Backup users.
      *
+     * @param[in] file name of the file in accounts directory
+     *
      * @throw std::exception in case of errors
      */
-    void backupPasswd();
+    void backupPasswd(const char* file);
 
     /**
      * @brief Backup passwords.
      *
+     * @param[in] file name of the file in accounts directory
+     *
      * @throw std::exception in case of errors
      */
-    void backupShadow();
+    void backupShadow(const char* file);
+
+    /**
+     * @brief Backup subordinate UIDs or GIDs.
+     *
+     * @param[in] file name of the file in accounts directory
+     *
+     * @throw std::exception in case of errors
+     */
+    void backupSubIds(const char* file);
+
+    /**
+     * @brief Backup SSH authorized keys of users, the home directories are
+     *        visited in a single pass over the backed up users.
+     *
+     * @throw std::exception in case of errors
+     */
+    void backupKeys();
 
     /**
      * @brief Restore groups.
      *
+     * @param[in] file name of the file in accounts directory
+     *
+     * @throw std::exception in case of errors
+     */
+    void restoreGroup(const char* file);
+
+    /**
+     * @brief Restore group passwords and administrators.
+     *
+     * @param[in] file name of the file in accounts directory
+     *
      * @throw std::exception in case of errors
      */
-    void restoreGroup();
+    void restoreGshadow(const char* file);
 
     /**
      * @brief Restore users.
      *
+     * @param[in] file name of the file in accounts directory
+     *
      * @throw std::exception in case of errors
      */
-    void restorePasswd();
+    void restorePasswd(const char* file);
 
     /**
      * @brief Restore passwords.
      *
+     * @param[in] file name of the file in accounts directory
+     *
+     * @throw std::exception in case of errors
+     */
+    void restoreShadow(const char* file);
+
+    /**
+     * @brief Restore subordinate UIDs or GIDs.
+     *
+     * @param[in] file name of the file in accounts directory
+     *
+     * @throw std::exception in case of errors
+     */
+    void restoreSubIds(const char* file);
+
+    /**
+     * @brief Restore SSH authorized keys of users, files with the same
+     *        checksum as the current ones are not written.
+     *
+     * @throw std::exception in case of errors
+     */
+    void restoreKeys();
+
+    /**
+     * @brief Restore members of the allowed groups from the backup.
+     *
+     * @param[in,out] list RO groups to update
+     * @param[in] file name of the file in accounts directory
+     * @param[in] field index of the member list field
+     *
+     * @throw std::exception in case of errors
+     */
+    template <class T>
+    void restoreMembers(T& list, const char* file, size_t field);
+
+    /**
+     * @brief Get parsed and filtered RO accounts tables, load them from
+     *        persistent cache or parse source files on the first call.
+     *
+     * @throw std::exception in case of errors
+     *
+     * @return RO accounts tables
+     */
+    const RoAccounts& ro();
+
+    /**
+     * @brief Load accounts list from file.
+     *
+     * @param[out] list accounts list to fill
+     * @param[in] file path to the file to load
+     *
+     * @throw std::exception in case of errors
+     */
+    template <class T>
+    void load(T& list, const std::filesystem::path& file) const;
+
+    /**
+     * @brief Load accounts list from RO file system, use cache if enabled.
+     *
+     * @param[out] list accounts list to fill
+     * @param[in] name name of the file in RO accounts directory
+     *
      * @throw std::exception in case of errors
      */
-    void restoreShadow();
+    template <class T>
+    void loadRo(T& list, const char* name) const;
+
+    /**
+     * @brief Add accounts of not selected users from the current file.
+     *
+     * @param[in,out] list accounts list to update
+     * @param[in] name name of the file in destination accounts directory
+     *
+     * @throw std::exception in case of errors
+     */
+    template <class T>
+    void keepCurrent(T& list, const char* name) const;
+
+    /**
+     * @brief Get policy of restoring group members.
+     *
+     * @param[in] group group name
+     *
+     * @return restore policy
+     */
+    MemberSet::Policy groupPolicy(std::string_view group) const;
+
+    /**
+     * @brief Check if user is selected for restore.
+     *
+     * @param[in] name user name
+     *
+     * @return true if user is selected
+     */
+    bool isSelected(std::string_view name) const
+    {
+        return users.empty() || users.find(name) != users.end();
+    }
+
+    /**
+     * @brief Save accounts list to destination file, the file is replaced
+     *        atomically through the destination root.
+     *
+     * @param[in] list accounts list to save
+     * @param[in] name name of the file in destination accounts directory
+     * @param[in] perms permissions of the file
+     *
+     * @throw std::exception in case of errors
+     */
+    template <class T>
+    void save(const T& list, const char* name,
+              std::filesystem::perms perms) const;
+
+    /**
+     * @brief Write restored accounts list to destination file with its
+     *        permissions, or report changes in dry run mode.
+     *
+     * @param[in] list accounts list to write
+     * @param[in] name name of the file in destination accounts directory
+     * @param[in] type type of entries for the report
+     * @param[in] perms permissions of the file
+     *
+     * @throw std::exception in case of errors
+     */
+    template <class T>
+    void commit(const T& list, const char* name, const char* type,
+                std::filesystem::perms perms) const;
+
+    /**
+     * @brief Check cancellation token.
+     *
+     * @throw Cancelled if operation is cancelled
+     */
+    void checkCancel() const;
 
   private:
+    /** @brief Registry of accounts files handlers, in processing order. */
+    static const std::array<Handler, 6> handlers;
+
+    /** @brief Source root FS. */
+    const std::filesystem::path srcRoot;
+    /** @brief Destination root FS. */
+    const std::filesystem::path dstRoot;
     /** @brief Source directory. */
     const std::filesystem::path srcDir;
     /** @brief Destination directory. */
     const std::filesystem::path dstDir;
     /** @brief RO directory. */
     const std::filesystem::path roDir;
+    /** @brief I/O throughput limiter. */
+    Throttle* const throttle;
+    /** @brief Cache of parsed RO files. */
+    AccountsCache* const cache;
+    /** @brief Directory of persistent cache, empty if disabled. */
+    std::filesystem::path cacheDir;
+    /** @brief Parsed and filtered RO accounts tables. */
+    std::unique_ptr<RoAccounts> roData;
+    /** @brief Users to restore, empty for all. */
+    std::set<std::string, std::less<>> users;
+    /** @brief Policies of restoring group members. */
+    GroupPolicies policies;
+    /** @brief Report of changes, nullptr to write files. */
+    Report* report = nullptr;
+    /** @brief Cancellation token, nullptr if not cancellable. */
+    const CancelToken* cancel = nullptr;
 };
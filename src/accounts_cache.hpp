@@ -0,0 +1,165 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#pragma once
+
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <ctime>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <typeindex>
+#include <utility>
+
+/**
+ * @class AccountsCache
+ * @brief Cache of parsed accounts files from RO file system.
+ *
+ * There is one entry per file path and data type. The entry is valid while
+ * device, inode, modification time and size of the file are the same, a
+ * changed file is parsed again and replaces the old entry, so a long running
+ * process keeps only the current data. Long running processes also keep
+ * os-release of the root FS here.
+ * The cache is thread safe: files are parsed outside the lock, concurrent
+ * requests of the same file wait for the single parsing.
+ */
+class AccountsCache
+{
+  public:
+    /**
+     * @brief Get parsed file, parse it on cache miss.
+     *
+     * @param[in] file path to the file
+     * @param[in] parse function to parse the file
+     *
+     * @throw std::exception in case of errors
+     *
+     * @return pointer to the parsed data
+     */
+    template <class T>
+    std::shared_ptr<const T>
+        get(const std::filesystem::path& file,
+            const std::function<void(T&, const std::filesystem::path&)>& parse)
+    {
+        struct stat st;
+        if (stat(file.c_str(), &st) != 0)
+        {
+            throw std::system_error(errno, std::system_category(), file);
+        }
+        const Stamp stamp(st.st_dev, st.st_ino, st.st_mtim.tv_sec,
+                          st.st_mtim.tv_nsec, st.st_size);
+        const Key key(typeid(T), file.string());
+
+        std::promise<std::shared_ptr<const void>> promise;
+        std::shared_future<std::shared_ptr<const void>> result;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto& entry = entries[key];
+            if (entry.data.valid() && entry.stamp == stamp)
+            {
+                ++hitCount;
+                result = entry.data;
+            }
+            else
+            {
+                // the old data of the changed file is released here
+                ++missCount;
+                entry.stamp = stamp;
+                entry.data = promise.get_future().share();
+            }
+        }
+        if (result.valid())
+        {
+            // waits if the file is being parsed by another thread
+            return std::static_pointer_cast<const T>(result.get());
+        }
+
+        try
+        {
+            auto data = std::make_shared<T>();
+            parse(*data, file);
+            promise.set_value(data);
+            return data;
+        }
+        catch (...)
+        {
+            promise.set_exception(std::current_exception());
+            // failed entry is not cached, the next request parses again
+            std::lock_guard<std::mutex> lock(mutex);
+            const auto it = entries.find(key);
+            if (it != entries.end() && it->second.stamp == stamp)
+            {
+                entries.erase(it);
+            }
+            throw;
+        }
+    }
+
+    /**
+     * @brief Get number of cache hits.
+     *
+     * @return number of requests served from the cache
+     */
+    size_t hits() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return hitCount;
+    }
+
+    /**
+     * @brief Get number of cache misses.
+     *
+     * @return number of parsed files
+     */
+    size_t misses() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return missCount;
+    }
+
+    /**
+     * @brief Get number of cached entries.
+     *
+     * @return number of cached files
+     */
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.size();
+    }
+
+  private:
+    /** @brief Cache key: data type and path to the file. */
+    using Key = std::pair<std::type_index, std::string>;
+    /** @brief File state: device, inode, mtime (sec, nsec), size. */
+    using Stamp = std::tuple<dev_t, ino_t, time_t, long, off_t>;
+
+    /**
+     * @struct Entry
+     * @brief Cached file.
+     */
+    struct Entry
+    {
+        /** @brief State of the parsed file. */
+        Stamp stamp;
+        /** @brief Parsed data, ready when parsing is finished. */
+        std::shared_future<std::shared_ptr<const void>> data;
+    };
+
+    /** @brief Cached entries. */
+    std::map<Key, Entry> entries;
+    /** @brief Number of cache hits. */
+    size_t hitCount = 0;
+    /** @brief Number of cache misses. */
+    size_t missCount = 0;
+    /** @brief Guard for cache data. */
+    mutable std::mutex mutex;
+};
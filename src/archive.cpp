@@ -0,0 +1,1955 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "archive.hpp"
+#include "checksum.hpp"
+#include "crypto.hpp"
+#include "dictionary.hpp"
+#include "root_dir.hpp"
+#include "progress.hpp"
+#include "throttle.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <system_error>
+
+namespace fs = std::filesystem;
+
+/** @brief Size of the tar block. */
+static constexpr size_t blockSize = 512;
+/** @brief Size of the chunk used for I/O operations. */
+static constexpr size_t chunkSize = 64 * 1024;
+/** @brief Minimal size of gzip file (header and trailer). */
+static constexpr off_t gzipMinSize = 18;
+/** @brief Size of the trailer of zlib stream (64-bit uncompressed size). */
+static constexpr size_t zlibTrailerSize = 8;
+/** @brief Minimal size of zlib file (header, dictionary ID and trailer). */
+static constexpr off_t zlibMinSize = 2 + 4 + 4 + zlibTrailerSize;
+/** @brief Minimal size of encrypted file (header, empty frame, footer). */
+static constexpr off_t encryptedMinSize =
+    Decryptor::headerSize + Decryptor::prefixSize + Decryptor::tagSize +
+    Decryptor::footerSize;
+
+/** @brief Max size of the PAX global header. */
+static constexpr size_t maxGlobalHeader = 4 * 1024 * 1024;
+/** @brief PAX record with checksums of archived files. */
+static const char* paxChecksums = "OBMC.crc32c";
+/** @brief Prefix of PAX records with extended attributes. */
+static const std::string paxXattr = "SCHILY.xattr.";
+
+/** @brief Tar entry types. */
+static constexpr char typeFile = '0';
+static constexpr char typeHardLink = '1';
+static constexpr char typeSymLink = '2';
+static constexpr char typeDir = '5';
+static constexpr char typeContFile = '7';
+static constexpr char typePaxExt = 'x';
+static constexpr char typePaxGlobal = 'g';
+static constexpr char typeGnuLongName = 'L';
+static constexpr char typeGnuLongLink = 'K';
+
+/**
+ * @struct TarHeader
+ * @brief Header of tar entry (POSIX ustar format).
+ */
+struct TarHeader
+{
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char padding[12];
+};
+static_assert(sizeof(TarHeader) == blockSize);
+
+/**
+ * @brief Put number to the header field in octal format.
+ *
+ * @param[out] field pointer to the header field
+ * @param[in] size size of the field
+ * @param[in] value value to set
+ *
+ * @return false if value is too big for the field
+ */
+static bool setNumber(char* field, size_t size, uint64_t value)
+{
+    const int digits = static_cast<int>(size) - 1;
+    if (digits < 22 && value >= (1ull << (3 * digits)))
+    {
+        return false;
+    }
+    snprintf(field, size, "%0*llo", digits,
+             static_cast<unsigned long long>(value));
+    return true;
+}
+
+/**
+ * @brief Get number from the header field.
+ *
+ * @param[in] field pointer to the header field
+ * @param[in] size size of the field
+ *
+ * @return numeric value
+ */
+static uint64_t getNumber(const char* field, size_t size)
+{
+    uint64_t value = 0;
+    if (static_cast<uint8_t>(*field) & 0x80)
+    {
+        // GNU base-256 encoding
+        value = static_cast<uint8_t>(*field) & 0x7f;
+        for (size_t i = 1; i < size; ++i)
+        {
+            value = (value << 8) | static_cast<uint8_t>(field[i]);
+        }
+        return value;
+    }
+    for (size_t i = 0; i < size && field[i]; ++i)
+    {
+        if (field[i] >= '0' && field[i] <= '7')
+        {
+            value = (value << 3) | (field[i] - '0');
+        }
+        else if (field[i] != ' ')
+        {
+            throw std::runtime_error("Invalid numeric field in tar header");
+        }
+    }
+    return value;
+}
+
+/**
+ * @brief Calculate checksum of the tar header.
+ *
+ * @param[in] hdr tar header
+ *
+ * @return checksum
+ */
+static uint32_t checksum(const TarHeader& hdr)
+{
+    const uint8_t* ptr = reinterpret_cast<const uint8_t*>(&hdr);
+    uint32_t sum = 0;
+    for (size_t i = 0; i < sizeof(hdr); ++i)
+    {
+        const bool isChksum = i >= offsetof(TarHeader, chksum) &&
+                              i < offsetof(TarHeader, typeflag);
+        sum += isChksum ? ' ' : ptr[i];
+    }
+    return sum;
+}
+
+/**
+ * @brief Get size of padding that aligns data to the tar block.
+ *
+ * @param[in] size size of the data
+ *
+ * @return padding size
+ */
+static size_t padSize(uint64_t size)
+{
+    return (blockSize - size % blockSize) % blockSize;
+}
+
+/**
+ * @brief Write whole buffer to the file, interrupted writes are retried.
+ *
+ * @param[in] fd file descriptor
+ * @param[in] data pointer to the data
+ * @param[in] size size of the data
+ * @param[in] what error message
+ *
+ * @throw std::system_error in case of errors
+ */
+static void writeAll(int fd, const void* data, size_t size,
+                     const std::string& what)
+{
+    const uint8_t* ptr = static_cast<const uint8_t*>(data);
+    while (size)
+    {
+        const ssize_t rc = ::write(fd, ptr, size);
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw std::system_error(errno, std::system_category(), what);
+        }
+        if (rc == 0)
+        {
+            // no progress, don't spin forever
+            throw std::system_error(EIO, std::system_category(), what);
+        }
+        ptr += rc;
+        size -= rc;
+    }
+}
+
+/**
+ * @brief Get string from the header field.
+ *
+ * @param[in] field pointer to the header field
+ * @param[in] size size of the field
+ *
+ * @return string value
+ */
+static std::string getString(const char* field, size_t size)
+{
+    return std::string(field, strnlen(field, size));
+}
+
+/**
+ * @brief Add record to the PAX extended header.
+ *
+ * @param[out] pax extended header data
+ * @param[in] key record name
+ * @param[in] value record value
+ */
+static void addPaxRecord(std::string& pax, const std::string& key,
+                         const std::string& value)
+{
+    // record format: "LEN KEY=VALUE\n", where LEN includes itself
+    const size_t len = key.size() + value.size() + 3;
+    size_t total = len + 1;
+    while (std::to_string(total).size() + len > total)
+    {
+        ++total;
+    }
+    pax += std::to_string(total);
+    pax += ' ';
+    pax += key;
+    pax += '=';
+    pax += value;
+    pax += '\n';
+}
+
+/**
+ * @brief Parse PAX extended header.
+ *
+ * @param[in] pax extended header data
+ *
+ * @throw std::runtime_error if header has invalid format
+ *
+ * @return map of records
+ */
+static std::map<std::string, std::string> parsePax(const std::string& pax)
+{
+    std::map<std::string, std::string> records;
+    size_t pos = 0;
+    while (pos < pax.size())
+    {
+        const size_t space = pax.find(' ', pos);
+        if (space == std::string::npos)
+        {
+            break;
+        }
+        const size_t len = std::stoul(pax.substr(pos, space - pos));
+        const size_t eq = pax.find('=', space);
+        if (len == 0 || pos + len > pax.size() || eq > pos + len)
+        {
+            throw std::runtime_error("Invalid PAX header");
+        }
+        records[pax.substr(space + 1, eq - space - 1)] =
+            pax.substr(eq + 1, pos + len - eq - 2);
+        pos += len;
+    }
+    return records;
+}
+
+/**
+ * @brief Convert entry name to safe relative path.
+ *
+ * @param[in] name entry name from the archive
+ *
+ * @throw std::runtime_error if name points outside the archive root
+ *
+ * @return relative path, empty for archive root
+ */
+static fs::path safePath(const std::string& name)
+{
+    fs::path rel;
+    for (const auto& it : fs::path(name).lexically_normal().relative_path())
+    {
+        if (it == "..")
+        {
+            std::string err = "Invalid entry name in archive: ";
+            err += name;
+            throw std::runtime_error(err);
+        }
+        if (!it.empty() && it != ".")
+        {
+            rel /= it;
+        }
+    }
+    return rel;
+}
+
+/**
+ * @brief Get metadata of the archive entry.
+ *
+ * @param[in] hdr tar header
+ * @param[in] pax records of the PAX extended header
+ *
+ * @throw std::exception if header has invalid format
+ *
+ * @return entry metadata
+ */
+static Metadata entryMetadata(const TarHeader& hdr,
+                              const std::map<std::string, std::string>& pax)
+{
+    Metadata meta;
+    meta.mode = getNumber(hdr.mode, sizeof(hdr.mode)) & 07777;
+    meta.uid = getNumber(hdr.uid, sizeof(hdr.uid));
+    meta.gid = getNumber(hdr.gid, sizeof(hdr.gid));
+    meta.mtime.tv_sec = getNumber(hdr.mtime, sizeof(hdr.mtime));
+
+    for (const auto& [key, value] : pax)
+    {
+        if (key == "uid")
+        {
+            meta.uid = std::stoul(value);
+        }
+        else if (key == "gid")
+        {
+            meta.gid = std::stoul(value);
+        }
+        else if (key == "mtime")
+        {
+            // seconds with optional fraction
+            size_t pos = 0;
+            meta.mtime.tv_sec = std::stoll(value, &pos);
+            if (pos < value.size() && value[pos] == '.')
+            {
+                std::string frac = value.substr(pos + 1, 9);
+                frac.resize(9, '0');
+                meta.mtime.tv_nsec = std::stol(frac);
+            }
+        }
+        else if (key.compare(0, paxXattr.size(), paxXattr) == 0)
+        {
+            meta.xattrs.emplace_back(key.substr(paxXattr.size()), value);
+        }
+    }
+
+    return meta;
+}
+
+/**
+ * @brief Check checksums of extracted files.
+ *
+ * @param[in] list list of expected checksums ("CRC NAME" lines)
+ * @param[in] checksums checksums of extracted files
+ * @param[in] skipped names of files that were not extracted
+ *
+ * @throw std::runtime_error in case of mismatch
+ */
+static void verifyChecksums(const std::string& list,
+                            const std::map<std::string, uint32_t>& checksums,
+                            const std::set<std::string>& skipped)
+{
+    size_t pos = 0;
+    while (pos < list.size())
+    {
+        size_t end = list.find('\n', pos);
+        if (end == std::string::npos)
+        {
+            end = list.size();
+        }
+        const std::string line = list.substr(pos, end - pos);
+        pos = end + 1;
+
+        const size_t space = line.find(' ');
+        if (space == std::string::npos)
+        {
+            throw std::runtime_error("Invalid checksum list in archive");
+        }
+        const std::string name = line.substr(space + 1);
+        if (skipped.find(name) != skipped.end())
+        {
+            continue; // file was not extracted
+        }
+        const auto it = checksums.find(name);
+        if (it == checksums.end() ||
+            it->second != std::stoul(line.substr(0, space), nullptr, 16))
+        {
+            std::string err = "Checksum mismatch in archive: ";
+            err += name;
+            throw std::runtime_error(err);
+        }
+    }
+}
+
+/**
+ * @brief Remove file or empty directory before replacing it.
+ *
+ * @param[in] dirFd descriptor of the parent directory
+ * @param[in] name name of the entry
+ * @param[in] path path to the entry (for error messages)
+ *
+ * @throw std::system_error in case of errors
+ */
+static void removeEntry(int dirFd, const char* name, const fs::path& path)
+{
+    if (unlinkat(dirFd, name, 0) != 0 &&
+        (errno != EISDIR || unlinkat(dirFd, name, AT_REMOVEDIR) != 0) &&
+        errno != ENOENT)
+    {
+        throw std::system_error(errno, std::system_category(), path);
+    }
+}
+
+ArchiveWriter::ArchiveWriter(uint64_t limit) :
+    limit(limit), compressed(chunkSize)
+{
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        throw std::runtime_error("Unable to initialize compressor");
+    }
+}
+
+ArchiveWriter::ArchiveWriter(const fs::path& file, uint64_t limit) :
+    ArchiveWriter(limit)
+{
+    fd = open(file.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        throw std::system_error(errno, std::system_category(), file);
+    }
+}
+
+ArchiveWriter::ArchiveWriter(const fs::path& file, const State& state,
+                             uint64_t limit) :
+    ArchiveWriter(limit)
+{
+    fd = open(file.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        throw std::system_error(errno, std::system_category(), file);
+    }
+    if (ftruncate(fd, state.offset) != 0 || lseek(fd, 0, SEEK_END) == -1)
+    {
+        throw std::system_error(errno, std::system_category(), file);
+    }
+    if (!state.tarSize)
+    {
+        return; // nothing was written, start a new stream
+    }
+
+    // the stream was fully flushed at the durable point, so it can be
+    // continued with raw deflate, trailer of the original gzip/zlib stream
+    // is written on finish
+    deflateEnd(&stream);
+    stream = {};
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        throw std::runtime_error("Unable to initialize compressor");
+    }
+    resumed = true;
+    total = state.offset;
+    tarSize = state.tarSize;
+    check = state.check;
+    zlibFormat = state.zlibFormat;
+    names = state.names;
+    checksums = state.checksums;
+}
+
+ArchiveWriter::~ArchiveWriter()
+{
+    deflateEnd(&stream);
+    if (fd != -1)
+    {
+        close(fd);
+    }
+}
+
+void ArchiveWriter::setKey(const CryptoKey* key)
+{
+    if (tarSize)
+    {
+        throw std::logic_error("Archive encryption must be set before data");
+    }
+    encryptor = key ? std::make_unique<Encryptor>(*key) : nullptr;
+}
+
+void ArchiveWriter::setDictionary(const Dictionary* dict)
+{
+    if (tarSize)
+    {
+        throw std::logic_error("Archive dictionary must be set before data");
+    }
+    deflateEnd(&stream);
+    stream = {};
+    // gzip format has no way to reference dictionary, zlib is used instead
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                     dict ? 15 : 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK ||
+        (dict && deflateSetDictionary(
+                     &stream, dict->data().data(),
+                     static_cast<uInt>(dict->data().size())) != Z_OK))
+    {
+        throw std::runtime_error("Unable to initialize compressor");
+    }
+    zlibFormat = dict != nullptr;
+    dictionary = dict;
+}
+
+void ArchiveWriter::setThreads(size_t num)
+{
+    if (tarSize)
+    {
+        throw std::logic_error("Archive threads must be set before data");
+    }
+    threads = std::max<size_t>(num, 1);
+}
+
+void ArchiveWriter::add(const fs::path& src, const std::string& name)
+{
+    const FileHandle fd(RootDir::openEntry(AT_FDCWD, src.c_str()));
+    if (fd.get() == -1)
+    {
+        throw std::system_error(errno, std::system_category(), src);
+    }
+    addParents(nullptr, src, name);
+    addEntry(fd.get(), AT_FDCWD, src.c_str(), src, name, nullptr);
+}
+
+void ArchiveWriter::addTree(const fs::path& src, const std::string& name,
+                            const Filter& filter)
+{
+    if (filter && !filter(safePath(name)))
+    {
+        return;
+    }
+
+    const FileHandle fd(RootDir::openEntry(AT_FDCWD, src.c_str()));
+    if (fd.get() == -1)
+    {
+        throw std::system_error(errno, std::system_category(), src);
+    }
+    addParents(nullptr, src, name);
+    addTree(fd.get(), AT_FDCWD, src.c_str(), src, name, filter, nullptr);
+}
+
+void ArchiveWriter::addTree(const RootDir& root, const fs::path& src,
+                            const std::string& name, const Filter& filter)
+{
+    if (filter && !filter(safePath(name)))
+    {
+        return;
+    }
+
+    const fs::path path = root.path() / src;
+    const FileHandle dirFd(root.open(src.parent_path(), O_PATH | O_DIRECTORY));
+    if (dirFd.get() == -1)
+    {
+        throw std::system_error(errno, std::system_category(), path);
+    }
+    const fs::path srcName = src.filename().empty() ? "." : src.filename();
+    const FileHandle fd(RootDir::openEntry(dirFd.get(), srcName.c_str()));
+    if (fd.get() == -1)
+    {
+        throw std::system_error(errno, std::system_category(), path);
+    }
+    addParents(&root, src, name);
+    addTree(fd.get(), dirFd.get(), srcName.c_str(), path, name, filter,
+            nullptr);
+}
+
+void ArchiveWriter::finish()
+{
+    if (!checksums.empty())
+    {
+        std::string pax;
+        addPaxRecord(pax, paxChecksums, checksums);
+        addContents("");
+        writePax(pax, typePaxGlobal, time(nullptr));
+    }
+
+    addContents("");
+    const uint8_t eof[blockSize * 2] = {};
+    write(eof, sizeof(eof), Z_FINISH);
+    if (resumed || blocks)
+    {
+        // trailer of the gzip (CRC-32 and size, little endian) or zlib
+        // (Adler-32, big endian) stream
+        uint8_t trailer[8];
+        size_t len = 0;
+        if (zlibFormat)
+        {
+            for (int shift = 24; shift >= 0; shift -= 8)
+            {
+                trailer[len++] = static_cast<uint8_t>(check >> shift);
+            }
+        }
+        else
+        {
+            for (const uint32_t val : {check, static_cast<uint32_t>(tarSize)})
+            {
+                for (int shift = 0; shift < 32; shift += 8)
+                {
+                    trailer[len++] = static_cast<uint8_t>(val >> shift);
+                }
+            }
+        }
+        output(trailer, len);
+    }
+    if (blocks && !encryptor &&
+        index.blocks.size() <= BlockCodec::Index::maxBlocks)
+    {
+        // the table is in the plain file only, encrypted stream can't be
+        // read from the middle
+        index.toc = contents;
+        const std::vector<uint8_t> table = index.encode();
+        output(table.data(), table.size());
+    }
+    if (zlibFormat)
+    {
+        uint8_t trailer[zlibTrailerSize];
+        for (size_t i = 0; i < sizeof(trailer); ++i)
+        {
+            trailer[i] = static_cast<uint8_t>(tarSize >> (i * 8));
+        }
+        output(trailer, sizeof(trailer));
+    }
+    if (encryptor)
+    {
+        const size_t used = buffer.size();
+        encryptor->finish(tarSize, buffer);
+        total += buffer.size() - used;
+        if (limit && total > limit)
+        {
+            throw std::runtime_error("Archive size limit exceeded");
+        }
+    }
+    flushBuffer();
+
+    if (fd != -1)
+    {
+        const int rc = close(fd);
+        fd = -1;
+        if (rc != 0)
+        {
+            throw std::system_error(errno, std::system_category(),
+                                    "Unable to write archive");
+        }
+    }
+}
+
+ArchiveWriter::State ArchiveWriter::checkpoint()
+{
+    if (fd == -1 || encryptor)
+    {
+        throw std::logic_error("Archive doesn't support checkpoints");
+    }
+
+    write(nullptr, 0, Z_FULL_FLUSH);
+    flushBuffer();
+    if (fdatasync(fd) != 0)
+    {
+        throw std::system_error(errno, std::system_category(),
+                                "Unable to write archive");
+    }
+
+    State state;
+    state.offset = total;
+    state.tarSize = tarSize;
+    state.check =
+        resumed || blocks ? check : static_cast<uint32_t>(stream.adler);
+    state.zlibFormat = zlibFormat;
+    state.names = names;
+    state.checksums = checksums;
+    return state;
+}
+
+void ArchiveWriter::addParents(const RootDir* root, const fs::path& src,
+                               const std::string& name)
+{
+    const fs::path rel = safePath(name);
+    if (!rel.has_parent_path())
+    {
+        return;
+    }
+
+    fs::path srcParent = src.parent_path();
+    fs::path nameParent = rel.parent_path();
+    std::string entry = "./";
+    entry += nameParent;
+    entry += '/';
+    if (names.find(entry) != names.end())
+    {
+        return;
+    }
+
+    addParents(root, srcParent, nameParent);
+    names.insert(entry);
+
+    Metadata meta;
+    const int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+    const FileHandle fd(root ? root->open(srcParent, flags)
+                             : open(srcParent.c_str(), flags));
+    if (fd.get() != -1)
+    {
+        try
+        {
+            meta = Metadata::load(fd.get(), AT_FDCWD, srcParent.c_str(),
+                                  srcParent);
+        }
+        catch (const std::system_error&)
+        {
+            // use defaults
+        }
+    }
+    if (!S_ISDIR(meta.mode))
+    {
+        // parent doesn't exist, use defaults
+        meta = {};
+        meta.mode = S_IFDIR | 0755;
+        meta.mtime.tv_sec = time(nullptr);
+    }
+    writeHeader(entry, meta, typeDir, {});
+}
+
+bool ArchiveWriter::addEntry(int fd, int dirFd, const char* srcName,
+                             const fs::path& src, const std::string& name,
+                             const IoEngine::File* file)
+{
+    const Metadata meta =
+        file ? Metadata::load(file->stx, fd, dirFd, srcName, src)
+             : Metadata::load(fd, dirFd, srcName, src);
+    const bool isDir = S_ISDIR(meta.mode);
+
+    const fs::path rel = safePath(name);
+    std::string entry = "./";
+    entry += rel;
+    if (isDir && !rel.empty())
+    {
+        entry += '/';
+    }
+    if (!names.insert(entry).second)
+    {
+        return isDir; // already added
+    }
+
+    if (isDir)
+    {
+        writeHeader(entry, meta, typeDir, {});
+    }
+    else if (S_ISLNK(meta.mode))
+    {
+        std::string target(PATH_MAX, '\0');
+        const ssize_t len = readlinkat(fd, "", target.data(), target.size());
+        if (len < 0)
+        {
+            throw std::system_error(errno, std::system_category(), src);
+        }
+        target.resize(len);
+        writeHeader(entry, meta, typeSymLink, target);
+    }
+    else if (S_ISREG(meta.mode))
+    {
+        if (meta.nlink > 1)
+        {
+            const auto it = hardLinks.find(meta.inode);
+            if (it != hardLinks.end())
+            {
+                writeHeader(entry, meta, typeHardLink, it->second);
+                return false;
+            }
+            hardLinks.emplace(meta.inode, entry);
+        }
+        writeHeader(entry, meta, typeFile, {});
+        const uint32_t crc = file && file->loaded
+                                 ? writeContent(file->data)
+                                 : writeContent(fd, src, meta.size);
+        if (entry.find('\n') == std::string::npos)
+        {
+            char hex[9];
+            snprintf(hex, sizeof(hex), "%08x", crc);
+            checksums += hex;
+            checksums += ' ';
+            checksums += entry;
+            checksums += '\n';
+        }
+    }
+
+    return isDir;
+}
+
+void ArchiveWriter::addTree(int fd, int dirFd, const char* srcName,
+                            const fs::path& src, const std::string& name,
+                            const Filter& filter, const IoEngine::File* file)
+{
+    if (!addEntry(fd, dirFd, srcName, src, name, file))
+    {
+        return;
+    }
+
+    std::vector<std::string> children;
+    for (const auto& it : RootDir::list(fd, src))
+    {
+        if (!filter || filter(safePath((fs::path(name) / it).string())))
+        {
+            children.push_back(it);
+        }
+    }
+
+    if (!io)
+    {
+        for (const auto& it : children)
+        {
+            const FileHandle childFd(RootDir::openEntry(fd, it.c_str()));
+            if (childFd.get() == -1)
+            {
+                throw std::system_error(errno, std::system_category(),
+                                        src / it);
+            }
+            addTree(childFd.get(), fd, it.c_str(), src / it,
+                    (fs::path(name) / it).string(), filter, nullptr);
+        }
+        return;
+    }
+
+    // open children and load small files in batches
+    for (size_t pos = 0; pos < children.size(); pos += IoEngine::batchSize)
+    {
+        const size_t end =
+            std::min(children.size(), pos + IoEngine::batchSize);
+        FileBatch batch(*io);
+        batch.files.resize(end - pos);
+        for (size_t i = pos; i < end; ++i)
+        {
+            batch.files[i - pos].name = children[i];
+        }
+        io->read(fd, batch.files);
+        for (auto& it : batch.files)
+        {
+            if (it.error)
+            {
+                throw std::system_error(it.error, std::system_category(),
+                                        src / it.name);
+            }
+            addTree(it.fd, fd, it.name.c_str(), src / it.name,
+                    (fs::path(name) / it.name).string(), filter, &it);
+            std::vector<uint8_t>().swap(it.data); // release memory early
+        }
+    }
+}
+
+void ArchiveWriter::addContents(const std::string& name)
+{
+    char offset[20];
+    snprintf(offset, sizeof(offset), "%016llx",
+             static_cast<unsigned long long>(tarSize));
+    addPaxRecord(contents, offset, name);
+}
+
+void ArchiveWriter::writeHeader(const std::string& name, const Metadata& meta,
+                                char type, const std::string& link)
+{
+    TarHeader hdr{};
+    std::string pax;
+
+    addContents(name);
+
+    if (name.size() > sizeof(hdr.name))
+    {
+        addPaxRecord(pax, "path", name);
+    }
+    if (link.size() > sizeof(hdr.linkname))
+    {
+        addPaxRecord(pax, "linkpath", link);
+    }
+    const uint64_t size = type == typeFile ? meta.size : 0;
+    if (!setNumber(hdr.size, sizeof(hdr.size), size))
+    {
+        addPaxRecord(pax, "size", std::to_string(size));
+    }
+    if (!setNumber(hdr.uid, sizeof(hdr.uid), meta.uid))
+    {
+        addPaxRecord(pax, "uid", std::to_string(meta.uid));
+    }
+    if (!setNumber(hdr.gid, sizeof(hdr.gid), meta.gid))
+    {
+        addPaxRecord(pax, "gid", std::to_string(meta.gid));
+    }
+    if (meta.mtime.tv_nsec)
+    {
+        char mtime[32];
+        snprintf(mtime, sizeof(mtime), "%lld.%09ld",
+                 static_cast<long long>(meta.mtime.tv_sec),
+                 meta.mtime.tv_nsec);
+        addPaxRecord(pax, "mtime", mtime);
+    }
+    for (const auto& [key, value] : meta.xattrs)
+    {
+        addPaxRecord(pax, paxXattr + key, value);
+    }
+
+    if (!pax.empty())
+    {
+        writePax(pax, typePaxExt, meta.mtime.tv_sec);
+    }
+
+    memcpy(hdr.name, name.data(), std::min(name.size(), sizeof(hdr.name)));
+    setNumber(hdr.mode, sizeof(hdr.mode), meta.mode & 07777);
+    setNumber(hdr.mtime, sizeof(hdr.mtime), meta.mtime.tv_sec);
+    hdr.typeflag = type;
+    memcpy(hdr.linkname, link.data(),
+           std::min(link.size(), sizeof(hdr.linkname)));
+    memcpy(hdr.magic, "ustar", sizeof(hdr.magic));
+    memcpy(hdr.version, "00", sizeof(hdr.version));
+    setNumber(hdr.chksum, sizeof(hdr.chksum) - 1, checksum(hdr));
+
+    write(&hdr, sizeof(hdr));
+}
+
+void ArchiveWriter::writePax(const std::string& pax, char type, time_t mtime)
+{
+    TarHeader ext{};
+    strncpy(ext.name,
+            type == typePaxGlobal ? "pax_global_header" : "././@PaxHeader",
+            sizeof(ext.name));
+    setNumber(ext.mode, sizeof(ext.mode), 0644);
+    setNumber(ext.uid, sizeof(ext.uid), 0);
+    setNumber(ext.gid, sizeof(ext.gid), 0);
+    setNumber(ext.size, sizeof(ext.size), pax.size());
+    setNumber(ext.mtime, sizeof(ext.mtime), mtime);
+    ext.typeflag = type;
+    memcpy(ext.magic, "ustar", sizeof(ext.magic));
+    memcpy(ext.version, "00", sizeof(ext.version));
+    setNumber(ext.chksum, sizeof(ext.chksum) - 1, checksum(ext));
+    write(&ext, sizeof(ext));
+    write(pax.data(), pax.size());
+    const uint8_t pad[blockSize] = {};
+    write(pad, padSize(pax.size()));
+}
+
+uint32_t ArchiveWriter::writeContent(int in, const fs::path& src,
+                                     uint64_t size)
+{
+    std::vector<uint8_t> chunk(chunkSize);
+    uint32_t crc = 0;
+    uint64_t left = size;
+    while (left)
+    {
+        const size_t len = std::min<uint64_t>(left, chunk.size());
+        const ssize_t rc = ::read(in, chunk.data(), len);
+        if (rc < 0)
+        {
+            throw std::system_error(errno, std::system_category(), src);
+        }
+        if (rc == 0)
+        {
+            // file was truncated while reading, fill the rest by zeros
+            std::fill(chunk.begin(), chunk.end(), 0);
+            while (left)
+            {
+                const size_t pad = std::min<uint64_t>(left, chunk.size());
+                crc = Checksum::update(crc, chunk.data(), pad);
+                write(chunk.data(), pad);
+                left -= pad;
+            }
+            break;
+        }
+        if (throttle)
+        {
+            throttle->consume(rc);
+        }
+        if (progress)
+        {
+            progress->addBytes(rc);
+        }
+        crc = Checksum::update(crc, chunk.data(), rc);
+        write(chunk.data(), rc);
+        left -= rc;
+    }
+
+    const uint8_t pad[blockSize] = {};
+    write(pad, padSize(size));
+
+    return crc;
+}
+
+uint32_t ArchiveWriter::writeContent(const std::vector<uint8_t>& data)
+{
+    if (throttle)
+    {
+        throttle->consume(data.size());
+    }
+    if (progress)
+    {
+        progress->addBytes(data.size());
+    }
+    write(data.data(), data.size());
+
+    const uint8_t pad[blockSize] = {};
+    write(pad, padSize(data.size()));
+
+    return Checksum::update(0, data.data(), data.size());
+}
+
+void ArchiveWriter::write(const void* data, size_t size, int flush)
+{
+    tarSize += size;
+    if (resumed && size)
+    {
+        const Bytef* ptr = static_cast<const Bytef*>(data);
+        check = zlibFormat ? adler32(check, ptr, static_cast<uInt>(size))
+                           : crc32(check, ptr, static_cast<uInt>(size));
+    }
+    if (!resumed)
+    {
+        writeBlocks(static_cast<const uint8_t*>(data), size, flush);
+    }
+    else
+    {
+        compress(data, size, flush);
+    }
+}
+
+void ArchiveWriter::compress(const void* data, size_t size, int flush)
+{
+    stream.next_in = static_cast<Bytef*>(const_cast<void*>(data));
+    stream.avail_in = static_cast<uInt>(size);
+    do
+    {
+        stream.next_out = compressed.data();
+        stream.avail_out = static_cast<uInt>(compressed.size());
+        if (deflate(&stream, flush) == Z_STREAM_ERROR)
+        {
+            throw std::runtime_error("Compression error");
+        }
+        output(compressed.data(), compressed.size() - stream.avail_out);
+    } while (stream.avail_out == 0);
+}
+
+void ArchiveWriter::writeBlocks(const uint8_t* data, size_t size, int flush)
+{
+    while (size)
+    {
+        const size_t len =
+            std::min(size, BlockCodec::blockSize - pending.size());
+        pending.insert(pending.end(), data, data + len);
+        data += len;
+        size -= len;
+        if (pending.size() == BlockCodec::blockSize)
+        {
+            submitBlock(false);
+        }
+    }
+
+    if (flush == Z_NO_FLUSH)
+    {
+        return;
+    }
+    if (!blocks)
+    {
+        if (flush == Z_FINISH)
+        {
+            // the whole stream fits in a single block
+            compress(pending.data(), pending.size(), flush);
+            return;
+        }
+        if (pending.empty())
+        {
+            return;
+        }
+    }
+    if (flush == Z_FINISH || !pending.empty())
+    {
+        submitBlock(flush == Z_FINISH);
+    }
+    BlockCodec::Block block;
+    while (blocks->next(block, true))
+    {
+        outputBlock(block);
+    }
+}
+
+void ArchiveWriter::submitBlock(bool last)
+{
+    const bool first = !blocks;
+    if (first)
+    {
+        std::vector<uint8_t> header;
+        if (zlibFormat)
+        {
+            // default compression level, preset dictionary
+            const uint32_t id = dictionary->id();
+            uint8_t flags = 0x80 | 0x20;
+            flags += 31 - ((0x78 << 8) | flags) % 31;
+            header = {0x78,
+                      flags,
+                      static_cast<uint8_t>(id >> 24),
+                      static_cast<uint8_t>(id >> 16),
+                      static_cast<uint8_t>(id >> 8),
+                      static_cast<uint8_t>(id)};
+            check = 1; // Adler-32 of empty data
+        }
+        else
+        {
+            header = {0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0, 0, 3 /* Unix */};
+            check = 0;
+        }
+        output(header.data(), header.size());
+        index.offset = header.size();
+        blocks = std::make_unique<BlockCodec>(threads, dictionary);
+    }
+
+    blocks->compress(std::move(pending), first, last);
+    pending.clear();
+    pending.reserve(BlockCodec::blockSize);
+
+    // write the blocks that are ready, wait if too many are queued
+    BlockCodec::Block block;
+    while (blocks->next(block, blocks->full()))
+    {
+        outputBlock(block);
+    }
+}
+
+void ArchiveWriter::outputBlock(const BlockCodec::Block& block)
+{
+    check = BlockCodec::combine(check, block.check, block.size, zlibFormat);
+    index.blocks.emplace_back(static_cast<uint32_t>(block.data.size()),
+                              block.size);
+    output(block.data.data(), block.data.size());
+}
+
+void ArchiveWriter::output(const uint8_t* data, size_t size)
+{
+    const size_t used = buffer.size();
+    if (encryptor)
+    {
+        encryptor->update(data, size, buffer);
+    }
+    else
+    {
+        buffer.insert(buffer.end(), data, data + size);
+    }
+    total += buffer.size() - used;
+    if (limit && total > limit)
+    {
+        throw std::runtime_error("Archive size limit exceeded");
+    }
+    if (fd != -1 && buffer.size() >= chunkSize)
+    {
+        flushBuffer();
+    }
+}
+
+void ArchiveWriter::flushBuffer()
+{
+    if (fd == -1)
+    {
+        return;
+    }
+    if (throttle)
+    {
+        throttle->consume(buffer.size());
+    }
+    writeAll(fd, buffer.data(), buffer.size(), "Unable to write archive");
+    buffer.clear();
+}
+
+ArchiveReader::ArchiveReader(const fs::path& file, size_t bufferSize,
+                             const CryptoKey* key)
+{
+    fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        throw std::system_error(errno, std::system_category(), file);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && static_cast<uint64_t>(st.st_size) < bufferSize)
+    {
+        bufferSize = st.st_size;
+    }
+    buffer.resize(std::max<size_t>(bufferSize, 1));
+
+    uint8_t hdr[Decryptor::headerSize];
+    const ssize_t len = pread(fd, hdr, sizeof(hdr), 0);
+    if (len > 0 && Decryptor::isEncrypted(hdr, static_cast<size_t>(len)))
+    {
+        try
+        {
+            if (!key)
+            {
+                throw std::runtime_error(
+                    "Archive is encrypted, key is required");
+            }
+            if (len != sizeof(hdr))
+            {
+                throw std::runtime_error("Encrypted archive is truncated");
+            }
+            decryptor = std::make_unique<Decryptor>(*key, hdr);
+            readFile(hdr, sizeof(hdr)); // skip header
+        }
+        catch (...)
+        {
+            close(fd);
+            throw;
+        }
+    }
+
+    if (inflateInit2(&stream, 15 + 32) != Z_OK)
+    {
+        close(fd);
+        throw std::runtime_error("Unable to initialize decompressor");
+    }
+}
+
+ArchiveReader::~ArchiveReader()
+{
+    inflateEnd(&stream);
+    close(fd);
+}
+
+void ArchiveReader::extract(const fs::path& dir, uint64_t limit,
+                            const Filter& filter)
+{
+    uint64_t written = 0;
+    std::string longName;
+    std::string longLink;
+    std::map<std::string, std::string> pax;
+    std::map<std::string, uint32_t> checksums;
+    std::set<std::string> skipped;
+    std::vector<std::pair<fs::path, timespec>> dirTimes;
+    std::vector<uint8_t> chunk(chunkSize);
+
+    fs::create_directories(dir);
+    const RootDir root(dir);
+
+    start();
+    const bool seekable = filter && blocks && !contents.empty();
+    size_t next = 0; // next entry in the table of contents
+    bool selected = false;
+
+    while (true)
+    {
+        selected = false;
+        if (seekable && next < contents.size() && pax.empty() &&
+            longName.empty() && longLink.empty())
+        {
+            // jump over the entries that are filtered out
+            if (contents[next].first != position)
+            {
+                throw std::runtime_error("Invalid archive index");
+            }
+            fs::path rel = safePath(contents[next].second);
+            while (!rel.empty() && !filter(rel))
+            {
+                skipped.insert("./" + rel.string());
+                if (++next == contents.size())
+                {
+                    throw std::runtime_error("Invalid archive index");
+                }
+                rel = safePath(contents[next].second);
+            }
+            seek(contents[next++].first);
+            selected = true;
+        }
+
+        TarHeader hdr;
+        const size_t len = read(&hdr, sizeof(hdr));
+        if (len == 0)
+        {
+            break; // end of archive without end marker
+        }
+        if (len != sizeof(hdr))
+        {
+            throw std::runtime_error("Unexpected end of archive");
+        }
+        const uint8_t* raw = reinterpret_cast<const uint8_t*>(&hdr);
+        if (std::all_of(raw, raw + sizeof(hdr),
+                        [](uint8_t c) { return c == 0; }))
+        {
+            break; // end of archive marker
+        }
+        if (getNumber(hdr.chksum, sizeof(hdr.chksum)) != checksum(hdr))
+        {
+            throw std::runtime_error("Invalid tar header checksum");
+        }
+
+        uint64_t size = getNumber(hdr.size, sizeof(hdr.size));
+
+        // extended headers
+        if (hdr.typeflag == typePaxExt || hdr.typeflag == typeGnuLongName ||
+            hdr.typeflag == typeGnuLongLink)
+        {
+            if (size > chunkSize)
+            {
+                throw std::runtime_error("Extended header is too big");
+            }
+            std::string data(size, 0);
+            readAll(data.data(), size);
+            skip(padSize(size));
+            if (hdr.typeflag == typePaxExt)
+            {
+                pax = parsePax(data);
+            }
+            else
+            {
+                data.resize(strnlen(data.c_str(), data.size()));
+                (hdr.typeflag == typeGnuLongName ? longName : longLink) = data;
+            }
+            continue;
+        }
+        if (hdr.typeflag == typePaxGlobal)
+        {
+            if (size > maxGlobalHeader)
+            {
+                skip(size + padSize(size));
+                continue;
+            }
+            std::string data(size, 0);
+            readAll(data.data(), size);
+            skip(padSize(size));
+            const auto records = parsePax(data);
+            const auto it = records.find(paxChecksums);
+            if (it != records.end())
+            {
+                verifyChecksums(it->second, checksums, skipped);
+            }
+            continue;
+        }
+
+        std::string name = longName;
+        std::string link = longLink;
+        if (name.empty())
+        {
+            name = getString(hdr.prefix, sizeof(hdr.prefix));
+            if (!name.empty())
+            {
+                name += '/';
+            }
+            name += getString(hdr.name, sizeof(hdr.name));
+        }
+        if (link.empty())
+        {
+            link = getString(hdr.linkname, sizeof(hdr.linkname));
+        }
+        auto it = pax.find("path");
+        if (it != pax.end())
+        {
+            name = it->second;
+        }
+        it = pax.find("linkpath");
+        if (it != pax.end())
+        {
+            link = it->second;
+        }
+        it = pax.find("size");
+        if (it != pax.end())
+        {
+            size = std::stoull(it->second);
+        }
+        const Metadata meta = entryMetadata(hdr, pax);
+        longName.clear();
+        longLink.clear();
+        pax.clear();
+
+        const fs::path rel = safePath(name);
+        const fs::path dst = dir / rel;
+        const size_t padding = padSize(size);
+
+        if (rel.empty())
+        {
+            skip(size + padding); // archive root
+            continue;
+        }
+        if (filter && !selected && !filter(rel))
+        {
+            skipped.insert("./" + rel.string());
+            skip(size + padding);
+            continue;
+        }
+
+        // entries are created relative to the parent descriptor, so symlinks
+        // extracted earlier can't redirect them outside the directory
+        const FileHandle parent(root.makeDirs(rel.parent_path()));
+        const std::string base = rel.filename();
+
+        switch (hdr.typeflag)
+        {
+            case typeFile:
+            case typeContFile:
+            case '\0':
+            {
+                written += size;
+                if (limit && written > limit)
+                {
+                    throw std::runtime_error(
+                        "Temporary space limit exceeded");
+                }
+                const FileHandle file(openat(
+                    parent.get(), base.c_str(),
+                    O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+                    meta.mode));
+                const int out = file.get();
+                if (out == -1)
+                {
+                    throw std::system_error(errno, std::system_category(),
+                                            dst);
+                }
+                uint32_t crc = 0;
+                uint64_t left = size;
+                while (left)
+                {
+                    const size_t part = std::min<uint64_t>(left, chunk.size());
+                    readAll(chunk.data(), part);
+                    crc = Checksum::update(crc, chunk.data(), part);
+                    if (throttle)
+                    {
+                        throttle->consume(part);
+                    }
+                    writeAll(out, chunk.data(), part, dst);
+                    left -= part;
+                }
+                meta.apply(out, dst);
+                checksums["./" + rel.string()] = crc;
+                size = 0; // already read
+                break;
+            }
+            case typeDir:
+            {
+                if (mkdirat(parent.get(), base.c_str(), 0700) != 0 &&
+                    errno != EEXIST)
+                {
+                    throw std::system_error(errno, std::system_category(),
+                                            dst);
+                }
+                const FileHandle out(
+                    openat(parent.get(), base.c_str(),
+                           O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+                if (out.get() == -1)
+                {
+                    throw std::system_error(errno, std::system_category(),
+                                            dst);
+                }
+                meta.apply(out.get(), dst, false);
+                // directory content changes mtime, it is set at the end
+                dirTimes.emplace_back(rel, meta.mtime);
+                break;
+            }
+            case typeSymLink:
+                removeEntry(parent.get(), base.c_str(), dst);
+                if (symlinkat(link.c_str(), parent.get(), base.c_str()) != 0)
+                {
+                    throw std::system_error(errno, std::system_category(),
+                                            dst);
+                }
+                meta.applyLink(parent.get(), base.c_str(), dst);
+                break;
+            case typeHardLink:
+            {
+                // link entry has no data, so it can't be restored if its
+                // target wasn't selected, the rest of the backup still can
+                const fs::path targetRel = safePath(link);
+                if (skipped.count("./" + targetRel.string()))
+                {
+                    fprintf(stderr,
+                            "WARNING! Unable to restore %s: hard link target "
+                            "%s is not selected, the link is skipped\n",
+                            rel.c_str(), targetRel.c_str());
+                    skipped.insert("./" + rel.string());
+                    break;
+                }
+                const FileHandle target(
+                    root.open(targetRel, O_PATH | O_NOFOLLOW));
+                removeEntry(parent.get(), base.c_str(), dst);
+                if (target.get() == -1 ||
+                    RootDir::link(target.get(), parent.get(), base.c_str()) !=
+                        0)
+                {
+                    throw std::system_error(errno, std::system_category(),
+                                            dst);
+                }
+                break;
+            }
+            default:
+                break; // unsupported entry type
+        }
+
+        skip(size + padding);
+    }
+
+    // nested directories are after their parents
+    for (auto it = dirTimes.rbegin(); it != dirTimes.rend(); ++it)
+    {
+        const FileHandle out(
+            root.open(it->first, O_RDONLY | O_DIRECTORY | O_NOFOLLOW));
+        const timespec ts[2] = {{0, UTIME_OMIT}, it->second};
+        if (out.get() == -1 || futimens(out.get(), ts) != 0)
+        {
+            throw std::system_error(errno, std::system_category(),
+                                    dir / it->first);
+        }
+    }
+
+    if (decryptor)
+    {
+        // authenticate the rest of the stream
+        while (read(chunk.data(), chunk.size()))
+        {
+        }
+        while (!eof)
+        {
+            fill();
+        }
+    }
+}
+
+std::vector<uint8_t> ArchiveReader::unpack(uint64_t limit)
+{
+    std::vector<uint8_t> data;
+    size_t len;
+    do
+    {
+        const size_t used = data.size();
+        data.resize(used + chunkSize);
+        len = read(data.data() + used, chunkSize);
+        data.resize(used + len);
+        if (limit && data.size() > limit)
+        {
+            throw std::runtime_error("Archive size limit exceeded");
+        }
+    } while (len);
+    while (decryptor && !eof)
+    {
+        fill(); // authenticate the rest of the stream
+    }
+    return data;
+}
+
+uint64_t ArchiveReader::contentSize(const fs::path& file)
+{
+    const int in = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in == -1)
+    {
+        throw std::system_error(errno, std::system_category(), file);
+    }
+    uint8_t magic[Decryptor::headerSize] = {};
+    uint8_t trailer[Decryptor::footerSize] = {};
+    const off_t end = lseek(in, 0, SEEK_END);
+    const ssize_t len = pread(in, magic, sizeof(magic), 0);
+    const bool encrypted =
+        len > 0 && Decryptor::isEncrypted(magic, static_cast<size_t>(len));
+    const bool zlib = !encrypted && len >= 2 && (magic[0] & 0x0f) == Z_DEFLATED &&
+                      (magic[0] << 8 | magic[1]) % 31 == 0;
+    // encrypted archive has footer with 64-bit size, so does zlib stream,
+    // gzip has 32-bit one
+    const size_t trailerSize = encrypted || zlib ? sizeof(trailer) : 4;
+    const bool valid =
+        (encrypted ? len == sizeof(magic) && end >= encryptedMinSize
+         : zlib    ? end >= zlibMinSize
+                   : end >= gzipMinSize && magic[0] == 0x1f &&
+                         magic[1] == 0x8b) &&
+        pread(in, trailer, trailerSize, end - trailerSize) ==
+            static_cast<ssize_t>(trailerSize);
+    // the table of blocks follows the gzip stream
+    BlockCodec::Index index;
+    const bool blocks =
+        valid && !encrypted && !zlib && BlockCodec::Index::load(in, end, index);
+    close(in);
+    if (!valid)
+    {
+        std::string err = "Invalid archive file: ";
+        err += file;
+        throw std::runtime_error(err);
+    }
+    if (blocks)
+    {
+        return index.size().second;
+    }
+    // gzip trailer: size of uncompressed data modulo 2^32, little-endian
+    uint64_t size = 0;
+    for (size_t i = 0; i < trailerSize; ++i)
+    {
+        size |= static_cast<uint64_t>(trailer[i]) << (i * 8);
+    }
+    return size;
+}
+
+size_t ArchiveReader::read(void* data, size_t size)
+{
+    start();
+    if (blocks)
+    {
+        const size_t len = readBlocks(static_cast<uint8_t*>(data), size);
+        position += len;
+        return len;
+    }
+
+    stream.next_out = static_cast<Bytef*>(data);
+    stream.avail_out = static_cast<uInt>(size);
+
+    while (stream.avail_out && !finished)
+    {
+        if (stream.avail_in == 0 && !eof)
+        {
+            fill();
+        }
+        if (stream.avail_in == 0 && eof)
+        {
+            break;
+        }
+        if (stream.total_in == 0)
+        {
+            zlibFormat = *stream.next_in != 0x1f;
+        }
+        const int rc = inflate(&stream, Z_NO_FLUSH);
+        if (rc == Z_NEED_DICT)
+        {
+            setDictionary();
+        }
+        else if (rc == Z_STREAM_END)
+        {
+            if (zlibFormat)
+            {
+                finished = true; // the rest is a trailer with size
+            }
+            else
+            {
+                inflateReset(&stream); // multi-member gzip
+            }
+        }
+        else if (rc != Z_OK && rc != Z_BUF_ERROR)
+        {
+            throw std::runtime_error("Archive decompression error");
+        }
+    }
+
+    const size_t len = size - stream.avail_out;
+    position += len;
+    return len;
+}
+
+void ArchiveReader::start()
+{
+    if (!started)
+    {
+        started = true;
+        if (!decryptor)
+        {
+            startBlocks();
+        }
+    }
+}
+
+void ArchiveReader::setDictionary()
+{
+    const Dictionary* dict = getDictionary(static_cast<uint32_t>(stream.adler));
+    if (inflateSetDictionary(&stream, dict->data().data(),
+                             static_cast<uInt>(dict->data().size())) != Z_OK)
+    {
+        throw std::runtime_error("Archive decompression error");
+    }
+}
+
+const Dictionary* ArchiveReader::getDictionary(uint32_t id) const
+{
+    const Dictionary* dict = dictionary;
+    if (!dict || dict->id() != id)
+    {
+        dict = Dictionary::embedded();
+    }
+    if (!dict || dict->id() != id)
+    {
+        char err[64];
+        snprintf(err, sizeof(err), "Archive requires dictionary %08x", id);
+        throw std::runtime_error(err);
+    }
+    return dict;
+}
+
+void ArchiveReader::startBlocks()
+{
+    struct stat st;
+    uint8_t header[6];
+    if (fstat(fd, &st) != 0 ||
+        pread(fd, header, sizeof(header), 0) != sizeof(header))
+    {
+        return; // too small for blocks, the stream will fail on its own
+    }
+    zlibFormat = header[0] != 0x1f;
+
+    // zlib stream is followed by the uncompressed size
+    const uint64_t end = st.st_size - (zlibFormat ? zlibTrailerSize : 0);
+    if (!BlockCodec::Index::load(fd, end, index))
+    {
+        return;
+    }
+    const size_t trailerSize = zlibFormat ? 4 : 8;
+    const uint64_t expected = index.offset + index.size().first +
+                              trailerSize + index.encode().size();
+    const bool dictFlag = header[1] & 0x20;
+    if (expected != end || index.offset != (zlibFormat ? 6 : 10) ||
+        zlibFormat != dictFlag)
+    {
+        return; // not a stream written by blocks
+    }
+
+    const Dictionary* dict = nullptr;
+    if (zlibFormat)
+    {
+        dict = getDictionary(static_cast<uint32_t>(header[2]) << 24 |
+                             static_cast<uint32_t>(header[3]) << 16 |
+                             static_cast<uint32_t>(header[4]) << 8 |
+                             header[5]);
+    }
+    if (readFile(header, index.offset) != index.offset)
+    {
+        throw std::runtime_error("Unexpected end of archive");
+    }
+
+    uint64_t compressed = index.offset;
+    uint64_t uncompressed = 0;
+    for (const auto& it : index.blocks)
+    {
+        blockStarts.emplace_back(compressed, uncompressed);
+        compressed += it.first;
+        uncompressed += it.second;
+    }
+    blockStarts.emplace_back(compressed, uncompressed);
+
+    // keys of the records are offsets, the map is ordered by them
+    for (const auto& [key, name] : parsePax(index.toc))
+    {
+        char* end = nullptr;
+        const uint64_t offset = strtoull(key.c_str(), &end, 16);
+        if (key.size() != 16 || *end || offset > uncompressed)
+        {
+            throw std::runtime_error("Invalid archive index");
+        }
+        contents.emplace_back(offset, name);
+    }
+
+    check = zlibFormat ? 1 : 0;
+    blocks = std::make_unique<BlockCodec>(threads, dict);
+}
+
+size_t ArchiveReader::readBlocks(uint8_t* data, size_t size)
+{
+    size_t done = 0;
+    while (done < size &&
+           (currentPos != current.data.size() || nextBlock()))
+    {
+        const size_t len =
+            std::min(size - done, current.data.size() - currentPos);
+        memcpy(data + done, current.data.data() + currentPos, len);
+        currentPos += len;
+        done += len;
+    }
+    return done;
+}
+
+bool ArchiveReader::nextBlock()
+{
+    // compressed blocks are read in order and decompressed ahead
+    while (queued < index.blocks.size() && !blocks->full())
+    {
+        const size_t num = queued++;
+        const auto& it = index.blocks[num];
+        std::vector<uint8_t> data(it.first);
+        if (readFile(data.data(), data.size()) != data.size())
+        {
+            throw std::runtime_error("Unexpected end of archive");
+        }
+        blocks->decompress(std::move(data), it.second, num == 0,
+                           queued == index.blocks.size());
+    }
+
+    if (blocks->next(current, true))
+    {
+        currentPos = 0;
+        check = BlockCodec::combine(check, current.check, current.size,
+                                    zlibFormat);
+        return true;
+    }
+    if (finished)
+    {
+        return false;
+    }
+    finished = true;
+
+    // trailer: CRC-32 and size of the gzip stream (little-endian),
+    // Adler-32 of the zlib stream (big-endian)
+    uint8_t trailer[8];
+    const size_t len = zlibFormat ? 4 : 8;
+    if (readFile(trailer, len) != len)
+    {
+        throw std::runtime_error("Unexpected end of archive");
+    }
+    uint32_t expected = 0;
+    uint32_t size = 0;
+    for (size_t i = 0; i < 4; ++i)
+    {
+        expected |= zlibFormat ? static_cast<uint32_t>(trailer[i])
+                                     << ((3 - i) * 8)
+                               : static_cast<uint32_t>(trailer[i]) << (i * 8);
+        size |= static_cast<uint32_t>(trailer[4 + i]) << (i * 8);
+    }
+    // skipped blocks were never decompressed, so after a seek the stream
+    // check can't be computed: only CRC-32C of the extracted entries
+    // (verified by extract) protects the data then
+    if ((!seeked && expected != check) ||
+        (!zlibFormat && size != static_cast<uint32_t>(index.size().second)))
+    {
+        throw std::runtime_error("Archive decompression error");
+    }
+    return false;
+}
+
+void ArchiveReader::seek(uint64_t offset)
+{
+    if (offset < position)
+    {
+        throw std::runtime_error("Invalid archive index");
+    }
+    // the block that contains the offset, or the end of the last block
+    const auto it =
+        std::upper_bound(blockStarts.begin(), blockStarts.end(), offset,
+                         [](uint64_t val, const auto& start) {
+                             return val < start.second;
+                         });
+    const size_t num = std::distance(blockStarts.begin(), it) - 1;
+    if (num >= queued)
+    {
+        // drop the blocks decompressed ahead, read from the new one
+        BlockCodec::Block block;
+        while (blocks->next(block, true))
+        {
+        }
+        if (lseek(fd, blockStarts[num].first, SEEK_SET) == -1)
+        {
+            throw std::system_error(errno, std::system_category(),
+                                    "Unable to read archive");
+        }
+        bufferPos = bufferEnd = 0;
+        queued = num;
+        current = {};
+        currentPos = 0;
+        position = blockStarts[num].second;
+        seeked = true;
+    }
+    skip(offset - position);
+}
+
+void ArchiveReader::fill()
+{
+    if (!decryptor)
+    {
+        eof = bufferPos == bufferEnd && !readBuffer();
+        stream.next_in = buffer.data() + bufferPos;
+        stream.avail_in = static_cast<uInt>(bufferEnd - bufferPos);
+        bufferPos = bufferEnd;
+        return;
+    }
+
+    uint8_t prefix[Decryptor::prefixSize];
+    uint8_t footer[Decryptor::footerSize];
+    bool last = false;
+    if (readFile(prefix, sizeof(prefix)) != sizeof(prefix))
+    {
+        throw std::runtime_error("Encrypted archive is truncated");
+    }
+    std::vector<uint8_t> frame(decryptor->frameSize(prefix, last));
+    if (readFile(frame.data(), frame.size()) != frame.size() ||
+        (last && readFile(footer, sizeof(footer)) != sizeof(footer)))
+    {
+        throw std::runtime_error("Encrypted archive is truncated");
+    }
+    decryptor->open(frame.data(), frame.size(), last ? footer : nullptr,
+                    plain);
+    if (last)
+    {
+        uint8_t extra;
+        if (readFile(&extra, sizeof(extra)))
+        {
+            throw std::runtime_error(
+                "Unexpected data after end of encrypted archive");
+        }
+        eof = true;
+    }
+    stream.next_in = plain.data();
+    stream.avail_in = static_cast<uInt>(plain.size());
+}
+
+size_t ArchiveReader::readFile(uint8_t* data, size_t size)
+{
+    size_t done = 0;
+    while (done < size && (bufferPos != bufferEnd || readBuffer()))
+    {
+        const size_t len = std::min(size - done, bufferEnd - bufferPos);
+        memcpy(data + done, buffer.data() + bufferPos, len);
+        bufferPos += len;
+        done += len;
+    }
+    return done;
+}
+
+bool ArchiveReader::readBuffer()
+{
+    ssize_t rc;
+    do
+    {
+        rc = ::read(fd, buffer.data(), buffer.size());
+    } while (rc < 0 && errno == EINTR);
+    if (rc < 0)
+    {
+        throw std::system_error(errno, std::system_category(),
+                                "Unable to read archive");
+    }
+    if (throttle)
+    {
+        throttle->consume(rc);
+    }
+    if (progress)
+    {
+        progress->addBytes(rc);
+    }
+    bufferPos = 0;
+    bufferEnd = rc;
+    return rc != 0;
+}
+
+void ArchiveReader::readAll(void* data, size_t size)
+{
+    if (read(data, size) != size)
+    {
+        throw std::runtime_error("Unexpected end of archive");
+    }
+}
+
+void ArchiveReader::skip(uint64_t size)
+{
+    uint8_t chunk[blockSize * 8];
+    while (size)
+    {
+        const size_t len = std::min<uint64_t>(size, sizeof(chunk));
+        readAll(chunk, len);
+        size -= len;
+    }
+}
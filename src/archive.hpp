@@ -0,0 +1,750 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#pragma once
+
+#include "block_codec.hpp"
+#include "io_engine.hpp"
+#include "metadata.hpp"
+
+#include <zlib.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+class CryptoKey;
+class Decryptor;
+class Dictionary;
+class Encryptor;
+class Progress;
+class RootDir;
+class Throttle;
+
+/**
+ * @class ArchiveWriter
+ * @brief Writer for tar.gz archives.
+ *
+ * Archive is compatible with the one created by "tar czf FILE -C DIR .":
+ * all entry names have prefix "./", directories have trailing slash.
+ * CRC-32C checksums of the files are stored in the PAX global header at the
+ * end of the archive and verified by the reader.
+ * Metadata of the entries is preserved: owner, mode, modification time with
+ * nanoseconds (PAX "mtime"), extended attributes including ACLs and SELinux
+ * labels (PAX "SCHILY.xattr.NAME", as GNU tar and bsdtar do) and hard links
+ * between archived files.
+ * If compression dictionary is set, zlib format is used instead of gzip
+ * (see dictionary.hpp).
+ * If encryption key is set, the compressed stream is encrypted (see crypto.hpp).
+ * The stream is compressed in independent blocks on a pool of threads, the
+ * table of blocks and the table of contents (offsets of the entries in the
+ * tar stream) are stored after the stream (see block_codec.hpp), so the
+ * reader can decompress blocks in parallel and jump to the entries it
+ * needs.
+ */
+class ArchiveWriter
+{
+  public:
+    /**
+     * @brief Entry filter for addTree: gets relative entry name,
+     *        returns false to skip the entry.
+     */
+    using Filter = std::function<bool(const std::filesystem::path&)>;
+
+    /**
+     * @struct State
+     * @brief State of the archive file at the durable point, allows to
+     *        continue writing after interruption (see checkpoint()).
+     */
+    struct State
+    {
+        /** @brief Size of the archive file. */
+        uint64_t offset = 0;
+        /** @brief Number of uncompressed bytes consumed. */
+        uint64_t tarSize = 0;
+        /** @brief CRC-32 (gzip) or Adler-32 (zlib) of uncompressed data. */
+        uint32_t check = 0;
+        /** @brief Compressed stream has zlib format. */
+        bool zlibFormat = false;
+        /** @brief Names of entries already added to the archive. */
+        std::set<std::string> names;
+        /** @brief Checksums of added files ("CRC NAME" lines). */
+        std::string checksums;
+    };
+
+    /**
+     * @brief Constructor: create archive in memory.
+     *
+     * @param[in] limit max size of the archive in bytes
+     */
+    explicit ArchiveWriter(uint64_t limit);
+
+    /**
+     * @brief Constructor: create archive file.
+     *
+     * @param[in] file path to the archive file to create
+     * @param[in] limit max size of the archive in bytes, 0 = unlimited
+     *
+     * @throw std::system_error in case of errors
+     */
+    ArchiveWriter(const std::filesystem::path& file, uint64_t limit = 0);
+
+    /**
+     * @brief Constructor: continue writing of the interrupted archive file.
+     *        Data written after the durable point is discarded.
+     *
+     * @param[in] file path to the existing archive file
+     * @param[in] state state of the archive at the durable point
+     * @param[in] limit max size of the archive in bytes, 0 = unlimited
+     *
+     * @throw std::system_error in case of errors
+     */
+    ArchiveWriter(const std::filesystem::path& file, const State& state,
+                  uint64_t limit = 0);
+
+    ~ArchiveWriter();
+
+    ArchiveWriter(const ArchiveWriter&) = delete;
+    ArchiveWriter& operator=(const ArchiveWriter&) = delete;
+
+    /**
+     * @brief Set I/O throughput limiter.
+     *
+     * @param[in] limiter pointer to the limiter, nullptr to disable
+     */
+    void setThrottle(Throttle* limiter)
+    {
+        throttle = limiter;
+    }
+
+    /**
+     * @brief Set progress tracker, it counts content of added files.
+     *
+     * @param[in] tracker pointer to the tracker, nullptr to disable
+     */
+    void setProgress(Progress* tracker)
+    {
+        progress = tracker;
+    }
+
+    /**
+     * @brief Set I/O engine used to load small files of directories in
+     *        batches.
+     *
+     * @param[in] engine I/O engine, nullptr to read files one by one
+     */
+    void setIoEngine(IoEngine* engine)
+    {
+        io = engine;
+    }
+
+    /**
+     * @brief Enable encryption, must be called before adding entries.
+     *
+     * @param[in] key encryption key, nullptr to disable
+     *
+     * @throw std::runtime_error in case of errors
+     */
+    void setKey(const CryptoKey* key);
+
+    /**
+     * @brief Set compression dictionary, must be called before adding entries.
+     *
+     * @param[in] dict compression dictionary, nullptr to disable
+     *
+     * @throw std::runtime_error in case of errors
+     */
+    void setDictionary(const Dictionary* dict);
+
+    /**
+     * @brief Set number of compression threads, must be called before
+     *        adding entries. Streams smaller than a block are compressed
+     *        by the calling thread anyway.
+     *
+     * @param[in] num number of threads
+     *
+     * @throw std::logic_error if data is already added
+     */
+    void setThreads(size_t num);
+
+    /**
+     * @brief Add single entry (file, directory or symlink) to the archive.
+     *        Parent directories are added automatically.
+     *
+     * @param[in] src path to the source file
+     * @param[in] name entry name inside the archive (relative path)
+     *
+     * @throw std::exception in case of errors
+     */
+    void add(const std::filesystem::path& src, const std::string& name);
+
+    /**
+     * @brief Add file or directory with all its content to the archive.
+     *
+     * @param[in] src path to the source file or directory
+     * @param[in] name entry name inside the archive (relative path)
+     * @param[in] filter entry filter, empty to add all entries
+     *
+     * @throw std::exception in case of errors
+     */
+    void addTree(const std::filesystem::path& src, const std::string& name,
+                 const Filter& filter = {});
+
+    /**
+     * @brief Add file or directory with all its content to the archive,
+     *        the same as above, but the source path can't escape the root
+     *        directory.
+     *
+     * @param[in] root root directory
+     * @param[in] src relative path to the source file or directory
+     * @param[in] name entry name inside the archive (relative path)
+     * @param[in] filter entry filter, empty to add all entries
+     *
+     * @throw std::exception in case of errors
+     */
+    void addTree(const RootDir& root, const std::filesystem::path& src,
+                 const std::string& name, const Filter& filter = {});
+
+    /**
+     * @brief Write end of the archive and flush all buffers.
+     *
+     * @throw std::exception in case of errors
+     */
+    void finish();
+
+    /**
+     * @brief Get archive content (in-memory mode only).
+     *
+     * @return compressed archive data
+     */
+    const std::vector<uint8_t>& data() const
+    {
+        return buffer;
+    }
+
+    /**
+     * @brief Make all data added to the archive durable: flush compressor
+     *        (full flush, so the rest of the stream doesn't refer to the
+     *        previous data) and synchronize the archive file with storage.
+     *        Not supported for in-memory and encrypted archives.
+     *
+     * @throw std::logic_error if the archive can't be checkpointed
+     * @throw std::system_error in case of errors
+     *
+     * @return state of the archive to continue writing from
+     */
+    State checkpoint();
+
+    /**
+     * @brief Get size of the archive.
+     *
+     * @return number of bytes written
+     */
+    uint64_t size() const
+    {
+        return total;
+    }
+
+  private:
+    /**
+     * @brief Add parent directories of the entry.
+     *
+     * @param[in] root root directory, nullptr if source path is not relative
+     * @param[in] src path to the source file
+     * @param[in] name entry name inside the archive
+     */
+    void addParents(const RootDir* root, const std::filesystem::path& src,
+                    const std::string& name);
+
+    /**
+     * @brief Add single opened entry to the archive.
+     *
+     * @param[in] fd descriptor of the source file (see RootDir::openEntry)
+     * @param[in] dirFd descriptor of the source parent directory
+     * @param[in] srcName name of the source in the parent directory
+     * @param[in] src path to the source file (for error messages)
+     * @param[in] name entry name inside the archive
+     * @param[in] file status and content of the file loaded in batch,
+     *                 nullptr if not loaded
+     *
+     * @throw std::exception in case of errors
+     *
+     * @return true if the entry is a directory
+     */
+    bool addEntry(int fd, int dirFd, const char* srcName,
+                  const std::filesystem::path& src, const std::string& name,
+                  const IoEngine::File* file);
+
+    /**
+     * @brief Add opened entry with all its content to the archive.
+     *
+     * @param[in] fd descriptor of the source file (see RootDir::openEntry)
+     * @param[in] dirFd descriptor of the source parent directory
+     * @param[in] srcName name of the source in the parent directory
+     * @param[in] src path to the source file (for error messages)
+     * @param[in] name entry name inside the archive
+     * @param[in] filter entry filter, empty to add all entries
+     * @param[in] file status and content of the file loaded in batch,
+     *                 nullptr if not loaded
+     *
+     * @throw std::exception in case of errors
+     */
+    void addTree(int fd, int dirFd, const char* srcName,
+                 const std::filesystem::path& src, const std::string& name,
+                 const Filter& filter, const IoEngine::File* file);
+
+    /**
+     * @brief Add the entry that starts at the current offset of the tar
+     *        stream to the table of contents.
+     *
+     * @param[in] name entry name inside the archive, empty for the global
+     *                 header and the end of archive marker
+     */
+    void addContents(const std::string& name);
+
+    /**
+     * @brief Write tar header (and extended header if needed).
+     *
+     * @param[in] name entry name inside the archive
+     * @param[in] meta entry metadata
+     * @param[in] type entry type (tar type flag)
+     * @param[in] link symlink or hard link target
+     */
+    void writeHeader(const std::string& name, const Metadata& meta, char type,
+                     const std::string& link);
+
+    /**
+     * @brief Write PAX extended header.
+     *
+     * @param[in] pax extended header data
+     * @param[in] type header type (local or global)
+     * @param[in] mtime modification time of the header
+     */
+    void writePax(const std::string& pax, char type, time_t mtime);
+
+    /**
+     * @brief Copy file content to the archive.
+     *
+     * @param[in] fd descriptor of the source file
+     * @param[in] src path to the source file (for error messages)
+     * @param[in] size expected file size
+     *
+     * @return checksum of the written data
+     */
+    uint32_t writeContent(int fd, const std::filesystem::path& src,
+                          uint64_t size);
+
+    /**
+     * @brief Put file content loaded in memory to the archive.
+     *
+     * @param[in] data file content
+     *
+     * @return checksum of the written data
+     */
+    uint32_t writeContent(const std::vector<uint8_t>& data);
+
+    /**
+     * @brief Put uncompressed data to the archive stream.
+     *
+     * @param[in] data pointer to the data
+     * @param[in] size size of the data
+     * @param[in] flush zlib flush mode
+     */
+    void write(const void* data, size_t size, int flush = Z_NO_FLUSH);
+
+    /**
+     * @brief Compress data with the single deflate stream.
+     *
+     * @param[in] data pointer to the data
+     * @param[in] size size of the data
+     * @param[in] flush deflate flush mode
+     */
+    void compress(const void* data, size_t size, int flush);
+
+    /**
+     * @brief Put uncompressed data to the blocks compressed in parallel.
+     *
+     * @param[in] data pointer to the data
+     * @param[in] size size of the data
+     * @param[in] flush deflate flush mode: the last block is finished or
+     *                  all queued blocks are written
+     */
+    void writeBlocks(const uint8_t* data, size_t size, int flush);
+
+    /**
+     * @brief Queue compression of the pending block, write the compressed
+     *        blocks that are ready.
+     *
+     * @param[in] last true for the last block of the stream
+     */
+    void submitBlock(bool last);
+
+    /**
+     * @brief Put compressed block to the output buffer.
+     *
+     * @param[in] block compressed block
+     */
+    void outputBlock(const BlockCodec::Block& block);
+
+    /**
+     * @brief Put compressed data to the output buffer.
+     *
+     * @param[in] data pointer to the data
+     * @param[in] size size of the data
+     */
+    void output(const uint8_t* data, size_t size);
+
+    /**
+     * @brief Write data from buffer to the output file.
+     */
+    void flushBuffer();
+
+  private:
+    /** @brief Compression stream. */
+    z_stream stream{};
+    /** @brief Output file descriptor, -1 for in-memory mode. */
+    int fd = -1;
+    /** @brief Max size of the archive, 0 = unlimited. */
+    uint64_t limit;
+    /** @brief Number of uncompressed bytes consumed. */
+    uint64_t tarSize = 0;
+    /** @brief Number of output bytes produced. */
+    uint64_t total = 0;
+    /** @brief Output of the compressor. */
+    std::vector<uint8_t> compressed;
+    /** @brief Output data not yet written to the file. */
+    std::vector<uint8_t> buffer;
+    /** @brief Stream encryptor, nullptr if encryption is disabled. */
+    std::unique_ptr<Encryptor> encryptor;
+    /** @brief Compressed stream has zlib format (dictionary is used). */
+    bool zlibFormat = false;
+    /** @brief Writing is resumed: raw deflate stream without wrapper. */
+    bool resumed = false;
+    /** @brief Checksum of uncompressed data of the resumed stream or
+     *         of the blocks. */
+    uint32_t check = 0;
+    /** @brief Compression dictionary, nullptr if not used. */
+    const Dictionary* dictionary = nullptr;
+    /** @brief Number of compression threads. */
+    size_t threads = 1;
+    /** @brief Uncompressed data of the next block. */
+    std::vector<uint8_t> pending;
+    /** @brief Table of written blocks. */
+    BlockCodec::Index index;
+    /** @brief Table of contents: PAX records with names of the entries,
+     *         keys are hexadecimal offsets in the tar stream. */
+    std::string contents;
+    /** @brief Pool of block compressors, nullptr for single stream. */
+    std::unique_ptr<BlockCodec> blocks;
+    /** @brief Names of entries already added to the archive. */
+    std::set<std::string> names;
+    /** @brief Checksums of added files ("CRC NAME" lines). */
+    std::string checksums;
+    /** @brief Names of added files with hard links, by inode. */
+    std::map<std::pair<dev_t, ino_t>, std::string> hardLinks;
+    /** @brief I/O throughput limiter. */
+    Throttle* throttle = nullptr;
+    /** @brief Progress tracker, nullptr if not used. */
+    Progress* progress = nullptr;
+    /** @brief Batched I/O engine, nullptr if not used. */
+    IoEngine* io = nullptr;
+};
+
+/**
+ * @class ArchiveReader
+ * @brief Reader for tar.gz archives.
+ *
+ * If the archive has the table of blocks, they are decompressed in parallel,
+ * extraction with a filter uses the table of contents to skip blocks of the
+ * entries that are filtered out.
+ */
+class ArchiveReader
+{
+  public:
+    /**
+     * @brief Entry filter for extract: gets relative entry name,
+     *        returns false to skip the entry.
+     */
+    using Filter = ArchiveWriter::Filter;
+
+    /**
+     * @brief Constructor.
+     *
+     * @param[in] file path to the archive file
+     * @param[in] bufferSize size of the read buffer, the whole file is
+     *                       loaded with a single read if it fits
+     * @param[in] key decryption key, required for encrypted archives only
+     *
+     * @throw std::exception in case of errors
+     */
+    ArchiveReader(const std::filesystem::path& file, size_t bufferSize,
+                  const CryptoKey* key = nullptr);
+
+    ~ArchiveReader();
+
+    ArchiveReader(const ArchiveReader&) = delete;
+    ArchiveReader& operator=(const ArchiveReader&) = delete;
+
+    /**
+     * @brief Set I/O throughput limiter.
+     *
+     * @param[in] limiter pointer to the limiter, nullptr to disable
+     */
+    void setThrottle(Throttle* limiter)
+    {
+        throttle = limiter;
+    }
+
+    /**
+     * @brief Set progress tracker, it counts data read from the archive.
+     *
+     * @param[in] tracker pointer to the tracker, nullptr to disable
+     */
+    void setProgress(Progress* tracker)
+    {
+        progress = tracker;
+    }
+
+    /**
+     * @brief Set compression dictionary used to decompress the archive.
+     *        Dictionary embedded at build time is used if the archive
+     *        references it.
+     *
+     * @param[in] dict compression dictionary, nullptr to use embedded one
+     */
+    void setDictionary(const Dictionary* dict)
+    {
+        dictionary = dict;
+    }
+
+    /**
+     * @brief Set number of decompression threads, used if the archive has
+     *        the table of blocks and is not encrypted.
+     *
+     * @param[in] num number of threads
+     */
+    void setThreads(size_t num)
+    {
+        threads = num;
+    }
+
+    /**
+     * @brief Extract all entries from the archive.
+     *        Encrypted archive is authenticated completely before return.
+     *        Stream checksum is not verified if the entries are found by
+     *        the table of contents (some blocks are skipped), only CRC-32C
+     *        checksums of the extracted files are verified then.
+     *        Hard links to the entries rejected by the filter are skipped
+     *        with a warning.
+     *
+     * @param[in] dir destination directory
+     * @param[in] limit max number of bytes to write, 0 = unlimited
+     * @param[in] filter entry filter, empty to extract all entries
+     *
+     * @throw std::exception in case of errors
+     */
+    void extract(const std::filesystem::path& dir, uint64_t limit = 0,
+                 const Filter& filter = {});
+
+    /**
+     * @brief Read the whole uncompressed tar stream.
+     *
+     * @param[in] limit max size of the data, 0 = unlimited
+     *
+     * @throw std::exception in case of errors
+     *
+     * @return uncompressed data
+     */
+    std::vector<uint8_t> unpack(uint64_t limit = 0);
+
+    /**
+     * @brief Get uncompressed size of the archive from gzip/zlib trailer
+     *        or from footer of the encrypted archive.
+     *
+     * @param[in] file path to the archive file
+     *
+     * @throw std::system_error in case of errors
+     *
+     * @return size of the uncompressed data
+     */
+    static uint64_t contentSize(const std::filesystem::path& file);
+
+  private:
+    /**
+     * @brief Read uncompressed data from the archive stream.
+     *
+     * @param[out] data pointer to the output buffer
+     * @param[in] size number of bytes to read
+     *
+     * @return number of bytes read, less than size at the end of stream
+     */
+    size_t read(void* data, size_t size);
+
+    /**
+     * @brief Choose the way of decompression on the first use.
+     *
+     * @throw std::exception in case of errors
+     */
+    void start();
+
+    /**
+     * @brief Set dictionary requested by the decompressor.
+     *
+     * @throw std::runtime_error if dictionary is not available
+     */
+    void setDictionary();
+
+    /**
+     * @brief Get dictionary by its ID: the one set by user or embedded.
+     *
+     * @param[in] id dictionary ID (Adler-32 of the data)
+     *
+     * @throw std::runtime_error if dictionary is not available
+     *
+     * @return dictionary
+     */
+    const Dictionary* getDictionary(uint32_t id) const;
+
+    /**
+     * @brief Load table of blocks and start parallel decompression if the
+     *        table is valid.
+     *
+     * @throw std::exception in case of errors
+     */
+    void startBlocks();
+
+    /**
+     * @brief Read uncompressed data from the blocks decompressed in
+     *        parallel.
+     *
+     * @param[out] data pointer to the output buffer
+     * @param[in] size number of bytes to read
+     *
+     * @throw std::exception in case of errors
+     *
+     * @return number of bytes read, less than size at the end of stream
+     */
+    size_t readBlocks(uint8_t* data, size_t size);
+
+    /**
+     * @brief Get the next decompressed block, queue reading and
+     *        decompression of the following ones, verify the stream
+     *        trailer after the last block.
+     *
+     * @throw std::exception in case of errors
+     *
+     * @return false at the end of stream
+     */
+    bool nextBlock();
+
+    /**
+     * @brief Move forward to the specified offset of the tar stream,
+     *        blocks before the one containing the offset are not
+     *        decompressed.
+     *
+     * @param[in] offset offset in the tar stream
+     *
+     * @throw std::exception in case of errors
+     */
+    void seek(uint64_t offset);
+
+    /**
+     * @brief Fill input buffer of the decompressor.
+     *
+     * @throw std::exception in case of errors
+     */
+    void fill();
+
+    /**
+     * @brief Read raw data from the archive file.
+     *
+     * @param[out] data pointer to the output buffer
+     * @param[in] size number of bytes to read
+     *
+     * @return number of bytes read, less than size at the end of file
+     */
+    size_t readFile(uint8_t* data, size_t size);
+
+    /**
+     * @brief Read next portion of the archive file to the input buffer.
+     *
+     * @throw std::system_error in case of errors
+     *
+     * @return false at the end of file
+     */
+    bool readBuffer();
+
+    /**
+     * @brief Read exactly specified number of bytes.
+     *
+     * @param[out] data pointer to the output buffer
+     * @param[in] size number of bytes to read
+     *
+     * @throw std::runtime_error if archive is truncated
+     */
+    void readAll(void* data, size_t size);
+
+    /**
+     * @brief Skip data in the archive stream.
+     *
+     * @param[in] size number of bytes to skip
+     */
+    void skip(uint64_t size);
+
+  private:
+    /** @brief Decompression stream. */
+    z_stream stream{};
+    /** @brief Input file descriptor. */
+    int fd = -1;
+    /** @brief Input buffer. */
+    std::vector<uint8_t> buffer;
+    /** @brief Position of unread data in the input buffer. */
+    size_t bufferPos = 0;
+    /** @brief End of data in the input buffer. */
+    size_t bufferEnd = 0;
+    /** @brief End of input stream reached. */
+    bool eof = false;
+    /** @brief Compressed stream has zlib format (dictionary is used). */
+    bool zlibFormat = false;
+    /** @brief End of zlib stream reached. */
+    bool finished = false;
+    /** @brief Compression dictionary. */
+    const Dictionary* dictionary = nullptr;
+    /** @brief Stream decryptor, nullptr if archive is not encrypted. */
+    std::unique_ptr<Decryptor> decryptor;
+    /** @brief Decrypted data. */
+    std::vector<uint8_t> plain;
+    /** @brief Number of decompression threads. */
+    size_t threads = 1;
+    /** @brief Reading is started, the way of decompression is chosen. */
+    bool started = false;
+    /** @brief Table of blocks. */
+    BlockCodec::Index index;
+    /** @brief Offsets of blocks in the file and in the tar stream. */
+    std::vector<std::pair<uint64_t, uint64_t>> blockStarts;
+    /** @brief Table of contents: offsets and names of the entries. */
+    std::vector<std::pair<uint64_t, std::string>> contents;
+    /** @brief Offset of unread data in the tar stream. */
+    uint64_t position = 0;
+    /** @brief Some blocks were skipped, stream checksum is unknown. */
+    bool seeked = false;
+    /** @brief Number of blocks queued for decompression. */
+    size_t queued = 0;
+    /** @brief Current decompressed block. */
+    BlockCodec::Block current;
+    /** @brief Position of unread data in the current block. */
+    size_t currentPos = 0;
+    /** @brief Checksum of decompressed blocks. */
+    uint32_t check = 0;
+    /** @brief Pool of block decompressors, nullptr for single stream. */
+    std::unique_ptr<BlockCodec> blocks;
+    /** @brief I/O throughput limiter. */
+    Throttle* throttle = nullptr;
+    /** @brief Progress tracker, nullptr if not used. */
+    Progress* progress = nullptr;
+};
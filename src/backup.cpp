@@ -2,9 +2,28 @@
 // Copyright (C) 2020 YADRO
 
 #include "accounts.hpp"
+#include "archive.hpp"
 #include "backup.hpp"
+#include "checkpoint.hpp"
+#include "delta.hpp"
+#include "io_engine.hpp"
 #include "manifest.hpp"
+#include "metadata.hpp"
+#include "progress.hpp"
+#include "root_dir.hpp"
 
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <memory>
+#include <thread>
 #include <vector>
 
 namespace fs = std::filesystem;
@@ -25,52 +44,388 @@ static const std::vector<const char*> networkConfigs = {
 };
 // clang-format on
 
+/**
+ * @brief Read content of the regular file inside the directory.
+ *
+ * @param[in] root directory with the file
+ * @param[in] rel path to the file relative to the directory
+ * @param[in] maxSize max size of the file
+ * @param[out] data file content
+ *
+ * @throw std::system_error in case of errors
+ *
+ * @return false if the file doesn't exist, is not a regular file (symlinks
+ *         are not followed) or is bigger than maxSize
+ */
+static bool readFile(const RootDir& root, const fs::path& rel,
+                     uintmax_t maxSize, std::vector<uint8_t>& data)
+{
+    // non-blocking to not hang on FIFO, it is rejected by the type check
+    const FileHandle fd(root.open(rel, O_RDONLY | O_NOFOLLOW | O_NONBLOCK));
+    if (fd.get() == -1)
+    {
+        if (errno == ENOENT || errno == ENOTDIR || errno == ELOOP ||
+            errno == EXDEV)
+        {
+            return false;
+        }
+        throw std::system_error(errno, std::system_category(),
+                                root.path() / rel);
+    }
+
+    struct stat st;
+    if (fstat(fd.get(), &st) == -1)
+    {
+        throw std::system_error(errno, std::system_category(),
+                                root.path() / rel);
+    }
+    if (!S_ISREG(st.st_mode) || static_cast<uintmax_t>(st.st_size) > maxSize)
+    {
+        return false;
+    }
+
+    data.resize(st.st_size);
+    size_t size = 0;
+    while (size < data.size())
+    {
+        const ssize_t rc =
+            read(fd.get(), data.data() + size, data.size() - size);
+        if (rc == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (rc == -1)
+        {
+            throw std::system_error(errno, std::system_category(),
+                                    root.path() / rel);
+        }
+        if (rc == 0)
+        {
+            break; // truncated while reading
+        }
+        size += rc;
+    }
+    data.resize(size);
+    return true;
+}
+
+/**
+ * @brief Compare content of two files.
+ *
+ * @param[in] path1 path to the first file
+ * @param[in] path2 path to the second file
+ *
+ * @throw std::system_error in case of errors
+ *
+ * @return true if files have the same content
+ */
+static bool sameContent(const fs::path& path1, const fs::path& path2)
+{
+    if (fs::file_size(path1) != fs::file_size(path2))
+    {
+        return false;
+    }
+    std::ifstream file1(path1, std::ios::binary);
+    std::ifstream file2(path2, std::ios::binary);
+    if (!file1 || !file2)
+    {
+        throw std::system_error(errno, std::system_category(),
+                                file1 ? path2 : path1);
+    }
+    char buf1[4096];
+    char buf2[sizeof(buf1)];
+    while (file1 && file2)
+    {
+        file1.read(buf1, sizeof(buf1));
+        file2.read(buf2, sizeof(buf2));
+        if (file1.gcount() != file2.gcount() ||
+            memcmp(buf1, buf2, file1.gcount()) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** @brief Size of the buffer used for reading archive in streaming mode. */
+static constexpr size_t readBufferSize = 64 * 1024;
+/** @brief Directory inside the archive with delta files. */
+static const char* deltaDir = ".delta";
+/** @brief Max size of the file stored as delta. */
+static constexpr uintmax_t maxDeltaSize = 16 * 1024 * 1024;
+/** @brief Max size of uncompressed archive used as dictionary sample. */
+static constexpr uint64_t maxSample = 16 * 1024 * 1024;
+
+/**
+ * @brief Get number of compression threads.
+ *
+ * @param[in] num configured number, 0 for the number of CPUs
+ *
+ * @return number of threads
+ */
+static size_t threadCount(size_t num)
+{
+    return num ? num : std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+/**
+ * @brief Fill catalog entry with manifest data.
+ *
+ * @param[in] manifest manifest of the archive
+ * @param[out] entry catalog entry
+ */
+static void describe(const Manifest& manifest, Catalog::Entry& entry)
+{
+    entry.osVersion = manifest.osVersion();
+    entry.machineName = manifest.machineName();
+    entry.hostName = manifest.hostName();
+}
+
 Backup::~Backup()
 {
-    if (!tmpDir.empty())
+    cleanup();
+}
+
+/**
+ * @brief Rename file, an existing destination file is never replaced.
+ *
+ * @param[in] from current file name
+ * @param[in] to new file name
+ *
+ * @return 0 on success or error code
+ */
+static int renameNoReplace(const fs::path& from, const fs::path& to)
+{
+    if (renameat2(AT_FDCWD, from.c_str(), AT_FDCWD, to.c_str(),
+                  RENAME_NOREPLACE) == 0)
+    {
+        return 0;
+    }
+    if (errno != EINVAL)
+    {
+        return errno;
+    }
+    // file system without RENAME_NOREPLACE, link() doesn't replace the
+    // existing file either
+    if (link(from.c_str(), to.c_str()) != 0)
+    {
+        return errno;
+    }
+    unlink(from.c_str());
+    return 0;
+}
+
+/**
+ * @brief Create temporary file with unique name next to the archive, it is
+ *        renamed to the archive name when complete.
+ *
+ * @param[in] archive path to the archive file
+ * @param[out] path path to the created file
+ *
+ * @throw std::system_error in case of errors
+ *
+ * @return descriptor of the file opened for writing
+ */
+static int createTemp(const fs::path& archive, fs::path& path)
+{
+    fs::path dir = archive.parent_path();
+    if (dir.empty())
+    {
+        dir = ".";
+    }
+    const FileHandle dirFd(
+        open(dir.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC));
+    std::string name;
+    const int fd = dirFd.get() == -1
+                       ? -1
+                       : RootDir::createTemp(dirFd.get(), archive.filename(),
+                                             0644, name);
+    if (fd == -1)
+    {
+        throw std::system_error(errno, std::system_category(), archive);
+    }
+    path = dir / name;
+    return fd;
+}
+
+/**
+ * @brief Flush file or directory to the storage.
+ *
+ * @param[in] path path to the file
+ *
+ * @return 0 on success or error code
+ */
+static int syncFile(const fs::path& path)
+{
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return errno;
+    }
+    int err = fsync(fd) != 0 ? errno : 0;
+    if (close(fd) != 0 && !err)
     {
-        fs::remove_all(tmpDir);
+        err = errno;
     }
+    return err;
 }
 
 void Backup::backup()
 {
-    if (fs::exists(archiveFile))
+    cleanup();
+    tracker = std::make_shared<Progress>(progressSink.get(), cancel.get());
+    if (resume)
+    {
+        state = Checkpoint::find("backup", archiveFile);
+    }
+    if (!state && fs::exists(archiveFile))
     {
         std::string err = "Backup file already exists: ";
         err += archiveFile;
         throw std::runtime_error(err);
     }
+    // a rejected run must not supersede the checkpoint of the same archive
+    Checkpoint::reclaim("backup", archiveFile);
+    if (!state)
+    {
+        state = Checkpoint::create("backup", archiveFile);
+    }
 
-    tmpDir = createTempDir();
+    tmpDir = state->dir();
+    stagedFile = tmpDir;
+    stagedFile += ".tar.gz";
+    openRoots();
 
-    if (handleAccounts)
+    std::vector<const char*> configs = baseConfigs;
+    if (handleNetwork)
+    {
+        configs.insert(configs.end(), networkConfigs.begin(),
+                       networkConfigs.end());
+    }
+
+    if (!state->isDone("prepare"))
+    {
+        tracker->begin("prepare", 0, 0);
+        // check if there is enough space before doing anything
+        Preflight preflight(maxMemory, maxTmp);
+        preflight.setEncrypted(key != nullptr);
+        if (handleAccounts)
+        {
+            for (const auto& it : Accounts::files())
+            {
+                preflight.addTemp(rootFs / it, it);
+            }
+        }
+        for (const auto& it : configs)
+        {
+            const fs::path src = sourceFile(it);
+            if (!src.empty())
+            {
+                preflight.addData(src, it);
+            }
+        }
+        fs::path archiveDir = archiveFile.parent_path();
+        if (archiveDir.empty())
+        {
+            archiveDir = ".";
+        }
+        procMode = preflight.backup(tmpDir, archiveDir);
+
+        if (handleAccounts)
+        {
+            Accounts acc(rootFs, tmpDir, readOnlyFs, throttle.get(),
+                         accountsCache.get());
+            acc.setCacheDir(accountsCacheDir);
+            acc.setCancel(cancel.get());
+            acc.backup();
+        }
+
+        Manifest manifest(rootFs, accountsCache.get());
+        createDeltas(configs, manifest);
+        manifest.save(tmpDir);
+
+        state->mode = procMode;
+        if (procMode == Preflight::Mode::staged && maxTmp)
+        {
+            state->limit = maxTmp - preflight.tempSize();
+        }
+        state->total = preflight.dataSize();
+        state->deltas = deltaSet;
+        saveProgress("prepare", nullptr);
+        tracker->finish();
+    }
+    else
     {
-        Accounts acc(rootFs, tmpDir, readOnlyFs);
-        acc.backup();
+        procMode = state->mode;
+        deltaSet = state->deltas;
     }
 
-    for (const auto& it : baseConfigs)
+    std::unique_ptr<ArchiveWriter> archive = createArchive();
+    try
+    {
+        writeArchive(*archive, configs);
+    }
+    catch (const std::runtime_error&)
     {
-        backupFile(it);
+        if (procMode != Preflight::Mode::memory ||
+            archive->size() <= maxMemory)
+        {
+            throw;
+        }
+        // data has grown since preflight, write the archive file directly
+        procMode = Preflight::Mode::streaming;
+        state->mode = procMode;
+        archive = createArchive();
+        writeArchive(*archive, configs);
     }
 
-    if (handleNetwork)
+    if (procMode == Preflight::Mode::memory)
     {
-        for (const auto& it : networkConfigs)
+        saveArchive(*archive);
+    }
+    else if (procMode == Preflight::Mode::staged)
+    {
+        const int err = syncFile(stagedFile);
+        if (err)
         {
-            backupFile(it);
+            throw std::system_error(err, std::system_category(), stagedFile);
         }
+        publishArchive(stagedFile);
     }
+    tracker->finish();
 
-    const Manifest manifest(rootFs);
-    manifest.save(tmpDir);
+    // directory with catalog is rotated, keep the catalog up to date
+    fs::path archiveDir = archiveFile.parent_path();
+    if (archiveDir.empty())
+    {
+        archiveDir = ".";
+    }
+    if (Catalog::exists(archiveDir))
+    {
+        Catalog catalog(archiveDir);
+        Catalog::Entry entry;
+        entry.name = archiveFile.filename();
+        describe(Manifest::load(tmpDir), entry);
+        catalog.add(entry);
+        catalog.save();
+    }
 
-    callTar(false);
+    cleanup();
 }
 
 void Backup::restore()
 {
+    if (fs::is_directory(archiveFile))
+    {
+        const Catalog catalog = openCatalog(archiveFile);
+        if (!catalog.latest())
+        {
+            std::string err = "No archives found in ";
+            err += archiveFile;
+            throw std::runtime_error(err);
+        }
+        archiveFile /= catalog.latest()->name;
+    }
     if (!fs::exists(archiveFile))
     {
         std::string err = "File not found: ";
@@ -78,47 +433,271 @@ void Backup::restore()
         throw std::runtime_error(err);
     }
 
-    tmpDir = createTempDir();
+    cleanup();
+    tracker = std::make_shared<Progress>(progressSink.get(), cancel.get());
+    // dry run doesn't change anything, there is nothing to continue, and it
+    // doesn't supersede the checkpoint of the interrupted restore
+    if (resume && !report)
+    {
+        state = Checkpoint::find("restore", archiveFile);
+    }
+    if (!report)
+    {
+        Checkpoint::reclaim("restore", archiveFile);
+    }
+    if (!state)
+    {
+        state = Checkpoint::create("restore", archiveFile);
+    }
+    tmpDir = state->dir();
 
-    callTar(true);
+    if (!state->isDone("extract"))
+    {
+        // the manifest is unpacked first, so the archive is not extracted
+        // if it can't be restored on this machine
+        checkManifest(loadManifest(archiveFile, nullptr));
 
-    checkManifest();
+        tracker->begin("extract", fs::file_size(archiveFile), 0);
+        const Preflight preflight(maxMemory, maxTmp);
+        procMode = preflight.restore(archiveFile, tmpDir, rootFs);
 
-    if (handleAccounts)
+        ArchiveReader archive(archiveFile,
+                              procMode == Preflight::Mode::memory
+                                  ? maxMemory
+                                  : readBufferSize,
+                              key.get());
+        archive.setThrottle(throttle.get());
+        archive.setProgress(tracker.get());
+        archive.setDictionary(dictionary.get());
+        archive.setThreads(threadCount(threads));
+        archive.extract(tmpDir, maxTmp, [this](const fs::path& rel) {
+            return isRestored(rel);
+        });
+        tracker->finish();
+
+        applyDeltas();
+
+        if (!report)
+        {
+            state->mode = procMode;
+            saveProgress("extract", nullptr);
+        }
+    }
+    else
     {
-        Accounts acc(tmpDir, rootFs, readOnlyFs);
-        acc.restore();
+        procMode = state->mode;
     }
 
-    for (const auto& it : baseConfigs)
+    if (!report)
     {
-        restoreFile(it);
+        fs::create_directories(rootFs);
     }
+    openRoots();
 
+    // restored files must reach the storage before they are marked as done:
+    // configuration files are flushed one by one while they are copied,
+    // accounts files are written in many places and are flushed together
+    // with the whole file system once
+    const auto done = [this](const std::string& step) {
+        if (!report)
+        {
+            saveProgress(step, nullptr);
+        }
+        tracker->addEntry(step);
+    };
+
+    std::vector<const char*> configs = baseConfigs;
     if (handleNetwork)
     {
-        for (const auto& it : networkConfigs)
+        configs.insert(configs.end(), networkConfigs.begin(),
+                       networkConfigs.end());
+    }
+    tracker->begin("restore", 0, configs.size() + restoreAccounts());
+
+    if (report)
+    {
+        report->begin(archiveFile);
+    }
+
+    if (restoreAccounts() && !state->isDone("accounts"))
+    {
+        Accounts acc(tmpDir, rootFs, readOnlyFs, throttle.get(),
+                     accountsCache.get());
+        acc.setCacheDir(accountsCacheDir);
+        if (!matchAccounts())
+        {
+            acc.setUsers(onlyUsers);
+        }
+        acc.setGroupPolicies(groupPolicies);
+        acc.setReport(report.get());
+        acc.setCancel(cancel.get());
+        acc.restore();
+        if (!report)
+        {
+            const FileHandle root(
+                rootDir->open(".", O_RDONLY | O_DIRECTORY));
+            if (root.get() == -1 || syncfs(root.get()) != 0)
+            {
+                throw std::system_error(errno, std::system_category(),
+                                        rootFs);
+            }
+        }
+        done("accounts");
+    }
+
+    for (const auto& it : configs)
+    {
+        if (!state->isDone(it))
         {
             restoreFile(it);
+            done(it);
         }
     }
+
+    if (report)
+    {
+        report->finish();
+    }
+    tracker->finish();
+    cleanup();
+}
+
+void Backup::trainDictionary(const fs::path& dictFile,
+                             const std::vector<fs::path>& archives)
+{
+    std::vector<std::vector<uint8_t>> samples;
+    for (const auto& it : archives)
+    {
+        ArchiveReader archive(it, readBufferSize, key.get());
+        archive.setThrottle(throttle.get());
+        archive.setDictionary(dictionary.get());
+        archive.setThreads(threadCount(threads));
+        samples.emplace_back(archive.unpack(maxSample));
+    }
+
+    const Dictionary dict = Dictionary::train(samples);
+    dict.save(dictFile);
+    printf("Dictionary %08x (%zu bytes) created from %zu archive(s)\n",
+           dict.id(), dict.data().size(), archives.size());
 }
 
-fs::path Backup::createTempDir() const
+void Backup::rotate(const fs::path& dir)
 {
-    std::string pathTemplate = fs::temp_directory_path() / "backup_XXXXXX";
-    const char* path = mkdtemp(pathTemplate.data());
-    if (!path)
+    Catalog catalog = openCatalog(dir);
+    const std::vector<Catalog::Entry> expired =
+        catalog.expired(keepDaily, keepWeekly);
+    for (const auto& it : expired)
     {
-        throw std::system_error(errno, std::system_category(), pathTemplate);
+        catalog.remove(it.name);
+        printf("Removed: %s\n", it.name.c_str());
     }
-    return path;
+    catalog.save();
+    printf("%zu archive(s) removed, %zu kept\n", expired.size(),
+           catalog.entries().size());
 }
 
-void Backup::checkManifest() const
+void Backup::list(const fs::path& dir)
 {
-    const Manifest mnfBackup = Manifest::load(tmpDir);
-    const Manifest mnfCurrent = Manifest(rootFs);
+    const Catalog catalog = openCatalog(dir);
+    for (const auto& it : catalog.entries())
+    {
+        tm local;
+        char date[32];
+        localtime_r(&it.mtime.tv_sec, &local);
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &local);
+        printf("%s %10" PRIu64 " %-16s %-24s %s%s\n", date, it.size,
+               it.hostName.c_str(), it.osVersion.c_str(), it.name.c_str(),
+               &it == catalog.latest() ? " (latest)" : "");
+    }
+}
+
+Catalog Backup::openCatalog(const fs::path& dir) const
+{
+    Catalog catalog(dir);
+    const bool changed = catalog.update([this](const fs::path& file,
+                                               Catalog::Entry& entry) {
+        describe(loadManifest(file, nullptr), entry);
+    });
+    if (changed || !Catalog::exists(dir))
+    {
+        catalog.save();
+    }
+    return catalog;
+}
+
+void Backup::inspect(const fs::path& file)
+{
+    std::vector<fs::path> entries;
+    const Manifest manifest = loadManifest(file, &entries);
+    printf("Archive:  %s\n", file.c_str());
+    printf("Size:     %" PRIu64 " bytes, %" PRIu64 " uncompressed\n",
+           static_cast<uint64_t>(fs::file_size(file)),
+           ArchiveReader::contentSize(file));
+    printf("Host:     %s\n", manifest.hostName().c_str());
+    printf("Machine:  %s\n", manifest.machineName().c_str());
+    printf("Version:  %s\n", manifest.osVersion().c_str());
+    printf("Entries:  %zu\n", entries.size());
+    for (const auto& it : entries)
+    {
+        printf("  %s\n", it.c_str());
+    }
+}
+
+Manifest Backup::loadManifest(const fs::path& file,
+                              std::vector<fs::path>* entries) const
+{
+    // unpack only the manifest, blocks of other entries are skipped if the
+    // archive has the table of contents
+    const std::unique_ptr<Checkpoint> tmp = Checkpoint::create("index", file);
+    try
+    {
+        ArchiveReader archive(file, readBufferSize, key.get());
+        archive.setThrottle(throttle.get());
+        archive.setDictionary(dictionary.get());
+        archive.setThreads(threadCount(threads));
+        archive.extract(tmp->dir(), maxTmp, [entries](const fs::path& rel) {
+            if (entries)
+            {
+                entries->push_back(rel);
+            }
+            return rel == Manifest::fileName();
+        });
+        Manifest manifest = Manifest::load(tmp->dir());
+        tmp->remove();
+        return manifest;
+    }
+    catch (...)
+    {
+        tmp->remove();
+        throw;
+    }
+}
+
+void Backup::cleanup()
+{
+    tmpRoot.reset();
+    if (state)
+    {
+        state->remove();
+        state.reset();
+    }
+    tmpDir.clear();
+    stagedFile.clear();
+}
+
+void Backup::saveProgress(const std::string& step, ArchiveWriter* archive)
+{
+    if (archive)
+    {
+        state->archive = archive->checkpoint();
+    }
+    state->steps.insert(step);
+    state->save();
+}
+
+void Backup::checkManifest(const Manifest& mnfBackup) const
+{
+    const Manifest mnfCurrent(rootFs, accountsCache.get());
 
     if (mnfBackup.machineName() != mnfCurrent.machineName())
     {
@@ -129,8 +708,11 @@ void Backup::checkManifest() const
         throw std::runtime_error(err);
     }
 
-    printf("Restore from backup file %s\n", archiveFile.c_str());
-    mnfBackup.print();
+    if (verbose)
+    {
+        printf("Restore from backup file %s\n", archiveFile.c_str());
+        mnfBackup.print();
+    }
 
     // Check versions
     const uint32_t bkpVer = mnfBackup.osVersionNumber();
@@ -143,7 +725,7 @@ void Backup::checkManifest() const
                 mnfCurrent.osVersion().c_str());
         throw std::runtime_error("Downgrading configuration is not possible");
     }
-    if (bkpVer < curVer)
+    if (bkpVer < curVer && verbose)
     {
         printf("WARNING! Backup was created for older BMC version %s.\n",
                mnfBackup.osVersion().c_str());
@@ -153,7 +735,7 @@ void Backup::checkManifest() const
             "Restoring from this backup may cause the BMC to become unstable!");
     }
 
-    if (!unattendedMode)
+    if (!unattendedMode && !report)
     {
         printf("Do you want to continue? [y/N]: ");
         char answer[2]; // first char with \0
@@ -165,74 +747,573 @@ void Backup::checkManifest() const
     }
 }
 
-void Backup::backupFile(const char* path) const
+void Backup::backupFile(ArchiveWriter& archive, const char* path) const
+{
+    const RootDir* root = sourceRoot(path);
+    if (root)
+    {
+        archive.addTree(*root, path, path,
+                        [this](const fs::path& rel) { return isPlain(rel); });
+    }
+}
+
+void Backup::restoreFile(const char* path) const
 {
-    fs::path src = rootFs / path;
-    if (!fs::exists(src))
+    if (!tmpRoot->exists(path))
     {
-        // try to get the file from RO
-        src = readOnlyFs / path;
-        if (!fs::exists(src))
+        return;
+    }
+    const fs::path src = tmpDir / path;
+
+    // restore permissions, try to get them from RO if file doesn't exist
+    const auto getMode = [path](const RootDir* root, struct stat& st) {
+        if (!root)
         {
+            return false;
+        }
+        const FileHandle fd(root->open(path, O_PATH));
+        return fd.get() != -1 && fstat(fd.get(), &st) == 0;
+    };
+    struct stat st;
+    if (getMode(rootDir.get(), st) || getMode(roDir.get(), st))
+    {
+        const fs::perms p = static_cast<fs::perms>(st.st_mode & 07777);
+        if (report)
+        {
+            reportFile(path, &p);
             return;
         }
+        // symlinks in the temp dir are copied as is, not followed
+        const FileHandle fd(tmpRoot->open(path, O_RDONLY | O_NOFOLLOW));
+        if (fd.get() == -1 ? errno != ELOOP
+                           : fchmod(fd.get(), st.st_mode & 07777) != 0)
+        {
+            throw std::system_error(errno, std::system_category(), src);
+        }
+    }
+    if (report)
+    {
+        reportFile(path, nullptr);
+        return;
     }
 
-    const fs::path dst = tmpDir / path;
-    fs::create_directories(dst.parent_path());
-    fs::copy(src, dst,
-             fs::copy_options::recursive | fs::copy_options::copy_symlinks);
+    // copy file
+    Metadata::copy(*tmpRoot, path, *rootDir, path, ioEngine.get(),
+                   throttle.get(), true);
 }
 
-void Backup::restoreFile(const char* path) const
+void Backup::reportFile(const char* path, const fs::perms* perms) const
 {
     const fs::path src = tmpDir / path;
-    if (!fs::exists(src))
+    const auto check = [&](const fs::path& srcFile, fs::perms newPerms) {
+        const fs::path rel = fs::relative(srcFile, tmpDir);
+        const fs::path dst = rootFs / rel;
+        const fs::file_status dstStatus = fs::symlink_status(dst);
+        if (!fs::exists(dstStatus))
+        {
+            report->file(rel, Report::Change::add);
+            return;
+        }
+        const fs::file_status srcStatus = fs::symlink_status(srcFile);
+        if (fs::is_symlink(srcStatus))
+        {
+            // copy_symlinks: link is replaced, its permissions don't matter
+            if (!fs::is_symlink(dstStatus) ||
+                fs::read_symlink(srcFile) != fs::read_symlink(dst))
+            {
+                report->file(rel, Report::Change::modify);
+            }
+            else
+            {
+                reportMetadata(rel, srcFile, dst);
+            }
+            return;
+        }
+        if (fs::is_regular_file(srcStatus) &&
+            (!fs::is_regular_file(dstStatus) ||
+             !sameContent(srcFile, dst)))
+        {
+            report->file(rel, Report::Change::modify);
+        }
+        else
+        {
+            reportMetadata(rel, srcFile, dst);
+        }
+        if (dstStatus.permissions() != newPerms)
+        {
+            report->perms(rel, dstStatus.permissions(), newPerms);
+        }
+    };
+
+    // permissions are replaced for the top level entry only, content of
+    // directories is copied with permissions from the archive
+    check(src, perms ? *perms : fs::symlink_status(src).permissions());
+    if (fs::is_directory(fs::symlink_status(src)))
+    {
+        for (const auto& it : fs::recursive_directory_iterator(src))
+        {
+            check(it.path(), it.symlink_status().permissions());
+        }
+    }
+}
+
+void Backup::reportMetadata(const fs::path& rel, const fs::path& src,
+                            const fs::path& dst) const
+{
+    const Metadata from = Metadata::load(src);
+    const Metadata to = Metadata::load(dst);
+    std::string attrs;
+    const auto add = [&attrs](const char* name) {
+        if (!attrs.empty())
+        {
+            attrs += ',';
+        }
+        attrs += name;
+    };
+    if (from.uid != to.uid || from.gid != to.gid)
+    {
+        add("owner");
+    }
+    if (from.mtime.tv_sec != to.mtime.tv_sec ||
+        from.mtime.tv_nsec != to.mtime.tv_nsec)
+    {
+        add("mtime");
+    }
+    // attributes from the archive are set, other ones are kept
+    for (const auto& it : from.xattrs)
+    {
+        if (std::find(to.xattrs.begin(), to.xattrs.end(), it) ==
+            to.xattrs.end())
+        {
+            add("xattrs");
+            break;
+        }
+    }
+    if (!attrs.empty())
+    {
+        report->metadata(rel, attrs);
+    }
+}
+
+fs::path Backup::sourceFile(const char* path) const
+{
+    const RootDir* root = sourceRoot(path);
+    return root ? root->path() / path : fs::path();
+}
+
+const RootDir* Backup::sourceRoot(const char* path) const
+{
+    // try to get the file from RO if it doesn't exist on root FS
+    for (const RootDir* root : {rootDir.get(), roDir.get()})
+    {
+        if (root)
+        {
+            const FileHandle fd(root->open(path, O_PATH));
+            if (fd.get() != -1)
+            {
+                return root;
+            }
+        }
+    }
+    return nullptr;
+}
+
+void Backup::openRoots()
+{
+    // absolute symlinks are resolved inside root and RO FS, as they would
+    // be on the running system, temp dir content must not refer outside
+    rootDir = fs::is_directory(rootFs)
+                  ? std::make_shared<const RootDir>(rootFs, true)
+                  : nullptr;
+    roDir = fs::is_directory(readOnlyFs)
+                ? std::make_shared<const RootDir>(readOnlyFs, true)
+                : nullptr;
+    tmpRoot = std::make_shared<const RootDir>(tmpDir);
+}
+
+std::unique_ptr<ArchiveWriter> Backup::createArchive()
+{
+    // the archive file can be continued after interruption if it is
+    // written through durable points, encrypted stream can't be continued
+    const bool durable = procMode != Preflight::Mode::memory && !key;
+    const fs::path& file =
+        procMode == Preflight::Mode::staged ? stagedFile : archiveFile;
+    std::unique_ptr<ArchiveWriter> archive;
+    if (procMode == Preflight::Mode::memory)
+    {
+        archive = std::make_unique<ArchiveWriter>(maxMemory);
+    }
+    else if (durable && state->isDone("archive"))
+    {
+        archive =
+            std::make_unique<ArchiveWriter>(file, state->archive, state->limit);
+    }
+    else
+    {
+        if (procMode == Preflight::Mode::staged || state->isDone("archive"))
+        {
+            std::error_code ec;
+            fs::remove(file, ec);
+        }
+        state->steps = {"prepare"};
+        state->archive = {};
+        archive = std::make_unique<ArchiveWriter>(file, state->limit);
+        saveProgress("archive", nullptr);
+    }
+
+    archive->setThrottle(throttle.get());
+    archive->setProgress(tracker.get());
+    archive->setIoEngine(ioEngine.get());
+    if (!archive->size())
+    {
+        archive->setKey(key.get());
+        archive->setDictionary(dictionary ? dictionary.get()
+                                          : Dictionary::embedded());
+        archive->setThreads(threadCount(threads));
+    }
+    return archive;
+}
+
+void Backup::writeArchive(ArchiveWriter& archive,
+                          const std::vector<const char*>& configs)
+{
+    const bool durable = procMode != Preflight::Mode::memory && !key;
+
+    // sizes of files were collected by preflight, the tree is not walked
+    // again
+    tracker->begin("archive", state->total, configs.size() + 1);
+
+    try
+    {
+        if (!state->isDone("."))
+        {
+            archive.addTree(
+                *tmpRoot, ".", ".",
+                [this](const fs::path& rel) { return isPlain(rel); });
+            if (durable)
+            {
+                saveProgress(".", &archive);
+            }
+        }
+        tracker->addEntry(".");
+        for (const auto& it : configs)
+        {
+            if (!state->isDone(it))
+            {
+                backupFile(archive, it);
+                if (durable)
+                {
+                    saveProgress(it, &archive);
+                }
+            }
+            tracker->addEntry(it);
+        }
+        archive.finish();
+    }
+    catch (...)
+    {
+        if (procMode == Preflight::Mode::streaming)
+        {
+            // remove partially written archive
+            std::error_code ec;
+            fs::remove(archiveFile, ec);
+        }
+        throw;
+    }
+}
+
+void Backup::saveArchive(const ArchiveWriter& archive) const
+{
+    const std::vector<uint8_t>& data = archive.data();
+    if (throttle)
+    {
+        throttle->consume(data.size());
+    }
+
+    // the file appears under its name complete and synced or not at all,
+    // a temporary file left by a crash doesn't block the next backup
+    fs::path newFile;
+    const int fd = createTemp(archiveFile, newFile);
+    const uint8_t* ptr = data.data();
+    size_t left = data.size();
+    while (left)
+    {
+        const ssize_t rc = write(fd, ptr, left);
+        if (rc == 0)
+        {
+            errno = EIO;
+            break;
+        }
+        if (rc < 0 && errno != EINTR)
+        {
+            break;
+        }
+        if (rc > 0)
+        {
+            ptr += rc;
+            left -= rc;
+        }
+    }
+    int err = left || fsync(fd) != 0 ? errno : 0;
+    if (close(fd) != 0 && !err)
+    {
+        err = errno;
+    }
+    if (err)
+    {
+        std::error_code ec;
+        fs::remove(newFile, ec);
+        throw std::system_error(err, std::system_category(), newFile);
+    }
+    try
+    {
+        publishArchive(newFile);
+    }
+    catch (...)
+    {
+        std::error_code ec;
+        fs::remove(newFile, ec);
+        throw;
+    }
+}
+
+void Backup::publishArchive(const fs::path& file) const
+{
+    int err = renameNoReplace(file, archiveFile);
+    if (err == EXDEV)
+    {
+        // different file systems: copy the file next to the archive, so
+        // it can be renamed there
+        if (throttle)
+        {
+            throttle->consume(2 * fs::file_size(file)); // read + write
+        }
+        fs::path newFile;
+        close(createTemp(archiveFile, newFile));
+        std::error_code ec;
+        fs::copy_file(file, newFile, fs::copy_options::overwrite_existing,
+                      ec);
+        err = ec ? ec.value() : syncFile(newFile);
+        if (!err)
+        {
+            err = renameNoReplace(newFile, archiveFile);
+        }
+        if (err)
+        {
+            fs::remove(newFile, ec);
+        }
+        else
+        {
+            fs::remove(file, ec);
+        }
+    }
+    if (err)
+    {
+        throw std::system_error(err, std::system_category(), archiveFile);
+    }
+
+    fs::path archiveDir = archiveFile.parent_path();
+    if (archiveDir.empty())
+    {
+        archiveDir = ".";
+    }
+    syncFile(archiveDir);
+}
+
+void Backup::createDeltas(const std::vector<const char*>& configs,
+                          Manifest& manifest)
+{
+    deltaSet.clear();
+    if (!deltaMode || !roDir)
     {
         return;
     }
 
-    const fs::path dst = rootFs / path;
+    if (handleAccounts)
+    {
+        for (const auto& it : Accounts::files())
+        {
+            createDelta(*tmpRoot, it, manifest);
+        }
+    }
+
+    for (const auto& it : configs)
+    {
+        const RootDir* root = sourceRoot(it);
+        if (!root)
+        {
+            continue;
+        }
+        // the walk only lists names, files are opened beneath the root
+        const fs::path src = root->path() / it;
+        if (fs::is_directory(fs::symlink_status(src)))
+        {
+            for (const auto& entry : fs::recursive_directory_iterator(src))
+            {
+                createDelta(*root, it / fs::relative(entry.path(), src),
+                            manifest);
+            }
+        }
+        else
+        {
+            createDelta(*root, it, manifest);
+        }
+    }
+}
+
+void Backup::createDelta(const RootDir& root, const fs::path& rel,
+                         Manifest& manifest)
+{
+    const std::string& name = rel.native();
+    if (name.find_first_of(" =\"\n") != std::string::npos)
+    {
+        return;
+    }
 
-    // restore permissions
-    fs::path permsFile = dst;
-    if (!fs::exists(permsFile))
+    std::vector<uint8_t> srcData;
+    std::vector<uint8_t> baseData;
+    if (!readFile(root, rel, maxDeltaSize, srcData) ||
+        !readFile(*roDir, rel, maxDeltaSize, baseData))
     {
-        // try to get permissions from RO
-        permsFile = readOnlyFs / path;
+        return;
     }
-    if (fs::exists(permsFile))
+    if (throttle)
     {
-        const fs::perms p = fs::status(permsFile).permissions();
-        fs::permissions(src, p, fs::perm_options::replace);
+        throttle->consume(srcData.size() + baseData.size());
     }
 
-    // copy file
-    fs::create_directories(dst.parent_path());
-    fs::copy(src, dst,
-             fs::copy_options::overwrite_existing |
-                 fs::copy_options::recursive | fs::copy_options::copy_symlinks);
+    const std::vector<uint8_t> delta = Delta::create(baseData, srcData);
+    if (delta.size() * 2 > srcData.size())
+    {
+        return; // not worth it
+    }
+
+    tmpRoot->replaceFile(deltaDir / rel, delta.data(), delta.size(), 0644);
+    manifest.addDelta(name, Delta::hash(baseData));
+    deltaSet.insert(rel);
 }
 
-void Backup::callTar(bool extract) const
+void Backup::applyDeltas() const
 {
-    std::string cmd = "tar ";
-    cmd += extract ? "xf" : "czf";
-    cmd += " '";
-    cmd += archiveFile;
-    cmd += "' -C '";
-    cmd += tmpDir;
-    cmd += '\'';
-    if (!extract)
+    const Manifest manifest = Manifest::load(tmpDir);
+    if (manifest.deltas().empty())
     {
-        cmd += " .";
+        return;
     }
 
-    const int rc = system(cmd.c_str());
-    if (rc)
+    // roots are not opened yet, the archive content and RO FS are accessed
+    // the same way as during the restore itself
+    const RootDir tmp(tmpDir);
+    const std::unique_ptr<const RootDir> ro =
+        fs::is_directory(readOnlyFs)
+            ? std::make_unique<const RootDir>(readOnlyFs, true)
+            : nullptr;
+
+    for (const auto& it : manifest.deltas())
     {
-        std::string err = "Tar error: ";
-        err += archiveFile;
-        throw std::runtime_error(err);
+        const fs::path rel = fs::path(it.first).lexically_normal();
+        if (rel.empty() || rel.is_absolute() || *rel.begin() == "..")
+        {
+            std::string err = "Invalid delta file name: ";
+            err += it.first;
+            throw std::runtime_error(err);
+        }
+
+        std::vector<uint8_t> delta;
+        if (!readFile(tmp, deltaDir / rel, maxDeltaSize, delta))
+        {
+            if (isSelective())
+            {
+                continue; // not selected for restore
+            }
+            std::string err = "Invalid delta file: ";
+            err += it.first;
+            throw std::runtime_error(err);
+        }
+
+        // RO FS is replaced by firmware update, the file can't be
+        // reconstructed then, but the rest of the backup is still valid
+        std::vector<uint8_t> baseData;
+        if (!ro || !readFile(*ro, rel, maxDeltaSize, baseData) ||
+            Delta::hash(baseData) != it.second)
+        {
+            fprintf(stderr,
+                    "WARNING! Unable to restore %s: base file on RO FS was "
+                    "changed after backup, the file is skipped\n",
+                    it.first.c_str());
+            continue;
+        }
+
+        if (throttle)
+        {
+            throttle->consume(baseData.size() + delta.size());
+        }
+        const std::vector<uint8_t> data = Delta::apply(baseData, delta);
+        tmp.replaceFile(rel, data.data(), data.size(), 0644);
     }
+    fs::remove_all(tmpDir / deltaDir);
+}
+
+bool Backup::matchFiles(const fs::path& rel) const
+{
+    for (const auto& it : onlyFiles)
+    {
+        // patterns are relative to the root FS
+        const size_t start = it.find_first_not_of('/');
+        if (start == std::string::npos)
+        {
+            return true; // the whole root FS
+        }
+        const char* pattern = it.c_str() + start;
+        fs::path path;
+        for (const auto& part : rel)
+        {
+            path /= part;
+            if (fnmatch(pattern, path.c_str(), 0) == 0)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool Backup::matchAccounts() const
+{
+    for (const auto& it : Accounts::files())
+    {
+        if (matchFiles(it))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Backup::restoreAccounts() const
+{
+    return handleAccounts &&
+           (!isSelective() || !onlyUsers.empty() || matchAccounts());
+}
+
+bool Backup::isRestored(const fs::path& rel) const
+{
+    if (!isSelective() || rel == Manifest::fileName())
+    {
+        return true;
+    }
+
+    // delta files are restored with their targets
+    fs::path path = rel;
+    if (*rel.begin() == deltaDir)
+    {
+        path = rel.lexically_relative(deltaDir);
+    }
+
+    if (restoreAccounts() && Accounts::isAccountsFile(path))
+    {
+        return true;
+    }
+
+    return matchFiles(path);
 }
@@ -3,7 +3,29 @@
 
 #pragma once
 
+#include "accounts.hpp"
+#include "catalog.hpp"
+#include "crypto.hpp"
+#include "dictionary.hpp"
+#include "preflight.hpp"
+#include "report.hpp"
+#include "throttle.hpp"
+
 #include <filesystem>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+class AccountsCache;
+class ArchiveWriter;
+class CancelToken;
+class Checkpoint;
+class IoEngine;
+class Manifest;
+class Progress;
+class ProgressSink;
+class RootDir;
 
 /**
  * @class Backup
@@ -28,31 +50,115 @@ class Backup
      */
     void restore();
 
+    /**
+     * @brief Train compression dictionary on existing backups.
+     *
+     * @param[in] dictFile path to the dictionary file to create
+     * @param[in] archives paths to the backup archives used as samples
+     *
+     * @throw std::exception in case of errors
+     */
+    void trainDictionary(const std::filesystem::path& dictFile,
+                         const std::vector<std::filesystem::path>& archives);
+
+    /**
+     * @brief Remove old archives of the directory by retention policy
+     *        (keepDaily, keepWeekly).
+     *
+     * @param[in] dir path to the directory with archives
+     *
+     * @throw std::exception in case of errors
+     */
+    void rotate(const std::filesystem::path& dir);
+
+    /**
+     * @brief Print archives of the directory.
+     *
+     * @param[in] dir path to the directory with archives
+     *
+     * @throw std::exception in case of errors
+     */
+    void list(const std::filesystem::path& dir);
+
+    /**
+     * @brief Print manifest and entries of the archive.
+     *
+     * @param[in] file path to the archive file
+     *
+     * @throw std::exception in case of errors
+     */
+    void inspect(const std::filesystem::path& file);
+
+    /**
+     * @brief Get processing mode chosen by the last operation.
+     *
+     * @return processing mode
+     */
+    Preflight::Mode mode() const
+    {
+        return procMode;
+    }
+
   private:
     /**
-     * @brief Create temp directory.
+     * @brief Remove temporary data of the previous operation.
+     */
+    void cleanup();
+
+    /**
+     * @brief Load manifest of the archive, other entries are skipped.
      *
-     * @throw std::system_error in case of other errors
+     * @param[in] file path to the archive file
+     * @param[out] entries names of all entries, nullptr if not needed
+     *
+     * @throw std::exception in case of errors
      *
-     * @return path to the created dir
+     * @return manifest of the archive
      */
-    std::filesystem::path createTempDir() const;
+    Manifest loadManifest(const std::filesystem::path& file,
+                          std::vector<std::filesystem::path>* entries) const;
+
+    /**
+     * @brief Mark step of the operation as completed and save checkpoint.
+     *
+     * @param[in] step step name
+     * @param[in] archive archive writer to make durable, nullptr if the
+     *                    step doesn't write to the archive
+     *
+     * @throw std::system_error in case of errors
+     */
+    void saveProgress(const std::string& step, ArchiveWriter* archive);
+
+    /**
+     * @brief Load catalog of the directory and synchronize it with the
+     *        directory content.
+     *
+     * @param[in] dir path to the directory with archives
+     *
+     * @throw std::exception in case of errors
+     *
+     * @return catalog
+     */
+    Catalog openCatalog(const std::filesystem::path& dir) const;
 
     /**
      * @brief Check manifest of early created backup.
      *
+     * @param[in] mnfBackup manifest of the archive
+     *
      * @throw std::runtime_error in case of errors
      */
-    void checkManifest() const;
+    void checkManifest(const Manifest& mnfBackup) const;
 
     /**
      * @brief Backup single file or directory.
      *
+     * @param[in] archive archive writer
      * @param[in] path relative path to the file
      *
      * @throw std::runtime_error in case of errors
      */
-    void backupFile(const char* path) const;
+    void backupFile(ArchiveWriter& archive, const char* path) const;
 
     /**
      * @brief Restore single file or directory.
@@ -64,17 +170,193 @@ class Backup
     void restoreFile(const char* path) const;
 
     /**
-     * @brief Call tar for creating or extracting archive.
+     * @brief Report changes that restore of single file or directory would
+     *        make (dry run).
      *
-     * @param[in] extract operation type: true=extract, false=create
+     * @param[in] path relative path to the file
+     * @param[in] perms permissions of the restored file, nullptr to keep
+     *                  permissions from the archive
      *
-     * @throw std::runtime_error in case of errors
+     * @throw std::exception in case of errors
+     */
+    void reportFile(const char* path,
+                    const std::filesystem::perms* perms) const;
+
+    /**
+     * @brief Report changes of ownership, modification time and extended
+     *        attributes that restore of the file would make (dry run).
+     *
+     * @param[in] rel path to the file relative to root FS
+     * @param[in] src restored file in the temporary directory
+     * @param[in] dst existing file on root FS
+     *
+     * @throw std::system_error in case of errors
+     */
+    void reportMetadata(const std::filesystem::path& rel,
+                        const std::filesystem::path& src,
+                        const std::filesystem::path& dst) const;
+
+    /**
+     * @brief Get path to the file that will be put to the archive.
+     *
+     * @param[in] path relative path to the file
+     *
+     * @return path to the file on root FS or RO FS, empty if not found
+     */
+    std::filesystem::path sourceFile(const char* path) const;
+
+    /**
+     * @brief Get directory that contains the file to put to the archive.
+     *
+     * @param[in] path relative path to the file
+     *
+     * @return root FS or RO FS directory, nullptr if file not found
+     */
+    const RootDir* sourceRoot(const char* path) const;
+
+    /**
+     * @brief Open root FS, RO FS and temp directories.
+     *
+     * @throw std::system_error in case of errors
+     */
+    void openRoots();
+
+    /**
+     * @brief Create archive writer for the current processing mode.
+     *
+     * @throw std::exception in case of errors
+     *
+     * @return archive writer
+     */
+    std::unique_ptr<ArchiveWriter> createArchive();
+
+    /**
+     * @brief Put collected data and configuration files to the archive.
+     *        Partially written archive file is removed on errors in
+     *        streaming mode.
+     *
+     * @param[in] archive archive writer
+     * @param[in] configs list of configuration files
+     *
+     * @throw std::exception in case of errors
+     */
+    void writeArchive(ArchiveWriter& archive,
+                      const std::vector<const char*>& configs);
+
+    /**
+     * @brief Write archive created in memory to the archive file with a
+     *        single write, sync it and rename to the final name, an
+     *        existing file is never replaced.
+     *
+     * @param[in] archive archive writer
+     *
+     * @throw std::system_error in case of errors
+     */
+    void saveArchive(const ArchiveWriter& archive) const;
+
+    /**
+     * @brief Move the complete and synced file to the archive file name,
+     *        an existing file is never replaced. File from another file
+     *        system is copied to a temporary file next to the archive and
+     *        synced first.
+     *
+     * @param[in] file file to move
+     *
+     * @throw std::system_error in case of errors
+     */
+    void publishArchive(const std::filesystem::path& file) const;
+
+    /**
+     * @brief Create binary deltas for files that have a copy on RO FS.
+     *
+     * @param[in] configs list of configuration files/directories
+     * @param[in,out] manifest manifest to register delta files
+     *
+     * @throw std::exception in case of errors
+     */
+    void createDeltas(const std::vector<const char*>& configs,
+                      Manifest& manifest);
+
+    /**
+     * @brief Create binary delta for single file if it is worth it.
+     *
+     * @param[in] root directory with the file (temp dir, root or RO FS)
+     * @param[in] rel relative path of the file (inside the archive)
+     * @param[in,out] manifest manifest to register delta file
+     *
+     * @throw std::exception in case of errors
+     */
+    void createDelta(const RootDir& root, const std::filesystem::path& rel,
+                     Manifest& manifest);
+
+    /**
+     * @brief Reconstruct files stored as binary delta in temp dir, files
+     *        with changed base on RO FS are skipped with a warning.
+     *
+     * @throw std::exception in case of errors
+     */
+    void applyDeltas() const;
+
+    /**
+     * @brief Check if selective restore is requested.
+     *
+     * @return true if only part of the backup must be restored
+     */
+    bool isSelective() const
+    {
+        return !onlyFiles.empty() || !onlyUsers.empty();
+    }
+
+    /**
+     * @brief Check if path matches any of file patterns (--only).
+     *
+     * @param[in] rel relative path to the file
+     *
+     * @return true if path or any of its parents matches a pattern
+     */
+    bool matchFiles(const std::filesystem::path& rel) const;
+
+    /**
+     * @brief Check if accounts files match any of file patterns (--only),
+     *        in this case accounts of all users are restored.
+     *
+     * @return true if any of accounts files matches a pattern
+     */
+    bool matchAccounts() const;
+
+    /**
+     * @brief Check if accounts data must be restored.
+     *
+     * @return true if accounts must be restored
+     */
+    bool restoreAccounts() const;
+
+    /**
+     * @brief Check if archive entry must be extracted on restore.
+     *
+     * @param[in] rel relative path of the entry
+     *
+     * @return true if entry must be extracted
+     */
+    bool isRestored(const std::filesystem::path& rel) const;
+
+    /**
+     * @brief Check if file is put to the archive as is (not as delta).
+     *
+     * @param[in] rel relative path of the file
+     *
+     * @return true if file is not stored as delta
      */
-    void callTar(bool extract) const;
+    bool isPlain(const std::filesystem::path& rel) const
+    {
+        return deltaSet.find(rel) == deltaSet.end();
+    }
 
   public:
     /** @brief Unattended mode (enable/disable flag). */
     bool unattendedMode = false;
+    /** @brief Print backup details on restore (enable/disable flag). */
+    bool verbose = true;
     /** @brief Handle accounts data (enable/disable flag). */
     bool handleAccounts = true;
     /** @brief Handle network configuration (enable/disable flag). */
@@ -85,8 +367,62 @@ class Backup
     std::filesystem::path rootFs = "/";
     /** @brief Path to the read only file system. */
     std::filesystem::path readOnlyFs = "/run/initramfs/ro";
+    /** @brief Max size of memory used for archive data. */
+    uint64_t maxMemory = 1024 * 1024;
+    /** @brief Max size of data in temporary directory, 0 = unlimited. */
+    uint64_t maxTmp = 0;
+    /** @brief I/O throughput limiter, nullptr = unlimited. */
+    std::shared_ptr<Throttle> throttle;
+    /** @brief Store files as binary delta against RO FS (enable flag). */
+    bool deltaMode = false;
+    /** @brief Archive encryption key, nullptr = no encryption. */
+    std::shared_ptr<const CryptoKey> key;
+    /** @brief Compression dictionary, nullptr = use embedded one (if any). */
+    std::shared_ptr<const Dictionary> dictionary;
+    /** @brief Cache of parsed RO accounts and os-release, nullptr = none. */
+    std::shared_ptr<AccountsCache> accountsCache;
+    /** @brief Directory of persistent RO accounts cache, empty = disabled. */
+    std::filesystem::path accountsCacheDir;
+    /** @brief Restore only files matching these patterns (fnmatch). */
+    std::vector<std::string> onlyFiles;
+    /** @brief Restore only these users. */
+    std::set<std::string> onlyUsers;
+    /** @brief Policies of restoring members of allowed groups. */
+    Accounts::GroupPolicies groupPolicies;
+    /** @brief Report changes instead of restoring, nullptr = restore. */
+    std::shared_ptr<Report> report;
+    /** @brief Number of compression threads, 0 = number of CPUs. */
+    size_t threads = 0;
+    /** @brief Batched I/O engine, nullptr = one file at a time. */
+    std::shared_ptr<IoEngine> ioEngine;
+    /** @brief Continue interrupted operation (enable/disable flag). */
+    bool resume = false;
+    /** @brief Number of daily archives kept by rotation. */
+    size_t keepDaily = 0;
+    /** @brief Number of weekly archives kept by rotation. */
+    size_t keepWeekly = 0;
+    /** @brief Receiver of progress reports, nullptr = no reports. */
+    std::shared_ptr<ProgressSink> progressSink;
+    /** @brief Cancellation token, nullptr = operation can't be cancelled. */
+    std::shared_ptr<CancelToken> cancel;
 
   private:
+    /** @brief Temporary directory and progress of the operation. */
+    std::shared_ptr<Checkpoint> state;
+    /** @brief Progress tracker of the operation. */
+    std::shared_ptr<Progress> tracker;
     /** @brief Temporary directory used for unpacked data. */
     std::filesystem::path tmpDir;
+    /** @brief Opened root FS, nullptr if it doesn't exist. */
+    std::shared_ptr<const RootDir> rootDir;
+    /** @brief Opened RO FS, nullptr if it doesn't exist. */
+    std::shared_ptr<const RootDir> roDir;
+    /** @brief Opened temporary directory. */
+    std::shared_ptr<const RootDir> tmpRoot;
+    /** @brief Temporary archive file used in staged mode. */
+    std::filesystem::path stagedFile;
+    /** @brief Processing mode. */
+    Preflight::Mode procMode = Preflight::Mode::streaming;
+    /** @brief Files stored as binary delta. */
+    std::set<std::filesystem::path> deltaSet;
 };
@@ -0,0 +1,161 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "accounts_cache.hpp"
+#include "batch.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+Batch::Batch(const Backup& proto, size_t threads) :
+    proto(proto), threads(threads), cache(std::make_shared<AccountsCache>())
+{
+    if (!this->threads)
+    {
+        this->threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+}
+
+std::vector<Batch::Job> Batch::load(const fs::path& jobFile)
+{
+    std::ifstream file(jobFile);
+    if (!file)
+    {
+        throw std::system_error(errno, std::system_category(), jobFile);
+    }
+
+    std::vector<Job> jobs;
+    std::string line;
+    size_t lineNum = 0;
+    while (std::getline(file, line))
+    {
+        ++lineNum;
+        std::istringstream fields(line);
+        std::string op;
+        if (!(fields >> op) || op[0] == '#')
+        {
+            continue;
+        }
+        Job job;
+        std::string extra;
+        fields >> job.archiveFile >> job.rootFs >> job.readOnlyFs;
+        if ((op != "backup" && op != "restore") || job.readOnlyFs.empty() ||
+            fields >> extra)
+        {
+            std::string err = "Invalid job at ";
+            err += jobFile;
+            err += ':';
+            err += std::to_string(lineNum);
+            err += ", expected \"backup|restore ARCHIVE ROOT_FS RO_FS\"";
+            throw std::runtime_error(err);
+        }
+        job.restore = op == "restore";
+        jobs.push_back(std::move(job));
+    }
+
+    return jobs;
+}
+
+std::vector<Batch::Result> Batch::run(const std::vector<Job>& jobs) const
+{
+    std::vector<Result> results(jobs.size());
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        size_t idx;
+        while ((idx = next++) < jobs.size())
+        {
+            results[idx] = run(jobs[idx]);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    const size_t count = std::min(threads, jobs.size());
+    for (size_t i = 1; i < count; ++i)
+    {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& it : pool)
+    {
+        it.join();
+    }
+
+    return results;
+}
+
+Batch::Result Batch::run(const Job& job) const
+{
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point start = Clock::now();
+
+    Result result;
+    try
+    {
+        Backup backup(proto);
+        backup.unattendedMode = true;
+        backup.verbose = false;
+        backup.progressSink.reset();
+        backup.accountsCache = cache;
+        backup.archiveFile = job.archiveFile;
+        backup.rootFs = job.rootFs;
+        backup.readOnlyFs = job.readOnlyFs;
+        if (!backup.threads)
+        {
+            // share CPUs between parallel jobs
+            const size_t cpus =
+                std::max(std::thread::hardware_concurrency(), 1u);
+            backup.threads = std::max<size_t>(cpus / threads, 1);
+        }
+        if (job.restore)
+        {
+            backup.restore();
+        }
+        else
+        {
+            backup.backup();
+        }
+        result.mode = backup.mode();
+    }
+    catch (const std::exception& ex)
+    {
+        result.error = ex.what();
+    }
+
+    result.time = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      Clock::now() - start)
+                      .count();
+    return result;
+}
+
+void Batch::print(const std::vector<Job>& jobs,
+                  const std::vector<Result>& results) const
+{
+    static const char* modes[] = {"memory", "staged", "streaming"};
+
+    size_t failed = 0;
+    printf("%5s  %-8s %-9s %9s  %-6s  %s\n", "JOB", "OP", "MODE", "TIME,ms",
+           "STATUS", "ARCHIVE");
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        const Result& res = results[i];
+        const bool ok = res.error.empty();
+        printf("%5zu  %-8s %-9s %9llu  %-6s  %s%s%s\n", i + 1,
+               jobs[i].restore ? "restore" : "backup",
+               ok ? modes[static_cast<size_t>(res.mode)] : "-",
+               static_cast<unsigned long long>(res.time), ok ? "OK" : "FAILED",
+               jobs[i].archiveFile.c_str(), ok ? "" : ": ",
+               res.error.c_str());
+        failed += !ok;
+    }
+    printf("Jobs: %zu, failed: %zu, threads: %zu, RO cache: %zu hits, "
+           "%zu misses\n",
+           jobs.size(), failed, std::min(threads, jobs.size()), cache->hits(),
+           cache->misses());
+}
@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#pragma once
+
+#include "backup.hpp"
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+/**
+ * @class Batch
+ * @brief Run many backup/restore jobs in one process.
+ *
+ * Jobs are executed on a bounded pool of threads, each job uses its own copy
+ * of the prototype settings, parsed RO accounts files are shared between
+ * all jobs.
+ */
+class Batch
+{
+  public:
+    /**
+     * @struct Job
+     * @brief Single backup or restore job.
+     */
+    struct Job
+    {
+        /** @brief Restore operation, otherwise backup. */
+        bool restore;
+        /** @brief Path to the archive file. */
+        std::filesystem::path archiveFile;
+        /** @brief Path to the root file system. */
+        std::filesystem::path rootFs;
+        /** @brief Path to the read only file system. */
+        std::filesystem::path readOnlyFs;
+    };
+
+    /**
+     * @struct Result
+     * @brief Result of the job.
+     */
+    struct Result
+    {
+        /** @brief Error description, empty on success. */
+        std::string error;
+        /** @brief Processing mode chosen by preflight check. */
+        Preflight::Mode mode = Preflight::Mode::memory;
+        /** @brief Execution time in milliseconds. */
+        uint64_t time = 0;
+    };
+
+    /**
+     * @brief Constructor.
+     *
+     * @param[in] proto prototype with settings for all jobs
+     * @param[in] threads max number of threads, 0 = number of CPUs
+     */
+    Batch(const Backup& proto, size_t threads = 0);
+
+    /**
+     * @brief Load jobs from file.
+     *
+     * Each line of the file describes one job:
+     *   backup|restore ARCHIVE ROOT_FS RO_FS
+     * Empty lines and lines started with '#' are ignored.
+     *
+     * @param[in] jobFile path to the job file
+     *
+     * @throw std::runtime_error in case of errors
+     *
+     * @return list of jobs
+     */
+    static std::vector<Job> load(const std::filesystem::path& jobFile);
+
+    /**
+     * @brief Run jobs.
+     *
+     * @param[in] jobs list of jobs
+     *
+     * @return results of the jobs in the same order
+     */
+    std::vector<Result> run(const std::vector<Job>& jobs) const;
+
+    /**
+     * @brief Print results table to stdout.
+     *
+     * @param[in] jobs list of jobs
+     * @param[in] results results of the jobs
+     */
+    void print(const std::vector<Job>& jobs,
+               const std::vector<Result>& results) const;
+
+  private:
+    /**
+     * @brief Run single job.
+     *
+     * @param[in] job job description
+     *
+     * @return result of the job
+     */
+    Result run(const Job& job) const;
+
+  private:
+    /** @brief Prototype with settings for all jobs. */
+    const Backup& proto;
+    /** @brief Max number of threads. */
+    size_t threads;
+    /** @brief Cache of parsed RO accounts files. */
+    std::shared_ptr<AccountsCache> cache;
+};
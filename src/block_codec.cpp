@@ -0,0 +1,390 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "block_codec.hpp"
+#include "dictionary.hpp"
+
+#include <unistd.h>
+#include <zlib.h>
+
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+/** @brief Size of the gzip header, XLEN and subfield header. */
+static constexpr size_t indexHeaderSize = 10 + 2 + 4;
+/** @brief Size of the empty deflate block and the gzip trailer. */
+static constexpr size_t indexTrailerSize = 2 + 8;
+/** @brief Size of the header of the table of contents member. */
+static constexpr size_t tocHeaderSize = 10;
+/** @brief Subfield ID of the block table. */
+static constexpr uint8_t indexId[] = {'O', 'B'};
+/** @brief Reserve for the sync flush marker after the compressed block. */
+static constexpr size_t flushReserve = 16;
+
+/**
+ * @brief Append little-endian number.
+ *
+ * @param[in,out] out output buffer
+ * @param[in] value number to append
+ * @param[in] size size of the number in bytes
+ */
+static void putNumber(std::vector<uint8_t>& out, uint64_t value, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        out.push_back(static_cast<uint8_t>(value >> (i * 8)));
+    }
+}
+
+/**
+ * @brief Get little-endian number.
+ *
+ * @param[in] data pointer to the number
+ * @param[in] size size of the number in bytes
+ *
+ * @return number
+ */
+static uint64_t getNumber(const uint8_t* data, size_t size)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; ++i)
+    {
+        value |= static_cast<uint64_t>(data[i]) << (i * 8);
+    }
+    return value;
+}
+
+/**
+ * @brief Append empty deflate stream and the gzip trailer of empty data.
+ *
+ * @param[in,out] out output buffer
+ */
+static void putEmptyTrailer(std::vector<uint8_t>& out)
+{
+    // final fixed Huffman block with end of block code only, CRC-32 and
+    // size are zero
+    out.push_back(0x03);
+    out.insert(out.end(), indexTrailerSize - 1, 0);
+}
+
+std::vector<uint8_t> BlockCodec::Index::encode() const
+{
+    std::vector<uint8_t> out;
+    if (!toc.empty())
+    {
+        const uint8_t header[tocHeaderSize] = {
+            0x1f, 0x8b, Z_DEFLATED, 0x10 /* FCOMMENT */, 0, 0, 0, 0, 0, 0xff};
+        out.reserve(tocHeaderSize + toc.size() + 1 + indexTrailerSize);
+        out.insert(out.end(), std::begin(header), std::end(header));
+        out.insert(out.end(), toc.begin(), toc.end());
+        out.push_back(0);
+        putEmptyTrailer(out);
+    }
+    const size_t tocSize = out.size();
+
+    const size_t payload = 8 + 8 + blocks.size() * 8 + 4;
+    const uint8_t header[] = {0x1f, 0x8b, Z_DEFLATED, 0x04 /* FEXTRA */,
+                              0,    0,    0,          0,
+                              0,    0xff};
+    out.insert(out.end(), std::begin(header), std::end(header));
+    putNumber(out, payload + 4, 2);
+    out.insert(out.end(), std::begin(indexId), std::end(indexId));
+    putNumber(out, payload, 2);
+    putNumber(out, offset, 8);
+    putNumber(out, tocSize, 8);
+    for (const auto& it : blocks)
+    {
+        putNumber(out, it.first, 4);
+        putNumber(out, it.second, 4);
+    }
+    putNumber(out, blocks.size(), 4);
+    putEmptyTrailer(out);
+    return out;
+}
+
+bool BlockCodec::Index::load(int fd, uint64_t end, Index& index)
+{
+    uint8_t tail[4 + indexTrailerSize];
+    if (end < sizeof(tail) ||
+        pread(fd, tail, sizeof(tail), end - sizeof(tail)) !=
+            static_cast<ssize_t>(sizeof(tail)))
+    {
+        return false;
+    }
+    static const uint8_t emptyMember[indexTrailerSize] = {0x03};
+    const size_t count = getNumber(tail, 4);
+    if (memcmp(tail + 4, emptyMember, sizeof(emptyMember)) != 0 || !count ||
+        count > maxBlocks)
+    {
+        return false;
+    }
+
+    const size_t payload = 8 + 8 + count * 8 + 4;
+    const size_t size = indexHeaderSize + payload + indexTrailerSize;
+    std::vector<uint8_t> member(size);
+    if (end < size || pread(fd, member.data(), size, end - size) !=
+                          static_cast<ssize_t>(size))
+    {
+        return false;
+    }
+    const uint8_t* ptr = member.data();
+    if (ptr[0] != 0x1f || ptr[1] != 0x8b || ptr[2] != Z_DEFLATED ||
+        ptr[3] != 0x04 || getNumber(ptr + 10, 2) != payload + 4 ||
+        memcmp(ptr + 12, indexId, sizeof(indexId)) != 0 ||
+        getNumber(ptr + 14, 2) != payload)
+    {
+        return false;
+    }
+
+    ptr += indexHeaderSize;
+    index.offset = getNumber(ptr, 8);
+    const uint64_t tocSize = getNumber(ptr + 8, 8);
+    ptr += 16;
+    index.blocks.resize(count);
+    for (auto& it : index.blocks)
+    {
+        it.first = static_cast<uint32_t>(getNumber(ptr, 4));
+        it.second = static_cast<uint32_t>(getNumber(ptr + 4, 4));
+        ptr += 8;
+        // sizes are used for allocation, a crafted table must not force
+        // a huge one
+        if (it.first > compressedBound(blockSize) || it.second > blockSize)
+        {
+            return false;
+        }
+    }
+
+    index.toc.clear();
+    if (!tocSize)
+    {
+        return true;
+    }
+    const uint64_t tocEnd = end - size;
+    if (tocSize < tocHeaderSize + 1 + indexTrailerSize || tocSize > tocEnd)
+    {
+        return false;
+    }
+    member.resize(tocSize);
+    if (pread(fd, member.data(), tocSize, tocEnd - tocSize) !=
+        static_cast<ssize_t>(tocSize))
+    {
+        return false;
+    }
+    const uint8_t* comment = member.data() + tocHeaderSize;
+    const size_t len = tocSize - tocHeaderSize - 1 - indexTrailerSize;
+    if (member[0] != 0x1f || member[1] != 0x8b || member[2] != Z_DEFLATED ||
+        member[3] != 0x10 || memchr(comment, 0, len) || comment[len] != 0 ||
+        memcmp(comment + len + 1, emptyMember, sizeof(emptyMember)) != 0)
+    {
+        return false;
+    }
+    index.toc.assign(reinterpret_cast<const char*>(comment), len);
+    return true;
+}
+
+uint64_t BlockCodec::Index::encodedSize(size_t blocks, size_t tocSize)
+{
+    const uint64_t table =
+        indexHeaderSize + 8 + 8 + blocks * 8 + 4 + indexTrailerSize;
+    return table +
+           (tocSize ? tocHeaderSize + tocSize + 1 + indexTrailerSize : 0);
+}
+
+std::pair<uint64_t, uint64_t> BlockCodec::Index::size() const
+{
+    std::pair<uint64_t, uint64_t> total(0, 0);
+    for (const auto& it : blocks)
+    {
+        total.first += it.first;
+        total.second += it.second;
+    }
+    return total;
+}
+
+size_t BlockCodec::compressedBound(size_t size)
+{
+    return compressBound(static_cast<uLong>(size)) + flushReserve;
+}
+
+BlockCodec::BlockCodec(size_t threads, const Dictionary* dict) : dict(dict)
+{
+    for (size_t i = 0; i < std::max<size_t>(threads, 1); ++i)
+    {
+        workers.emplace_back([this]() { work(); });
+    }
+}
+
+BlockCodec::~BlockCodec()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    cond.notify_all();
+    for (auto& it : workers)
+    {
+        it.join();
+    }
+}
+
+void BlockCodec::compress(std::vector<uint8_t>&& data, bool first,
+                          bool last)
+{
+    const Dictionary* preset = first ? dict : nullptr;
+    const bool adler = dict != nullptr;
+    submit([data = std::move(data), last, preset, adler]() {
+        return compressBlock(data, last, preset, adler);
+    });
+}
+
+void BlockCodec::decompress(std::vector<uint8_t>&& data, uint32_t size,
+                            bool first, bool last)
+{
+    const Dictionary* preset = first ? dict : nullptr;
+    const bool adler = dict != nullptr;
+    submit([data = std::move(data), size, last, preset, adler]() {
+        return decompressBlock(data, size, last, preset, adler);
+    });
+}
+
+bool BlockCodec::next(Block& block, bool wait)
+{
+    if (results.empty() ||
+        (!wait && results.front().wait_for(std::chrono::seconds(0)) !=
+                      std::future_status::ready))
+    {
+        return false;
+    }
+    std::future<Block> result = std::move(results.front());
+    results.pop_front();
+    block = result.get();
+    return true;
+}
+
+BlockCodec::Block BlockCodec::compressBlock(const std::vector<uint8_t>& data,
+                                            bool last, const Dictionary* dict,
+                                            bool adler)
+{
+    z_stream stream{};
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        throw std::runtime_error("Unable to initialize compressor");
+    }
+    if (dict && deflateSetDictionary(
+                    &stream, dict->data().data(),
+                    static_cast<uInt>(dict->data().size())) != Z_OK)
+    {
+        deflateEnd(&stream);
+        throw std::runtime_error("Unable to initialize compressor");
+    }
+
+    Block block;
+    block.size = static_cast<uint32_t>(data.size());
+    block.check =
+        adler ? adler32(adler32(0, nullptr, 0), data.data(), block.size)
+              : crc32(0, data.data(), block.size);
+
+    // the bound is for a finished stream, sync flush adds an empty block
+    block.data.resize(deflateBound(&stream, block.size) + flushReserve);
+    stream.next_in = const_cast<Bytef*>(data.data());
+    stream.avail_in = block.size;
+    stream.next_out = block.data.data();
+    stream.avail_out = static_cast<uInt>(block.data.size());
+    const int rc = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    const bool done = last ? rc == Z_STREAM_END
+                           : rc == Z_OK && stream.avail_out != 0;
+    block.data.resize(block.data.size() - stream.avail_out);
+    deflateEnd(&stream);
+    if (!done || stream.avail_in)
+    {
+        throw std::runtime_error("Compression error");
+    }
+    return block;
+}
+
+BlockCodec::Block
+    BlockCodec::decompressBlock(const std::vector<uint8_t>& data,
+                                uint32_t size, bool last,
+                                const Dictionary* dict, bool adler)
+{
+    if (size > blockSize || data.size() > compressedBound(blockSize))
+    {
+        throw std::runtime_error("Archive decompression error");
+    }
+
+    z_stream stream{};
+    if (inflateInit2(&stream, -15) != Z_OK)
+    {
+        throw std::runtime_error("Unable to initialize decompressor");
+    }
+    if (dict && inflateSetDictionary(
+                    &stream, dict->data().data(),
+                    static_cast<uInt>(dict->data().size())) != Z_OK)
+    {
+        inflateEnd(&stream);
+        throw std::runtime_error("Unable to initialize decompressor");
+    }
+
+    // extra byte of the output detects blocks that are bigger than expected
+    Block block;
+    block.data.resize(size + 1);
+    stream.next_in = const_cast<Bytef*>(data.data());
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = block.data.data();
+    stream.avail_out = static_cast<uInt>(block.data.size());
+    const int rc = inflate(&stream, Z_SYNC_FLUSH);
+    const bool done = (last ? rc == Z_STREAM_END : rc == Z_OK) &&
+                      !stream.avail_in && stream.total_out == size;
+    inflateEnd(&stream);
+    if (!done)
+    {
+        throw std::runtime_error("Archive decompression error");
+    }
+
+    block.data.resize(size);
+    block.size = size;
+    block.check =
+        adler ? adler32(adler32(0, nullptr, 0), block.data.data(), size)
+              : crc32(0, block.data.data(), size);
+    return block;
+}
+
+uint32_t BlockCodec::combine(uint32_t first, uint32_t second, uint64_t size,
+                             bool adler)
+{
+    const z_off_t len = static_cast<z_off_t>(size);
+    return static_cast<uint32_t>(adler ? adler32_combine(first, second, len)
+                                       : crc32_combine(first, second, len));
+}
+
+void BlockCodec::submit(std::function<Block()>&& task)
+{
+    std::packaged_task<Block()> job(std::move(task));
+    results.push_back(job.get_future());
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push(std::move(job));
+    }
+    cond.notify_one();
+}
+
+void BlockCodec::work()
+{
+    while (true)
+    {
+        std::packaged_task<Block()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this]() { return stop || !tasks.empty(); });
+            if (stop)
+            {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+        task();
+    }
+}
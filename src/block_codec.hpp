@@ -0,0 +1,263 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class Dictionary;
+
+/**
+ * @class BlockCodec
+ * @brief Compression of a stream split into independent blocks on a pool of
+ *        threads, results are returned in the order of submission.
+ *
+ * Each block is a raw deflate stream ended with a sync flush (the last one
+ * with the final deflate block). Blocks don't refer to data of each other,
+ * so the concatenation of the blocks is a regular deflate stream (as pigz
+ * makes it) and any block can be decompressed separately. Only the first
+ * block uses the preset dictionary: back references of the next ones would
+ * point to the previous block in the joined stream.
+ *
+ * Block index is stored after the compressed stream as an empty gzip
+ * member, gzip tools skip it. The block table is in the extra field of the
+ * member header (subfield "OB"): u64 offset of the first block in the
+ * stream, u64 size of the table of contents member (0 if there is none),
+ * then compressed and uncompressed u32 sizes of each block and u32 number
+ * of blocks (little-endian), the member is located by its end. The table
+ * of contents is another empty member just before it with the text in the
+ * comment field of the header.
+ */
+class BlockCodec
+{
+  public:
+    /** @brief Size of uncompressed data of a full block. */
+    static constexpr size_t blockSize = 256 * 1024;
+
+    /**
+     * @struct Block
+     * @brief Result of block compression or decompression.
+     */
+    struct Block
+    {
+        /** @brief Compressed or decompressed data. */
+        std::vector<uint8_t> data;
+        /** @brief Size of uncompressed data. */
+        uint32_t size = 0;
+        /** @brief CRC-32 (gzip) or Adler-32 (zlib) of uncompressed data. */
+        uint32_t check = 0;
+    };
+
+    /**
+     * @struct Index
+     * @brief Table of compressed blocks.
+     */
+    struct Index
+    {
+        /** @brief Max number of blocks, limited by size of the gzip extra
+         *         field. */
+        static constexpr size_t maxBlocks = 8188;
+
+        /** @brief Offset of the first block in the compressed stream. */
+        uint64_t offset = 0;
+        /** @brief Compressed and uncompressed sizes of blocks. */
+        std::vector<std::pair<uint32_t, uint32_t>> blocks;
+        /** @brief Table of contents, text without null characters. */
+        std::string toc;
+
+        /**
+         * @brief Serialize the table and the table of contents to empty
+         *        gzip members.
+         *
+         * @return gzip members with the table of contents in the comment
+         *         and the table in the extra field
+         */
+        std::vector<uint8_t> encode() const;
+
+        /**
+         * @brief Load the table stored before the specified end of file.
+         *        Table with blocks bigger than blockSize (or their
+         *        compressed data bigger than its bound) is invalid.
+         *
+         * @param[in] fd descriptor of the archive file
+         * @param[in] end offset of the end of the gzip member with the table
+         * @param[out] index loaded table
+         *
+         * @return false if there is no valid table
+         */
+        static bool load(int fd, uint64_t end, Index& index);
+
+        /**
+         * @brief Get size of the encoded table.
+         *
+         * @param[in] blocks number of blocks
+         * @param[in] tocSize size of the table of contents
+         *
+         * @return size of the gzip members in bytes
+         */
+        static uint64_t encodedSize(size_t blocks, size_t tocSize);
+
+        /**
+         * @brief Get size of all blocks.
+         *
+         * @return pair of compressed and uncompressed sizes
+         */
+        std::pair<uint64_t, uint64_t> size() const;
+    };
+
+    /**
+     * @brief Constructor: start worker threads.
+     *
+     * @param[in] threads number of worker threads, at least one
+     * @param[in] dict preset dictionary, nullptr for gzip format
+     */
+    BlockCodec(size_t threads, const Dictionary* dict);
+
+    ~BlockCodec();
+
+    BlockCodec(const BlockCodec&) = delete;
+    BlockCodec& operator=(const BlockCodec&) = delete;
+
+    /**
+     * @brief Queue compression of the block.
+     *
+     * @param[in] data uncompressed data, at most blockSize bytes
+     * @param[in] first true for the first block of the stream
+     * @param[in] last true for the last block of the stream
+     */
+    void compress(std::vector<uint8_t>&& data, bool first, bool last);
+
+    /**
+     * @brief Queue decompression of the block.
+     *
+     * @param[in] data compressed data
+     * @param[in] size size of uncompressed data
+     * @param[in] first true for the first block of the stream
+     * @param[in] last true for the last block of the stream
+     */
+    void decompress(std::vector<uint8_t>&& data, uint32_t size, bool first,
+                    bool last);
+
+    /**
+     * @brief Get the next block in order of submission.
+     *
+     * @param[out] block compressed or decompressed block
+     * @param[in] wait wait until the block is ready
+     *
+     * @throw std::exception if processing of the block failed
+     *
+     * @return false if there is no ready block
+     */
+    bool next(Block& block, bool wait);
+
+    /**
+     * @brief Check if there are too many queued blocks, so the caller
+     *        should wait for results before submitting more.
+     *
+     * @return true if the queue is full
+     */
+    bool full() const
+    {
+        return results.size() >= workers.size() * 2;
+    }
+
+    /**
+     * @brief Check if there are no queued blocks.
+     *
+     * @return true if all results are taken
+     */
+    bool empty() const
+    {
+        return results.empty();
+    }
+
+    /**
+     * @brief Compress single block.
+     *
+     * @param[in] data uncompressed data
+     * @param[in] last true for the last block of the stream
+     * @param[in] dict preset dictionary or nullptr
+     * @param[in] adler true for Adler-32 (zlib), false for CRC-32 (gzip)
+     *
+     * @throw std::runtime_error in case of errors
+     *
+     * @return compressed block
+     */
+    static Block compressBlock(const std::vector<uint8_t>& data, bool last,
+                               const Dictionary* dict, bool adler);
+
+    /**
+     * @brief Decompress single block.
+     *
+     * @param[in] data compressed data
+     * @param[in] size size of uncompressed data, at most blockSize bytes
+     * @param[in] last true for the last block of the stream
+     * @param[in] dict preset dictionary or nullptr
+     * @param[in] adler true for Adler-32 (zlib), false for CRC-32 (gzip)
+     *
+     * @throw std::runtime_error if the block is corrupted or too big
+     *
+     * @return decompressed block
+     */
+    static Block decompressBlock(const std::vector<uint8_t>& data,
+                                 uint32_t size, bool last,
+                                 const Dictionary* dict, bool adler);
+
+    /**
+     * @brief Get max size of the compressed block.
+     *
+     * @param[in] size size of uncompressed data, at most blockSize bytes
+     *
+     * @return size in bytes
+     */
+    static size_t compressedBound(size_t size);
+
+    /**
+     * @brief Combine checks of two adjacent parts of the stream.
+     *
+     * @param[in] first check of the first part
+     * @param[in] second check of the second part
+     * @param[in] size size of the second part
+     * @param[in] adler true for Adler-32 (zlib), false for CRC-32 (gzip)
+     *
+     * @return check of both parts
+     */
+    static uint32_t combine(uint32_t first, uint32_t second, uint64_t size,
+                            bool adler);
+
+  private:
+    /**
+     * @brief Queue the task.
+     *
+     * @param[in] task function that processes the block
+     */
+    void submit(std::function<Block()>&& task);
+
+    /** @brief Worker thread: execute tasks from the queue. */
+    void work();
+
+    /** @brief Preset dictionary, nullptr for gzip format. */
+    const Dictionary* const dict;
+    /** @brief Worker threads. */
+    std::vector<std::thread> workers;
+    /** @brief Queue of tasks. */
+    std::queue<std::packaged_task<Block()>> tasks;
+    /** @brief Results of queued tasks in order of submission. */
+    std::deque<std::future<Block>> results;
+    /** @brief Mutex to protect the queue. */
+    std::mutex mutex;
+    /** @brief Condition to wake up workers. */
+    std::condition_variable cond;
+    /** @brief Stop flag. */
+    bool stop = false;
+};
@@ -0,0 +1,306 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "catalog.hpp"
+#include "crypto.hpp"
+#include "root_dir.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <system_error>
+
+namespace fs = std::filesystem;
+
+/** @brief Name of the catalog file. */
+static const char* catalogFile = ".backup-catalog";
+/** @brief First line of the catalog file (format version). */
+static const char* catalogHeader = "# backup catalog v1";
+/** @brief Field separator. */
+static constexpr char separator = '\t';
+
+/**
+ * @brief Replace characters that can't be stored in the catalog field.
+ *
+ * @param[in] value field value
+ *
+ * @return safe value
+ */
+static std::string safeField(std::string value)
+{
+    std::replace_if(
+        value.begin(), value.end(),
+        [](char c) { return c == separator || c == '\n' || c == '\r'; }, ' ');
+    return value;
+}
+
+/**
+ * @brief Calculate SHA-256 of the file.
+ *
+ * @param[in] path path to the file
+ *
+ * @throw std::system_error in case of errors
+ *
+ * @return hash as hex string
+ */
+static std::string fileHash(const fs::path& path)
+{
+    const FileHandle file(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (file.get() == -1)
+    {
+        throw std::system_error(errno, std::system_category(), path);
+    }
+    Sha256 sha;
+    uint8_t buf[64 * 1024];
+    ssize_t len;
+    while ((len = read(file.get(), buf, sizeof(buf))) != 0)
+    {
+        if (len < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw std::system_error(errno, std::system_category(), path);
+        }
+        sha.update(buf, len);
+    }
+    return sha.hex();
+}
+
+/**
+ * @brief Check if catalog entry describes the file.
+ *
+ * @param[in] entry catalog entry
+ * @param[in] st file status
+ *
+ * @return true if size and modification time are the same
+ */
+static bool sameFile(const Catalog::Entry& entry, const struct stat& st)
+{
+    return entry.size == static_cast<uint64_t>(st.st_size) &&
+           entry.mtime.tv_sec == st.st_mtim.tv_sec &&
+           entry.mtime.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+Catalog::Catalog(const fs::path& dir) : dir(dir)
+{
+    std::ifstream file(dir / catalogFile);
+    if (!file)
+    {
+        return;
+    }
+
+    std::string line;
+    if (!std::getline(file, line) || line != catalogHeader)
+    {
+        throw std::runtime_error("Invalid catalog file: " +
+                                 (dir / catalogFile).string());
+    }
+    while (std::getline(file, line))
+    {
+        std::vector<std::string> fields;
+        size_t pos = 0;
+        while (true)
+        {
+            const size_t end = line.find(separator, pos);
+            fields.push_back(line.substr(pos, end - pos));
+            if (end == std::string::npos)
+            {
+                break;
+            }
+            pos = end + 1;
+        }
+        if (fields.size() != 8)
+        {
+            throw std::runtime_error("Invalid catalog file: " +
+                                     (dir / catalogFile).string());
+        }
+        Entry& entry = archives.emplace_back();
+        entry.name = fields[0];
+        entry.size = std::stoull(fields[1]);
+        entry.mtime.tv_sec = std::stoll(fields[2]);
+        entry.mtime.tv_nsec = std::stol(fields[3]);
+        entry.hash = fields[4];
+        entry.osVersion = fields[5];
+        entry.machineName = fields[6];
+        entry.hostName = fields[7];
+    }
+    sort();
+}
+
+const char* Catalog::fileName()
+{
+    return catalogFile;
+}
+
+bool Catalog::exists(const fs::path& dir)
+{
+    return fs::exists(dir / catalogFile);
+}
+
+bool Catalog::update(const Indexer& indexer)
+{
+    std::map<std::string, struct stat> files;
+    for (const auto& it : fs::directory_iterator(dir))
+    {
+        const std::string name = it.path().filename();
+        struct stat st;
+        // archive being written is renamed from a temporary file
+        if (name[0] == '.' || RootDir::isTemp(name) ||
+            safeField(name) != name ||
+            lstat(it.path().c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            continue;
+        }
+        files.emplace(name, st);
+    }
+
+    bool changed = false;
+    // deleted and changed files
+    for (auto it = archives.begin(); it != archives.end();)
+    {
+        const auto file = files.find(it->name);
+        if (file != files.end() && sameFile(*it, file->second))
+        {
+            files.erase(file);
+            ++it;
+        }
+        else
+        {
+            it = archives.erase(it);
+            changed = true;
+        }
+    }
+    // new files
+    for (const auto& [name, st] : files)
+    {
+        Entry entry;
+        entry.name = name;
+        try
+        {
+            indexer(dir / name, entry);
+            add(entry);
+            changed = true;
+        }
+        catch (const std::exception&)
+        {
+            // not an archive or can't be opened
+        }
+    }
+    return changed;
+}
+
+void Catalog::add(Entry entry)
+{
+    const fs::path path = dir / entry.name;
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+    {
+        throw std::system_error(errno, std::system_category(), path);
+    }
+    entry.size = st.st_size;
+    entry.mtime = st.st_mtim;
+    entry.hash = fileHash(path);
+
+    archives.erase(std::remove_if(archives.begin(), archives.end(),
+                                  [&entry](const Entry& it) {
+                                      return it.name == entry.name;
+                                  }),
+                   archives.end());
+    archives.push_back(std::move(entry));
+    sort();
+}
+
+void Catalog::save() const
+{
+    std::string data = catalogHeader;
+    data += '\n';
+    for (const auto& it : archives)
+    {
+        for (const std::string& field :
+             {it.name, std::to_string(it.size),
+              std::to_string(it.mtime.tv_sec),
+              std::to_string(it.mtime.tv_nsec), it.hash,
+              safeField(it.osVersion), safeField(it.machineName),
+              safeField(it.hostName)})
+        {
+            data += field;
+            data += separator;
+        }
+        data.back() = '\n';
+    }
+
+    // an interrupted save must not lose the catalog of the directory
+    RootDir(dir).replaceFile(catalogFile, data.data(), data.size(), 0644);
+}
+
+std::vector<Catalog::Entry> Catalog::expired(size_t daily,
+                                             size_t weekly) const
+{
+    if (!daily && !weekly)
+    {
+        throw std::invalid_argument("Retention policy is not set");
+    }
+
+    std::vector<bool> keep(archives.size(), false);
+    for (const auto& [count, format] :
+         {std::make_pair(daily, "%Y-%m-%d"), std::make_pair(weekly, "%G-%V")})
+    {
+        // the latest archive of each period, starting from the newest one
+        std::string last;
+        size_t periods = 0;
+        for (size_t i = archives.size(); i-- > 0 && periods < count;)
+        {
+            tm local;
+            char period[32];
+            localtime_r(&archives[i].mtime.tv_sec, &local);
+            strftime(period, sizeof(period), format, &local);
+            if (last != period)
+            {
+                last = period;
+                keep[i] = true;
+                ++periods;
+            }
+        }
+    }
+
+    std::vector<Entry> entries;
+    for (size_t i = 0; i < archives.size(); ++i)
+    {
+        if (!keep[i])
+        {
+            entries.push_back(archives[i]);
+        }
+    }
+    return entries;
+}
+
+void Catalog::remove(const std::string& name)
+{
+    std::error_code ec;
+    if (!fs::remove(dir / name, ec) && ec)
+    {
+        throw std::system_error(ec, dir / name);
+    }
+    archives.erase(std::remove_if(
+                       archives.begin(), archives.end(),
+                       [&name](const Entry& it) { return it.name == name; }),
+                   archives.end());
+}
+
+void Catalog::sort()
+{
+    std::stable_sort(archives.begin(), archives.end(),
+                     [](const Entry& lhs, const Entry& rhs) {
+                         return lhs.mtime.tv_sec != rhs.mtime.tv_sec
+                                    ? lhs.mtime.tv_sec < rhs.mtime.tv_sec
+                                    : lhs.mtime.tv_nsec < rhs.mtime.tv_nsec;
+                     });
+}
@@ -0,0 +1,165 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * @class Catalog
+ * @brief Index of the backup archives in a directory.
+ *
+ * Catalog file (.backup-catalog) describes each archive of the directory:
+ * size and modification time of the file, SHA-256 of its content and
+ * manifest data (firmware version, machine and host names).
+ * Listing, lookup of the latest archive and rotation read only the catalog
+ * file, archives are opened once: when they are added by backup operation
+ * or when unknown files are found in the directory.
+ */
+class Catalog
+{
+  public:
+    /**
+     * @struct Entry
+     * @brief Catalog entry (archive description).
+     */
+    struct Entry
+    {
+        /** @brief Archive file name. */
+        std::string name;
+        /** @brief Size of the archive file. */
+        uint64_t size = 0;
+        /** @brief Modification time of the file (creation of the backup). */
+        timespec mtime = {};
+        /** @brief SHA-256 of the archive file (hex string). */
+        std::string hash;
+        /** @brief OS version from the manifest. */
+        std::string osVersion;
+        /** @brief Machine name from the manifest. */
+        std::string machineName;
+        /** @brief Host name from the manifest. */
+        std::string hostName;
+    };
+
+    /**
+     * @brief Function that reads manifest of the archive and fills entry
+     *        fields, throws if file is not a valid archive.
+     */
+    using Indexer =
+        std::function<void(const std::filesystem::path& file, Entry& entry)>;
+
+    /**
+     * @brief Constructor: load catalog of the directory.
+     *
+     * @param[in] dir path to the directory with archives
+     *
+     * @throw std::runtime_error if catalog file is corrupted
+     */
+    explicit Catalog(const std::filesystem::path& dir);
+
+    /**
+     * @brief Get name of the catalog file.
+     *
+     * @return file name
+     */
+    static const char* fileName();
+
+    /**
+     * @brief Check if directory has a catalog.
+     *
+     * @param[in] dir path to the directory
+     *
+     * @return true if catalog file exists
+     */
+    static bool exists(const std::filesystem::path& dir);
+
+    /**
+     * @brief Synchronize catalog with the directory content: remove entries
+     *        of deleted files and index new or changed files. Files that
+     *        are not valid archives and temporary files of archives being
+     *        written (NAME.tmp.XXXXXX) are ignored.
+     *
+     * @param[in] indexer function used to read manifest of new archives
+     *
+     * @return true if catalog was changed
+     */
+    bool update(const Indexer& indexer);
+
+    /**
+     * @brief Add (or replace) archive of the directory.
+     *
+     * @param[in] entry archive description, file attributes and hash are
+     *                  filled from the file
+     *
+     * @throw std::system_error in case of errors
+     */
+    void add(Entry entry);
+
+    /**
+     * @brief Save catalog file atomically and durably (write, fsync, rename).
+     *
+     * @throw std::system_error in case of errors
+     */
+    void save() const;
+
+    /**
+     * @brief Get catalog entries.
+     *
+     * @return entries sorted by time, oldest first
+     */
+    const std::vector<Entry>& entries() const
+    {
+        return archives;
+    }
+
+    /**
+     * @brief Get the latest archive.
+     *
+     * @return pointer to the entry, nullptr if catalog is empty
+     */
+    const Entry* latest() const
+    {
+        return archives.empty() ? nullptr : &archives.back();
+    }
+
+    /**
+     * @brief Select archives to remove by retention policy: the latest
+     *        archive of each of the last N days and of the last M weeks
+     *        (ISO 8601, local time) that have archives are kept.
+     *
+     * @param[in] daily number of daily archives to keep
+     * @param[in] weekly number of weekly archives to keep
+     *
+     * @throw std::invalid_argument if both numbers are zero
+     *
+     * @return entries of the archives to remove, oldest first
+     */
+    std::vector<Entry> expired(size_t daily, size_t weekly) const;
+
+    /**
+     * @brief Remove archive file and its entry.
+     *
+     * @param[in] name archive file name
+     *
+     * @throw std::system_error in case of errors
+     */
+    void remove(const std::string& name);
+
+  private:
+    /**
+     * @brief Sort entries by time.
+     */
+    void sort();
+
+    /** @brief Directory with archives. */
+    std::filesystem::path dir;
+    /** @brief Archives of the directory. */
+    std::vector<Entry> archives;
+};
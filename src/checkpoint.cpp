@@ -0,0 +1,387 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "checkpoint.hpp"
+#include "root_dir.hpp"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+/** @brief Prefix of the temporary directory name. */
+static const std::string tmpPrefix = "backup_";
+/** @brief Length of the random suffix of the temporary directory name. */
+static constexpr size_t tmpSuffixLen = 6;
+/** @brief Extension of the checkpoint file. */
+static const char* fileExt = ".checkpoint";
+/** @brief Max age of the checkpoint kept for resume. */
+static constexpr auto maxAge = std::chrono::hours(24);
+
+/**
+ * @brief Check if file name is a name of the temporary directory.
+ *
+ * @param[in] name file name
+ *
+ * @return true if name has format backup_XXXXXX
+ */
+static bool isTempName(const std::string& name)
+{
+    if (name.size() != tmpPrefix.size() + tmpSuffixLen ||
+        name.compare(0, tmpPrefix.size(), tmpPrefix) != 0)
+    {
+        return false;
+    }
+    for (size_t i = tmpPrefix.size(); i < name.size(); ++i)
+    {
+        if (!isalnum(static_cast<unsigned char>(name[i])))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Open and lock the temporary directory.
+ *
+ * @param[in] dir path to the directory
+ *
+ * @return descriptor of the locked directory, -1 if the directory is locked
+ *         by another process or doesn't exist
+ */
+static int lockDir(const fs::path& dir)
+{
+    const int fd =
+        open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    struct stat st;
+    // directory can be removed by reclaim between creation and locking
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0 || fstat(fd, &st) != 0 ||
+        st.st_nlink == 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Remove temporary directory and files next to it.
+ *
+ * @param[in] dir path to the directory
+ */
+static void removeTemp(const fs::path& dir)
+{
+    // files first: file without directory is considered orphaned
+    const std::string prefix = dir.filename().string() + '.';
+    std::error_code ec;
+    for (const auto& it : fs::directory_iterator(dir.parent_path(), ec))
+    {
+        if (it.path().filename().string().compare(0, prefix.size(), prefix) ==
+            0)
+        {
+            fs::remove(it.path(), ec);
+        }
+    }
+    fs::remove_all(dir, ec);
+}
+
+/**
+ * @brief Add record to the checkpoint data.
+ *
+ * @param[in,out] data checkpoint data
+ * @param[in] key record key
+ * @param[in] value record value
+ */
+static void addRecord(std::string& data, const std::string& key,
+                      const std::string& value)
+{
+    // record format: "LEN KEY=VALUE\n", where LEN is the length of
+    // "KEY=VALUE", so values can contain any characters
+    data += std::to_string(key.size() + 1 + value.size());
+    data += ' ';
+    data += key;
+    data += '=';
+    data += value;
+    data += '\n';
+}
+
+/**
+ * @brief Parse checkpoint data.
+ *
+ * @param[in] data checkpoint data
+ *
+ * @throw std::exception if data has invalid format
+ *
+ * @return records (key and value)
+ */
+static std::vector<std::pair<std::string, std::string>>
+    parseRecords(const std::string& data)
+{
+    std::vector<std::pair<std::string, std::string>> records;
+    size_t pos = 0;
+    while (pos < data.size())
+    {
+        const size_t space = data.find(' ', pos);
+        if (space == std::string::npos)
+        {
+            throw std::runtime_error("Invalid checkpoint");
+        }
+        const size_t len = std::stoul(data.substr(pos, space - pos));
+        const size_t end = space + 1 + len;
+        const size_t eq = data.find('=', space);
+        if (end >= data.size() || data[end] != '\n' || eq >= end)
+        {
+            throw std::runtime_error("Invalid checkpoint");
+        }
+        records.emplace_back(data.substr(space + 1, eq - space - 1),
+                             data.substr(eq + 1, end - eq - 1));
+        pos = end + 1;
+    }
+    return records;
+}
+
+std::unique_ptr<Checkpoint> Checkpoint::create(const std::string& operation,
+                                               const fs::path& archive)
+{
+    std::unique_ptr<Checkpoint> cp;
+    while (!cp)
+    {
+        std::string pathTemplate =
+            fs::temp_directory_path() / (tmpPrefix + "XXXXXX");
+        const char* path = mkdtemp(pathTemplate.data());
+        if (!path)
+        {
+            throw std::system_error(errno, std::system_category(),
+                                    pathTemplate);
+        }
+        const int fd = lockDir(path);
+        if (fd != -1)
+        {
+            cp.reset(new Checkpoint(path, fd));
+        }
+    }
+    cp->operation = operation;
+    cp->archiveFile = fs::absolute(archive);
+    return cp;
+}
+
+std::unique_ptr<Checkpoint> Checkpoint::find(const std::string& operation,
+                                             const fs::path& archive)
+{
+    const fs::path archiveFile = fs::absolute(archive);
+    std::error_code ec;
+    for (const auto& it :
+         fs::directory_iterator(fs::temp_directory_path(), ec))
+    {
+        if (!isTempName(it.path().filename()) || !it.is_directory(ec))
+        {
+            continue;
+        }
+        const int fd = lockDir(it.path());
+        if (fd == -1)
+        {
+            continue;
+        }
+        std::unique_ptr<Checkpoint> cp(new Checkpoint(it.path(), fd));
+        if (cp->load() && cp->operation == operation &&
+            cp->archiveFile == archiveFile)
+        {
+            return cp;
+        }
+    }
+    return nullptr;
+}
+
+void Checkpoint::reclaim(const std::string& operation,
+                         const fs::path& archive)
+{
+    const fs::path archiveFile = fs::absolute(archive);
+    const fs::path tmp = fs::temp_directory_path();
+    std::error_code ec;
+
+    const size_t nameLen = tmpPrefix.size() + tmpSuffixLen;
+    std::vector<fs::path> dirs;
+    std::vector<fs::path> files;
+    for (const auto& it : fs::directory_iterator(tmp, ec))
+    {
+        const std::string name = it.path().filename();
+        if (isTempName(name))
+        {
+            dirs.push_back(it.path());
+        }
+        else if (name.size() > nameLen && name[nameLen] == '.' &&
+                 isTempName(name.substr(0, nameLen)))
+        {
+            files.push_back(it.path());
+        }
+    }
+
+    for (const auto& it : dirs)
+    {
+        const int fd = lockDir(it);
+        if (fd == -1)
+        {
+            continue; // in use
+        }
+        Checkpoint cp(it, fd);
+        if (cp.load() &&
+            (cp.operation != operation || cp.archiveFile != archiveFile) &&
+            fs::file_time_type::clock::now() -
+                    fs::last_write_time(cp.file, ec) <
+                maxAge)
+        {
+            continue; // can be resumed
+        }
+        cp.remove();
+    }
+
+    // files of removed directories (crash during cleanup)
+    for (const auto& it : files)
+    {
+        const std::string name = it.filename();
+        if (!fs::exists(tmp / name.substr(0, nameLen), ec))
+        {
+            fs::remove(it, ec);
+        }
+    }
+}
+
+Checkpoint::Checkpoint(const fs::path& dir, int lock) :
+    tmpDir(dir), file(dir.string() + fileExt), lockFd(lock)
+{}
+
+Checkpoint::~Checkpoint()
+{
+    close(lockFd);
+}
+
+void Checkpoint::save() const
+{
+    std::string data;
+    addRecord(data, "operation", operation);
+    addRecord(data, "archive", archiveFile);
+    addRecord(data, "mode", std::to_string(static_cast<int>(mode)));
+    addRecord(data, "limit", std::to_string(limit));
+    addRecord(data, "total", std::to_string(total));
+    for (const auto& it : steps)
+    {
+        addRecord(data, "step", it);
+    }
+    for (const auto& it : deltas)
+    {
+        addRecord(data, "delta", it);
+    }
+    addRecord(data, "offset", std::to_string(archive.offset));
+    addRecord(data, "tar-size", std::to_string(archive.tarSize));
+    addRecord(data, "check", std::to_string(archive.check));
+    addRecord(data, "zlib", archive.zlibFormat ? "1" : "0");
+    for (const auto& it : archive.names)
+    {
+        addRecord(data, "name", it);
+    }
+    addRecord(data, "checksums", archive.checksums);
+
+    if (syncfs(lockFd) != 0)
+    {
+        throw std::system_error(errno, std::system_category(), tmpDir);
+    }
+
+    RootDir(file.parent_path())
+        .replaceFile(file.filename(), data.data(), data.size(), 0600);
+}
+
+void Checkpoint::remove() const
+{
+    removeTemp(tmpDir);
+}
+
+bool Checkpoint::load()
+{
+    std::ifstream in(file, std::ios::binary);
+    if (!in)
+    {
+        return false;
+    }
+    const std::string data(std::istreambuf_iterator<char>(in), {});
+
+    try
+    {
+        for (const auto& [key, value] : parseRecords(data))
+        {
+            if (key == "operation")
+            {
+                operation = value;
+            }
+            else if (key == "archive")
+            {
+                archiveFile = value;
+            }
+            else if (key == "mode")
+            {
+                mode = static_cast<Preflight::Mode>(std::stoi(value));
+            }
+            else if (key == "limit")
+            {
+                limit = std::stoull(value);
+            }
+            else if (key == "total")
+            {
+                total = std::stoull(value);
+            }
+            else if (key == "step")
+            {
+                steps.insert(value);
+            }
+            else if (key == "delta")
+            {
+                deltas.insert(value);
+            }
+            else if (key == "offset")
+            {
+                archive.offset = std::stoull(value);
+            }
+            else if (key == "tar-size")
+            {
+                archive.tarSize = std::stoull(value);
+            }
+            else if (key == "check")
+            {
+                archive.check = static_cast<uint32_t>(std::stoul(value));
+            }
+            else if (key == "zlib")
+            {
+                archive.zlibFormat = value == "1";
+            }
+            else if (key == "name")
+            {
+                archive.names.insert(value);
+            }
+            else if (key == "checksums")
+            {
+                archive.checksums = value;
+            }
+        }
+    }
+    catch (const std::exception&)
+    {
+        return false;
+    }
+    return !operation.empty() && !archiveFile.empty();
+}
@@ -0,0 +1,151 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#pragma once
+
+#include "archive.hpp"
+#include "preflight.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <set>
+#include <string>
+
+/**
+ * @class Checkpoint
+ * @brief Temporary directory of the backup/restore operation and progress
+ *        of the operation, saved durably to continue it after interruption.
+ *
+ * Temporary directory (TMPDIR/backup_XXXXXX) is locked with flock(2) while
+ * the operation is running, the lock is released by the kernel if the
+ * process crashes. Checkpoint file (backup_XXXXXX.checkpoint) is stored next
+ * to the directory, it is replaced atomically (write, fsync, rename).
+ * Unlocked directories left by crashed processes are reclaimed on startup,
+ * unless they have a checkpoint that can be resumed later.
+ */
+class Checkpoint
+{
+  public:
+    /**
+     * @brief Create and lock a new temporary directory.
+     *
+     * @param[in] operation operation name: backup or restore
+     * @param[in] archive path to the archive file
+     *
+     * @throw std::system_error in case of errors
+     *
+     * @return checkpoint of the new operation
+     */
+    static std::unique_ptr<Checkpoint> create(const std::string& operation,
+                                              const std::filesystem::path&
+                                                  archive);
+
+    /**
+     * @brief Find and lock checkpoint of the interrupted operation.
+     *
+     * @param[in] operation operation name: backup or restore
+     * @param[in] archive path to the archive file
+     *
+     * @return loaded checkpoint, nullptr if not found
+     */
+    static std::unique_ptr<Checkpoint>
+        find(const std::string& operation,
+             const std::filesystem::path& archive);
+
+    /**
+     * @brief Remove unlocked temporary directories (and their files) left
+     *        by crashed processes. Directories with a checkpoint are kept
+     *        for a day unless the checkpoint is for the same operation with
+     *        the same archive: it is superseded by the new run.
+     *
+     * @param[in] operation operation name: backup or restore
+     * @param[in] archive path to the archive file
+     */
+    static void reclaim(const std::string& operation,
+                        const std::filesystem::path& archive);
+
+    ~Checkpoint();
+
+    Checkpoint(const Checkpoint&) = delete;
+    Checkpoint& operator=(const Checkpoint&) = delete;
+
+    /**
+     * @brief Get path to the temporary directory.
+     *
+     * @return path to the directory
+     */
+    const std::filesystem::path& dir() const
+    {
+        return tmpDir;
+    }
+
+    /**
+     * @brief Save checkpoint. Data in the temporary directory is
+     *        synchronized with storage before.
+     *
+     * @throw std::system_error in case of errors
+     */
+    void save() const;
+
+    /**
+     * @brief Remove checkpoint file, temporary directory and other files
+     *        next to it (backup_XXXXXX.*), the lock is held until
+     *        destruction.
+     */
+    void remove() const;
+
+    /**
+     * @brief Check if step of the operation is completed.
+     *
+     * @param[in] step step name
+     *
+     * @return true if the step is completed
+     */
+    bool isDone(const std::string& step) const
+    {
+        return steps.find(step) != steps.end();
+    }
+
+  private:
+    /**
+     * @brief Constructor.
+     *
+     * @param[in] dir path to the locked temporary directory
+     * @param[in] lock descriptor of the directory holding the lock
+     */
+    Checkpoint(const std::filesystem::path& dir, int lock);
+
+    /**
+     * @brief Load checkpoint file.
+     *
+     * @return false if checkpoint file doesn't exist or is invalid
+     */
+    bool load();
+
+  public:
+    /** @brief Operation name: backup or restore. */
+    std::string operation;
+    /** @brief Absolute path to the archive file. */
+    std::filesystem::path archiveFile;
+    /** @brief Processing mode chosen by preflight. */
+    Preflight::Mode mode = Preflight::Mode::streaming;
+    /** @brief Max size of the archive in staged mode, 0 = unlimited. */
+    uint64_t limit = 0;
+    /** @brief Size of file content to archive estimated by preflight. */
+    uint64_t total = 0;
+    /** @brief Completed steps of the operation. */
+    std::set<std::string> steps;
+    /** @brief Files stored as binary delta. */
+    std::set<std::filesystem::path> deltas;
+    /** @brief State of the archive file at the last durable point. */
+    ArchiveWriter::State archive;
+
+  private:
+    /** @brief Temporary directory. */
+    std::filesystem::path tmpDir;
+    /** @brief Path to the checkpoint file. */
+    std::filesystem::path file;
+    /** @brief Descriptor of the temporary directory holding the lock. */
+    int lockFd;
+};
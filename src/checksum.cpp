@@ -0,0 +1,403 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "checksum.hpp"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#endif
+
+/** @brief CRC-32C polynomial (reversed). */
+static constexpr uint32_t polynomial = 0x82f63b78;
+
+/**
+ * @struct Tables
+ * @brief Lookup tables for slice-by-8 algorithm.
+ */
+struct Tables
+{
+    uint32_t data[8][256];
+};
+
+/**
+ * @brief Generate lookup tables.
+ *
+ * @return lookup tables
+ */
+static constexpr Tables makeTables()
+{
+    Tables tbl{};
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            crc = crc & 1 ? (crc >> 1) ^ polynomial : crc >> 1;
+        }
+        tbl.data[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        for (size_t n = 1; n < 8; ++n)
+        {
+            const uint32_t prev = tbl.data[n - 1][i];
+            tbl.data[n][i] = (prev >> 8) ^ tbl.data[0][prev & 0xff];
+        }
+    }
+    return tbl;
+}
+
+/** @brief Lookup tables for slice-by-8 algorithm. */
+static constexpr Tables tables = makeTables();
+
+/**
+ * @brief Load 64-bit little-endian word.
+ *
+ * @param[in] ptr pointer to the data
+ *
+ * @return word
+ */
+static inline uint64_t load64(const uint8_t* ptr)
+{
+    uint64_t val;
+    memcpy(&val, ptr, sizeof(val));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    val = __builtin_bswap64(val);
+#endif
+    return val;
+}
+
+/**
+ * @brief Check if pointer is not aligned to the word size.
+ *
+ * @param[in] ptr pointer to check
+ *
+ * @return true if pointer is unaligned
+ */
+static inline bool unaligned(const uint8_t* ptr)
+{
+    return reinterpret_cast<uintptr_t>(ptr) & (sizeof(uint64_t) - 1);
+}
+
+/**
+ * @brief Slice-by-8 implementation.
+ *
+ * @param[in] crc current checksum (inverted)
+ * @param[in] ptr pointer to the data
+ * @param[in] size size of the data
+ *
+ * @return new checksum (inverted)
+ */
+static uint32_t crcPortable(uint32_t crc, const uint8_t* ptr, size_t size)
+{
+    const auto& tbl = tables.data;
+    while (size && unaligned(ptr))
+    {
+        crc = tbl[0][(crc ^ *ptr++) & 0xff] ^ (crc >> 8);
+        --size;
+    }
+    while (size >= sizeof(uint64_t))
+    {
+        const uint64_t word = load64(ptr) ^ crc;
+        crc = tbl[7][word & 0xff] ^ tbl[6][(word >> 8) & 0xff] ^
+              tbl[5][(word >> 16) & 0xff] ^ tbl[4][(word >> 24) & 0xff] ^
+              tbl[3][(word >> 32) & 0xff] ^ tbl[2][(word >> 40) & 0xff] ^
+              tbl[1][(word >> 48) & 0xff] ^ tbl[0][word >> 56];
+        ptr += sizeof(uint64_t);
+        size -= sizeof(uint64_t);
+    }
+    while (size--)
+    {
+        crc = tbl[0][(crc ^ *ptr++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+
+/** @brief Size of the single stream in 3-way interleaved implementation. */
+static constexpr size_t pclmulBlock = 512;
+
+/**
+ * @brief Multiply polynomials modulo CRC polynomial (reflected form).
+ *
+ * @param[in] a first multiplier
+ * @param[in] b second multiplier
+ *
+ * @return product
+ */
+static constexpr uint32_t multModP(uint32_t a, uint32_t b)
+{
+    uint32_t prod = 0;
+    for (uint32_t mask = 1u << 31; mask; mask >>= 1)
+    {
+        if (a & mask)
+        {
+            prod ^= b;
+        }
+        b = b & 1 ? (b >> 1) ^ polynomial : b >> 1;
+    }
+    return prod;
+}
+
+/**
+ * @brief Get x^n modulo CRC polynomial (reflected form).
+ *
+ * @param[in] n power
+ *
+ * @return polynomial
+ */
+static constexpr uint32_t powModP(uint64_t n)
+{
+    uint32_t res = 1u << 31; // x^0
+    uint32_t base = 1u << 30; // x^1
+    while (n)
+    {
+        if (n & 1)
+        {
+            res = multModP(res, base);
+        }
+        base = multModP(base, base);
+        n >>= 1;
+    }
+    return res;
+}
+
+/**
+ * @brief SSE4.2 implementation.
+ *
+ * @param[in] crc current checksum (inverted)
+ * @param[in] ptr pointer to the data
+ * @param[in] size size of the data
+ *
+ * @return new checksum (inverted)
+ */
+__attribute__((target("sse4.2"))) static uint32_t
+    crcSse42(uint32_t crc, const uint8_t* ptr, size_t size)
+{
+    while (size && unaligned(ptr))
+    {
+        crc = _mm_crc32_u8(crc, *ptr++);
+        --size;
+    }
+    uint64_t crc64 = crc;
+    while (size >= sizeof(uint64_t))
+    {
+        crc64 = _mm_crc32_u64(crc64, load64(ptr));
+        ptr += sizeof(uint64_t);
+        size -= sizeof(uint64_t);
+    }
+    crc = static_cast<uint32_t>(crc64);
+    while (size--)
+    {
+        crc = _mm_crc32_u8(crc, *ptr++);
+    }
+    return crc;
+}
+
+/**
+ * @brief Shift checksum as if zeros were appended to the data.
+ *
+ * @param[in] crc checksum
+ * @param[in] constant x^(8*N-33) modulo polynomial, N is number of zeros
+ *
+ * @return new checksum
+ */
+__attribute__((target("sse4.2,pclmul"))) static inline uint32_t
+    crcShift(uint64_t crc, uint32_t constant)
+{
+    const __m128i prod = _mm_clmulepi64_si128(
+        _mm_cvtsi64_si128(crc), _mm_cvtsi32_si128(constant), 0);
+    return static_cast<uint32_t>(
+        _mm_crc32_u64(0, static_cast<uint64_t>(_mm_cvtsi128_si64(prod))));
+}
+
+/**
+ * @brief SSE4.2 implementation with 3 interleaved streams.
+ *
+ * CRC32 instruction has latency 3 and throughput 1, so 3 independent
+ * streams use the full CPU capacity. Partial checksums are merged with
+ * carry-less multiplication.
+ *
+ * @param[in] crc current checksum (inverted)
+ * @param[in] ptr pointer to the data
+ * @param[in] size size of the data
+ *
+ * @return new checksum (inverted)
+ */
+__attribute__((target("sse4.2,pclmul"))) static uint32_t
+    crcPclmul(uint32_t crc, const uint8_t* ptr, size_t size)
+{
+    static constexpr uint32_t shift1 = powModP(pclmulBlock * 8 - 33);
+    static constexpr uint32_t shift2 = powModP(pclmulBlock * 16 - 33);
+
+    while (size && unaligned(ptr))
+    {
+        crc = _mm_crc32_u8(crc, *ptr++);
+        --size;
+    }
+    while (size >= pclmulBlock * 3)
+    {
+        uint64_t crc0 = crc;
+        uint64_t crc1 = 0;
+        uint64_t crc2 = 0;
+        for (size_t i = 0; i < pclmulBlock; i += sizeof(uint64_t))
+        {
+            crc0 = _mm_crc32_u64(crc0, load64(ptr + i));
+            crc1 = _mm_crc32_u64(crc1, load64(ptr + i + pclmulBlock));
+            crc2 = _mm_crc32_u64(crc2, load64(ptr + i + pclmulBlock * 2));
+        }
+        crc = crcShift(crc0, shift2) ^ crcShift(crc1, shift1) ^
+              static_cast<uint32_t>(crc2);
+        ptr += pclmulBlock * 3;
+        size -= pclmulBlock * 3;
+    }
+    return crcSse42(crc, ptr, size);
+}
+
+#elif defined(__aarch64__)
+
+/**
+ * @brief ARMv8 implementation.
+ *
+ * @param[in] crc current checksum (inverted)
+ * @param[in] ptr pointer to the data
+ * @param[in] size size of the data
+ *
+ * @return new checksum (inverted)
+ */
+__attribute__((target("+crc"))) static uint32_t
+    crcArmv8(uint32_t crc, const uint8_t* ptr, size_t size)
+{
+    while (size && unaligned(ptr))
+    {
+        crc = __crc32cb(crc, *ptr++);
+        --size;
+    }
+    while (size >= sizeof(uint64_t))
+    {
+        crc = __crc32cd(crc, load64(ptr));
+        ptr += sizeof(uint64_t);
+        size -= sizeof(uint64_t);
+    }
+    while (size--)
+    {
+        crc = __crc32cb(crc, *ptr++);
+    }
+    return crc;
+}
+
+#endif
+
+/** @brief Pointer to the implementation function. */
+using KernelFn = uint32_t (*)(uint32_t, const uint8_t*, size_t);
+
+/**
+ * @brief Get implementation function.
+ *
+ * @param[in] kernel implementation type
+ *
+ * @return pointer to the function, nullptr if not supported by the CPU
+ */
+static KernelFn getKernel(Checksum::Kernel kernel)
+{
+    switch (kernel)
+    {
+        case Checksum::Kernel::portable:
+            return crcPortable;
+#if defined(__x86_64__)
+        case Checksum::Kernel::sse42:
+            return __builtin_cpu_supports("sse4.2") ? crcSse42 : nullptr;
+        case Checksum::Kernel::pclmul:
+            return __builtin_cpu_supports("sse4.2") &&
+                           __builtin_cpu_supports("pclmul")
+                       ? crcPclmul
+                       : nullptr;
+#elif defined(__aarch64__)
+        case Checksum::Kernel::armv8:
+            return getauxval(AT_HWCAP) & HWCAP_CRC32 ? crcArmv8 : nullptr;
+#endif
+        default:
+            return nullptr;
+    }
+}
+
+/**
+ * @brief Get the fastest implementation function.
+ *
+ * @return pointer to the function
+ */
+static KernelFn bestKernel()
+{
+    static const KernelFn fn = getKernel(Checksum::kernel());
+    return fn;
+}
+
+uint32_t Checksum::update(uint32_t crc, const void* data, size_t size)
+{
+    return ~bestKernel()(~crc, static_cast<const uint8_t*>(data), size);
+}
+
+uint32_t Checksum::update(Kernel kernel, uint32_t crc, const void* data,
+                          size_t size)
+{
+    const KernelFn fn = getKernel(kernel);
+    if (!fn)
+    {
+        std::string err = "Checksum implementation is not supported: ";
+        err += name(kernel);
+        throw std::invalid_argument(err);
+    }
+    return ~fn(~crc, static_cast<const uint8_t*>(data), size);
+}
+
+Checksum::Kernel Checksum::kernel()
+{
+    // ordered from the fastest one
+    for (const Kernel it : {Kernel::armv8, Kernel::pclmul, Kernel::sse42})
+    {
+        if (getKernel(it))
+        {
+            return it;
+        }
+    }
+    return Kernel::portable;
+}
+
+std::vector<Checksum::Kernel> Checksum::kernels()
+{
+    std::vector<Kernel> list;
+    for (const Kernel it : {Kernel::portable, Kernel::sse42, Kernel::pclmul,
+                            Kernel::armv8})
+    {
+        if (getKernel(it))
+        {
+            list.push_back(it);
+        }
+    }
+    return list;
+}
+
+const char* Checksum::name(Kernel kernel)
+{
+    switch (kernel)
+    {
+        case Kernel::portable:
+            return "slice-by-8";
+        case Kernel::sse42:
+            return "sse4.2";
+        case Kernel::pclmul:
+            return "sse4.2+pclmul";
+        case Kernel::armv8:
+            return "armv8";
+    }
+    return "unknown";
+}
@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @class Checksum
+ * @brief CRC-32C (Castagnoli) calculation.
+ *
+ * The implementation is chosen at runtime: ARMv8 CRC32 instructions,
+ * SSE4.2 CRC32 instruction (with PCLMUL for 3-way interleaving) on x86,
+ * slice-by-8 table lookup on other CPUs.
+ */
+class Checksum
+{
+  public:
+    /**
+     * @brief Checksum implementations.
+     */
+    enum class Kernel
+    {
+        /** Slice-by-8 table lookup. */
+        portable,
+        /** x86 SSE4.2 CRC32 instruction. */
+        sse42,
+        /** x86 SSE4.2 CRC32 instruction on 3 streams, merged with PCLMUL. */
+        pclmul,
+        /** ARMv8 CRC32 instructions. */
+        armv8
+    };
+
+    /**
+     * @brief Update checksum with the fastest implementation.
+     *
+     * @param[in] crc current checksum, 0 for the first call
+     * @param[in] data pointer to the data
+     * @param[in] size size of the data
+     *
+     * @return new checksum
+     */
+    static uint32_t update(uint32_t crc, const void* data, size_t size);
+
+    /**
+     * @brief Update checksum with specified implementation.
+     *
+     * @param[in] kernel implementation to use
+     * @param[in] crc current checksum, 0 for the first call
+     * @param[in] data pointer to the data
+     * @param[in] size size of the data
+     *
+     * @throw std::invalid_argument if implementation is not supported
+     *
+     * @return new checksum
+     */
+    static uint32_t update(Kernel kernel, uint32_t crc, const void* data,
+                           size_t size);
+
+    /**
+     * @brief Get implementation used by default.
+     *
+     * @return fastest implementation supported by the CPU
+     */
+    static Kernel kernel();
+
+    /**
+     * @brief Get all implementations supported by the CPU.
+     *
+     * @return list of implementations
+     */
+    static std::vector<Kernel> kernels();
+
+    /**
+     * @brief Get name of the implementation.
+     *
+     * @param[in] kernel implementation
+     *
+     * @return name of the implementation
+     */
+    static const char* name(Kernel kernel);
+};
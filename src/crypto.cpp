@@ -0,0 +1,454 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "crypto.hpp"
+
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+/** @brief Magic signature of encrypted stream. */
+static constexpr uint8_t magic[] = {'O', 'B', 'M', 'C', 'B', 'K', 'E', '1'};
+/** @brief Cipher identifier: ChaCha20-Poly1305. */
+static constexpr uint8_t cipherChaCha20Poly1305 = 1;
+/** @brief KDF identifier: raw key, no derivation. */
+static constexpr uint8_t kdfNone = 0;
+/** @brief KDF identifier: PBKDF2-HMAC-SHA256. */
+static constexpr uint8_t kdfPbkdf2 = 1;
+/** @brief Number of PBKDF2 iterations for new archives. */
+static constexpr uint32_t kdfIterations = 100000;
+/** @brief Max number of PBKDF2 iterations accepted on decryption. */
+static constexpr uint32_t kdfMaxIterations = 10000000;
+/** @brief Size of the plain data in a frame. */
+static constexpr uint32_t frameDataSize = 64 * 1024;
+/** @brief Max size of the frame accepted on decryption. */
+static constexpr uint32_t frameMaxSize = 16 * 1024 * 1024;
+/** @brief Flag of the last frame in frame prefix. */
+static constexpr uint32_t lastFrameFlag = 1u << 31;
+/** @brief Size of nonce. */
+static constexpr size_t nonceSize = 12;
+
+// header layout
+static constexpr size_t offCipher = 8;
+static constexpr size_t offKdf = 9;
+static constexpr size_t offIterations = 12;
+static constexpr size_t offFrameSize = 16;
+static constexpr size_t offSalt = 20;
+static constexpr size_t saltSize = 16;
+static constexpr size_t offNonce = 36;
+static constexpr size_t noncePrefixSize = 8;
+static_assert(offNonce + noncePrefixSize == Decryptor::headerSize);
+
+/**
+ * @brief Write 32-bit little-endian number.
+ *
+ * @param[out] ptr destination buffer
+ * @param[in] val value to write
+ */
+static void putLE32(uint8_t* ptr, uint32_t val)
+{
+    for (size_t i = 0; i < sizeof(val); ++i)
+    {
+        ptr[i] = static_cast<uint8_t>(val >> (i * 8));
+    }
+}
+
+/**
+ * @brief Read 32-bit little-endian number.
+ *
+ * @param[in] ptr source buffer
+ *
+ * @return value
+ */
+static uint32_t getLE32(const uint8_t* ptr)
+{
+    uint32_t val = 0;
+    for (size_t i = 0; i < sizeof(val); ++i)
+    {
+        val |= static_cast<uint32_t>(ptr[i]) << (i * 8);
+    }
+    return val;
+}
+
+/**
+ * @brief Create cipher context.
+ *
+ * @param[in] key encryption key
+ * @param[in] encrypt operation type: true=encrypt, false=decrypt
+ *
+ * @throw std::runtime_error in case of errors
+ *
+ * @return cipher context
+ */
+static EVP_CIPHER_CTX* createContext(const uint8_t* key, bool encrypt)
+{
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (!ctx)
+    {
+        throw std::runtime_error("Unable to create cipher context");
+    }
+    if (EVP_CipherInit_ex(ctx, EVP_chacha20_poly1305(), nullptr, key,
+                          nullptr, encrypt ? 1 : 0) != 1)
+    {
+        EVP_CIPHER_CTX_free(ctx);
+        throw std::runtime_error("Unable to initialize cipher");
+    }
+    return ctx;
+}
+
+/**
+ * @brief Initialize cipher for the next frame.
+ *
+ * @param[in] ctx cipher context
+ * @param[in] header stream header
+ * @param[in] counter frame number
+ * @param[in] footer footer data, nullptr if the frame is not last
+ *
+ * @throw std::runtime_error in case of errors
+ */
+static void initFrame(EVP_CIPHER_CTX* ctx, const std::vector<uint8_t>& header,
+                      uint32_t counter, const uint8_t* footer)
+{
+    uint8_t nonce[nonceSize];
+    memcpy(nonce, header.data() + offNonce, noncePrefixSize);
+    putLE32(nonce + noncePrefixSize, counter);
+
+    const uint8_t last = footer ? 1 : 0;
+    int len;
+    if (EVP_CipherInit_ex(ctx, nullptr, nullptr, nullptr, nonce, -1) != 1 ||
+        EVP_CipherUpdate(ctx, nullptr, &len, header.data(),
+                         static_cast<int>(header.size())) != 1 ||
+        EVP_CipherUpdate(ctx, nullptr, &len, &last, sizeof(last)) != 1 ||
+        (footer && EVP_CipherUpdate(ctx, nullptr, &len, footer,
+                                    Decryptor::footerSize) != 1))
+    {
+        throw std::runtime_error("Unable to initialize cipher");
+    }
+}
+
+/**
+ * @brief Read file content.
+ *
+ * @param[in] file path to the file
+ *
+ * @throw std::system_error in case of errors
+ *
+ * @return file content
+ */
+static std::vector<uint8_t> readSecret(const fs::path& file)
+{
+    std::ifstream in(file, std::ios::binary);
+    if (!in)
+    {
+        throw std::system_error(errno, std::system_category(), file);
+    }
+    return std::vector<uint8_t>((std::istreambuf_iterator<char>(in)),
+                                std::istreambuf_iterator<char>());
+}
+
+CryptoKey::CryptoKey(std::vector<uint8_t>&& secret, bool passphrase) :
+    secret(std::move(secret)), passphrase(passphrase)
+{}
+
+CryptoKey::~CryptoKey()
+{
+    OPENSSL_cleanse(secret.data(), secret.size());
+}
+
+CryptoKey CryptoKey::fromKeyFile(const fs::path& file)
+{
+    std::vector<uint8_t> key = readSecret(file);
+    if (key.size() != keySize)
+    {
+        OPENSSL_cleanse(key.data(), key.size());
+        std::string err = "Invalid key file ";
+        err += file;
+        err += ": expected ";
+        err += std::to_string(keySize);
+        err += " bytes";
+        throw std::runtime_error(err);
+    }
+    return CryptoKey(std::move(key), false);
+}
+
+CryptoKey CryptoKey::fromPassphraseFile(const fs::path& file)
+{
+    std::vector<uint8_t> pass = readSecret(file);
+    const auto eol = std::find_if(pass.begin(), pass.end(), [](uint8_t c) {
+        return c == '\n' || c == '\r';
+    });
+    OPENSSL_cleanse(pass.data() + (eol - pass.begin()), pass.end() - eol);
+    pass.erase(eol, pass.end());
+    if (pass.empty())
+    {
+        std::string err = "Empty passphrase in file ";
+        err += file;
+        throw std::runtime_error(err);
+    }
+    return CryptoKey(std::move(pass), true);
+}
+
+void CryptoKey::derive(const uint8_t* salt, size_t saltLen,
+                       uint32_t iterations, uint8_t* key) const
+{
+    if (!passphrase)
+    {
+        memcpy(key, secret.data(), keySize);
+    }
+    else if (PKCS5_PBKDF2_HMAC(reinterpret_cast<const char*>(secret.data()),
+                               static_cast<int>(secret.size()), salt,
+                               static_cast<int>(saltLen),
+                               static_cast<int>(iterations), EVP_sha256(),
+                               keySize, key) != 1)
+    {
+        throw std::runtime_error("Unable to derive key from passphrase");
+    }
+}
+
+Encryptor::Encryptor(const CryptoKey& key) : header(Decryptor::headerSize)
+{
+    memcpy(header.data(), magic, sizeof(magic));
+    header[offCipher] = cipherChaCha20Poly1305;
+    header[offKdf] = key.isPassphrase() ? kdfPbkdf2 : kdfNone;
+    putLE32(&header[offIterations], key.isPassphrase() ? kdfIterations : 0);
+    putLE32(&header[offFrameSize], frameDataSize);
+    if (RAND_bytes(&header[offSalt], saltSize) != 1 ||
+        RAND_bytes(&header[offNonce], noncePrefixSize) != 1)
+    {
+        throw std::runtime_error("Unable to generate random data");
+    }
+
+    uint8_t raw[CryptoKey::keySize];
+    key.derive(&header[offSalt], saltSize, kdfIterations, raw);
+    try
+    {
+        ctx = createContext(raw, true);
+    }
+    catch (...)
+    {
+        OPENSSL_cleanse(raw, sizeof(raw));
+        throw;
+    }
+    OPENSSL_cleanse(raw, sizeof(raw));
+
+    pending.reserve(frameDataSize);
+}
+
+Encryptor::~Encryptor()
+{
+    EVP_CIPHER_CTX_free(ctx);
+}
+
+void Encryptor::update(const uint8_t* data, size_t size,
+                       std::vector<uint8_t>& out)
+{
+    if (!headerWritten)
+    {
+        out.insert(out.end(), header.begin(), header.end());
+        headerWritten = true;
+    }
+
+    while (size)
+    {
+        // full frame is sealed only when more data arrives, since the last
+        // frame must be marked on encryption
+        if (pending.size() == frameDataSize)
+        {
+            seal(pending.data(), pending.size(), nullptr, out);
+            pending.clear();
+        }
+        const size_t len = std::min(size, frameDataSize - pending.size());
+        pending.insert(pending.end(), data, data + len);
+        data += len;
+        size -= len;
+    }
+}
+
+void Encryptor::finish(uint64_t contentSize, std::vector<uint8_t>& out)
+{
+    update(nullptr, 0, out); // write header
+
+    uint8_t footer[Decryptor::footerSize];
+    putLE32(footer, static_cast<uint32_t>(contentSize));
+    putLE32(footer + 4, static_cast<uint32_t>(contentSize >> 32));
+
+    seal(pending.data(), pending.size(), footer, out);
+    pending.clear();
+    out.insert(out.end(), footer, footer + sizeof(footer));
+}
+
+uint64_t Encryptor::bound(uint64_t size)
+{
+    const uint64_t frames = size / frameDataSize + 1;
+    return Decryptor::headerSize + Decryptor::footerSize + size +
+           frames * (Decryptor::prefixSize + Decryptor::tagSize);
+}
+
+void Encryptor::seal(const uint8_t* data, size_t size, const uint8_t* footer,
+                     std::vector<uint8_t>& out)
+{
+    if (counter == UINT32_MAX)
+    {
+        throw std::runtime_error("Too many frames in encrypted stream");
+    }
+    initFrame(ctx, header, counter++, footer);
+
+    const size_t start = out.size();
+    out.resize(start + Decryptor::prefixSize + size + Decryptor::tagSize);
+    uint8_t* ptr = out.data() + start;
+
+    putLE32(ptr, static_cast<uint32_t>(size) | (footer ? lastFrameFlag : 0));
+    ptr += Decryptor::prefixSize;
+
+    int len = 0;
+    int fin = 0;
+    if ((size && EVP_EncryptUpdate(ctx, ptr, &len, data,
+                                   static_cast<int>(size)) != 1) ||
+        EVP_EncryptFinal_ex(ctx, ptr + len, &fin) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, Decryptor::tagSize,
+                            ptr + size) != 1)
+    {
+        throw std::runtime_error("Encryption error");
+    }
+}
+
+bool Decryptor::isEncrypted(const uint8_t* data, size_t size)
+{
+    return size >= sizeof(magic) && memcmp(data, magic, sizeof(magic)) == 0;
+}
+
+Decryptor::Decryptor(const CryptoKey& key, const uint8_t* hdr) :
+    header(hdr, hdr + headerSize)
+{
+    if (!isEncrypted(hdr, headerSize))
+    {
+        throw std::runtime_error("Invalid encrypted archive header");
+    }
+    if (header[offCipher] != cipherChaCha20Poly1305)
+    {
+        throw std::runtime_error("Unsupported archive cipher");
+    }
+
+    const uint8_t kdf = header[offKdf];
+    const uint32_t iterations = getLE32(&header[offIterations]);
+    if ((kdf != kdfNone && kdf != kdfPbkdf2) ||
+        (kdf == kdfPbkdf2 && (!iterations || iterations > kdfMaxIterations)))
+    {
+        throw std::runtime_error("Unsupported archive key derivation");
+    }
+    if ((kdf == kdfPbkdf2) != key.isPassphrase())
+    {
+        throw std::runtime_error(
+            kdf == kdfPbkdf2 ? "Archive is encrypted with a passphrase"
+                             : "Archive is encrypted with a key file");
+    }
+
+    maxFrame = getLE32(&header[offFrameSize]);
+    if (!maxFrame || maxFrame > frameMaxSize)
+    {
+        throw std::runtime_error("Invalid archive frame size");
+    }
+
+    uint8_t raw[CryptoKey::keySize];
+    key.derive(&header[offSalt], saltSize, iterations, raw);
+    try
+    {
+        ctx = createContext(raw, false);
+    }
+    catch (...)
+    {
+        OPENSSL_cleanse(raw, sizeof(raw));
+        throw;
+    }
+    OPENSSL_cleanse(raw, sizeof(raw));
+}
+
+Decryptor::~Decryptor()
+{
+    EVP_CIPHER_CTX_free(ctx);
+}
+
+size_t Decryptor::frameSize(const uint8_t* prefix, bool& last) const
+{
+    const uint32_t val = getLE32(prefix);
+    const uint32_t size = val & ~lastFrameFlag;
+    if (size > maxFrame)
+    {
+        throw std::runtime_error("Invalid archive frame size");
+    }
+    last = val & lastFrameFlag;
+    return size + Decryptor::tagSize;
+}
+
+void Decryptor::open(const uint8_t* frame, size_t size, const uint8_t* footer,
+                     std::vector<uint8_t>& out)
+{
+    if (size < Decryptor::tagSize || counter == UINT32_MAX)
+    {
+        throw std::runtime_error("Invalid archive frame");
+    }
+    initFrame(ctx, header, counter++, footer);
+
+    const size_t dataSize = size - Decryptor::tagSize;
+    out.resize(dataSize);
+
+    int len = 0;
+    int fin = 0;
+    if ((dataSize && EVP_DecryptUpdate(ctx, out.data(), &len, frame,
+                                       static_cast<int>(dataSize)) != 1) ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, Decryptor::tagSize,
+                            const_cast<uint8_t*>(frame + dataSize)) != 1 ||
+        EVP_DecryptFinal_ex(ctx, out.data() + len, &fin) != 1)
+    {
+        OPENSSL_cleanse(out.data(), out.size());
+        out.clear();
+        throw std::runtime_error(
+            "Archive authentication failed: data is corrupted or key is wrong");
+    }
+}
+
+Sha256::Sha256() : ctx(EVP_MD_CTX_new())
+{
+    if (!ctx || EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr) != 1)
+    {
+        EVP_MD_CTX_free(ctx);
+        throw std::runtime_error("Unable to calculate hash");
+    }
+}
+
+Sha256::~Sha256()
+{
+    EVP_MD_CTX_free(ctx);
+}
+
+void Sha256::update(const void* data, size_t size)
+{
+    if (EVP_DigestUpdate(ctx, data, size) != 1)
+    {
+        throw std::runtime_error("Unable to calculate hash");
+    }
+}
+
+std::string Sha256::hex()
+{
+    uint8_t digest[EVP_MAX_MD_SIZE];
+    unsigned int size = 0;
+    if (EVP_DigestFinal_ex(ctx, digest, &size) != 1)
+    {
+        throw std::runtime_error("Unable to calculate hash");
+    }
+    static const char* hex = "0123456789abcdef";
+    std::string str;
+    for (unsigned int i = 0; i < size; ++i)
+    {
+        str += hex[digest[i] >> 4];
+        str += hex[digest[i] & 0xf];
+    }
+    return str;
+}
@@ -0,0 +1,294 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#pragma once
+
+#include <openssl/evp.h>
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+/**
+ * Encrypted archive format (all numbers are little-endian):
+ *
+ * Header (44 bytes):
+ *   magic "OBMCBKE1", cipher id (u8), KDF id (u8), reserved (u16),
+ *   KDF iterations (u32), frame size (u32), salt (16), nonce prefix (8).
+ * Frames (one or more):
+ *   length of encrypted data (u32, bit 31 marks the last frame),
+ *   encrypted data, authentication tag (16).
+ * Footer (8 bytes, after the last frame):
+ *   size of the unencrypted and uncompressed archive data (u64).
+ *
+ * Each frame is encrypted with ChaCha20-Poly1305, the nonce is the nonce
+ * prefix followed by the frame number (u32). The header, the last frame flag
+ * and the footer are authenticated as associated data, so any modification,
+ * reordering or truncation is detected on the frame where it occurs.
+ */
+
+/**
+ * @class CryptoKey
+ * @brief Key material used for archive encryption.
+ */
+class CryptoKey
+{
+  public:
+    /** @brief Size of the encryption key. */
+    static constexpr size_t keySize = 32;
+
+    /**
+     * @brief Load raw key from file.
+     *
+     * @param[in] file path to the file with 32 bytes of the key
+     *
+     * @throw std::exception in case of errors
+     *
+     * @return key instance
+     */
+    static CryptoKey fromKeyFile(const std::filesystem::path& file);
+
+    /**
+     * @brief Load passphrase from file, the key will be derived with PBKDF2.
+     *
+     * @param[in] file path to the file with passphrase (first line)
+     *
+     * @throw std::exception in case of errors
+     *
+     * @return key instance
+     */
+    static CryptoKey fromPassphraseFile(const std::filesystem::path& file);
+
+    CryptoKey(CryptoKey&&) = default;
+    CryptoKey& operator=(CryptoKey&&) = default;
+    ~CryptoKey();
+
+    /**
+     * @brief Check if the key must be derived from passphrase.
+     *
+     * @return true if key is a passphrase
+     */
+    bool isPassphrase() const
+    {
+        return passphrase;
+    }
+
+    /**
+     * @brief Get encryption key.
+     *
+     * @param[in] salt salt for key derivation
+     * @param[in] saltLen size of salt
+     * @param[in] iterations number of KDF iterations
+     * @param[out] key buffer for the key (keySize bytes)
+     *
+     * @throw std::runtime_error in case of errors
+     */
+    void derive(const uint8_t* salt, size_t saltLen, uint32_t iterations,
+                uint8_t* key) const;
+
+  private:
+    CryptoKey(std::vector<uint8_t>&& secret, bool passphrase);
+
+    /** @brief Raw key or passphrase. */
+    std::vector<uint8_t> secret;
+    /** @brief Secret is a passphrase. */
+    bool passphrase;
+};
+
+/**
+ * @class Encryptor
+ * @brief Stream encryption with chunked AEAD.
+ */
+class Encryptor
+{
+  public:
+    /**
+     * @brief Constructor.
+     *
+     * @param[in] key encryption key
+     *
+     * @throw std::runtime_error in case of errors
+     */
+    explicit Encryptor(const CryptoKey& key);
+
+    ~Encryptor();
+
+    Encryptor(const Encryptor&) = delete;
+    Encryptor& operator=(const Encryptor&) = delete;
+
+    /**
+     * @brief Encrypt data.
+     *
+     * @param[in] data pointer to the data to encrypt
+     * @param[in] size size of the data
+     * @param[out] out buffer to append encrypted frames
+     *
+     * @throw std::runtime_error in case of errors
+     */
+    void update(const uint8_t* data, size_t size, std::vector<uint8_t>& out);
+
+    /**
+     * @brief Finish the stream: encrypt the last frame and write footer.
+     *
+     * @param[in] contentSize size of the uncompressed archive data
+     * @param[out] out buffer to append encrypted frames
+     *
+     * @throw std::runtime_error in case of errors
+     */
+    void finish(uint64_t contentSize, std::vector<uint8_t>& out);
+
+    /**
+     * @brief Get max size of encrypted stream.
+     *
+     * @param[in] size size of the data to encrypt
+     *
+     * @return size of the encrypted data (upper bound)
+     */
+    static uint64_t bound(uint64_t size);
+
+  private:
+    /**
+     * @brief Encrypt single frame.
+     *
+     * @param[in] data pointer to the data to encrypt
+     * @param[in] size size of the data
+     * @param[in] footer footer data, nullptr if the frame is not last
+     * @param[out] out buffer to append encrypted frame
+     */
+    void seal(const uint8_t* data, size_t size, const uint8_t* footer,
+              std::vector<uint8_t>& out);
+
+  private:
+    /** @brief Cipher context. */
+    EVP_CIPHER_CTX* ctx;
+    /** @brief Stream header. */
+    std::vector<uint8_t> header;
+    /** @brief Header is already written to the output. */
+    bool headerWritten = false;
+    /** @brief Data of incomplete frame. */
+    std::vector<uint8_t> pending;
+    /** @brief Frame counter. */
+    uint32_t counter = 0;
+};
+
+/**
+ * @class Decryptor
+ * @brief Stream decryption with chunked AEAD.
+ */
+class Decryptor
+{
+  public:
+    /** @brief Size of the stream header. */
+    static constexpr size_t headerSize = 44;
+    /** @brief Size of the frame prefix (length). */
+    static constexpr size_t prefixSize = 4;
+    /** @brief Size of the stream footer. */
+    static constexpr size_t footerSize = 8;
+    /** @brief Size of the frame authentication tag. */
+    static constexpr size_t tagSize = 16;
+
+    /**
+     * @brief Check if data is an encrypted stream.
+     *
+     * @param[in] data pointer to the beginning of the stream
+     * @param[in] size size of the data
+     *
+     * @return true if stream is encrypted
+     */
+    static bool isEncrypted(const uint8_t* data, size_t size);
+
+    /**
+     * @brief Constructor.
+     *
+     * @param[in] key encryption key
+     * @param[in] hdr stream header (headerSize bytes)
+     *
+     * @throw std::runtime_error if header is invalid
+     */
+    Decryptor(const CryptoKey& key, const uint8_t* hdr);
+
+    ~Decryptor();
+
+    Decryptor(const Decryptor&) = delete;
+    Decryptor& operator=(const Decryptor&) = delete;
+
+    /**
+     * @brief Parse frame prefix.
+     *
+     * @param[in] prefix frame prefix (prefixSize bytes)
+     * @param[out] last flag of the last frame
+     *
+     * @throw std::runtime_error if prefix is invalid
+     *
+     * @return size of the frame data to read (encrypted data and tag)
+     */
+    size_t frameSize(const uint8_t* prefix, bool& last) const;
+
+    /**
+     * @brief Decrypt and verify single frame.
+     *
+     * @param[in] frame encrypted data and tag
+     * @param[in] size size of the frame
+     * @param[in] footer footer data, nullptr if the frame is not last
+     * @param[out] out buffer for decrypted data
+     *
+     * @throw std::runtime_error if frame is corrupted
+     */
+    void open(const uint8_t* frame, size_t size, const uint8_t* footer,
+              std::vector<uint8_t>& out);
+
+  private:
+    /** @brief Cipher context. */
+    EVP_CIPHER_CTX* ctx;
+    /** @brief Stream header. */
+    std::vector<uint8_t> header;
+    /** @brief Max size of the frame data. */
+    uint32_t maxFrame;
+    /** @brief Frame counter. */
+    uint32_t counter = 0;
+};
+
+/**
+ * @class Sha256
+ * @brief Incremental SHA-256 hash used to identify file content.
+ */
+class Sha256
+{
+  public:
+    /**
+     * @brief Constructor.
+     *
+     * @throw std::runtime_error in case of errors
+     */
+    Sha256();
+
+    ~Sha256();
+
+    Sha256(const Sha256&) = delete;
+    Sha256& operator=(const Sha256&) = delete;
+
+    /**
+     * @brief Hash the next part of the data.
+     *
+     * @param[in] data pointer to the data
+     * @param[in] size size of the data
+     *
+     * @throw std::runtime_error in case of errors
+     */
+    void update(const void* data, size_t size);
+
+    /**
+     * @brief Finish hashing.
+     *
+     * @throw std::runtime_error in case of errors
+     *
+     * @return hash as hex string
+     */
+    std::string hex();
+
+  private:
+    /** @brief Digest context. */
+    EVP_MD_CTX* ctx;
+};
@@ -0,0 +1,330 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "checksum.hpp"
+#include "crypto.hpp"
+#include "delta.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+/** @brief Magic signature of delta data. */
+static constexpr uint8_t magic[] = {'O', 'B', 'M', 'C', 'D', 'L', 'T', '1'};
+/** @brief Operation: copy data from base. */
+static constexpr uint8_t opCopy = 0;
+/** @brief Operation: insert new data. */
+static constexpr uint8_t opInsert = 1;
+/** @brief Min size of the block used for matching. */
+static constexpr size_t minBlock = 32;
+/** @brief Max size of the block used for matching. */
+static constexpr size_t maxBlock = 4096;
+
+/**
+ * @class Rolling
+ * @brief Rolling checksum (rsync algorithm).
+ */
+class Rolling
+{
+  public:
+    /**
+     * @brief Constructor: calculate checksum of the window.
+     *
+     * @param[in] data pointer to the window
+     * @param[in] size size of the window
+     */
+    Rolling(const uint8_t* data, size_t size) : size(size)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            a += data[i];
+            b += static_cast<uint32_t>(size - i) * data[i];
+        }
+    }
+
+    /**
+     * @brief Move window by one byte.
+     *
+     * @param[in] out byte leaving the window
+     * @param[in] in byte entering the window
+     */
+    void roll(uint8_t out, uint8_t in)
+    {
+        a += in - out;
+        b += a - static_cast<uint32_t>(size) * out;
+    }
+
+    /**
+     * @brief Get checksum value.
+     *
+     * @return checksum
+     */
+    uint32_t value() const
+    {
+        return (a & 0xffff) | (b << 16);
+    }
+
+  private:
+    /** @brief Size of the window. */
+    size_t size;
+    /** @brief Sum of bytes. */
+    uint32_t a = 0;
+    /** @brief Weighted sum of bytes. */
+    uint32_t b = 0;
+};
+
+/**
+ * @brief Append number in LEB128 format.
+ *
+ * @param[out] out output buffer
+ * @param[in] val value to write
+ */
+static void putNumber(std::vector<uint8_t>& out, uint64_t val)
+{
+    while (val >= 0x80)
+    {
+        out.push_back(static_cast<uint8_t>(val) | 0x80);
+        val >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(val));
+}
+
+/**
+ * @brief Read number in LEB128 format.
+ *
+ * @param[in] in input buffer
+ * @param[in,out] pos current position in the input buffer
+ *
+ * @throw std::runtime_error if data is truncated
+ *
+ * @return value
+ */
+static uint64_t getNumber(const std::vector<uint8_t>& in, size_t& pos)
+{
+    uint64_t val = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7)
+    {
+        if (pos >= in.size())
+        {
+            break;
+        }
+        const uint8_t byte = in[pos++];
+        val |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            return val;
+        }
+    }
+    throw std::runtime_error("Delta is corrupted");
+}
+
+/**
+ * @brief Append 32-bit little-endian number.
+ *
+ * @param[out] out output buffer
+ * @param[in] val value to write
+ */
+static void putLE32(std::vector<uint8_t>& out, uint32_t val)
+{
+    for (size_t i = 0; i < sizeof(val); ++i)
+    {
+        out.push_back(static_cast<uint8_t>(val >> (i * 8)));
+    }
+}
+
+/**
+ * @brief Read 32-bit little-endian number.
+ *
+ * @param[in] in input buffer
+ * @param[in,out] pos current position in the input buffer
+ *
+ * @throw std::runtime_error if data is truncated
+ *
+ * @return value
+ */
+static uint32_t getLE32(const std::vector<uint8_t>& in, size_t& pos)
+{
+    if (in.size() - pos < sizeof(uint32_t))
+    {
+        throw std::runtime_error("Delta is corrupted");
+    }
+    uint32_t val = 0;
+    for (size_t i = 0; i < sizeof(val); ++i)
+    {
+        val |= static_cast<uint32_t>(in[pos++]) << (i * 8);
+    }
+    return val;
+}
+
+/**
+ * @brief Append insert operation.
+ *
+ * @param[out] out output buffer
+ * @param[in] data pointer to the new data
+ * @param[in] size size of the new data
+ */
+static void putInsert(std::vector<uint8_t>& out, const uint8_t* data,
+                      size_t size)
+{
+    if (size)
+    {
+        out.push_back(opInsert);
+        putNumber(out, size);
+        out.insert(out.end(), data, data + size);
+    }
+}
+
+std::vector<uint8_t> Delta::create(const std::vector<uint8_t>& base,
+                                   const std::vector<uint8_t>& target)
+{
+    std::vector<uint8_t> out(magic, magic + sizeof(magic));
+    putNumber(out, base.size());
+    putNumber(out, target.size());
+    putLE32(out, Checksum::update(0, base.data(), base.size()));
+    putLE32(out, Checksum::update(0, target.data(), target.size()));
+
+    // block size grows with the file size to keep the index small
+    const size_t block = std::clamp<size_t>(
+        static_cast<size_t>(std::sqrt(static_cast<double>(base.size()))),
+        minBlock, maxBlock);
+
+    std::unordered_multimap<uint32_t, size_t> index;
+    index.reserve(base.size() / block);
+    for (size_t off = 0; off + block <= base.size(); off += block)
+    {
+        index.emplace(Rolling(&base[off], block).value(), off);
+    }
+
+    size_t literal = 0; // start of data not covered by copy operations
+    size_t pos = 0;
+    if (!index.empty() && target.size() >= block)
+    {
+        Rolling rolling(target.data(), block);
+        while (true)
+        {
+            size_t match = base.size();
+            const auto range = index.equal_range(rolling.value());
+            for (auto it = range.first; it != range.second; ++it)
+            {
+                if (memcmp(&base[it->second], &target[pos], block) == 0)
+                {
+                    match = it->second;
+                    break;
+                }
+            }
+
+            if (match == base.size())
+            {
+                if (pos + block >= target.size())
+                {
+                    break;
+                }
+                rolling.roll(target[pos], target[pos + block]);
+                ++pos;
+                continue;
+            }
+
+            // extend match in both directions
+            size_t len = block;
+            while (pos + len < target.size() && match + len < base.size() &&
+                   target[pos + len] == base[match + len])
+            {
+                ++len;
+            }
+            while (pos > literal && match > 0 &&
+                   target[pos - 1] == base[match - 1])
+            {
+                --pos;
+                --match;
+                ++len;
+            }
+
+            putInsert(out, target.data() + literal, pos - literal);
+            out.push_back(opCopy);
+            putNumber(out, match);
+            putNumber(out, len);
+
+            pos += len;
+            literal = pos;
+            if (pos + block > target.size())
+            {
+                break;
+            }
+            rolling = Rolling(&target[pos], block);
+        }
+    }
+    putInsert(out, target.data() + literal, target.size() - literal);
+
+    return out;
+}
+
+std::vector<uint8_t> Delta::apply(const std::vector<uint8_t>& base,
+                                  const std::vector<uint8_t>& delta)
+{
+    if (delta.size() < sizeof(magic) ||
+        memcmp(delta.data(), magic, sizeof(magic)) != 0)
+    {
+        throw std::runtime_error("Invalid delta format");
+    }
+
+    size_t pos = sizeof(magic);
+    const uint64_t baseSize = getNumber(delta, pos);
+    const uint64_t targetSize = getNumber(delta, pos);
+    const uint32_t baseCrc = getLE32(delta, pos);
+    const uint32_t targetCrc = getLE32(delta, pos);
+
+    if (baseSize != base.size() ||
+        baseCrc != Checksum::update(0, base.data(), base.size()))
+    {
+        throw std::runtime_error("Base file of delta doesn't match");
+    }
+    std::vector<uint8_t> out;
+    out.reserve(std::min<uint64_t>(targetSize, base.size() + delta.size()));
+    while (pos < delta.size())
+    {
+        const uint8_t op = delta[pos++];
+        if (op == opCopy)
+        {
+            const uint64_t off = getNumber(delta, pos);
+            const uint64_t len = getNumber(delta, pos);
+            if (off > base.size() || len > base.size() - off ||
+                len > targetSize - out.size())
+            {
+                throw std::runtime_error("Delta is corrupted");
+            }
+            out.insert(out.end(), base.begin() + off, base.begin() + off + len);
+        }
+        else if (op == opInsert)
+        {
+            const uint64_t len = getNumber(delta, pos);
+            if (len > delta.size() - pos || len > targetSize - out.size())
+            {
+                throw std::runtime_error("Delta is corrupted");
+            }
+            out.insert(out.end(), delta.begin() + pos,
+                       delta.begin() + pos + len);
+            pos += len;
+        }
+        else
+        {
+            throw std::runtime_error("Delta is corrupted");
+        }
+    }
+
+    if (out.size() != targetSize ||
+        targetCrc != Checksum::update(0, out.data(), out.size()))
+    {
+        throw std::runtime_error("Delta is corrupted");
+    }
+
+    return out;
+}
+
+std::string Delta::hash(const std::vector<uint8_t>& data)
+{
+    Sha256 sha;
+    sha.update(data.data(), data.size());
+    return sha.hex();
+}
@@ -0,0 +1,61 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @class Delta
+ * @brief Binary delta of a file relative to its base version.
+ *
+ * Delta is created with rsync-style block matching: base is split into
+ * blocks indexed by rolling checksum, target is scanned byte by byte to find
+ * the blocks and the matches are extended as far as possible.
+ *
+ * Delta format (numbers are LEB128 encoded if not specified):
+ *   magic "OBMCDLT1", base size, target size, base CRC-32C (u32 LE),
+ *   target CRC-32C (u32 LE), then sequence of operations:
+ *   0x00 OFFSET LENGTH - copy data from base,
+ *   0x01 LENGTH DATA   - insert new data.
+ */
+class Delta
+{
+  public:
+    /**
+     * @brief Create delta.
+     *
+     * @param[in] base base version of the file
+     * @param[in] target new version of the file
+     *
+     * @return delta data
+     */
+    static std::vector<uint8_t> create(const std::vector<uint8_t>& base,
+                                       const std::vector<uint8_t>& target);
+
+    /**
+     * @brief Apply delta to the base file.
+     *
+     * @param[in] base base version of the file
+     * @param[in] delta delta data
+     *
+     * @throw std::runtime_error if delta is invalid or base doesn't match
+     *
+     * @return new version of the file
+     */
+    static std::vector<uint8_t> apply(const std::vector<uint8_t>& base,
+                                      const std::vector<uint8_t>& delta);
+
+    /**
+     * @brief Get content hash used to identify the base file.
+     *
+     * @param[in] data file content
+     *
+     * @throw std::runtime_error in case of errors
+     *
+     * @return SHA-256 as hex string
+     */
+    static std::string hash(const std::vector<uint8_t>& data);
+};
@@ -0,0 +1,196 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "dictionary.hpp"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef EMBEDDED_DICTIONARY
+/** @brief Dictionary data embedded at build time (generated file). */
+extern const uint8_t embeddedDictionary[];
+/** @brief Size of the embedded dictionary. */
+extern const size_t embeddedDictionarySize;
+#endif
+
+namespace fs = std::filesystem;
+
+/** @brief Size of the substring used for scoring. */
+static constexpr size_t dmerSize = sizeof(uint64_t);
+/** @brief Size of the segment selected to the dictionary. */
+static constexpr size_t segmentSize = 128;
+
+/**
+ * @brief Get substring starting at specified position.
+ *
+ * @param[in] ptr pointer to the data
+ *
+ * @return substring as a number
+ */
+static inline uint64_t dmer(const uint8_t* ptr)
+{
+    uint64_t val;
+    memcpy(&val, ptr, sizeof(val));
+    return val;
+}
+
+Dictionary::Dictionary(std::vector<uint8_t>&& data) : content(std::move(data))
+{
+    if (content.empty() || content.size() > maxSize)
+    {
+        throw std::invalid_argument("Invalid size of compression dictionary");
+    }
+    dictId = adler32(adler32(0, nullptr, 0), content.data(),
+                     static_cast<uInt>(content.size()));
+}
+
+Dictionary Dictionary::load(const fs::path& file)
+{
+    std::ifstream in(file, std::ios::binary);
+    if (!in)
+    {
+        throw std::system_error(errno, std::system_category(), file);
+    }
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)),
+                              std::istreambuf_iterator<char>());
+    return Dictionary(std::move(data));
+}
+
+const Dictionary* Dictionary::embedded()
+{
+#ifdef EMBEDDED_DICTIONARY
+    static const Dictionary dict(std::vector<uint8_t>(
+        embeddedDictionary, embeddedDictionary + embeddedDictionarySize));
+    return &dict;
+#else
+    return nullptr;
+#endif
+}
+
+Dictionary Dictionary::train(const std::vector<std::vector<uint8_t>>& samples,
+                             size_t size)
+{
+    size = std::min(size, maxSize);
+
+    // frequency of substrings: number of samples that contain it
+    std::unordered_map<uint64_t, uint32_t> freq;
+    size_t total = 0;
+    for (const auto& sample : samples)
+    {
+        std::unordered_set<uint64_t> seen;
+        for (size_t i = 0; i + dmerSize <= sample.size(); ++i)
+        {
+            if (seen.insert(dmer(&sample[i])).second)
+            {
+                ++freq[dmer(&sample[i])];
+            }
+        }
+        total += sample.size();
+    }
+    if (total < segmentSize)
+    {
+        throw std::runtime_error("Not enough data to train dictionary");
+    }
+
+    // split samples into epochs, select the best segment from each one
+    const size_t segments = std::max<size_t>(size / segmentSize, 1);
+    const size_t epochSize = std::max(total / segments, segmentSize);
+
+    std::vector<std::pair<uint64_t, std::vector<uint8_t>>> selected;
+    size_t sampleIdx = 0;
+    size_t offset = 0;
+    while (sampleIdx < samples.size())
+    {
+        const std::vector<uint8_t>& sample = samples[sampleIdx];
+        const size_t end = std::min(offset + epochSize, sample.size());
+
+        // sliding window over the epoch, score is a sum of frequencies of
+        // unique substrings in the window
+        std::unordered_map<uint64_t, uint32_t> active;
+        uint64_t score = 0;
+        uint64_t bestScore = 0;
+        size_t bestStart = 0;
+        size_t start = offset;
+        for (size_t i = offset; i + dmerSize <= end; ++i)
+        {
+            const uint64_t dm = dmer(&sample[i]);
+            if (active[dm]++ == 0)
+            {
+                score += freq[dm];
+            }
+            if (i + dmerSize - start > segmentSize)
+            {
+                const uint64_t old = dmer(&sample[start]);
+                if (--active[old] == 0)
+                {
+                    score -= freq[old];
+                }
+                ++start;
+            }
+            if (score > bestScore)
+            {
+                bestScore = score;
+                bestStart = start;
+            }
+        }
+
+        if (bestScore > 0)
+        {
+            const size_t len = std::min(segmentSize, end - bestStart);
+            selected.emplace_back(
+                bestScore,
+                std::vector<uint8_t>(sample.begin() + bestStart,
+                                     sample.begin() + bestStart + len));
+            // substrings from the selected segment have no more value
+            for (size_t i = bestStart; i + dmerSize <= bestStart + len; ++i)
+            {
+                freq[dmer(&sample[i])] = 0;
+            }
+        }
+
+        offset = end;
+        if (offset >= sample.size())
+        {
+            ++sampleIdx;
+            offset = 0;
+        }
+    }
+
+    // the most valuable segments are placed to the end of the dictionary
+    std::stable_sort(
+        selected.begin(), selected.end(),
+        [](const auto& a, const auto& b) { return a.first < b.first; });
+    std::vector<uint8_t> data;
+    for (auto it = selected.rbegin(); it != selected.rend(); ++it)
+    {
+        if (data.size() + it->second.size() > size)
+        {
+            break;
+        }
+        data.insert(data.begin(), it->second.begin(), it->second.end());
+    }
+    if (data.empty())
+    {
+        throw std::runtime_error("Not enough data to train dictionary");
+    }
+
+    return Dictionary(std::move(data));
+}
+
+void Dictionary::save(const fs::path& file) const
+{
+    std::ofstream out(file, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(content.data()), content.size());
+    out.close();
+    if (!out)
+    {
+        throw std::system_error(EIO, std::system_category(), file);
+    }
+}
@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+/**
+ * @class Dictionary
+ * @brief Preset dictionary for archive compression.
+ *
+ * Archives compressed with a dictionary use zlib format instead of gzip:
+ * the zlib header references the dictionary by its ID (Adler-32 of the
+ * dictionary data), the stream is followed by 8 bytes of the uncompressed
+ * size (little-endian).
+ */
+class Dictionary
+{
+  public:
+    /** @brief Max size of the dictionary (deflate window size). */
+    static constexpr size_t maxSize = 32 * 1024;
+    /** @brief Default size of the trained dictionary. */
+    static constexpr size_t defaultSize = 16 * 1024;
+
+    /**
+     * @brief Constructor.
+     *
+     * @param[in] data dictionary data
+     *
+     * @throw std::invalid_argument if dictionary is empty or too big
+     */
+    explicit Dictionary(std::vector<uint8_t>&& data);
+
+    /**
+     * @brief Load dictionary from file.
+     *
+     * @param[in] file path to the dictionary file
+     *
+     * @throw std::exception in case of errors
+     *
+     * @return dictionary instance
+     */
+    static Dictionary load(const std::filesystem::path& file);
+
+    /**
+     * @brief Get dictionary embedded at build time.
+     *
+     * @return pointer to the dictionary, nullptr if there is no one
+     */
+    static const Dictionary* embedded();
+
+    /**
+     * @brief Train dictionary on the set of samples.
+     *
+     * Segments of the samples that contain most of the substrings common
+     * for different samples are selected (COVER algorithm), the most
+     * valuable segments are placed to the end of the dictionary as they are
+     * the closest to the compressed data.
+     *
+     * @param[in] samples set of samples (uncompressed archives)
+     * @param[in] size max size of the dictionary
+     *
+     * @throw std::runtime_error if samples are too small
+     *
+     * @return dictionary instance
+     */
+    static Dictionary train(const std::vector<std::vector<uint8_t>>& samples,
+                            size_t size = defaultSize);
+
+    /**
+     * @brief Save dictionary to file.
+     *
+     * @param[in] file path to the dictionary file
+     *
+     * @throw std::system_error in case of errors
+     */
+    void save(const std::filesystem::path& file) const;
+
+    /**
+     * @brief Get dictionary ID.
+     *
+     * @return Adler-32 of the dictionary data
+     */
+    uint32_t id() const
+    {
+        return dictId;
+    }
+
+    /**
+     * @brief Get dictionary data.
+     *
+     * @return dictionary data
+     */
+    const std::vector<uint8_t>& data() const
+    {
+        return content;
+    }
+
+  private:
+    /** @brief Dictionary data. */
+    std::vector<uint8_t> content;
+    /** @brief Dictionary ID. */
+    uint32_t dictId;
+};
@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "ini.hpp"
+
+#include <fstream>
+#include <regex>
+
+namespace fs = std::filesystem;
+
+std::map<std::string, std::string> parseIni(const fs::path& iniFile,
+                                            const std::string& section)
+{
+    std::map<std::string, std::string> data;
+    const std::regex iniRegex("([^= ]+)\\s*=\\s*\"?([^\"]+)\"?");
+    const std::regex sectionRegex("\\s*\\[\\s*([^\\] ]+)\\s*\\]\\s*");
+
+    std::ifstream file(iniFile);
+    if (!file)
+    {
+        std::string err = "Error opening file ";
+        err += iniFile;
+        throw std::runtime_error(err);
+    }
+    std::string current;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (line.empty() || line[0] == '#' || line[0] == ';')
+        {
+            continue; // comment
+        }
+        std::smatch match;
+        if (std::regex_match(line, match, sectionRegex))
+        {
+            current = match[1].str();
+        }
+        else if (current == section && std::regex_match(line, match, iniRegex))
+        {
+            const auto& name = match[1].str();
+            const auto& value = match[2].str();
+            data.insert(std::make_pair(name, value));
+        }
+    }
+
+    return data;
+}
@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <string>
+
+/**
+ * @brief Parse ini file.
+ *
+ * @param[in] iniFile path to the ini file to parse
+ * @param[in] section name of the section to load, empty for properties
+ *                    defined before the first section
+ *
+ * @throw std::runtime_error in case of errors
+ *
+ * @return map of ini values
+ */
+std::map<std::string, std::string>
+    parseIni(const std::filesystem::path& iniFile,
+             const std::string& section = {});
@@ -0,0 +1,758 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "io_engine.hpp"
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+/** @brief Number of submission queue entries of io_uring. */
+static constexpr unsigned ringEntries = IoEngine::batchSize;
+/** @brief Max number of threads in the pool. */
+static constexpr unsigned maxThreads = 8;
+
+/** @brief Operations required from io_uring. */
+static constexpr uint8_t uringOps[] = {IORING_OP_OPENAT, IORING_OP_STATX,
+                                       IORING_OP_READ, IORING_OP_WRITE,
+                                       IORING_OP_CLOSE};
+
+void IoEngine::read(int dirFd, std::vector<File>& files, size_t maxSize)
+{
+    std::vector<Op> ops;
+    std::vector<File*> targets;
+
+    // regular files and directories are opened for reading
+    for (auto& it : files)
+    {
+        Op op{Op::Type::open, dirFd};
+        op.name = it.name.c_str();
+        op.flags = O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_NOCTTY | O_CLOEXEC;
+        ops.push_back(op);
+        targets.push_back(&it);
+    }
+    run(ops);
+
+    // symlinks and sockets can't be opened for reading
+    std::vector<Op> retry;
+    std::vector<File*> retryTargets;
+    for (size_t i = 0; i < ops.size(); ++i)
+    {
+        if (ops[i].result == -ELOOP || ops[i].result == -ENXIO)
+        {
+            Op op = ops[i];
+            op.flags = O_PATH | O_NOFOLLOW | O_CLOEXEC;
+            retry.push_back(op);
+            retryTargets.push_back(targets[i]);
+        }
+        else if (ops[i].result < 0)
+        {
+            targets[i]->error = static_cast<int>(-ops[i].result);
+        }
+        else
+        {
+            targets[i]->fd = static_cast<int>(ops[i].result);
+        }
+    }
+    if (!retry.empty())
+    {
+        run(retry);
+        for (size_t i = 0; i < retry.size(); ++i)
+        {
+            if (retry[i].result < 0)
+            {
+                retryTargets[i]->error = static_cast<int>(-retry[i].result);
+            }
+            else
+            {
+                retryTargets[i]->fd = static_cast<int>(retry[i].result);
+            }
+        }
+    }
+
+    // get status of all opened files
+    ops.clear();
+    targets.clear();
+    for (auto& it : files)
+    {
+        if (it.fd != -1)
+        {
+            Op op{Op::Type::statx, it.fd};
+            op.flags = AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW;
+            op.buf = &it.stx;
+            ops.push_back(op);
+            targets.push_back(&it);
+        }
+    }
+    run(ops);
+
+    // load content of small files
+    std::vector<Op> reads;
+    std::vector<File*> readTargets;
+    for (size_t i = 0; i < ops.size(); ++i)
+    {
+        File& file = *targets[i];
+        if (ops[i].result < 0)
+        {
+            file.error = static_cast<int>(-ops[i].result);
+            continue;
+        }
+        if (!S_ISREG(file.stx.stx_mode) || file.stx.stx_size > maxSize)
+        {
+            continue;
+        }
+        file.data.resize(file.stx.stx_size);
+        file.loaded = file.data.empty();
+        if (!file.loaded)
+        {
+            Op op{Op::Type::read, file.fd};
+            op.buf = file.data.data();
+            op.size = file.data.size();
+            reads.push_back(op);
+            readTargets.push_back(&file);
+        }
+    }
+    run(reads);
+    for (size_t i = 0; i < reads.size(); ++i)
+    {
+        File& file = *readTargets[i];
+        if (reads[i].result < 0)
+        {
+            file.error = static_cast<int>(-reads[i].result);
+        }
+        // short read: file was changed, the caller reads it as usual
+        file.loaded = reads[i].result == static_cast<long>(reads[i].size);
+        if (!file.loaded)
+        {
+            file.data.clear();
+        }
+    }
+}
+
+void IoEngine::write(int dirFd, std::vector<File>& files)
+{
+    std::vector<Op> ops;
+    std::vector<File*> targets;
+    for (auto& it : files)
+    {
+        Op op{Op::Type::open, dirFd};
+        op.name = it.name.c_str();
+        op.flags = O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC;
+        op.mode = it.mode;
+        ops.push_back(op);
+        targets.push_back(&it);
+    }
+    run(ops);
+
+    std::vector<Op> writes;
+    std::vector<File*> writeTargets;
+    for (size_t i = 0; i < ops.size(); ++i)
+    {
+        File& file = *targets[i];
+        if (ops[i].result < 0)
+        {
+            file.error = static_cast<int>(-ops[i].result);
+            continue;
+        }
+        file.fd = static_cast<int>(ops[i].result);
+        if (!file.data.empty())
+        {
+            Op op{Op::Type::write, file.fd};
+            op.buf = file.data.data();
+            op.size = file.data.size();
+            writes.push_back(op);
+            writeTargets.push_back(&file);
+        }
+    }
+
+    // repeat short writes until all data is written
+    while (!writes.empty())
+    {
+        run(writes);
+        std::vector<Op> rest;
+        std::vector<File*> restTargets;
+        for (size_t i = 0; i < writes.size(); ++i)
+        {
+            Op& op = writes[i];
+            if (op.result <= 0)
+            {
+                writeTargets[i]->error =
+                    op.result < 0 ? static_cast<int>(-op.result) : EIO;
+            }
+            else if (static_cast<size_t>(op.result) < op.size)
+            {
+                op.buf = static_cast<uint8_t*>(op.buf) + op.result;
+                op.size -= op.result;
+                op.offset += op.result;
+                rest.push_back(op);
+                restTargets.push_back(writeTargets[i]);
+            }
+        }
+        writes.swap(rest);
+        writeTargets.swap(restTargets);
+    }
+}
+
+void IoEngine::close(std::vector<File>& files)
+{
+    std::vector<Op> ops;
+    for (auto& it : files)
+    {
+        if (it.fd != -1)
+        {
+            Op op{Op::Type::close, it.fd};
+            op.result = -ECANCELED;
+            ops.push_back(op);
+            it.fd = -1;
+        }
+    }
+    try
+    {
+        run(ops);
+    }
+    catch (const std::exception&)
+    {
+        // engine failure, close the rest with blocking calls
+        for (auto& it : ops)
+        {
+            if (it.result == -ECANCELED)
+            {
+                execute(it);
+            }
+        }
+    }
+}
+
+void IoEngine::execute(Op& op)
+{
+    switch (op.type)
+    {
+        case Op::Type::open:
+            op.result = openat(op.fd, op.name, op.flags, op.mode);
+            break;
+        case Op::Type::statx:
+            op.result = statx(op.fd, "", op.flags, STATX_BASIC_STATS,
+                              static_cast<struct statx*>(op.buf));
+            break;
+        case Op::Type::read:
+            op.result = pread(op.fd, op.buf, op.size, op.offset);
+            break;
+        case Op::Type::write:
+            op.result = pwrite(op.fd, op.buf, op.size, op.offset);
+            break;
+        case Op::Type::close:
+            op.result = ::close(op.fd);
+            break;
+    }
+    if (op.result < 0)
+    {
+        op.result = -errno;
+    }
+}
+
+/**
+ * @class SyncEngine
+ * @brief Engine that executes operations one by one.
+ */
+class SyncEngine : public IoEngine
+{
+  public:
+    const char* name() const override
+    {
+        return "sync";
+    }
+
+  protected:
+    void run(std::vector<Op>& ops) override
+    {
+        for (auto& it : ops)
+        {
+            execute(it);
+        }
+    }
+};
+
+/**
+ * @class ThreadEngine
+ * @brief Engine that executes operations on a pool of threads.
+ */
+class ThreadEngine : public IoEngine
+{
+  public:
+    ThreadEngine()
+    {
+        const unsigned num =
+            std::clamp(std::thread::hardware_concurrency(), 2u, maxThreads);
+        for (unsigned i = 0; i < num; ++i)
+        {
+            workers.emplace_back([this]() { work(); });
+        }
+    }
+
+    ~ThreadEngine() override
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cond.notify_all();
+        for (auto& it : workers)
+        {
+            it.join();
+        }
+    }
+
+    const char* name() const override
+    {
+        return "threads";
+    }
+
+  protected:
+    void run(std::vector<Op>& ops) override
+    {
+        if (ops.size() <= 1)
+        {
+            for (auto& it : ops)
+            {
+                execute(it);
+            }
+            return;
+        }
+
+        // operations are fast, so they are grouped by worker
+        const size_t parts = std::min(ops.size(), workers.size());
+        size_t left = parts;
+        std::mutex doneMutex;
+        std::condition_variable done;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < parts; ++i)
+            {
+                tasks.emplace([&, i]() {
+                    for (size_t j = i; j < ops.size(); j += parts)
+                    {
+                        execute(ops[j]);
+                    }
+                    std::lock_guard<std::mutex> lock(doneMutex);
+                    if (--left == 0)
+                    {
+                        done.notify_one();
+                    }
+                });
+            }
+        }
+        cond.notify_all();
+
+        std::unique_lock<std::mutex> lock(doneMutex);
+        done.wait(lock, [&]() { return left == 0; });
+    }
+
+  private:
+    /** @brief Worker thread: execute tasks from the queue. */
+    void work()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [this]() { return stop || !tasks.empty(); });
+                if (tasks.empty())
+                {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+
+    /** @brief Worker threads. */
+    std::vector<std::thread> workers;
+    /** @brief Queue of tasks. */
+    std::queue<std::function<void()>> tasks;
+    /** @brief Mutex to protect the queue. */
+    std::mutex mutex;
+    /** @brief Condition to wake up workers. */
+    std::condition_variable cond;
+    /** @brief Stop flag. */
+    bool stop = false;
+};
+
+/**
+ * @class Ring
+ * @brief io_uring instance: submission and completion queues mapped to
+ *        the process memory.
+ */
+class Ring
+{
+  public:
+    /**
+     * @brief Constructor: set up the ring.
+     *
+     * @throw std::system_error in case of errors
+     */
+    Ring()
+    {
+        io_uring_params params{};
+        fd = static_cast<int>(
+            syscall(SYS_io_uring_setup, ringEntries, &params));
+        if (fd == -1)
+        {
+            throw std::system_error(errno, std::system_category(),
+                                    "Unable to set up io_uring");
+        }
+
+        sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqSize = params.cq_off.cqes +
+                 params.cq_entries * sizeof(struct io_uring_cqe);
+        const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single)
+        {
+            sqSize = cqSize = std::max(sqSize, cqSize);
+        }
+        sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+        sq = map(sqSize, IORING_OFF_SQ_RING);
+        cq = single ? sq : map(cqSize, IORING_OFF_CQ_RING);
+        sqes = static_cast<io_uring_sqe*>(map(sqesSize, IORING_OFF_SQES));
+        if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED)
+        {
+            const int err = errno;
+            release();
+            throw std::system_error(err, std::system_category(),
+                                    "Unable to map io_uring");
+        }
+
+        uint8_t* sqPtr = static_cast<uint8_t*>(sq);
+        uint8_t* cqPtr = static_cast<uint8_t*>(cq);
+        sqTail = reinterpret_cast<unsigned*>(sqPtr + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(sqPtr + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sqPtr + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cqPtr + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cqPtr + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cqPtr + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cqPtr + params.cq_off.cqes);
+        entries = params.sq_entries;
+    }
+
+    ~Ring()
+    {
+        release();
+    }
+
+    Ring(const Ring&) = delete;
+    Ring& operator=(const Ring&) = delete;
+
+    /**
+     * @brief Check if the kernel supports all required operations.
+     *
+     * @return true if operations are supported
+     */
+    bool probe() const
+    {
+        constexpr unsigned maxOps = 256;
+        std::vector<uint8_t> buf(sizeof(io_uring_probe) +
+                                 maxOps * sizeof(io_uring_probe_op));
+        io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(buf.data());
+        if (syscall(SYS_io_uring_register, fd, IORING_REGISTER_PROBE, probe,
+                    maxOps) != 0)
+        {
+            return false;
+        }
+        for (const uint8_t op : uringOps)
+        {
+            if (op > probe->last_op ||
+                !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Submit operations and wait for their completion.
+     *
+     * @param[in,out] ops operations to execute
+     */
+    void run(std::vector<IoEngine::Op>& ops)
+    {
+        for (size_t pos = 0; pos < ops.size(); pos += entries)
+        {
+            const size_t num = std::min<size_t>(ops.size() - pos, entries);
+            const unsigned tail = *sqTail;
+            for (size_t i = 0; i < num; ++i)
+            {
+                const unsigned idx = (tail + i) & sqMask;
+                prepare(sqes[idx], ops[pos + i], pos + i);
+                sqArray[idx] = idx;
+            }
+            __atomic_store_n(sqTail, tail + num, __ATOMIC_RELEASE);
+
+            size_t submitted = 0;
+            size_t completed = 0;
+            while (completed < num)
+            {
+                const long rc =
+                    syscall(SYS_io_uring_enter, fd, num - submitted,
+                            num - completed, IORING_ENTER_GETEVENTS, nullptr,
+                            0);
+                if (rc < 0 && errno != EINTR && errno != EAGAIN &&
+                    errno != EBUSY)
+                {
+                    throw std::system_error(errno, std::system_category(),
+                                            "io_uring_enter failed");
+                }
+                if (rc > 0)
+                {
+                    submitted += rc;
+                }
+                completed += reap(ops);
+            }
+        }
+    }
+
+  private:
+    /**
+     * @brief Map ring memory.
+     *
+     * @param[in] size size of the region
+     * @param[in] offset offset of the region
+     *
+     * @return pointer to the mapped memory or MAP_FAILED
+     */
+    void* map(size_t size, off_t offset) const
+    {
+        return mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, offset);
+    }
+
+    /** @brief Unmap ring memory and close the ring. */
+    void release()
+    {
+        if (sqes && sqes != MAP_FAILED)
+        {
+            munmap(sqes, sqesSize);
+        }
+        if (cq && cq != MAP_FAILED && cq != sq)
+        {
+            munmap(cq, cqSize);
+        }
+        if (sq && sq != MAP_FAILED)
+        {
+            munmap(sq, sqSize);
+        }
+        ::close(fd);
+    }
+
+    /**
+     * @brief Fill submission queue entry.
+     *
+     * @param[out] sqe submission queue entry
+     * @param[in] op operation
+     * @param[in] index index of the operation
+     */
+    static void prepare(io_uring_sqe& sqe, const IoEngine::Op& op,
+                        size_t index)
+    {
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.fd = op.fd;
+        sqe.user_data = index;
+        switch (op.type)
+        {
+            case IoEngine::Op::Type::open:
+                sqe.opcode = IORING_OP_OPENAT;
+                sqe.addr = reinterpret_cast<uintptr_t>(op.name);
+                sqe.len = op.mode;
+                sqe.open_flags = op.flags;
+                break;
+            case IoEngine::Op::Type::statx:
+                sqe.opcode = IORING_OP_STATX;
+                sqe.addr = reinterpret_cast<uintptr_t>("");
+                sqe.len = STATX_BASIC_STATS;
+                sqe.off = reinterpret_cast<uintptr_t>(op.buf);
+                sqe.statx_flags = op.flags;
+                break;
+            case IoEngine::Op::Type::read:
+            case IoEngine::Op::Type::write:
+                sqe.opcode = op.type == IoEngine::Op::Type::read
+                                 ? IORING_OP_READ
+                                 : IORING_OP_WRITE;
+                sqe.addr = reinterpret_cast<uintptr_t>(op.buf);
+                sqe.len = static_cast<uint32_t>(op.size);
+                sqe.off = op.offset;
+                break;
+            case IoEngine::Op::Type::close:
+                sqe.opcode = IORING_OP_CLOSE;
+                break;
+        }
+    }
+
+    /**
+     * @brief Get results of completed operations.
+     *
+     * @param[in,out] ops executed operations
+     *
+     * @return number of completed operations
+     */
+    size_t reap(std::vector<IoEngine::Op>& ops)
+    {
+        unsigned head = *cqHead;
+        const unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        size_t num = 0;
+        for (; head != tail; ++head, ++num)
+        {
+            const io_uring_cqe& cqe = cqes[head & cqMask];
+            ops[cqe.user_data].result = cqe.res;
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        return num;
+    }
+
+    /** @brief Ring descriptor. */
+    int fd = -1;
+    /** @brief Number of submission queue entries. */
+    unsigned entries = 0;
+    /** @brief Submission queue ring. */
+    void* sq = nullptr;
+    /** @brief Size of the submission queue ring. */
+    size_t sqSize = 0;
+    /** @brief Completion queue ring. */
+    void* cq = nullptr;
+    /** @brief Size of the completion queue ring. */
+    size_t cqSize = 0;
+    /** @brief Submission queue entries. */
+    io_uring_sqe* sqes = nullptr;
+    /** @brief Size of submission queue entries. */
+    size_t sqesSize = 0;
+    /** @brief Submission queue tail. */
+    unsigned* sqTail = nullptr;
+    /** @brief Submission queue index mask. */
+    unsigned sqMask = 0;
+    /** @brief Submission queue index array. */
+    unsigned* sqArray = nullptr;
+    /** @brief Completion queue head. */
+    unsigned* cqHead = nullptr;
+    /** @brief Completion queue tail. */
+    unsigned* cqTail = nullptr;
+    /** @brief Completion queue index mask. */
+    unsigned cqMask = 0;
+    /** @brief Completion queue entries. */
+    io_uring_cqe* cqes = nullptr;
+};
+
+/**
+ * @class UringEngine
+ * @brief Engine that submits operations to io_uring.
+ *
+ * Rings are not thread safe, so each caller takes a free ring from the
+ * pool, new rings are created on demand.
+ */
+class UringEngine : public IoEngine
+{
+  public:
+    /**
+     * @brief Constructor.
+     *
+     * @throw std::runtime_error if io_uring is not supported
+     */
+    UringEngine()
+    {
+        auto ring = std::make_unique<Ring>();
+        if (!ring->probe())
+        {
+            throw std::runtime_error("io_uring doesn't support file I/O");
+        }
+        rings.push_back(std::move(ring));
+    }
+
+    const char* name() const override
+    {
+        return "uring";
+    }
+
+  protected:
+    void run(std::vector<Op>& ops) override
+    {
+        if (ops.empty())
+        {
+            return;
+        }
+
+        std::unique_ptr<Ring> ring;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!rings.empty())
+            {
+                ring = std::move(rings.back());
+                rings.pop_back();
+            }
+        }
+        if (!ring)
+        {
+            ring = std::make_unique<Ring>();
+        }
+
+        ring->run(ops);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        rings.push_back(std::move(ring));
+    }
+
+  private:
+    /** @brief Free rings. */
+    std::vector<std::unique_ptr<Ring>> rings;
+    /** @brief Mutex to protect the pool. */
+    std::mutex mutex;
+};
+
+std::unique_ptr<IoEngine> IoEngine::create(const std::string& name)
+{
+    if (name == "uring")
+    {
+        try
+        {
+            return std::make_unique<UringEngine>();
+        }
+        catch (const std::system_error& ex)
+        {
+            throw std::runtime_error(ex.what());
+        }
+    }
+    if (name == "threads")
+    {
+        return std::make_unique<ThreadEngine>();
+    }
+    if (name == "sync")
+    {
+        return std::make_unique<SyncEngine>();
+    }
+    if (name == "auto")
+    {
+        try
+        {
+            return std::make_unique<UringEngine>();
+        }
+        catch (const std::exception&)
+        {
+            // io_uring is not available (old kernel or disabled by policy)
+            return std::make_unique<ThreadEngine>();
+        }
+    }
+    throw std::invalid_argument("Unknown I/O engine: " + name);
+}
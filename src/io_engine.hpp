@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#pragma once
+
+#include <sys/stat.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @class IoEngine
+ * @brief Batched file I/O for trees of many small files.
+ *
+ * Files of a directory are processed in batches: all files of the batch are
+ * opened at once, then all of them are examined with statx, then content of
+ * all small files is read (or written) at once. Each step is a set of
+ * independent operations executed by the engine:
+ * - io_uring: one submission per step, a few syscalls for the whole batch;
+ * - threads: operations are spread over a pool of threads (portable
+ *   fallback for kernels without io_uring or where it is disabled);
+ * - sync: operations are executed one by one in the calling thread.
+ *
+ * Engines are thread safe, one engine can be shared by parallel jobs.
+ */
+class IoEngine
+{
+  public:
+    /** @brief Max number of files in one batch. */
+    static constexpr size_t batchSize = 64;
+    /** @brief Max size of the file content loaded in batch. */
+    static constexpr size_t smallFileSize = 16 * 1024;
+
+    /**
+     * @struct File
+     * @brief File processed in batch.
+     */
+    struct File
+    {
+        /** @brief Name of the file in the directory. */
+        std::string name;
+        /** @brief File descriptor, -1 if not opened. */
+        int fd = -1;
+        /** @brief Error code of the first failed operation, 0 on success. */
+        int error = 0;
+        /** @brief File status (read only). */
+        struct statx stx = {};
+        /** @brief Mode of the created file (write only). */
+        mode_t mode = 0644;
+        /** @brief File content. */
+        std::vector<uint8_t> data;
+        /** @brief Content is loaded completely (read only). */
+        bool loaded = false;
+    };
+
+    /**
+     * @struct Op
+     * @brief Single I/O operation.
+     */
+    struct Op
+    {
+        /** @brief Operation types. */
+        enum class Type
+        {
+            open,
+            statx,
+            read,
+            write,
+            close
+        };
+
+        /** @brief Operation type. */
+        Type type;
+        /** @brief File descriptor (directory descriptor for open). */
+        int fd;
+        /** @brief File name (open only). */
+        const char* name = nullptr;
+        /** @brief Open flags. */
+        int flags = 0;
+        /** @brief Mode of the created file. */
+        mode_t mode = 0;
+        /** @brief Data buffer (struct statx for statx). */
+        void* buf = nullptr;
+        /** @brief Size of the buffer. */
+        size_t size = 0;
+        /** @brief File offset. */
+        uint64_t offset = 0;
+        /** @brief Result: non-negative value on success, -errno on errors. */
+        long result = 0;
+    };
+
+    virtual ~IoEngine() = default;
+
+    /**
+     * @brief Create engine.
+     *
+     * @param[in] name engine name: uring, threads, sync or auto (io_uring if
+     *                 supported by the kernel, otherwise threads)
+     *
+     * @throw std::invalid_argument if name is unknown
+     * @throw std::runtime_error if engine is not supported
+     *
+     * @return pointer to the engine
+     */
+    static std::unique_ptr<IoEngine> create(const std::string& name = "auto");
+
+    /**
+     * @brief Get engine name.
+     *
+     * @return engine name
+     */
+    virtual const char* name() const = 0;
+
+    /**
+     * @brief Open files of the directory without following symlinks, get
+     *        their status and load content of small regular files.
+     *        Regular files and directories are opened for reading, other
+     *        entries are opened with O_PATH (see RootDir::openEntry).
+     *
+     * @param[in] dirFd descriptor of the directory
+     * @param[in,out] files files to open, descriptors must be closed by
+     *                      the caller
+     * @param[in] maxSize max size of the file content to load
+     */
+    void read(int dirFd, std::vector<File>& files,
+              size_t maxSize = smallFileSize);
+
+    /**
+     * @brief Create (or truncate) files in the directory and write their
+     *        content. Symlinks are not followed.
+     *
+     * @param[in] dirFd descriptor of the directory
+     * @param[in,out] files files to write, descriptors must be closed by
+     *                      the caller
+     */
+    void write(int dirFd, std::vector<File>& files);
+
+    /**
+     * @brief Close descriptors of the files, errors are ignored.
+     *
+     * @param[in,out] files files to close
+     */
+    void close(std::vector<File>& files);
+
+    /**
+     * @brief Execute single operation with blocking syscall.
+     *
+     * @param[in,out] op operation to execute
+     */
+    static void execute(Op& op);
+
+  protected:
+    /**
+     * @brief Execute independent operations.
+     *
+     * @param[in,out] ops operations to execute
+     */
+    virtual void run(std::vector<Op>& ops) = 0;
+};
+
+/**
+ * @class FileBatch
+ * @brief Owner of the files processed in batch, closes them on destruction.
+ */
+class FileBatch
+{
+  public:
+    /**
+     * @brief Constructor.
+     *
+     * @param[in] io I/O engine
+     */
+    explicit FileBatch(IoEngine& io) : io(io)
+    {}
+
+    ~FileBatch()
+    {
+        io.close(files);
+    }
+
+    FileBatch(const FileBatch&) = delete;
+    FileBatch& operator=(const FileBatch&) = delete;
+
+    /** @brief Files of the batch. */
+    std::vector<IoEngine::File> files;
+
+  private:
+    /** @brief I/O engine. */
+    IoEngine& io;
+};
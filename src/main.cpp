@@ -2,17 +2,34 @@
 // Copyright (C) 2020 YADRO
 
 #include "backup.hpp"
+#include "batch.hpp"
+#include "ini.hpp"
+#include "io_engine.hpp"
+#include "priority.hpp"
+#include "progress.hpp"
+#include "service.hpp"
 #include "version.hpp"
 
 #include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <iterator>
+#include <limits>
+#include <map>
 #include <stdexcept>
+#include <vector>
 
 namespace fs = std::filesystem;
 
+/** @brief Default path to the configuration file. */
+static const char* defaultConfig = "/etc/obmc-backup.conf";
+
 /**
  * @class Operation
  * @brief Operation types.
@@ -20,9 +37,243 @@ namespace fs = std::filesystem;
 enum class Operation
 {
     backup,
-    restore
+    restore,
+    trainDict,
+    batch,
+    rotate,
+    list,
+    inspect,
+    serve
 };
 
+/**
+ * @brief Parse size value with optional suffix (K, M, G).
+ *
+ * @param[in] text text to parse
+ * @param[out] size parsed value
+ *
+ * @return false if text has invalid format
+ */
+static bool parseSize(const char* text, uint64_t& size)
+{
+    char* end = nullptr;
+    errno = 0;
+    const unsigned long long num = strtoull(text, &end, 10);
+    if (errno || end == text || *text == '-')
+    {
+        return false;
+    }
+    unsigned shift = 0;
+    switch (*end)
+    {
+        case '\0':
+            break;
+        case 'k':
+        case 'K':
+            shift = 10;
+            break;
+        case 'm':
+        case 'M':
+            shift = 20;
+            break;
+        case 'g':
+        case 'G':
+            shift = 30;
+            break;
+        default:
+            return false;
+    }
+    if (*end && end[1])
+    {
+        return false;
+    }
+    if (num > (std::numeric_limits<uint64_t>::max() >> shift))
+    {
+        return false;
+    }
+    size = static_cast<uint64_t>(num) << shift;
+    return true;
+}
+
+/**
+ * @brief Parse boolean value.
+ *
+ * @param[in] text text to parse
+ * @param[out] value parsed value
+ *
+ * @return false if text has invalid format
+ */
+static bool parseBool(const std::string& text, bool& value)
+{
+    if (text == "yes" || text == "true" || text == "1")
+    {
+        value = true;
+    }
+    else if (text == "no" || text == "false" || text == "0")
+    {
+        value = false;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Names of settings in the order they are applied. Priorities go
+ *        first: they are properties of the thread, so every thread started
+ *        later (I/O pool, compression and batch workers) inherits them.
+ *        The I/O engine goes last as it starts its own pool of threads.
+ */
+static const char* const settingsOrder[] = {
+    "ioprio",     "nice",           "max-memory",   "max-tmp",
+    "rate",       "delta",          "key-file",     "passphrase-file",
+    "dictionary", "accounts-cache", "group-policy", "jobs",
+    "threads",    "keep-daily",     "keep-weekly",  "io-engine"};
+
+/**
+ * @brief Apply setting from command line or configuration file.
+ *
+ * @param[in] name setting name (long option name)
+ * @param[in] value setting value
+ * @param[out] backup backup instance to configure
+ * @param[out] jobs number of threads for batch mode
+ *
+ * @throw std::exception in case of errors
+ */
+static void applySetting(const std::string& name, const std::string& value,
+                         Backup& backup, size_t& jobs)
+{
+    bool valid = true;
+    if (name == "max-memory")
+    {
+        valid = parseSize(value.c_str(), backup.maxMemory);
+    }
+    else if (name == "max-tmp")
+    {
+        valid = parseSize(value.c_str(), backup.maxTmp);
+    }
+    else if (name == "rate")
+    {
+        uint64_t rate;
+        valid = parseSize(value.c_str(), rate);
+        if (valid)
+        {
+            backup.throttle =
+                rate ? std::make_shared<Throttle>(rate) : nullptr;
+        }
+    }
+    else if (name == "delta")
+    {
+        valid = parseBool(value, backup.deltaMode);
+    }
+    else if (name == "key-file")
+    {
+        backup.key =
+            std::make_shared<const CryptoKey>(CryptoKey::fromKeyFile(value));
+    }
+    else if (name == "passphrase-file")
+    {
+        backup.key = std::make_shared<const CryptoKey>(
+            CryptoKey::fromPassphraseFile(value));
+    }
+    else if (name == "dictionary")
+    {
+        backup.dictionary =
+            std::make_shared<const Dictionary>(Dictionary::load(value));
+    }
+    else if (name == "accounts-cache")
+    {
+        backup.accountsCacheDir = value;
+    }
+    else if (name == "jobs")
+    {
+        uint64_t num;
+        valid = parseSize(value.c_str(), num) && num <= 1024;
+        if (valid)
+        {
+            jobs = static_cast<size_t>(num);
+        }
+    }
+    else if (name == "threads")
+    {
+        uint64_t num;
+        valid = parseSize(value.c_str(), num) && num <= 1024;
+        if (valid)
+        {
+            backup.threads = static_cast<size_t>(num);
+        }
+    }
+    else if (name == "ioprio")
+    {
+        setIoPriority(value);
+    }
+    else if (name == "io-engine")
+    {
+        backup.ioEngine = IoEngine::create(value);
+    }
+    else if (name == "keep-daily" || name == "keep-weekly")
+    {
+        uint64_t num;
+        valid = parseSize(value.c_str(), num) && num <= 10000;
+        if (valid)
+        {
+            (name == "keep-daily" ? backup.keepDaily : backup.keepWeekly) =
+                static_cast<size_t>(num);
+        }
+    }
+    else if (name == "group-policy")
+    {
+        // comma separated list of [GROUP:]POLICY
+        backup.groupPolicies.clear();
+        size_t pos = 0;
+        while (pos <= value.size())
+        {
+            size_t end = value.find(',', pos);
+            if (end == std::string::npos)
+            {
+                end = value.size();
+            }
+            const std::string item = value.substr(pos, end - pos);
+            const size_t delim = item.find(':');
+            if (delim == std::string::npos)
+            {
+                backup.groupPolicies[""] = MemberSet::policy(item);
+            }
+            else
+            {
+                backup.groupPolicies[item.substr(0, delim)] =
+                    MemberSet::policy(item.substr(delim + 1));
+            }
+            pos = end + 1;
+        }
+    }
+    else if (name == "nice")
+    {
+        char* end = nullptr;
+        const long nice = strtol(value.c_str(), &end, 10);
+        valid = end != value.c_str() && !*end;
+        if (valid)
+        {
+            setCpuPriority(static_cast<int>(nice));
+        }
+    }
+    else
+    {
+        throw std::invalid_argument("Unknown setting: " + name);
+    }
+
+    if (!valid)
+    {
+        std::string err = "Invalid value for ";
+        err += name;
+        err += ": ";
+        err += value;
+        throw std::invalid_argument(err);
+    }
+}
+
 /**
  * @brief Print help usage info.
  *
@@ -33,28 +284,148 @@ static void printHelp(const char* app)
     puts("OpenBMC backup tool.");
     puts("Copyright (c) 2020 YADRO.");
     puts("Version " VERSION);
-    printf("Usage: %s [OPTION...] {backup|restore} FILE\n", app);
+    printf("Usage: %s [OPTION...] {backup|restore|inspect} FILE\n", app);
+    printf("       %s [OPTION...] train-dict DICT_FILE ARCHIVE...\n", app);
+    printf("       %s [OPTION...] batch JOB_FILE\n", app);
+    printf("       %s [OPTION...] {rotate|list} DIR\n", app);
+    printf("       %s [OPTION...] serve SOCKET\n", app);
     puts("  -a, --skip-accounts  Skip accounts data");
     puts("  -n, --skip-network   Skip network configuration");
     puts("  -y, --yes            Do not ask for confirmation");
+    puts("  -R, --resume         Continue interrupted operation with the same");
+    puts("                       archive from the last checkpoint");
+    puts("  -o, --only=PATTERN   Restore only files matching the pattern");
+    puts("                       (shell wildcards, can be repeated)");
+    puts("  -u, --only-user=NAME Restore only the specified user account,");
+    puts("                       other accounts are kept (can be repeated)");
+    puts("  -s, --dry-run[=FORMAT]");
+    puts("                       Show changes that restore would make without");
+    puts("                       applying them, FORMAT is text (default) or");
+    puts("                       json");
+    puts("  -m, --max-memory=SIZE");
+    puts("                       Max size of archive kept in memory");
+    puts("                       (default: 1M, 0 to disable in-memory mode)");
+    puts("  -t, --max-tmp=SIZE   Max size of data in temporary directory");
+    puts("                       (default: 0, limited by free space only)");
+    puts("  -r, --rate=SIZE      Limit I/O throughput, bytes per second");
+    puts("  -d, --delta          Store files as binary delta against RO image");
+    puts("  -k, --key-file=FILE  Encrypt/decrypt archive with 256-bit key");
+    puts("  -P, --passphrase-file=FILE");
+    puts("                       Encrypt/decrypt archive with passphrase");
+    puts("                       from the first line of FILE");
+    puts("  -D, --dictionary=FILE");
+    puts("                       Compression dictionary created with");
+    puts("                       train-dict");
+    puts("  -A, --accounts-cache=DIR");
+    puts("                       Directory for persistent cache of parsed");
+    puts("                       RO accounts files");
+    puts("  -G, --group-policy=[GROUP:]POLICY");
+    puts("                       Restore members of the allowed group (all");
+    puts("                       of them if GROUP is omitted): replace");
+    puts("                       (default), union with RO members or apply");
+    puts("                       changes against RO to the current members");
+    puts("                       (can be repeated)");
+    puts("  -j, --jobs=NUM       Max number of parallel jobs in batch mode");
+    puts("                       (default: 0, number of CPUs)");
+    puts("  -T, --threads=NUM    Number of archive compression threads");
+    puts("                       (default: 0, number of CPUs)");
+    puts("  -i, --ioprio=CLASS[:LEVEL]");
+    puts("                       Set I/O priority: idle, be or rt class,");
+    puts("                       level from 0 (highest) to 7 (lowest)");
+    puts("  -N, --nice=NICE      Set CPU priority, positive values also");
+    puts("                       enable batch scheduling policy");
+    puts("  -I, --io-engine=NAME Batched file I/O: uring, threads, sync or");
+    puts("                       auto (default: io_uring if supported,");
+    puts("                       otherwise threads)");
+    puts("  -K, --keep-daily=NUM Rotation: keep the latest archive of each of");
+    puts("                       the last NUM days");
+    puts("  -W, --keep-weekly=NUM");
+    puts("                       Rotation: keep the latest archive of each of");
+    puts("                       the last NUM weeks");
+    puts("  -c, --config=FILE    Configuration file");
+    printf("                       (default: %s)\n", defaultConfig);
+    puts("  -p, --profile=NAME   Use settings from the section NAME of the");
+    puts("                       configuration file");
     puts("  -h, --help           Print this help and exit");
+    puts("Settings from the configuration file have the same names as long");
+    puts("options (max-memory, max-tmp, rate, delta=yes|no, key-file,");
+    puts("passphrase-file, dictionary, accounts-cache, group-policy, jobs,");
+    puts("threads, ioprio, nice, io-engine, keep-daily, keep-weekly), options");
+    puts("from the command line override them.");
+    puts("Each line of the batch job file describes one job:");
+    puts("  backup|restore ARCHIVE ROOT_FS RO_FS");
+    puts("The service (serve) accepts the same lines from clients of the Unix");
+    puts("socket, ROOT_FS and RO_FS are optional there.");
+}
+
+/** @brief Cancellation token of the running operation. */
+static CancelToken* runningOperation = nullptr;
+
+/**
+ * @brief Signal handler: cancel the operation.
+ */
+static void cancelOperation(int)
+{
+    if (runningOperation)
+    {
+        runningOperation->cancel();
+    }
+}
+
+/** @brief Running service, stopped by SIGTERM and SIGINT. */
+static Service* runningService = nullptr;
+
+/**
+ * @brief Signal handler: stop the service.
+ */
+static void stopService(int)
+{
+    if (runningService)
+    {
+        runningService->stop();
+    }
 }
 
 /** @brief Application entry point. */
 int main(int argc, char* argv[])
 {
     Backup backup;
+    std::map<std::string, std::string> settings;
+    const char* configFile = nullptr;
+    const char* profile = nullptr;
 
     // clang-format off
     const struct option longOpts[] = {
-        {"skip-accounts", no_argument,       nullptr, 'a'},
-        {"skip-network",  no_argument,       nullptr, 'n'},
-        {"yes",           no_argument,       nullptr, 'y'},
-        {"help",          no_argument,       nullptr, 'h'},
-        {nullptr,         0,                 nullptr,  0 }
+        {"skip-accounts",   no_argument,       nullptr, 'a'},
+        {"skip-network",    no_argument,       nullptr, 'n'},
+        {"yes",             no_argument,       nullptr, 'y'},
+        {"resume",          no_argument,       nullptr, 'R'},
+        {"only",            required_argument, nullptr, 'o'},
+        {"only-user",       required_argument, nullptr, 'u'},
+        {"dry-run",         optional_argument, nullptr, 's'},
+        {"max-memory",      required_argument, nullptr, 'm'},
+        {"max-tmp",         required_argument, nullptr, 't'},
+        {"rate",            required_argument, nullptr, 'r'},
+        {"delta",           no_argument,       nullptr, 'd'},
+        {"key-file",        required_argument, nullptr, 'k'},
+        {"passphrase-file", required_argument, nullptr, 'P'},
+        {"dictionary",      required_argument, nullptr, 'D'},
+        {"accounts-cache",  required_argument, nullptr, 'A'},
+        {"group-policy",    required_argument, nullptr, 'G'},
+        {"jobs",            required_argument, nullptr, 'j'},
+        {"threads",         required_argument, nullptr, 'T'},
+        {"ioprio",          required_argument, nullptr, 'i'},
+        {"nice",            required_argument, nullptr, 'N'},
+        {"io-engine",       required_argument, nullptr, 'I'},
+        {"keep-daily",      required_argument, nullptr, 'K'},
+        {"keep-weekly",     required_argument, nullptr, 'W'},
+        {"config",          required_argument, nullptr, 'c'},
+        {"profile",         required_argument, nullptr, 'p'},
+        {"help",            no_argument,       nullptr, 'h'},
+        {nullptr,           0,                 nullptr,  0 }
     };
     // clang-format on
-    const char* shortOpts = "anyh";
+    const char* shortOpts = "anyRo:u:s::m:t:r:dk:P:D:A:G:j:T:i:N:I:K:W:c:p:h";
 
     opterr = 0; // prevent native error messages
 
@@ -73,6 +444,92 @@ int main(int argc, char* argv[])
             case 'y':
                 backup.unattendedMode = true;
                 break;
+            case 'R':
+                backup.resume = true;
+                break;
+            case 'o':
+                backup.onlyFiles.emplace_back(optarg);
+                break;
+            case 'u':
+                backup.onlyUsers.emplace(optarg);
+                break;
+            case 's':
+                if (!optarg || strcmp(optarg, "text") == 0)
+                {
+                    backup.report =
+                        std::make_shared<Report>(Report::Format::text);
+                }
+                else if (strcmp(optarg, "json") == 0)
+                {
+                    // keep the output a valid JSON document
+                    backup.report =
+                        std::make_shared<Report>(Report::Format::json);
+                    backup.verbose = false;
+                }
+                else
+                {
+                    fprintf(stderr, "Invalid report format: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'm':
+                settings["max-memory"] = optarg;
+                break;
+            case 't':
+                settings["max-tmp"] = optarg;
+                break;
+            case 'r':
+                settings["rate"] = optarg;
+                break;
+            case 'd':
+                settings["delta"] = "yes";
+                break;
+            case 'k':
+                settings["key-file"] = optarg;
+                break;
+            case 'P':
+                settings["passphrase-file"] = optarg;
+                break;
+            case 'D':
+                settings["dictionary"] = optarg;
+                break;
+            case 'A':
+                settings["accounts-cache"] = optarg;
+                break;
+            case 'G':
+            {
+                std::string& list = settings["group-policy"];
+                list += list.empty() ? "" : ",";
+                list += optarg;
+                break;
+            }
+            case 'j':
+                settings["jobs"] = optarg;
+                break;
+            case 'T':
+                settings["threads"] = optarg;
+                break;
+            case 'i':
+                settings["ioprio"] = optarg;
+                break;
+            case 'N':
+                settings["nice"] = optarg;
+                break;
+            case 'I':
+                settings["io-engine"] = optarg;
+                break;
+            case 'K':
+                settings["keep-daily"] = optarg;
+                break;
+            case 'W':
+                settings["keep-weekly"] = optarg;
+                break;
+            case 'c':
+                configFile = optarg;
+                break;
+            case 'p':
+                profile = optarg;
+                break;
             case 'h':
                 printHelp(argv[0]);
                 return EXIT_SUCCESS;
@@ -82,21 +539,13 @@ int main(int argc, char* argv[])
         }
     }
 
-    // there are must be exactly 2 positional arguments (operation + file name)
-    const int maxArgc = optind + 2;
-    if (maxArgc > argc)
+    // get operation type from positional argument
+    if (optind >= argc)
     {
         fprintf(stderr,
                 "Invalid arguments: expected \"backup|restore FILE\"\n");
         return EXIT_FAILURE;
     }
-    else if (maxArgc < argc)
-    {
-        fprintf(stderr, "Unexpected argument: %s\n", argv[maxArgc]);
-        return EXIT_FAILURE;
-    }
-
-    // get operation type from positional argument
     Operation operation;
     if (strcmp(argv[optind], "backup") == 0)
     {
@@ -106,15 +555,77 @@ int main(int argc, char* argv[])
     {
         operation = Operation::restore;
     }
+    else if (strcmp(argv[optind], "train-dict") == 0)
+    {
+        operation = Operation::trainDict;
+    }
+    else if (strcmp(argv[optind], "batch") == 0)
+    {
+        operation = Operation::batch;
+    }
+    else if (strcmp(argv[optind], "rotate") == 0)
+    {
+        operation = Operation::rotate;
+    }
+    else if (strcmp(argv[optind], "list") == 0)
+    {
+        operation = Operation::list;
+    }
+    else if (strcmp(argv[optind], "inspect") == 0)
+    {
+        operation = Operation::inspect;
+    }
+    else if (strcmp(argv[optind], "serve") == 0)
+    {
+        operation = Operation::serve;
+    }
     else
     {
         fprintf(stderr,
-                "Invalid argument: %s, expected \"backup\" or \"restore\"\n",
+                "Invalid argument: %s, expected \"backup\", \"restore\", "
+                "\"train-dict\", \"batch\", \"rotate\", \"list\", "
+                "\"inspect\" or \"serve\"\n",
                 argv[optind]);
         return EXIT_FAILURE;
     }
     ++optind;
 
+    // train-dict expects dictionary file and at least one archive,
+    // other operations expect exactly one file name
+    const int minArgc = optind + (operation == Operation::trainDict ? 2 : 1);
+    if (minArgc > argc)
+    {
+        fprintf(stderr, "Invalid arguments: expected %s\n",
+                operation == Operation::trainDict
+                    ? "\"train-dict DICT_FILE ARCHIVE...\""
+                : operation == Operation::batch
+                    ? "\"batch JOB_FILE\""
+                : operation == Operation::rotate || operation == Operation::list
+                    ? "\"rotate|list DIR\""
+                : operation == Operation::serve
+                    ? "\"serve SOCKET\""
+                    : "\"backup|restore|inspect FILE\"");
+        return EXIT_FAILURE;
+    }
+    else if (operation != Operation::trainDict && minArgc < argc)
+    {
+        fprintf(stderr, "Unexpected argument: %s\n", argv[minArgc]);
+        return EXIT_FAILURE;
+    }
+    if (operation != Operation::restore &&
+        (!backup.onlyFiles.empty() || !backup.onlyUsers.empty()))
+    {
+        fprintf(stderr, "Options --only and --only-user are applicable to "
+                        "restore operation only\n");
+        return EXIT_FAILURE;
+    }
+    if (operation != Operation::restore && backup.report)
+    {
+        fprintf(stderr,
+                "Option --dry-run is applicable to restore operation only\n");
+        return EXIT_FAILURE;
+    }
+
     // get file name from positional argument
     backup.archiveFile = argv[optind];
     if (backup.archiveFile.empty())
@@ -122,23 +633,138 @@ int main(int argc, char* argv[])
         fprintf(stderr, "Backup file name can not be empty\n");
         return EXIT_FAILURE;
     }
+    const std::vector<fs::path> archives(argv + optind + 1, argv + argc);
 
+    std::shared_ptr<ProgressBar> progressBar;
     try
     {
+        // settings priority: command line, profile, common config
+        if (configFile || profile || fs::exists(defaultConfig))
+        {
+            const fs::path cfg = configFile ? configFile : defaultConfig;
+            if (profile)
+            {
+                const auto values = parseIni(cfg, profile);
+                if (values.empty())
+                {
+                    std::string err = "Profile not found: ";
+                    err += profile;
+                    throw std::runtime_error(err);
+                }
+                settings.insert(values.begin(), values.end());
+            }
+            const auto values = parseIni(cfg);
+            settings.insert(values.begin(), values.end());
+        }
+        if (settings.count("key-file") && settings.count("passphrase-file"))
+        {
+            throw std::invalid_argument(
+                "Options key-file and passphrase-file are mutually exclusive");
+        }
+        for (const auto& it : settings)
+        {
+            if (std::find_if(std::begin(settingsOrder),
+                             std::end(settingsOrder), [&](const char* name) {
+                                 return it.first == name;
+                             }) == std::end(settingsOrder))
+            {
+                throw std::invalid_argument("Unknown setting: " + it.first);
+            }
+        }
+        settings.emplace("io-engine", "auto");
+        size_t jobs = 0;
+        for (const char* name : settingsOrder)
+        {
+            const auto it = settings.find(name);
+            if (it != settings.end())
+            {
+                applySetting(it->first, it->second, backup, jobs);
+            }
+        }
+
+        // SIGINT and SIGTERM cancel the operation, so temporary data is
+        // removed, the second signal terminates the process
+        const auto cancel = std::make_shared<CancelToken>();
+        if (operation != Operation::serve)
+        {
+            backup.cancel = cancel;
+            runningOperation = cancel.get();
+            struct sigaction sa = {};
+            sa.sa_handler = cancelOperation;
+            sa.sa_flags = SA_RESETHAND;
+            sigaction(SIGTERM, &sa, nullptr);
+            sigaction(SIGINT, &sa, nullptr);
+        }
+        if ((operation == Operation::backup ||
+             operation == Operation::restore) &&
+            !backup.report && isatty(STDERR_FILENO))
+        {
+            progressBar = std::make_shared<ProgressBar>(stderr);
+            backup.progressSink = progressBar;
+        }
+
         if (operation == Operation::backup)
         {
             backup.backup();
             printf("Backup created: %s\n", backup.archiveFile.c_str());
         }
+        else if (operation == Operation::rotate)
+        {
+            backup.rotate(backup.archiveFile);
+        }
+        else if (operation == Operation::list)
+        {
+            backup.list(backup.archiveFile);
+        }
+        else if (operation == Operation::inspect)
+        {
+            backup.inspect(backup.archiveFile);
+        }
+        else if (operation == Operation::serve)
+        {
+            Service service(backup, backup.archiveFile);
+            struct sigaction sa = {};
+            sa.sa_handler = stopService;
+            runningService = &service;
+            sigaction(SIGTERM, &sa, nullptr);
+            sigaction(SIGINT, &sa, nullptr);
+            service.run();
+            runningService = nullptr;
+        }
+        else if (operation == Operation::trainDict)
+        {
+            backup.trainDictionary(backup.archiveFile, archives);
+        }
+        else if (operation == Operation::batch)
+        {
+            const Batch batch(backup, jobs);
+            const auto jobList = Batch::load(backup.archiveFile);
+            const auto results = batch.run(jobList);
+            batch.print(jobList, results);
+            for (const auto& it : results)
+            {
+                if (!it.error.empty())
+                {
+                    return EXIT_FAILURE;
+                }
+            }
+        }
         else
         {
             backup.restore();
-            puts("Configuration was restored.");
-            puts("Please reboot the BMC to apply changes.");
+            if (!backup.report)
+            {
+                puts("Configuration was restored.");
+                puts("Please reboot the BMC to apply changes.");
+            }
         }
     }
     catch (std::exception& ex)
     {
+        if (progressBar)
+        {
+            progressBar->close();
+        }
         fprintf(stderr, "%s\n", ex.what());
         return EXIT_FAILURE;
     }
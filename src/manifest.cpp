@@ -1,6 +1,8 @@
 // SPDX-License-Identifier: Apache-2.0
 // Copyright (C) 2020 YADRO
 
+#include "accounts_cache.hpp"
+#include "ini.hpp"
 #include "manifest.hpp"
 
 #include <limits.h>
@@ -14,6 +16,9 @@ namespace fs = std::filesystem;
 /** @brief Name of the manifest file. */
 static const std::string manifestFile = "bmc.manifest";
 
+/** @brief Name of the section with list of delta files. */
+static const std::string deltaSection = "delta";
+
 /** @brief Name of OS version property. */
 static const std::string osVersionProp = "VERSION";
 /** @brief Name of machine (platform) name property. */
@@ -21,46 +26,18 @@ static const std::string machineNameProp = "MACHINE";
 /** @brief Name of host name property. */
 static const std::string hostNameProp = "HOSTNAME";
 
-/**
- * @brief Parse ini file.
- *
- * @param[in] iniFile path to the ini file to parse
- *
- * @throw std::runtime_error in case of errors
- *
- * @return map of ini values
- */
-static std::map<std::string, std::string> parseIni(const fs::path& iniFile)
-{
-    std::map<std::string, std::string> data;
-    const std::regex iniRegex("([^= ]+)\\s*=\\s*\"?([^\"]+)\"?");
-
-    std::ifstream file(iniFile);
-    if (!file)
-    {
-        std::string err = "Error opening file ";
-        err += iniFile;
-        throw std::runtime_error(err);
-    }
-    std::string line;
-    while (std::getline(file, line))
-    {
-        std::smatch match;
-        if (std::regex_match(line, match, iniRegex))
-        {
-            const auto& name = match[1].str();
-            const auto& value = match[2].str();
-            data.insert(std::make_pair(name, value));
-        }
-    }
-
-    return data;
-}
-
-Manifest::Manifest(const std::filesystem::path& rootFs)
+Manifest::Manifest(const std::filesystem::path& rootFs, AccountsCache* cache)
 {
+    using Ini = std::map<std::string, std::string>;
     const fs::path osRelease = rootFs / "etc/os-release";
-    const std::map<std::string, std::string> ini = parseIni(osRelease);
+    // host name is not cached: it can be changed without touching os-release
+    const std::shared_ptr<const Ini> osrData =
+        cache ? cache->get<Ini>(osRelease,
+                                [](Ini& data, const fs::path& file) {
+                                    data = parseIni(file);
+                                })
+              : std::make_shared<const Ini>(parseIni(osRelease));
+    const Ini& ini = *osrData;
     const std::map<std::string, std::string> osr{
         {"OPENBMC_TARGET_MACHINE", machineNameProp},
         {"VERSION", osVersionProp}};
@@ -107,6 +84,8 @@ Manifest Manifest::load(const fs::path& dir)
         manifest.properties.insert(*val);
     }
 
+    manifest.deltaFiles = parseIni(mnfFile, deltaSection);
+
     return manifest;
 }
 
@@ -124,6 +103,19 @@ void Manifest::save(const fs::path& dir) const
     {
         file << it.first << "=\"" << it.second << '"' << std::endl;
     }
+    if (!deltaFiles.empty())
+    {
+        file << '[' << deltaSection << ']' << std::endl;
+        for (const auto& it : deltaFiles)
+        {
+            file << it.first << "=\"" << it.second << '"' << std::endl;
+        }
+    }
+}
+
+const std::string& Manifest::fileName()
+{
+    return manifestFile;
 }
 
 void Manifest::print() const
@@ -161,3 +153,8 @@ const std::string& Manifest::hostName() const
 {
     return properties.find(hostNameProp)->second;
 }
+
+void Manifest::addDelta(const std::string& path, const std::string& baseHash)
+{
+    deltaFiles[path] = baseHash;
+}
@@ -6,6 +6,8 @@
 #include <filesystem>
 #include <map>
 
+class AccountsCache;
+
 /**
  * @struct Manifest
  * @brief Manifest file.
@@ -20,10 +22,12 @@ class Manifest
      * @brief Constructor - create manifest for current system.
      *
      * @param[in] rootFs path to the root FS
+     * @param[in] cache cache of parsed files, nullptr = parse os-release
      *
      * @throw std::runtime_error in case of errors
      */
-    Manifest(const std::filesystem::path& rootFs);
+    Manifest(const std::filesystem::path& rootFs,
+             AccountsCache* cache = nullptr);
 
     /**
      * @brief Load manifest from file.
@@ -45,6 +49,13 @@ class Manifest
      */
     void save(const std::filesystem::path& dir) const;
 
+    /**
+     * @brief Get name of the manifest file.
+     *
+     * @return file name relative to the archive root
+     */
+    static const std::string& fileName();
+
     /**
      * @brief Print manifest data to stdout.
      */
@@ -59,7 +70,27 @@ class Manifest
     /** @brief Get host name. */
     const std::string& hostName() const;
 
+    /**
+     * @brief Register file stored as binary delta against RO image.
+     *
+     * @param[in] path relative path to the file
+     * @param[in] baseHash content hash of the base file on RO FS
+     */
+    void addDelta(const std::string& path, const std::string& baseHash);
+
+    /**
+     * @brief Get files stored as binary delta.
+     *
+     * @return map: relative path -> content hash of the base file
+     */
+    const std::map<std::string, std::string>& deltas() const
+    {
+        return deltaFiles;
+    }
+
   private:
     /** @brief Properties. */
     std::map<std::string, std::string> properties;
+    /** @brief Files stored as binary delta. */
+    std::map<std::string, std::string> deltaFiles;
 };
@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "member_set.hpp"
+
+#include <iterator>
+#include <stdexcept>
+
+MemberSet MemberSet::unite(const MemberSet& lhs, const MemberSet& rhs)
+{
+    MemberSet result;
+    result.names.reserve(lhs.size() + rhs.size());
+    std::set_union(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+                   std::back_inserter(result.names));
+    return result;
+}
+
+MemberSet MemberSet::intersect(const MemberSet& lhs, const MemberSet& rhs)
+{
+    MemberSet result;
+    result.names.reserve(std::min(lhs.size(), rhs.size()));
+    std::set_intersection(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+                          std::back_inserter(result.names));
+    return result;
+}
+
+MemberSet MemberSet::subtract(const MemberSet& lhs, const MemberSet& rhs)
+{
+    MemberSet result;
+    result.names.reserve(lhs.size());
+    std::set_difference(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+                        std::back_inserter(result.names));
+    return result;
+}
+
+MemberSet MemberSet::merge(Policy policy, const MemberSet& ro,
+                           const MemberSet& backup, const MemberSet& current)
+{
+    switch (policy)
+    {
+        case Policy::unite:
+            return unite(ro, backup);
+        case Policy::apply:
+        {
+            const MemberSet added = subtract(backup, ro);
+            const MemberSet removed = subtract(ro, backup);
+            return subtract(unite(current, added), removed);
+        }
+        case Policy::replace:
+            break;
+    }
+    return backup;
+}
+
+MemberSet::Policy MemberSet::policy(const std::string& name)
+{
+    if (name == "replace")
+    {
+        return Policy::replace;
+    }
+    if (name == "union")
+    {
+        return Policy::unite;
+    }
+    if (name == "apply")
+    {
+        return Policy::apply;
+    }
+    std::string err = "Invalid group policy: ";
+    err += name;
+    throw std::invalid_argument(err);
+}
+
+bool MemberSet::contains(std::string_view name) const
+{
+    const auto it = std::lower_bound(names.begin(), names.end(), name);
+    return it != names.end() && *it == name;
+}
+
+std::string MemberSet::toString() const
+{
+    std::string list;
+    for (const auto& it : names)
+    {
+        if (!list.empty())
+        {
+            list += ',';
+        }
+        list += it;
+    }
+    return list;
+}
@@ -0,0 +1,161 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @class MemberSet
+ * @brief Sorted list of unique group members.
+ *
+ * All set operations are single merge passes, linear in the number of
+ * members of both operands.
+ */
+class MemberSet
+{
+  public:
+    /**
+     * @brief Policy of restoring group members.
+     */
+    enum class Policy
+    {
+        /** Members from the backup. */
+        replace,
+        /** Members from the RO image and from the backup. */
+        unite,
+        /** Changes made in the backup against the RO image are applied to
+         *  the current members. */
+        apply
+    };
+
+    MemberSet() = default;
+
+    /**
+     * @brief Constructor: create set from a list of names.
+     *
+     * @param[in] first begin of the list
+     * @param[in] last end of the list
+     */
+    template <class It>
+    MemberSet(It first, It last)
+    {
+        for (; first != last; ++first)
+        {
+            names.emplace_back(*first);
+        }
+        std::sort(names.begin(), names.end());
+        names.erase(std::unique(names.begin(), names.end()), names.end());
+    }
+
+    /**
+     * @brief Constructor: create set from a list of names.
+     *
+     * @param[in] list list of names
+     */
+    template <class C>
+    explicit MemberSet(const C& list) : MemberSet(list.begin(), list.end())
+    {}
+
+    /**
+     * @brief Get union of two sets.
+     *
+     * @param[in] lhs first set
+     * @param[in] rhs second set
+     *
+     * @return members of any set
+     */
+    static MemberSet unite(const MemberSet& lhs, const MemberSet& rhs);
+
+    /**
+     * @brief Get intersection of two sets.
+     *
+     * @param[in] lhs first set
+     * @param[in] rhs second set
+     *
+     * @return members of both sets
+     */
+    static MemberSet intersect(const MemberSet& lhs, const MemberSet& rhs);
+
+    /**
+     * @brief Get difference of two sets.
+     *
+     * @param[in] lhs first set
+     * @param[in] rhs second set
+     *
+     * @return members of the first set that are not in the second one
+     */
+    static MemberSet subtract(const MemberSet& lhs, const MemberSet& rhs);
+
+    /**
+     * @brief Merge members according to the policy.
+     *
+     * @param[in] policy restore policy
+     * @param[in] ro members from the RO image
+     * @param[in] backup members from the backup
+     * @param[in] current current members
+     *
+     * @return members to restore
+     */
+    static MemberSet merge(Policy policy, const MemberSet& ro,
+                           const MemberSet& backup, const MemberSet& current);
+
+    /**
+     * @brief Get policy by name.
+     *
+     * @param[in] name policy name: replace, union or apply
+     *
+     * @throw std::invalid_argument if policy is unknown
+     *
+     * @return policy
+     */
+    static Policy policy(const std::string& name);
+
+    /**
+     * @brief Check if the name is in the set.
+     *
+     * @param[in] name member name
+     *
+     * @return true if the set contains the name
+     */
+    bool contains(std::string_view name) const;
+
+    /**
+     * @brief Serialize to comma separated list.
+     *
+     * @return list of members
+     */
+    std::string toString() const;
+
+    bool operator==(const MemberSet& other) const
+    {
+        return names == other.names;
+    }
+
+    size_t size() const
+    {
+        return names.size();
+    }
+
+    bool empty() const
+    {
+        return names.empty();
+    }
+
+    std::vector<std::string>::const_iterator begin() const
+    {
+        return names.begin();
+    }
+
+    std::vector<std::string>::const_iterator end() const
+    {
+        return names.end();
+    }
+
+  private:
+    /** @brief Sorted unique member names. */
+    std::vector<std::string> names;
+};
@@ -0,0 +1,632 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "io_engine.hpp"
+#include "metadata.hpp"
+#include "root_dir.hpp"
+#include "throttle.hpp"
+
+#include <fcntl.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <map>
+#include <system_error>
+
+namespace fs = std::filesystem;
+
+/** @brief Initial size of the buffer for extended attributes. */
+static constexpr size_t xattrBufferSize = 1024;
+/** @brief Size of the chunk used for copying file content. */
+static constexpr size_t chunkSize = 64 * 1024;
+
+/**
+ * @struct LinkMap
+ * @brief Map of copied hard links: source inode to descriptor of the copy.
+ */
+struct LinkMap : std::map<std::pair<dev_t, ino_t>, int>
+{
+    ~LinkMap()
+    {
+        for (const auto& it : *this)
+        {
+            close(it.second);
+        }
+    }
+};
+
+/**
+ * @struct CopyContext
+ * @brief State of recursive copy shared by all entries.
+ */
+struct CopyContext
+{
+    /** @brief Map of copied hard links. */
+    LinkMap links;
+    /** @brief Engine for batched copy of small files, nullptr if not used. */
+    IoEngine* io = nullptr;
+    /** @brief I/O throughput limiter, nullptr to disable. */
+    Throttle* throttle = nullptr;
+    /** @brief Flush copied files and directories to the storage. */
+    bool sync = false;
+
+    /**
+     * @brief Report content of the copied file to the throttle.
+     *
+     * @param[in] size size of the file
+     */
+    void consume(uint64_t size) const
+    {
+        if (throttle)
+        {
+            throttle->consume(2 * size); // read + write
+        }
+    }
+
+    /**
+     * @brief Flush the copied file or directory if sync is enabled.
+     *
+     * @param[in] fd descriptor of the copy
+     * @param[in] path path to the copy (for error messages)
+     *
+     * @throw std::system_error in case of errors
+     */
+    void flush(int fd, const fs::path& path) const
+    {
+        if (sync && fsync(fd) != 0)
+        {
+            throw std::system_error(errno, std::system_category(), path);
+        }
+    }
+};
+
+/**
+ * @brief Check if error means that metadata can't be applied on this system
+ *        or by this user, such errors are ignored.
+ *
+ * @param[in] err error code
+ *
+ * @return true if error must be ignored
+ */
+static bool isUnsupported(int err)
+{
+    return err == EPERM || err == ENOTSUP || err == EOPNOTSUPP;
+}
+
+/**
+ * @brief Call xattr function that fills buffer, grow the buffer if needed.
+ *
+ * @param[in,out] buf buffer
+ * @param[in] fn function to call, gets buffer and returns size or -1
+ *
+ * @return size of the data, -1 on errors
+ */
+template <class F>
+static ssize_t xattrCall(std::string& buf, F fn)
+{
+    buf.resize(xattrBufferSize);
+    ssize_t len;
+    while ((len = fn(buf.data(), buf.size())) < 0 && errno == ERANGE)
+    {
+        buf.resize(buf.size() * 4);
+    }
+    return len;
+}
+
+/**
+ * @brief Get path to the entry of opened directory, used for calls that
+ *        don't have descriptor based versions (xattrs of symlinks).
+ *
+ * @param[in] dirFd descriptor of the directory or AT_FDCWD
+ * @param[in] name name of the entry
+ *
+ * @return path to the entry
+ */
+static std::string entryPath(int dirFd, const char* name)
+{
+    if (dirFd == AT_FDCWD)
+    {
+        return name;
+    }
+    std::string path = "/proc/self/fd/";
+    path += std::to_string(dirFd);
+    path += '/';
+    path += name;
+    return path;
+}
+
+Metadata Metadata::load(const fs::path& path)
+{
+    const int fd = RootDir::openEntry(AT_FDCWD, path.c_str());
+    if (fd == -1)
+    {
+        throw std::system_error(errno, std::system_category(), path);
+    }
+    const FileHandle guard(fd);
+    return load(fd, AT_FDCWD, path.c_str(), path);
+}
+
+Metadata Metadata::load(int fd, int dirFd, const char* name,
+                        const fs::path& path)
+{
+    struct statx stx;
+    if (statx(fd, "", AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW, STATX_BASIC_STATS,
+              &stx) != 0)
+    {
+        throw std::system_error(errno, std::system_category(), path);
+    }
+    return load(stx, fd, dirFd, name, path);
+}
+
+Metadata Metadata::load(const struct statx& stx, int fd, int dirFd,
+                        const char* name, const fs::path& path)
+{
+    Metadata meta;
+    meta.mode = stx.stx_mode;
+    meta.uid = stx.stx_uid;
+    meta.gid = stx.stx_gid;
+    meta.size = stx.stx_size;
+    meta.mtime.tv_sec = stx.stx_mtime.tv_sec;
+    meta.mtime.tv_nsec = stx.stx_mtime.tv_nsec;
+    meta.nlink = stx.stx_nlink;
+    meta.inode = {makedev(stx.stx_dev_major, stx.stx_dev_minor), stx.stx_ino};
+
+    // only regular files and directories are opened for reading,
+    // other entries are accessed through the parent directory
+    const bool opened = S_ISREG(meta.mode) || S_ISDIR(meta.mode);
+    const std::string link = opened ? std::string() : entryPath(dirFd, name);
+
+    std::string names;
+    const ssize_t len = xattrCall(names, [&](char* buf, size_t size) {
+        return opened ? flistxattr(fd, buf, size)
+                      : llistxattr(link.c_str(), buf, size);
+    });
+    if (len < 0)
+    {
+        if (isUnsupported(errno))
+        {
+            return meta;
+        }
+        throw std::system_error(errno, std::system_category(), path);
+    }
+
+    std::string value;
+    for (size_t pos = 0; pos < static_cast<size_t>(len);)
+    {
+        const std::string attr = names.c_str() + pos;
+        pos += attr.size() + 1;
+        const ssize_t vlen = xattrCall(value, [&](char* buf, size_t size) {
+            return opened ? fgetxattr(fd, attr.c_str(), buf, size)
+                          : lgetxattr(link.c_str(), attr.c_str(), buf, size);
+        });
+        if (vlen < 0)
+        {
+            if (errno == ENODATA || isUnsupported(errno))
+            {
+                continue; // removed or not readable by this user
+            }
+            throw std::system_error(errno, std::system_category(), path);
+        }
+        meta.xattrs.emplace_back(attr, value.substr(0, vlen));
+    }
+
+    return meta;
+}
+
+void Metadata::apply(int fd, const fs::path& path, bool times) const
+{
+    // change owner first: it resets setuid/setgid bits
+    if (fchown(fd, uid, gid) != 0 && !isUnsupported(errno))
+    {
+        throw std::system_error(errno, std::system_category(), path);
+    }
+    if (fchmod(fd, mode & 07777) != 0)
+    {
+        throw std::system_error(errno, std::system_category(), path);
+    }
+    // ACLs are set after mode as they override group permissions
+    for (const auto& [name, value] : xattrs)
+    {
+        if (fsetxattr(fd, name.c_str(), value.data(), value.size(), 0) != 0 &&
+            !isUnsupported(errno))
+        {
+            throw std::system_error(errno, std::system_category(), path);
+        }
+    }
+    if (times)
+    {
+        const timespec ts[2] = {{0, UTIME_OMIT}, mtime};
+        if (futimens(fd, ts) != 0)
+        {
+            throw std::system_error(errno, std::system_category(), path);
+        }
+    }
+}
+
+void Metadata::applyLink(const fs::path& path) const
+{
+    applyLink(AT_FDCWD, path.c_str(), path);
+}
+
+void Metadata::applyLink(int dirFd, const char* name,
+                         const fs::path& path) const
+{
+    if (fchownat(dirFd, name, uid, gid, AT_SYMLINK_NOFOLLOW) != 0 &&
+        !isUnsupported(errno))
+    {
+        throw std::system_error(errno, std::system_category(), path);
+    }
+    const std::string link = entryPath(dirFd, name);
+    for (const auto& [attr, value] : xattrs)
+    {
+        if (lsetxattr(link.c_str(), attr.c_str(), value.data(), value.size(),
+                      0) != 0 &&
+            !isUnsupported(errno))
+        {
+            throw std::system_error(errno, std::system_category(), path);
+        }
+    }
+    const timespec ts[2] = {{0, UTIME_OMIT}, mtime};
+    if (utimensat(dirFd, name, ts, AT_SYMLINK_NOFOLLOW) != 0)
+    {
+        throw std::system_error(errno, std::system_category(), path);
+    }
+}
+
+/**
+ * @brief Copy content of the regular file.
+ *
+ * @param[in] in source file descriptor
+ * @param[in] out destination file descriptor
+ * @param[in] src path to the source (for error messages)
+ * @param[in] dst path to the destination (for error messages)
+ *
+ * @throw std::system_error in case of errors
+ */
+static void copyContent(int in, int out, const fs::path& src,
+                        const fs::path& dst)
+{
+    std::vector<char> chunk(chunkSize);
+    ssize_t len;
+    while ((len = read(in, chunk.data(), chunk.size())) != 0)
+    {
+        if (len < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw std::system_error(errno, std::system_category(), src);
+        }
+        const char* ptr = chunk.data();
+        while (len)
+        {
+            const ssize_t rc = write(out, ptr, len);
+            if (rc < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::system_error(errno, std::system_category(), dst);
+            }
+            if (rc == 0)
+            {
+                throw std::system_error(EIO, std::system_category(), dst);
+            }
+            ptr += rc;
+            len -= rc;
+        }
+    }
+}
+
+/**
+ * @brief Remove file or directory with all its content.
+ *
+ * @param[in] dirFd descriptor of the parent directory
+ * @param[in] name name of the entry to remove
+ * @param[in] isDir entry is a directory
+ * @param[in] path path to the entry (for error messages)
+ *
+ * @throw std::system_error in case of errors
+ */
+static void removeEntry(int dirFd, const char* name, bool isDir,
+                        const fs::path& path)
+{
+    if (isDir)
+    {
+        const int fd = openat(dirFd, name,
+                              O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd == -1)
+        {
+            throw std::system_error(errno, std::system_category(), path);
+        }
+        const FileHandle guard(fd);
+        for (const auto& it : RootDir::list(fd, path))
+        {
+            struct stat st;
+            const bool dir =
+                fstatat(fd, it.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+                S_ISDIR(st.st_mode);
+            removeEntry(fd, it.c_str(), dir, path / it);
+        }
+    }
+    if (unlinkat(dirFd, name, isDir ? AT_REMOVEDIR : 0) != 0)
+    {
+        throw std::system_error(errno, std::system_category(), path);
+    }
+}
+
+static void copyTree(int src, int srcDir, const char* srcName,
+                     const fs::path& srcPath, int dstDir, const char* dstName,
+                     const fs::path& dstPath, CopyContext& ctx,
+                     const Metadata* known);
+
+/**
+ * @brief Copy directory entries in batches: small regular files are read and
+ *        written with the I/O engine, other entries are copied one by one.
+ *
+ * @param[in] src descriptor of the source directory
+ * @param[in] srcPath path to the source directory (for error messages)
+ * @param[in] dst descriptor of the destination directory
+ * @param[in] dstPath path to the destination directory (for error messages)
+ * @param[in] names names of the entries to copy
+ * @param[in,out] ctx copy state, the I/O engine must be set
+ *
+ * @throw std::exception in case of errors
+ */
+static void copyEntries(int src, const fs::path& srcPath, int dst,
+                        const fs::path& dstPath,
+                        const std::vector<std::string>& names,
+                        CopyContext& ctx)
+{
+    IoEngine& io = *ctx.io;
+    for (size_t pos = 0; pos < names.size(); pos += IoEngine::batchSize)
+    {
+        const size_t end = std::min(names.size(), pos + IoEngine::batchSize);
+        FileBatch in(io);
+        in.files.resize(end - pos);
+        for (size_t i = pos; i < end; ++i)
+        {
+            in.files[i - pos].name = names[i];
+        }
+        io.read(src, in.files);
+
+        FileBatch out(io);
+        std::vector<Metadata> metas;
+        for (auto& file : in.files)
+        {
+            const char* name = file.name.c_str();
+            const fs::path from = srcPath / file.name;
+            if (file.error)
+            {
+                throw std::system_error(file.error, std::system_category(),
+                                        from);
+            }
+            const Metadata meta =
+                Metadata::load(file.stx, file.fd, src, name, from);
+            if (!file.loaded || meta.nlink > 1)
+            {
+                copyTree(file.fd, src, name, from, dst, name,
+                         dstPath / file.name, ctx, &meta);
+                continue;
+            }
+            // existing regular files are rewritten in place
+            struct stat st;
+            if (fstatat(dst, name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+                !S_ISREG(st.st_mode))
+            {
+                removeEntry(dst, name, S_ISDIR(st.st_mode),
+                            dstPath / file.name);
+            }
+            ctx.consume(file.data.size());
+            IoEngine::File& copy = out.files.emplace_back();
+            copy.name = file.name;
+            copy.mode = meta.mode & 07777;
+            copy.data.swap(file.data);
+            metas.push_back(meta);
+        }
+
+        io.write(dst, out.files);
+        for (size_t i = 0; i < out.files.size(); ++i)
+        {
+            const IoEngine::File& file = out.files[i];
+            const fs::path to = dstPath / file.name;
+            if (file.error)
+            {
+                throw std::system_error(file.error, std::system_category(),
+                                        to);
+            }
+            metas[i].apply(file.fd, to);
+            ctx.flush(file.fd, to);
+        }
+    }
+}
+
+/**
+ * @brief Copy file or directory recursively.
+ *
+ * @param[in] src source file descriptor (see RootDir::openEntry)
+ * @param[in] srcDir descriptor of the source parent directory
+ * @param[in] srcName name of the source in the parent directory
+ * @param[in] srcPath path to the source (for error messages)
+ * @param[in] dstDir descriptor of the destination parent directory
+ * @param[in] dstName name of the destination in the parent directory
+ * @param[in] dstPath path to the destination (for error messages)
+ * @param[in,out] ctx copy state
+ * @param[in] known metadata of the source if already loaded
+ *
+ * @throw std::exception in case of errors
+ */
+static void copyTree(int src, int srcDir, const char* srcName,
+                     const fs::path& srcPath, int dstDir, const char* dstName,
+                     const fs::path& dstPath, CopyContext& ctx,
+                     const Metadata* known)
+{
+    const Metadata meta =
+        known ? *known : Metadata::load(src, srcDir, srcName, srcPath);
+    const bool isDir = S_ISDIR(meta.mode);
+    const bool isLink = S_ISLNK(meta.mode);
+    const bool isHardLink = S_ISREG(meta.mode) && meta.nlink > 1;
+
+    // replace destination of different type, existing files are rewritten
+    // in place like fs::copy does
+    struct stat st;
+    if (fstatat(dstDir, dstName, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+        (isDir != S_ISDIR(st.st_mode) || isLink || S_ISLNK(st.st_mode) ||
+         isHardLink))
+    {
+        removeEntry(dstDir, dstName, S_ISDIR(st.st_mode), dstPath);
+    }
+
+    if (isLink)
+    {
+        std::string target(PATH_MAX, '\0');
+        const ssize_t len = readlinkat(src, "", target.data(), target.size());
+        if (len < 0)
+        {
+            throw std::system_error(errno, std::system_category(), srcPath);
+        }
+        target.resize(len);
+        if (symlinkat(target.c_str(), dstDir, dstName) != 0)
+        {
+            throw std::system_error(errno, std::system_category(), dstPath);
+        }
+        meta.applyLink(dstDir, dstName, dstPath);
+        return;
+    }
+
+    if (isHardLink)
+    {
+        const auto it = ctx.links.find(meta.inode);
+        if (it != ctx.links.end())
+        {
+            if (RootDir::link(it->second, dstDir, dstName) != 0)
+            {
+                throw std::system_error(errno, std::system_category(),
+                                        dstPath);
+            }
+            return;
+        }
+    }
+
+    if (isDir)
+    {
+        if (mkdirat(dstDir, dstName, meta.mode & 07777) != 0 &&
+            errno != EEXIST)
+        {
+            throw std::system_error(errno, std::system_category(), dstPath);
+        }
+        const int fd = openat(dstDir, dstName,
+                              O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd == -1)
+        {
+            throw std::system_error(errno, std::system_category(), dstPath);
+        }
+        const FileHandle guard(fd);
+        meta.apply(fd, dstPath, false);
+        const std::vector<std::string> names = RootDir::list(src, srcPath);
+        if (ctx.io)
+        {
+            copyEntries(src, srcPath, fd, dstPath, names, ctx);
+        }
+        else
+        {
+            for (const auto& it : names)
+            {
+                const FileHandle child(RootDir::openEntry(src, it.c_str()));
+                if (child.get() == -1)
+                {
+                    throw std::system_error(errno, std::system_category(),
+                                            srcPath / it);
+                }
+                copyTree(child.get(), src, it.c_str(), srcPath / it, fd,
+                         it.c_str(), dstPath / it, ctx, nullptr);
+            }
+        }
+        // content changes directory mtime, so it is set last
+        const timespec ts[2] = {{0, UTIME_OMIT}, meta.mtime};
+        if (futimens(fd, ts) != 0)
+        {
+            throw std::system_error(errno, std::system_category(), dstPath);
+        }
+        ctx.flush(fd, dstPath);
+    }
+    else if (S_ISREG(meta.mode))
+    {
+        const int fd = openat(dstDir, dstName,
+                              O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW |
+                                  O_CLOEXEC,
+                              meta.mode & 07777);
+        if (fd == -1)
+        {
+            throw std::system_error(errno, std::system_category(), dstPath);
+        }
+        const FileHandle guard(fd);
+        ctx.consume(meta.size);
+        copyContent(src, fd, srcPath, dstPath);
+        meta.apply(fd, dstPath);
+        ctx.flush(fd, dstPath);
+        if (isHardLink)
+        {
+            const int copy = dup(fd);
+            if (copy == -1)
+            {
+                throw std::system_error(errno, std::system_category(),
+                                        dstPath);
+            }
+            ctx.links.emplace(meta.inode, copy);
+        }
+    }
+}
+
+void Metadata::copy(const fs::path& src, const fs::path& dst)
+{
+    const RootDir srcRoot(src.parent_path().empty() ? "." : src.parent_path());
+    const RootDir dstRoot(dst.parent_path().empty() ? "." : dst.parent_path());
+    copy(srcRoot, src.filename(), dstRoot, dst.filename());
+}
+
+void Metadata::copy(const RootDir& srcRoot, const fs::path& src,
+                    const RootDir& dstRoot, const fs::path& dst, IoEngine* io,
+                    Throttle* throttle, bool sync)
+{
+    const fs::path srcPath = srcRoot.path() / src;
+    const FileHandle srcDir(
+        srcRoot.open(src.parent_path(), O_PATH | O_DIRECTORY));
+    if (srcDir.get() == -1)
+    {
+        throw std::system_error(errno, std::system_category(), srcPath);
+    }
+    const fs::path srcName = src.filename().empty() ? "." : src.filename();
+    const FileHandle fd(RootDir::openEntry(srcDir.get(), srcName.c_str()));
+    if (fd.get() == -1)
+    {
+        throw std::system_error(errno, std::system_category(), srcPath);
+    }
+    const FileHandle dstDir(dstRoot.makeDirs(dst.parent_path()));
+
+    CopyContext ctx;
+    ctx.io = io;
+    ctx.throttle = throttle;
+    ctx.sync = sync;
+    copyTree(fd.get(), srcDir.get(), srcName.c_str(), srcPath, dstDir.get(),
+             dst.filename().c_str(), dstRoot.path() / dst, ctx, nullptr);
+
+    if (sync)
+    {
+        // entry of the copy in its parent directory
+        const fs::path parent = (dstRoot.path() / dst).parent_path();
+        const FileHandle dir(
+            openat(dstDir.get(), ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+        if (dir.get() == -1)
+        {
+            throw std::system_error(errno, std::system_category(), parent);
+        }
+        ctx.flush(dir.get(), parent);
+    }
+}
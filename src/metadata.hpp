@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#pragma once
+
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+
+class IoEngine;
+class RootDir;
+class Throttle;
+
+/**
+ * @struct Metadata
+ * @brief File metadata: type, mode, ownership, modification time and
+ *        extended attributes (including POSIX ACLs and SELinux labels, which
+ *        are stored as system.posix_acl_* and security.selinux attributes).
+ */
+struct Metadata
+{
+    /** @brief File type and mode. */
+    mode_t mode = 0;
+    /** @brief Owner ID. */
+    uid_t uid = 0;
+    /** @brief Group ID. */
+    gid_t gid = 0;
+    /** @brief File size. */
+    uint64_t size = 0;
+    /** @brief Modification time. */
+    timespec mtime = {};
+    /** @brief Number of hard links. */
+    uint32_t nlink = 1;
+    /** @brief Device ID and inode number (identify hard links). */
+    std::pair<dev_t, ino_t> inode;
+    /** @brief Extended attributes: name and value. */
+    std::vector<std::pair<std::string, std::string>> xattrs;
+
+    /**
+     * @brief Get metadata of the file (symlinks are not followed) with
+     *        single statx and listxattr calls.
+     *
+     * @param[in] path path to the file
+     *
+     * @throw std::system_error in case of errors
+     *
+     * @return file metadata
+     */
+    static Metadata load(const std::filesystem::path& path);
+
+    /**
+     * @brief Get metadata of the opened file with single statx and listxattr
+     *        calls.
+     *
+     * @param[in] fd descriptor of the file (see RootDir::openEntry)
+     * @param[in] dirFd descriptor of the parent directory
+     * @param[in] name name of the file in the parent directory, used for
+     *                 extended attributes of symlinks, which can't be
+     *                 opened
+     * @param[in] path path to the file (for error messages)
+     *
+     * @throw std::system_error in case of errors
+     *
+     * @return file metadata
+     */
+    static Metadata load(int fd, int dirFd, const char* name,
+                         const std::filesystem::path& path);
+
+    /**
+     * @brief Get metadata of the opened file with already known status,
+     *        the same as above, but without statx call.
+     *
+     * @param[in] stx file status
+     * @param[in] fd descriptor of the file (see RootDir::openEntry)
+     * @param[in] dirFd descriptor of the parent directory
+     * @param[in] name name of the file in the parent directory
+     * @param[in] path path to the file (for error messages)
+     *
+     * @throw std::system_error in case of errors
+     *
+     * @return file metadata
+     */
+    static Metadata load(const struct statx& stx, int fd, int dirFd,
+                         const char* name, const std::filesystem::path& path);
+
+    /**
+     * @brief Apply ownership, mode, extended attributes and modification
+     *        time to the opened file or directory.
+     *
+     * Changing ownership and setting attributes not supported by the file
+     * system or not allowed for the current user are silently skipped.
+     *
+     * @param[in] fd file descriptor
+     * @param[in] path path to the file (for error messages)
+     * @param[in] times set modification time, false to leave it as is
+     *
+     * @throw std::system_error in case of errors
+     */
+    void apply(int fd, const std::filesystem::path& path,
+               bool times = true) const;
+
+    /**
+     * @brief Apply ownership, extended attributes and modification time to
+     *        the symbolic link itself.
+     *
+     * @param[in] path path to the symbolic link
+     *
+     * @throw std::system_error in case of errors
+     */
+    void applyLink(const std::filesystem::path& path) const;
+
+    /**
+     * @brief Apply ownership, extended attributes and modification time to
+     *        the symbolic link itself.
+     *
+     * @param[in] dirFd descriptor of the parent directory
+     * @param[in] name name of the symbolic link
+     * @param[in] path path to the symbolic link (for error messages)
+     *
+     * @throw std::system_error in case of errors
+     */
+    void applyLink(int dirFd, const char* name,
+                   const std::filesystem::path& path) const;
+
+    /**
+     * @brief Copy file or directory with all its content, metadata and hard
+     *        links between copied files. Existing directories are merged,
+     *        existing files are overwritten.
+     *
+     * @param[in] src path to the source file or directory
+     * @param[in] dst path to the destination
+     *
+     * @throw std::exception in case of errors
+     */
+    static void copy(const std::filesystem::path& src,
+                     const std::filesystem::path& dst);
+
+    /**
+     * @brief Copy file or directory between opened directories, the same as
+     *        above, but paths can't escape the directories.
+     *
+     * @param[in] srcRoot source directory
+     * @param[in] src relative path to the source file or directory
+     * @param[in] dstRoot destination directory
+     * @param[in] dst relative path to the destination, missing parent
+     *                directories are created
+     * @param[in] io engine for batched copy of small files, nullptr to copy
+     *               files one by one
+     * @param[in] throttle I/O throughput limiter, content of each copied
+     *                     file is reported to it, nullptr to disable
+     * @param[in] sync flush each copied file and directory and the parent
+     *                 directory of the copy with fsync, so the copy reaches
+     *                 the storage without flushing the whole file system
+     *
+     * @throw std::exception in case of errors
+     */
+    static void copy(const RootDir& srcRoot, const std::filesystem::path& src,
+                     const RootDir& dstRoot, const std::filesystem::path& dst,
+                     IoEngine* io = nullptr, Throttle* throttle = nullptr,
+                     bool sync = false);
+};
@@ -0,0 +1,312 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "archive.hpp"
+#include "block_codec.hpp"
+#include "crypto.hpp"
+#include "preflight.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/xattr.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <system_error>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+/** @brief Size of the tar block. */
+static constexpr uint64_t blockSize = 512;
+/** @brief Size of the tar entry name that fits into the header. */
+static constexpr size_t maxNameLen = 100;
+/** @brief Overhead of the tar stream: root entry, implicit parent
+ *         directories and end-of-archive marker.
+ */
+static constexpr uint64_t tarOverhead = 32 * blockSize;
+/** @brief Size of gzip header and trailer. */
+static constexpr uint64_t gzipOverhead = 18;
+/** @brief Size of the PAX record besides key and value: length (up to 20
+ *         digits), space, equal sign and line feed.
+ */
+static constexpr size_t paxRecordSize = 23;
+/** @brief Size of the PAX record with mtime in nanoseconds, the writer adds
+ *         it for almost every entry.
+ */
+static constexpr size_t paxMtimeSize = paxRecordSize + 5 + 30;
+/** @brief Key prefix of PAX records with extended attributes. */
+static constexpr size_t paxXattrSize = sizeof("SCHILY.xattr.") - 1;
+/** @brief Key of the PAX record with checksums of files. */
+static constexpr size_t paxChecksumsSize = sizeof("OBMC.crc32c") - 1;
+/** @brief Size of the checksum line besides the name: CRC, space and line
+ *         feed.
+ */
+static constexpr size_t checksumLineSize = 8 + 2;
+/** @brief Size of the table of contents record besides the name: offset and
+ *         record overhead.
+ */
+static constexpr size_t tocRecordSize = 16 + paxRecordSize;
+/** @brief Overhead of the table of contents: implicit entries and records
+ *         of the end of the archive.
+ */
+static constexpr uint64_t tocOverhead = 32 * (tocRecordSize + maxNameLen);
+
+/**
+ * @brief Round up size to the tar block size.
+ *
+ * @param[in] size size to round
+ *
+ * @return rounded size
+ */
+static uint64_t alignBlock(uint64_t size)
+{
+    return (size + blockSize - 1) / blockSize * blockSize;
+}
+
+/**
+ * @brief Get file type and size.
+ *
+ * @param[in] path path to the file
+ * @param[in] follow follow symbolic links
+ * @param[out] stx file attributes
+ *
+ * @return false if file doesn't exist
+ *
+ * @throw std::system_error in case of other errors
+ */
+static bool getAttributes(const fs::path& path, bool follow,
+                          struct statx& stx)
+{
+    if (statx(AT_FDCWD, path.c_str(), follow ? 0 : AT_SYMLINK_NOFOLLOW,
+              STATX_TYPE | STATX_SIZE, &stx) != 0)
+    {
+        if (errno == ENOENT)
+        {
+            return false;
+        }
+        throw std::system_error(errno, std::system_category(), path);
+    }
+    return true;
+}
+
+/**
+ * @brief Get size of PAX records with extended attributes of the file.
+ *
+ * @param[in] path path to the file, symbolic links are not followed
+ *
+ * @return size in bytes, 0 if attributes are not supported
+ */
+static uint64_t xattrSize(const fs::path& path)
+{
+    const ssize_t len = llistxattr(path.c_str(), nullptr, 0);
+    if (len <= 0)
+    {
+        return 0;
+    }
+    std::vector<char> names(len);
+    const ssize_t rc = llistxattr(path.c_str(), names.data(), names.size());
+    uint64_t size = 0;
+    for (ssize_t pos = 0; pos < rc;)
+    {
+        const char* name = names.data() + pos;
+        const size_t nameLen = strnlen(name, rc - pos);
+        const ssize_t valueLen = lgetxattr(path.c_str(), name, nullptr, 0);
+        if (valueLen >= 0)
+        {
+            size += paxRecordSize + paxXattrSize + nameLen + valueLen;
+        }
+        pos += nameLen + 1;
+    }
+    return size;
+}
+
+/**
+ * @brief Format error message about free space.
+ *
+ * @param[in] what description of the space owner
+ * @param[in] path path to the directory
+ * @param[in] required required size in bytes
+ * @param[in] available available size in bytes
+ *
+ * @return error message
+ */
+static std::string spaceError(const char* what, const fs::path& path,
+                              uint64_t required, uint64_t available)
+{
+    std::string err = "Not enough space for ";
+    err += what;
+    err += " in ";
+    err += path;
+    err += ": required ";
+    err += std::to_string(required);
+    err += " bytes, available ";
+    err += std::to_string(available);
+    return err;
+}
+
+Preflight::Preflight(uint64_t maxMemory, uint64_t maxTmp) :
+    maxMemory(maxMemory), maxTmp(maxTmp)
+{}
+
+void Preflight::addData(const fs::path& path, const std::string& name)
+{
+    struct statx stx;
+    if (!getAttributes(path, false, stx))
+    {
+        throw std::system_error(ENOENT, std::system_category(), path);
+    }
+
+    // entries are named "./NAME", directories end with a slash
+    const bool isDir = S_ISDIR(stx.stx_mode);
+    const size_t nameLen = name.size() + 2 + isDir;
+    const size_t linkLen = S_ISLNK(stx.stx_mode) ? stx.stx_size : 0;
+    addEntry(S_ISREG(stx.stx_mode) ? stx.stx_size : 0, nameLen, linkLen,
+             xattrSize(path), S_ISREG(stx.stx_mode));
+
+    if (isDir)
+    {
+        for (const auto& it : fs::directory_iterator(path))
+        {
+            addData(it.path(), (fs::path(name) / it.path().filename()).string());
+        }
+    }
+}
+
+void Preflight::addTemp(const fs::path& path, const std::string& name)
+{
+    struct statx stx;
+    if (getAttributes(path, true, stx) && S_ISREG(stx.stx_mode))
+    {
+        tmpBytes += stx.stx_size;
+        addEntry(stx.stx_size, name.size() + 2, 0, 0, true);
+    }
+}
+
+Preflight::Mode Preflight::backup(const fs::path& tmpDir,
+                                  const fs::path& archiveDir) const
+{
+    const uint64_t arcSize = archiveSize();
+
+    const uint64_t arcFree = freeSpace(archiveDir);
+    if (arcSize > arcFree)
+    {
+        throw std::runtime_error(
+            spaceError("archive", archiveDir, arcSize, arcFree));
+    }
+
+    uint64_t tmpFree = freeSpace(tmpDir);
+    if (maxTmp)
+    {
+        tmpFree = std::min(tmpFree, maxTmp);
+    }
+    if (tmpBytes > tmpFree)
+    {
+        throw std::runtime_error(
+            spaceError("temporary data", tmpDir, tmpBytes, tmpFree));
+    }
+
+    if (arcSize <= maxMemory)
+    {
+        return Mode::memory;
+    }
+    if (tmpBytes + arcSize <= tmpFree)
+    {
+        return Mode::staged;
+    }
+    return Mode::streaming;
+}
+
+Preflight::Mode Preflight::restore(const fs::path& archive,
+                                   const fs::path& tmpDir,
+                                   const fs::path& rootFs) const
+{
+    const uint64_t arcSize = fs::file_size(archive);
+    const uint64_t dataSize = ArchiveReader::contentSize(archive);
+
+    uint64_t tmpFree = freeSpace(tmpDir);
+    if (maxTmp)
+    {
+        tmpFree = std::min(tmpFree, maxTmp);
+    }
+    if (dataSize > tmpFree)
+    {
+        throw std::runtime_error(
+            spaceError("unpacked archive", tmpDir, dataSize, tmpFree));
+    }
+
+    const uint64_t rootFree = freeSpace(rootFs);
+    if (dataSize > rootFree)
+    {
+        throw std::runtime_error(
+            spaceError("restored files", rootFs, dataSize, rootFree));
+    }
+
+    return arcSize <= maxMemory ? Mode::memory : Mode::streaming;
+}
+
+uint64_t Preflight::archiveSize() const
+{
+    // global PAX header with checksums of the files
+    const uint64_t tarSize =
+        tarBytes + tarOverhead + blockSize +
+        alignBlock(paxRecordSize + paxChecksumsSize + checksumBytes);
+    if (tarSize > std::numeric_limits<uLong>::max())
+    {
+        return std::numeric_limits<uint64_t>::max();
+    }
+
+    // the stream is compressed in independent blocks, each one ends with
+    // a sync flush, the table of blocks and the table of contents follow
+    const uint64_t fullBlocks = tarSize / BlockCodec::blockSize;
+    const size_t lastBlock = tarSize % BlockCodec::blockSize;
+    const uint64_t blocks = fullBlocks + (lastBlock != 0);
+    uint64_t gzipSize =
+        fullBlocks * BlockCodec::compressedBound(BlockCodec::blockSize) +
+        (lastBlock ? BlockCodec::compressedBound(lastBlock) : 0) +
+        gzipOverhead;
+    if (blocks <= BlockCodec::Index::maxBlocks)
+    {
+        gzipSize += BlockCodec::Index::encodedSize(blocks,
+                                                   tocBytes + tocOverhead);
+    }
+    return encrypted ? Encryptor::bound(gzipSize) : gzipSize;
+}
+
+uint64_t Preflight::freeSpace(const fs::path& path)
+{
+    struct statvfs st;
+    if (statvfs(path.empty() ? "." : path.c_str(), &st) != 0)
+    {
+        throw std::system_error(errno, std::system_category(), path);
+    }
+    return static_cast<uint64_t>(st.f_bavail) * st.f_frsize;
+}
+
+void Preflight::addEntry(uint64_t size, size_t nameLen, size_t linkLen,
+                         uint64_t xattrBytes, bool regular)
+{
+    dataBytes += size;
+    tarBytes += blockSize + alignBlock(size);
+
+    // PAX extended header, the same records as the archive writer adds
+    uint64_t pax = paxMtimeSize + xattrBytes;
+    if (nameLen > maxNameLen)
+    {
+        pax += paxRecordSize + 4 + nameLen; // path
+    }
+    if (linkLen > maxNameLen)
+    {
+        pax += paxRecordSize + 8 + linkLen; // linkpath
+    }
+    tarBytes += blockSize + alignBlock(pax);
+
+    tocBytes += tocRecordSize + nameLen;
+    if (regular)
+    {
+        checksumBytes += checksumLineSize + nameLen;
+    }
+}
@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+/**
+ * @class Preflight
+ * @brief Estimate resources needed for backup/restore before starting it.
+ */
+class Preflight
+{
+  public:
+    /**
+     * @brief Archive processing mode.
+     */
+    enum class Mode
+    {
+        /** Archive is assembled in memory and written with a single call. */
+        memory,
+        /** Archive is assembled in temp dir and then moved to destination. */
+        staged,
+        /** Archive is written directly to destination. */
+        streaming
+    };
+
+    /**
+     * @brief Constructor.
+     *
+     * @param[in] maxMemory max size of memory used for archive data
+     * @param[in] maxTmp max size of data in temp dir, 0 = unlimited
+     */
+    Preflight(uint64_t maxMemory, uint64_t maxTmp);
+
+    /**
+     * @brief Account overhead of the archive encryption.
+     *
+     * @param[in] enable true if archive will be encrypted
+     */
+    void setEncrypted(bool enable)
+    {
+        encrypted = enable;
+    }
+
+    /**
+     * @brief Add file or directory (recursively) to the archive data set.
+     *
+     * @param[in] path path to the file or directory
+     * @param[in] name name of the entry in the archive
+     *
+     * @throw std::system_error in case of errors
+     */
+    void addData(const std::filesystem::path& path, const std::string& name);
+
+    /**
+     * @brief Add file that will be created in temp dir and put to archive.
+     *
+     * @param[in] path path to the source file, missing files are ignored
+     * @param[in] name name of the entry in the archive
+     *
+     * @throw std::system_error in case of errors
+     */
+    void addTemp(const std::filesystem::path& path, const std::string& name);
+
+    /**
+     * @brief Check available space and choose mode for backup operation.
+     *
+     * @param[in] tmpDir path to the temp dir
+     * @param[in] archiveDir path to the directory of the archive file
+     *
+     * @throw std::runtime_error if there is not enough space
+     *
+     * @return processing mode
+     */
+    Mode backup(const std::filesystem::path& tmpDir,
+                const std::filesystem::path& archiveDir) const;
+
+    /**
+     * @brief Check available space and choose mode for restore operation.
+     *
+     * @param[in] archive path to the archive file
+     * @param[in] tmpDir path to the temp dir
+     * @param[in] rootFs path to the root FS
+     *
+     * @throw std::runtime_error if there is not enough space
+     *
+     * @return processing mode
+     */
+    Mode restore(const std::filesystem::path& archive,
+                 const std::filesystem::path& tmpDir,
+                 const std::filesystem::path& rootFs) const;
+
+    /**
+     * @brief Get estimated size of the archive (upper bound).
+     *
+     * @return size in bytes
+     */
+    uint64_t archiveSize() const;
+
+    /**
+     * @brief Get estimated size of data created in temp dir.
+     *
+     * @return size in bytes
+     */
+    uint64_t tempSize() const
+    {
+        return tmpBytes;
+    }
+
+    /**
+     * @brief Get size of file content in the archive data set.
+     *
+     * @return size in bytes
+     */
+    uint64_t dataSize() const
+    {
+        return dataBytes;
+    }
+
+    /**
+     * @brief Get free space available for unprivileged user.
+     *
+     * @param[in] path path to any file on the file system
+     *
+     * @throw std::system_error in case of errors
+     *
+     * @return free space in bytes
+     */
+    static uint64_t freeSpace(const std::filesystem::path& path);
+
+  private:
+    /**
+     * @brief Add single entry to the archive data set.
+     *
+     * @param[in] size size of the entry data
+     * @param[in] nameLen length of the entry name
+     * @param[in] linkLen length of the symbolic link target
+     * @param[in] xattrBytes size of PAX records with extended attributes
+     * @param[in] regular true for regular file (has a checksum)
+     */
+    void addEntry(uint64_t size, size_t nameLen, size_t linkLen,
+                  uint64_t xattrBytes, bool regular);
+
+  private:
+    /** @brief Max size of memory used for archive data. */
+    const uint64_t maxMemory;
+    /** @brief Max size of data in temp dir, 0 = unlimited. */
+    const uint64_t maxTmp;
+    /** @brief Size of uncompressed tar stream. */
+    uint64_t tarBytes = 0;
+    /** @brief Size of data in temp dir. */
+    uint64_t tmpBytes = 0;
+    /** @brief Size of file content. */
+    uint64_t dataBytes = 0;
+    /** @brief Size of the table of contents. */
+    uint64_t tocBytes = 0;
+    /** @brief Size of the list of file checksums. */
+    uint64_t checksumBytes = 0;
+    /** @brief Archive will be encrypted. */
+    bool encrypted = false;
+};
@@ -0,0 +1,93 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "priority.hpp"
+
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+
+// I/O priority definitions, see linux/ioprio.h
+static constexpr int ioprioClassShift = 13;
+static constexpr int ioprioClassRt = 1;
+static constexpr int ioprioClassBe = 2;
+static constexpr int ioprioClassIdle = 3;
+static constexpr int ioprioWhoProcess = 1;
+static constexpr int ioprioMaxLevel = 7;
+
+void setIoPriority(const std::string& spec)
+{
+    const size_t delim = spec.find(':');
+    const std::string cls = spec.substr(0, delim);
+
+    int ioClass;
+    if (cls == "idle")
+    {
+        ioClass = ioprioClassIdle;
+    }
+    else if (cls == "be")
+    {
+        ioClass = ioprioClassBe;
+    }
+    else if (cls == "rt")
+    {
+        ioClass = ioprioClassRt;
+    }
+    else
+    {
+        throw std::invalid_argument("Invalid I/O priority class: " + cls);
+    }
+
+    int level = 0;
+    if (delim != std::string::npos)
+    {
+        const std::string num = spec.substr(delim + 1);
+        if (ioClass == ioprioClassIdle || num.size() != 1 || num[0] < '0' ||
+            num[0] > '0' + ioprioMaxLevel)
+        {
+            throw std::invalid_argument("Invalid I/O priority level: " + num);
+        }
+        level = num[0] - '0';
+    }
+    else if (ioClass != ioprioClassIdle)
+    {
+        level = 4; // default level, see ioprio_set(2)
+    }
+
+    const int prio = ioClass << ioprioClassShift | level;
+    if (syscall(SYS_ioprio_set, ioprioWhoProcess, 0, prio) != 0)
+    {
+        throw std::system_error(errno, std::system_category(),
+                                "Unable to set I/O priority");
+    }
+}
+
+void setCpuPriority(int nice)
+{
+    if (nice < -20 || nice > 19)
+    {
+        throw std::invalid_argument("Invalid nice value: " +
+                                    std::to_string(nice));
+    }
+
+    if (nice > 0)
+    {
+        const sched_param param{};
+        if (sched_setscheduler(0, SCHED_BATCH, &param) != 0)
+        {
+            throw std::system_error(errno, std::system_category(),
+                                    "Unable to set scheduling policy");
+        }
+    }
+
+    if (setpriority(PRIO_PROCESS, 0, nice) != 0)
+    {
+        throw std::system_error(errno, std::system_category(),
+                                "Unable to set CPU priority");
+    }
+}
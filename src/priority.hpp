@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#pragma once
+
+#include <string>
+
+/**
+ * @brief Set I/O scheduling class and priority of the current process.
+ *
+ * @param[in] spec priority in format CLASS[:LEVEL], where CLASS is one of
+ *                 "idle", "be" (best-effort) or "rt" (real-time), LEVEL is
+ *                 a number from 0 (highest) to 7 (lowest)
+ *
+ * @throw std::invalid_argument if spec has invalid format
+ * @throw std::system_error in case of other errors
+ */
+void setIoPriority(const std::string& spec);
+
+/**
+ * @brief Set CPU scheduling priority of the current process.
+ *        Positive nice value also switches the process to the batch
+ *        scheduling policy (SCHED_BATCH).
+ *
+ * @param[in] nice nice value from -20 (highest) to 19 (lowest)
+ *
+ * @throw std::invalid_argument if nice value is out of range
+ * @throw std::system_error in case of other errors
+ */
+void setCpuPriority(int nice);
@@ -0,0 +1,171 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "progress.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+
+/** @brief Min interval between reports of byte counters. */
+static constexpr auto reportInterval = std::chrono::milliseconds(100);
+/** @brief Width of the progress bar. */
+static constexpr size_t barWidth = 24;
+
+/**
+ * @brief Format size in human readable form.
+ *
+ * @param[in] size size in bytes
+ *
+ * @return formatted size (e.g. 1.5M)
+ */
+static std::string formatSize(uint64_t size)
+{
+    static const char* units = "BKMG";
+    double value = static_cast<double>(size);
+    size_t unit = 0;
+    while (value >= 1024 && unit < 3)
+    {
+        value /= 1024;
+        ++unit;
+    }
+    char text[32];
+    snprintf(text, sizeof(text), unit ? "%.1f%c" : "%.0f%c", value,
+             units[unit]);
+    return text;
+}
+
+Progress::Progress(ProgressSink* sink, const CancelToken* cancel) :
+    sink(sink), cancel(cancel)
+{}
+
+void Progress::begin(const std::string& phase, uint64_t totalBytes,
+                     size_t totalEntries)
+{
+    check();
+    status = {};
+    status.phase = phase;
+    status.totalBytes = totalBytes;
+    status.totalEntries = totalEntries;
+    started = Clock::now();
+    report();
+}
+
+void Progress::addBytes(uint64_t bytes)
+{
+    check();
+    status.bytes += bytes;
+    if (sink && Clock::now() - reported >= reportInterval)
+    {
+        report();
+    }
+}
+
+void Progress::addEntry(const std::string& item)
+{
+    check();
+    status.item = item;
+    ++status.entries;
+    report();
+}
+
+void Progress::finish()
+{
+    status.finished = true;
+    report();
+}
+
+void Progress::report()
+{
+    if (!sink)
+    {
+        return;
+    }
+    reported = Clock::now();
+
+    // estimate by bytes if total size is known, otherwise by entries
+    double ratio = -1;
+    if (status.totalBytes)
+    {
+        ratio = static_cast<double>(status.bytes) / status.totalBytes;
+    }
+    else if (status.totalEntries)
+    {
+        ratio = static_cast<double>(status.entries) / status.totalEntries;
+    }
+    if (status.finished || ratio >= 1)
+    {
+        status.eta = 0;
+    }
+    else if (ratio > 0)
+    {
+        const std::chrono::duration<double> elapsed = reported - started;
+        status.eta = static_cast<int64_t>(elapsed.count() * (1 - ratio) /
+                                              ratio +
+                                          0.5);
+    }
+    else
+    {
+        status.eta = -1;
+    }
+
+    sink->update(status);
+}
+
+void ProgressBar::update(const Status& status)
+{
+    double ratio = -1;
+    std::string counter;
+    if (status.totalBytes)
+    {
+        ratio = static_cast<double>(status.bytes) / status.totalBytes;
+        counter = formatSize(status.bytes) + '/' +
+                  formatSize(status.totalBytes);
+    }
+    else if (status.totalEntries)
+    {
+        ratio = static_cast<double>(status.entries) / status.totalEntries;
+        counter = std::to_string(status.entries) + '/' +
+                  std::to_string(status.totalEntries);
+    }
+    if (status.finished)
+    {
+        ratio = 1;
+    }
+
+    fprintf(out, "\r%-8s", status.phase.c_str());
+    if (ratio >= 0)
+    {
+        ratio = std::min(ratio, 1.0);
+        const size_t fill = static_cast<size_t>(ratio * barWidth);
+        fprintf(out, " [%s%s] %3d%% %s",
+                std::string(fill, '#').c_str(),
+                std::string(barWidth - fill, ' ').c_str(),
+                static_cast<int>(ratio * 100), counter.c_str());
+    }
+    if (status.eta >= 0 && !status.finished)
+    {
+        fprintf(out, " ETA %" PRId64 ":%02d", status.eta / 60,
+                static_cast<int>(status.eta % 60));
+    }
+    if (!status.item.empty() && !status.finished)
+    {
+        fprintf(out, " %s", status.item.c_str());
+    }
+    // clear the rest of the previous line
+    fputs("\033[K", out);
+    if (status.finished)
+    {
+        fputc('\n', out);
+    }
+    lineOpen = !status.finished;
+    fflush(out);
+}
+
+void ProgressBar::close()
+{
+    if (lineOpen)
+    {
+        fputc('\n', out);
+        lineOpen = false;
+    }
+}
@@ -0,0 +1,228 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+/**
+ * @class Cancelled
+ * @brief Exception thrown by the cancelled operation.
+ */
+class Cancelled : public std::runtime_error
+{
+  public:
+    Cancelled() : std::runtime_error("Operation cancelled")
+    {}
+};
+
+/**
+ * @class CancelToken
+ * @brief Cooperative cancellation of the operation.
+ *
+ * The token is set from any thread or from a signal handler, the operation
+ * checks it between units of work and throws Cancelled, so temporary data
+ * is removed as on any other error.
+ */
+class CancelToken
+{
+  public:
+    /**
+     * @brief Request cancellation, async-signal-safe.
+     */
+    void cancel()
+    {
+        flag = true;
+    }
+
+    /**
+     * @brief Check if cancellation is requested.
+     *
+     * @return true if operation must be cancelled
+     */
+    bool cancelled() const
+    {
+        return flag;
+    }
+
+    /**
+     * @brief Throw if cancellation is requested.
+     *
+     * @throw Cancelled if operation must be cancelled
+     */
+    void check() const
+    {
+        if (flag)
+        {
+            throw Cancelled();
+        }
+    }
+
+  private:
+    /** @brief Cancellation flag. */
+    std::atomic<bool> flag{false};
+    static_assert(std::atomic<bool>::is_always_lock_free);
+};
+
+/**
+ * @class ProgressSink
+ * @brief Receiver of progress reports.
+ */
+class ProgressSink
+{
+  public:
+    /**
+     * @struct Status
+     * @brief State of the current phase of the operation.
+     */
+    struct Status
+    {
+        /** @brief Phase name (prepare, archive, extract, restore). */
+        std::string phase;
+        /** @brief Last processed entry (relative path or accounts). */
+        std::string item;
+        /** @brief Number of processed bytes. */
+        uint64_t bytes = 0;
+        /** @brief Estimated number of bytes, 0 = unknown. */
+        uint64_t totalBytes = 0;
+        /** @brief Number of processed entries. */
+        size_t entries = 0;
+        /** @brief Number of entries, 0 = unknown. */
+        size_t totalEntries = 0;
+        /** @brief Estimated time to the end of the phase (sec), -1 = n/a. */
+        int64_t eta = -1;
+        /** @brief Phase is completed. */
+        bool finished = false;
+    };
+
+    virtual ~ProgressSink() = default;
+
+    /**
+     * @brief Handle progress report.
+     *
+     * @param[in] status state of the current phase
+     */
+    virtual void update(const Status& status) = 0;
+};
+
+/**
+ * @class Progress
+ * @brief Progress tracker of a single operation.
+ *
+ * Counts processed data of the current phase, estimates remaining time and
+ * passes the state to the sink (byte counters are reported at most 10 times
+ * per second). Every update checks the cancellation token, so data loops
+ * stop at the next chunk. The tracker is used by one thread.
+ */
+class Progress
+{
+  public:
+    /**
+     * @brief Constructor.
+     *
+     * @param[in] sink receiver of reports, nullptr = no reports
+     * @param[in] cancel cancellation token, nullptr = not cancellable
+     */
+    Progress(ProgressSink* sink, const CancelToken* cancel);
+
+    /**
+     * @brief Start new phase of the operation.
+     *
+     * @param[in] phase phase name
+     * @param[in] totalBytes estimated number of bytes, 0 = unknown
+     * @param[in] totalEntries number of entries, 0 = unknown
+     *
+     * @throw Cancelled if operation is cancelled
+     */
+    void begin(const std::string& phase, uint64_t totalBytes,
+               size_t totalEntries);
+
+    /**
+     * @brief Account processed data.
+     *
+     * @param[in] bytes number of processed bytes
+     *
+     * @throw Cancelled if operation is cancelled
+     */
+    void addBytes(uint64_t bytes);
+
+    /**
+     * @brief Account processed entry.
+     *
+     * @param[in] item entry name
+     *
+     * @throw Cancelled if operation is cancelled
+     */
+    void addEntry(const std::string& item);
+
+    /**
+     * @brief Report completion of the current phase.
+     */
+    void finish();
+
+    /**
+     * @brief Check cancellation token.
+     *
+     * @throw Cancelled if operation is cancelled
+     */
+    void check() const
+    {
+        if (cancel)
+        {
+            cancel->check();
+        }
+    }
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @brief Update estimated time and pass the state to the sink.
+     */
+    void report();
+
+    /** @brief Receiver of reports. */
+    ProgressSink* const sink;
+    /** @brief Cancellation token. */
+    const CancelToken* const cancel;
+    /** @brief State of the current phase. */
+    ProgressSink::Status status;
+    /** @brief Start time of the current phase. */
+    Clock::time_point started;
+    /** @brief Time of the last report. */
+    Clock::time_point reported;
+};
+
+/**
+ * @class ProgressBar
+ * @brief Progress bar on a terminal.
+ */
+class ProgressBar : public ProgressSink
+{
+  public:
+    /**
+     * @brief Constructor.
+     *
+     * @param[in] out output stream (terminal)
+     */
+    explicit ProgressBar(FILE* out) : out(out)
+    {}
+
+    void update(const Status& status) override;
+
+    /**
+     * @brief End unfinished progress line, e.g. before an error message.
+     */
+    void close();
+
+  private:
+    /** @brief Output stream. */
+    FILE* out;
+    /** @brief Progress line is not finished. */
+    bool lineOpen = false;
+};
@@ -0,0 +1,165 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "report.hpp"
+
+namespace fs = std::filesystem;
+
+/** @brief Names of changes. */
+static const char* changeNames[] = {"add", "modify", "remove"};
+
+/**
+ * @brief Escape string for JSON output.
+ *
+ * @param[in] str string to escape
+ *
+ * @return escaped string (without quotes)
+ */
+static std::string escape(const std::string& str)
+{
+    std::string esc;
+    esc.reserve(str.size());
+    for (const char c : str)
+    {
+        if (c == '"' || c == '\\')
+        {
+            esc += '\\';
+            esc += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            esc += buf;
+        }
+        else
+        {
+            esc += c;
+        }
+    }
+    return esc;
+}
+
+/**
+ * @brief Get name of the change.
+ *
+ * @param[in] change type of change
+ *
+ * @return name of the change
+ */
+static const char* changeName(Report::Change change)
+{
+    return changeNames[static_cast<size_t>(change)];
+}
+
+void Report::begin(const fs::path& archive)
+{
+    if (format == Format::json)
+    {
+        fprintf(out, "{\"archive\":\"%s\",\"changes\":[",
+                escape(archive).c_str());
+    }
+    else
+    {
+        fprintf(out, "Changes to apply from backup file %s:\n",
+                archive.c_str());
+    }
+}
+
+void Report::file(const fs::path& path, Change change)
+{
+    next();
+    if (format == Format::json)
+    {
+        fprintf(out, "{\"type\":\"file\",\"path\":\"%s\",\"change\":\"%s\"}",
+                escape(path).c_str(), changeName(change));
+    }
+    else
+    {
+        fprintf(out, "  %-7s %-9s %s\n", changeName(change), "file",
+                path.c_str());
+    }
+    ++files;
+}
+
+void Report::perms(const fs::path& path, fs::perms from, fs::perms to)
+{
+    next();
+    const unsigned int oldMode = static_cast<unsigned int>(from);
+    const unsigned int newMode = static_cast<unsigned int>(to);
+    if (format == Format::json)
+    {
+        fprintf(out,
+                "{\"type\":\"perms\",\"path\":\"%s\",\"from\":\"%04o\","
+                "\"to\":\"%04o\"}",
+                escape(path).c_str(), oldMode, newMode);
+    }
+    else
+    {
+        fprintf(out, "  %-7s %-9s %s %04o -> %04o\n", "chmod", "file",
+                path.c_str(), oldMode, newMode);
+    }
+    ++permChanges;
+}
+
+void Report::metadata(const fs::path& path, const std::string& attrs)
+{
+    next();
+    if (format == Format::json)
+    {
+        fprintf(out,
+                "{\"type\":\"metadata\",\"path\":\"%s\","
+                "\"attrs\":\"%s\"}",
+                escape(path).c_str(), attrs.c_str());
+    }
+    else
+    {
+        fprintf(out, "  %-7s %-9s %s (%s)\n", "modify", "metadata",
+                path.c_str(), attrs.c_str());
+    }
+    ++metaChanges;
+}
+
+void Report::account(const char* type, const std::string& name, Change change)
+{
+    next();
+    if (format == Format::json)
+    {
+        fprintf(out, "{\"type\":\"%s\",\"name\":\"%s\",\"change\":\"%s\"}",
+                type, escape(name).c_str(), changeName(change));
+    }
+    else
+    {
+        fprintf(out, "  %-7s %-9s %s\n", changeName(change), type,
+                name.c_str());
+    }
+    ++accounts;
+}
+
+void Report::finish()
+{
+    if (format == Format::json)
+    {
+        fprintf(out,
+                "\n],\"summary\":{\"files\":%zu,\"perms\":%zu,"
+                "\"metadata\":%zu,\"accounts\":%zu}}\n",
+                files, permChanges, metaChanges, accounts);
+    }
+    else
+    {
+        fprintf(out,
+                "Files: %zu, permissions: %zu, metadata: %zu, "
+                "accounts: %zu\n",
+                files, permChanges, metaChanges, accounts);
+    }
+    fflush(out);
+}
+
+void Report::next()
+{
+    if (format == Format::json)
+    {
+        fputs(files + permChanges + metaChanges + accounts ? ",\n" : "\n",
+              out);
+    }
+}
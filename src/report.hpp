@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#pragma once
+
+#include <cstdio>
+#include <filesystem>
+#include <string>
+
+/**
+ * @class Report
+ * @brief Report of changes that restore would make (dry run).
+ *
+ * Changes are written to the output stream as soon as they are found, so the
+ * report doesn't keep anything in memory. JSON format:
+ *   {"archive":"FILE","changes":[
+ *   {"type":"file","path":"etc/hostname","change":"modify"},
+ *   {"type":"perms","path":"etc/machine-id","from":"0644","to":"0444"},
+ *   {"type":"metadata","path":"etc/hosts","attrs":"owner,mtime"},
+ *   {"type":"user","name":"dude","change":"add"},
+ *   ...
+ *   ],"summary":{"files":1,"perms":1,"metadata":1,"accounts":1}}
+ */
+class Report
+{
+  public:
+    /** @brief Output format. */
+    enum class Format
+    {
+        text,
+        json
+    };
+
+    /** @brief Type of change. */
+    enum class Change
+    {
+        add,
+        modify,
+        remove
+    };
+
+    /**
+     * @brief Constructor.
+     *
+     * @param[in] format output format
+     * @param[in] out output stream
+     */
+    Report(Format format, FILE* out = stdout) : format(format), out(out)
+    {}
+
+    /**
+     * @brief Start the report.
+     *
+     * @param[in] archive path to the archive file
+     */
+    void begin(const std::filesystem::path& archive);
+
+    /**
+     * @brief Report file change.
+     *
+     * @param[in] path path to the file relative to root FS
+     * @param[in] change type of change
+     */
+    void file(const std::filesystem::path& path, Change change);
+
+    /**
+     * @brief Report permissions change of existing file.
+     *
+     * @param[in] path path to the file relative to root FS
+     * @param[in] from current permissions
+     * @param[in] to new permissions
+     */
+    void perms(const std::filesystem::path& path, std::filesystem::perms from,
+               std::filesystem::perms to);
+
+    /**
+     * @brief Report change of ownership, modification time or extended
+     *        attributes of existing file with unchanged content.
+     *
+     * @param[in] path path to the file relative to root FS
+     * @param[in] attrs changed attributes: comma separated list of "owner",
+     *                  "mtime" and "xattrs"
+     */
+    void metadata(const std::filesystem::path& path, const std::string& attrs);
+
+    /**
+     * @brief Report change of accounts entry.
+     *
+     * @param[in] type type of entry: user, group or password
+     * @param[in] name name of the entry
+     * @param[in] change type of change
+     */
+    void account(const char* type, const std::string& name, Change change);
+
+    /**
+     * @brief Finish the report, print summary.
+     */
+    void finish();
+
+  private:
+    /**
+     * @brief Write separator between JSON array items.
+     */
+    void next();
+
+  private:
+    /** @brief Output format. */
+    const Format format;
+    /** @brief Output stream. */
+    FILE* const out;
+    /** @brief Number of changed files. */
+    size_t files = 0;
+    /** @brief Number of permission changes. */
+    size_t permChanges = 0;
+    /** @brief Number of metadata changes. */
+    size_t metaChanges = 0;
+    /** @brief Number of changed accounts entries. */
+    size_t accounts = 0;
+};
@@ -0,0 +1,330 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "checksum.hpp"
+#include "ro_accounts.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+/** @brief Magic signature of the cache file. */
+static constexpr char magic[] = {'O', 'B', 'M', 'C', 'R', 'A', 'C', '1'};
+/** @brief Offset of the data covered by checksum. */
+static constexpr size_t dataOffset = sizeof(magic) + sizeof(uint32_t);
+
+/**
+ * @class CacheReader
+ * @brief Reader of the mapped cache data.
+ */
+class CacheReader
+{
+  public:
+    /**
+     * @brief Constructor.
+     *
+     * @param[in] data pointer to the data
+     * @param[in] size size of the data
+     */
+    CacheReader(const uint8_t* data, size_t size) : ptr(data), end(data + size)
+    {}
+
+    /**
+     * @brief Get next number.
+     *
+     * @throw std::runtime_error if data is truncated
+     *
+     * @return number
+     */
+    template <class T>
+    T number()
+    {
+        T val;
+        memcpy(&val, take(sizeof(val)), sizeof(val));
+        return val;
+    }
+
+    /**
+     * @brief Get next string (u32 size, data).
+     *
+     * @throw std::runtime_error if data is truncated
+     *
+     * @return string, valid while the data is mapped
+     */
+    std::string_view string()
+    {
+        return bytes(number<uint32_t>());
+    }
+
+    /**
+     * @brief Get next raw data.
+     *
+     * @param[in] size size of the data
+     *
+     * @throw std::runtime_error if data is truncated
+     *
+     * @return data, valid while the data is mapped
+     */
+    std::string_view bytes(size_t size)
+    {
+        return std::string_view(reinterpret_cast<const char*>(take(size)),
+                                size);
+    }
+
+    /**
+     * @brief Get next accounts table.
+     *
+     * @param[out] list accounts table
+     *
+     * @throw std::runtime_error if data is invalid
+     */
+    template <class T>
+    void table(AccountList<T>& list)
+    {
+        const uint32_t count = number<uint32_t>();
+        std::vector<std::array<std::string_view, T::fieldCount>> entries(
+            count);
+        size_t size = 0;
+        for (auto& fields : entries)
+        {
+            for (auto& it : fields)
+            {
+                it = string();
+                size += it.size() + 1;
+            }
+        }
+        // all fields are copied to the list arena at once
+        const auto alloc = list.allocator(size);
+        list.reserve(list.size() + count);
+        for (const auto& fields : entries)
+        {
+            list.emplace_back(fields, alloc);
+        }
+    }
+
+    /**
+     * @brief Check if all data was read.
+     *
+     * @return true if there is no more data
+     */
+    bool done() const
+    {
+        return ptr == end;
+    }
+
+  private:
+    /**
+     * @brief Take next portion of the data.
+     *
+     * @param[in] size size of the data
+     *
+     * @throw std::runtime_error if data is truncated
+     *
+     * @return pointer to the data
+     */
+    const uint8_t* take(size_t size)
+    {
+        if (static_cast<size_t>(end - ptr) < size)
+        {
+            throw std::runtime_error("Accounts cache is truncated");
+        }
+        const uint8_t* data = ptr;
+        ptr += size;
+        return data;
+    }
+
+  private:
+    /** @brief Current position. */
+    const uint8_t* ptr;
+    /** @brief End of data. */
+    const uint8_t* const end;
+};
+
+/**
+ * @brief Append number to the cache data.
+ *
+ * @param[out] out cache data
+ * @param[in] val number to write
+ */
+template <class T>
+static void putNumber(std::string& out, T val)
+{
+    out.append(reinterpret_cast<const char*>(&val), sizeof(val));
+}
+
+/**
+ * @brief Append string to the cache data.
+ *
+ * @param[out] out cache data
+ * @param[in] str string to write
+ */
+static void putString(std::string& out, std::string_view str)
+{
+    putNumber(out, static_cast<uint32_t>(str.size()));
+    out += str;
+}
+
+/**
+ * @brief Append accounts table to the cache data.
+ *
+ * @param[out] out cache data
+ * @param[in] list accounts table
+ */
+template <class T>
+static void putTable(std::string& out, const AccountList<T>& list)
+{
+    putNumber(out, static_cast<uint32_t>(list.size()));
+    for (const auto& entry : list)
+    {
+        for (size_t i = 0; i < T::fieldCount; ++i)
+        {
+            putString(out, entry.get(i));
+        }
+    }
+}
+
+/**
+ * @brief Get state of the source files: size, mtime and checksum.
+ *
+ * @param[in] sources paths to the source files
+ *
+ * @throw std::system_error in case of errors
+ *
+ * @return serialized state
+ */
+static std::string sourceState(const std::vector<fs::path>& sources)
+{
+    std::string state;
+    putNumber(state, static_cast<uint32_t>(sources.size()));
+    for (const auto& it : sources)
+    {
+        std::ifstream file(it, std::ios::binary);
+        struct stat st;
+        if (!file || stat(it.c_str(), &st) != 0)
+        {
+            throw std::system_error(errno, std::system_category(), it);
+        }
+        const std::string content((std::istreambuf_iterator<char>(file)),
+                                  std::istreambuf_iterator<char>());
+        putNumber(state, static_cast<uint64_t>(st.st_size));
+        putNumber(state, static_cast<int64_t>(st.st_mtim.tv_sec));
+        putNumber(state, static_cast<uint32_t>(st.st_mtim.tv_nsec));
+        putNumber(state, Checksum::update(0, content.data(), content.size()));
+    }
+    return state;
+}
+
+bool RoAccounts::load(const fs::path& file, const std::vector<fs::path>& sources,
+                      const std::string& policy)
+{
+    const int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return false;
+    }
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) > dataOffset)
+    {
+        map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+
+    bool valid = false;
+    try
+    {
+        const uint8_t* data = static_cast<const uint8_t*>(map);
+        const size_t size = st.st_size;
+        uint32_t crc;
+        memcpy(&crc, data + sizeof(magic), sizeof(crc));
+        if (memcmp(data, magic, sizeof(magic)) == 0 &&
+            crc == Checksum::update(0, data + dataOffset, size - dataOffset))
+        {
+            CacheReader rd(data + dataOffset, size - dataOffset);
+            const std::string state = sourceState(sources);
+            if (rd.string() == policy && rd.bytes(state.size()) == state)
+            {
+                const uint32_t count = rd.number<uint32_t>();
+                for (uint32_t i = 0; i < count; ++i)
+                {
+                    validGids.insert(rd.number<uint32_t>());
+                }
+                rd.table(groups);
+                rd.table(passwd);
+                rd.table(shadow);
+                valid = rd.done();
+            }
+        }
+    }
+    catch (const std::exception&)
+    {
+        valid = false;
+    }
+    if (!valid)
+    {
+        groups.clear();
+        passwd.clear();
+        shadow.clear();
+        validGids.clear();
+    }
+
+    munmap(map, st.st_size);
+    return valid;
+}
+
+void RoAccounts::save(const fs::path& file, const std::vector<fs::path>& sources,
+                      const std::string& policy) const
+{
+    std::string data;
+    putString(data, policy);
+    data += sourceState(sources);
+    putNumber(data, static_cast<uint32_t>(validGids.size()));
+    for (const auto& it : validGids)
+    {
+        putNumber(data, it);
+    }
+    putTable(data, groups);
+    putTable(data, passwd);
+    putTable(data, shadow);
+
+    std::string hdr(magic, sizeof(magic));
+    putNumber(hdr, Checksum::update(0, data.data(), data.size()));
+
+    // write to temporary file and rename to replace the cache atomically
+    fs::create_directories(file.parent_path());
+    std::string tmpFile = file;
+    tmpFile += ".XXXXXX";
+    const int fd = mkstemp(tmpFile.data());
+    if (fd == -1)
+    {
+        throw std::system_error(errno, std::system_category(), tmpFile);
+    }
+    const bool written =
+        write(fd, hdr.data(), hdr.size()) ==
+            static_cast<ssize_t>(hdr.size()) &&
+        write(fd, data.data(), data.size()) ==
+            static_cast<ssize_t>(data.size());
+    const int err = errno;
+    close(fd);
+    if (!written || rename(tmpFile.c_str(), file.c_str()) != 0)
+    {
+        const int ec = written ? errno : (err ? err : EIO);
+        unlink(tmpFile.c_str());
+        throw std::system_error(ec, std::system_category(), file);
+    }
+}
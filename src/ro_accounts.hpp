@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#pragma once
+
+#include "account_entry.hpp"
+#include "account_list.hpp"
+
+#include <filesystem>
+#include <set>
+#include <string>
+#include <vector>
+
+using Groups = AccountList<GroupEntry>;
+using Passwd = AccountList<PasswdEntry>;
+using Shadow = AccountList<ShadowEntry>;
+using Gshadow = AccountList<GshadowEntry>;
+using SubIds = AccountList<SubIdEntry>;
+
+/**
+ * @struct RoAccounts
+ * @brief Parsed and filtered accounts tables of the RO file system.
+ *
+ * Tables can be stored in a persistent binary cache file, the cache is
+ * loaded with a single mmap call and doesn't require text parsing. The cache
+ * is valid while the source files have the same size, mtime and checksum
+ * (CRC-32C) and the filter policy is the same.
+ *
+ * Cache format (numbers have native byte order, the cache is local):
+ *   magic "OBMCRAC1", u32 CRC-32C of the rest of the file, u32 policy size,
+ *   policy, u32 number of sources, sources (u64 size, i64 mtime sec,
+ *   u32 mtime nsec, u32 CRC-32C), u32 number of valid GIDs, GIDs (u32),
+ *   then tables (groups, passwd, shadow): u32 number of entries, fields of
+ *   each entry (u32 size, data).
+ */
+struct RoAccounts
+{
+    /** @brief All groups. */
+    Groups groups;
+    /** @brief Build-in users (without modifiable ones). */
+    Passwd passwd;
+    /** @brief Passwords of build-in users (without modifiable ones). */
+    Shadow shadow;
+    /** @brief GIDs that can be primary for a user. */
+    std::set<uint32_t> validGids;
+
+    /**
+     * @brief Load tables from the cache file.
+     *
+     * @param[in] file path to the cache file
+     * @param[in] sources paths to the source files (group, passwd, shadow)
+     * @param[in] policy description of the filter policy
+     *
+     * @return false if cache doesn't exist, is stale or corrupted
+     */
+    bool load(const std::filesystem::path& file,
+              const std::vector<std::filesystem::path>& sources,
+              const std::string& policy);
+
+    /**
+     * @brief Save tables to the cache file (atomically).
+     *
+     * @param[in] file path to the cache file
+     * @param[in] sources paths to the source files (group, passwd, shadow)
+     * @param[in] policy description of the filter policy
+     *
+     * @throw std::exception in case of errors
+     */
+    void save(const std::filesystem::path& file,
+              const std::vector<std::filesystem::path>& sources,
+              const std::string& policy) const;
+};
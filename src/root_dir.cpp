@@ -0,0 +1,351 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "root_dir.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/openat2.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <random>
+#include <string>
+#include <system_error>
+
+namespace fs = std::filesystem;
+
+/** @brief Max number of retries if openat2 detects a rename race. */
+static constexpr int maxRetries = 8;
+
+/** @brief Infix of the temporary file name: NAME.tmp.XXXXXX. */
+static const std::string tmpInfix = ".tmp.";
+/** @brief Length of the random suffix of the temporary file name. */
+static constexpr size_t tmpSuffixLen = 6;
+/** @brief Max number of attempts to create a file with unique name. */
+static constexpr int maxTempAttempts = 100;
+
+/** @brief Kernel doesn't support openat2 (ENOSYS). */
+static std::atomic<bool> noOpenat2 = false;
+
+/**
+ * @brief Open file relative to the directory, component by component
+ *        (fallback for kernels without openat2).
+ *
+ * @param[in] dirFd descriptor of the directory
+ * @param[in] rel relative path to the file
+ * @param[in] flags open flags
+ * @param[in] mode permissions of created file
+ *
+ * @return file descriptor or -1 on errors (errno is set)
+ */
+static int openComponents(int dirFd, const fs::path& rel, int flags,
+                          mode_t mode)
+{
+    int cur = openat(dirFd, ".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    fs::path last = ".";
+    for (auto it = rel.begin(); cur != -1 && it != rel.end(); ++it)
+    {
+        if (*it == "..")
+        {
+            close(cur);
+            errno = EXDEV;
+            return -1;
+        }
+        if (it->empty() || *it == ".")
+        {
+            continue;
+        }
+        if (last != ".")
+        {
+            const int next = openat(cur, last.c_str(),
+                                    O_PATH | O_DIRECTORY | O_NOFOLLOW |
+                                        O_CLOEXEC);
+            close(cur);
+            cur = next;
+        }
+        last = *it;
+    }
+    if (cur == -1)
+    {
+        return -1;
+    }
+    const int fd = openat(cur, last.c_str(), flags | O_NOFOLLOW, mode);
+    const int err = errno;
+    close(cur);
+    errno = err;
+    return fd;
+}
+
+FileHandle::~FileHandle()
+{
+    if (fd != -1)
+    {
+        close(fd);
+    }
+}
+
+RootDir::RootDir(const fs::path& path, bool chroot) :
+    dirPath(path),
+    resolve(RESOLVE_NO_MAGICLINKS |
+            (chroot ? RESOLVE_IN_ROOT : RESOLVE_BENEATH))
+{
+    dirFd = ::open(path.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd == -1)
+    {
+        throw std::system_error(errno, std::system_category(), path);
+    }
+}
+
+RootDir::~RootDir()
+{
+    close(dirFd);
+}
+
+int RootDir::open(const fs::path& rel, int flags, mode_t mode) const
+{
+    flags |= O_CLOEXEC;
+    const char* name = rel.empty() ? "." : rel.c_str();
+
+    if (!noOpenat2)
+    {
+        open_how how{};
+        how.flags = flags;
+        how.mode = flags & (O_CREAT | O_TMPFILE) ? mode : 0;
+        how.resolve = resolve;
+        long fd;
+        int retry = 0;
+        do
+        {
+            fd = syscall(SYS_openat2, dirFd, name, &how, sizeof(how));
+        } while (fd == -1 && errno == EAGAIN && ++retry < maxRetries);
+        if (fd != -1 || errno != ENOSYS)
+        {
+            return static_cast<int>(fd);
+        }
+        noOpenat2 = true;
+    }
+
+    return openComponents(dirFd, rel, flags, mode);
+}
+
+bool RootDir::exists(const fs::path& rel) const
+{
+    const int fd = open(rel, O_PATH | O_NOFOLLOW);
+    if (fd == -1)
+    {
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+int RootDir::makeDirs(const fs::path& rel) const
+{
+    int fd = open(rel, O_PATH | O_DIRECTORY);
+    if (fd != -1 || errno != ENOENT)
+    {
+        if (fd == -1)
+        {
+            throw std::system_error(errno, std::system_category(),
+                                    dirPath / rel);
+        }
+        return fd;
+    }
+
+    // create missing components one by one
+    fd = open({}, O_PATH | O_DIRECTORY);
+    fs::path cur;
+    for (const auto& it : rel)
+    {
+        if (fd == -1)
+        {
+            break;
+        }
+        if (it.empty() || it == ".")
+        {
+            continue;
+        }
+        cur /= it;
+        int next = open(cur, O_PATH | O_DIRECTORY);
+        if (next == -1 && errno == ENOENT)
+        {
+            if (mkdirat(fd, it.c_str(), 0755) != 0 && errno != EEXIST)
+            {
+                const int err = errno;
+                close(fd);
+                throw std::system_error(err, std::system_category(),
+                                        dirPath / cur);
+            }
+            next = open(cur, O_PATH | O_DIRECTORY);
+        }
+        close(fd);
+        fd = next;
+    }
+    if (fd == -1)
+    {
+        throw std::system_error(errno, std::system_category(), dirPath / rel);
+    }
+    return fd;
+}
+
+void RootDir::replaceFile(const fs::path& rel, const void* data, size_t size,
+                          mode_t mode) const
+{
+    const fs::path path = dirPath / rel;
+    const std::string name = rel.filename();
+    const FileHandle parent(makeDirs(rel.parent_path()));
+    std::string tmpName;
+    const int fd = createTemp(parent.get(), name, mode, tmpName);
+    if (fd == -1)
+    {
+        throw std::system_error(errno, std::system_category(), path);
+    }
+
+    const char* ptr = static_cast<const char*>(data);
+    size_t left = size;
+    while (left)
+    {
+        const ssize_t rc = write(fd, ptr, left);
+        if (rc == 0)
+        {
+            errno = EIO;
+            break;
+        }
+        if (rc < 0 && errno != EINTR)
+        {
+            break;
+        }
+        if (rc > 0)
+        {
+            ptr += rc;
+            left -= rc;
+        }
+    }
+    // umask must not change permissions of the replaced file
+    int err = left || fchmod(fd, mode) != 0 || fsync(fd) != 0 ? errno : 0;
+    if (close(fd) != 0 && !err)
+    {
+        err = errno;
+    }
+    if (!err &&
+        renameat(parent.get(), tmpName.c_str(), parent.get(), name.c_str()) !=
+            0)
+    {
+        err = errno;
+    }
+    if (err)
+    {
+        unlinkat(parent.get(), tmpName.c_str(), 0);
+        throw std::system_error(err, std::system_category(), path);
+    }
+
+    // parent is opened with O_PATH, which can't be synced
+    const FileHandle dir(open(rel.parent_path(), O_RDONLY | O_DIRECTORY));
+    if (dir.get() != -1)
+    {
+        fsync(dir.get());
+    }
+}
+
+int RootDir::createTemp(int dirFd, const std::string& name, mode_t mode,
+                        std::string& tmpName)
+{
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyz"
+                                "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    std::random_device rnd;
+    std::uniform_int_distribution<size_t> dist(0, sizeof(chars) - 2);
+    for (int i = 0; i < maxTempAttempts; ++i)
+    {
+        tmpName = name + tmpInfix;
+        for (size_t j = 0; j < tmpSuffixLen; ++j)
+        {
+            tmpName += chars[dist(rnd)];
+        }
+        const int fd = openat(dirFd, tmpName.c_str(),
+                              O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW |
+                                  O_CLOEXEC,
+                              mode);
+        if (fd != -1 || errno != EEXIST)
+        {
+            return fd;
+        }
+    }
+    errno = EEXIST;
+    return -1;
+}
+
+bool RootDir::isTemp(const std::string& name)
+{
+    const size_t len = tmpInfix.size() + tmpSuffixLen;
+    return name.size() > len &&
+           name.compare(name.size() - len, tmpInfix.size(), tmpInfix) == 0;
+}
+
+int RootDir::openEntry(int dirFd, const char* name)
+{
+    int fd = openat(dirFd, name,
+                    O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+    if (fd == -1 && (errno == ELOOP || errno == ENXIO))
+    {
+        // symlink or socket
+        fd = openat(dirFd, name, O_PATH | O_NOFOLLOW | O_CLOEXEC);
+    }
+    return fd;
+}
+
+std::vector<std::string> RootDir::list(int fd, const fs::path& path)
+{
+    // fdopendir takes ownership of the descriptor
+    const int dirFd = dup(fd);
+    DIR* dir = dirFd == -1 ? nullptr : fdopendir(dirFd);
+    if (!dir)
+    {
+        const int err = errno;
+        if (dirFd != -1)
+        {
+            close(dirFd);
+        }
+        throw std::system_error(err, std::system_category(), path);
+    }
+    rewinddir(dir);
+
+    std::vector<std::string> names;
+    errno = 0;
+    while (const dirent* entry = readdir(dir))
+    {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+        {
+            names.emplace_back(entry->d_name);
+        }
+    }
+    const int err = errno;
+    closedir(dir);
+    if (err)
+    {
+        throw std::system_error(err, std::system_category(), path);
+    }
+
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+int RootDir::link(int fd, int dirFd, const char* name)
+{
+    if (linkat(fd, "", dirFd, name, AT_EMPTY_PATH) == 0)
+    {
+        return 0;
+    }
+    if (errno != ENOENT && errno != EPERM)
+    {
+        return -1;
+    }
+    // AT_EMPTY_PATH requires CAP_DAC_READ_SEARCH, use procfs instead
+    const std::string proc = "/proc/self/fd/" + std::to_string(fd);
+    return linkat(AT_FDCWD, proc.c_str(), dirFd, name, AT_SYMLINK_FOLLOW);
+}
@@ -0,0 +1,213 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+/**
+ * @class FileHandle
+ * @brief File descriptor owner, closes the descriptor on destruction.
+ */
+class FileHandle
+{
+  public:
+    /**
+     * @brief Constructor.
+     *
+     * @param[in] fd file descriptor, -1 for none
+     */
+    explicit FileHandle(int fd) : fd(fd)
+    {}
+
+    ~FileHandle();
+
+    FileHandle(const FileHandle&) = delete;
+    FileHandle& operator=(const FileHandle&) = delete;
+
+    /**
+     * @brief Get file descriptor.
+     *
+     * @return file descriptor
+     */
+    int get() const
+    {
+        return fd;
+    }
+
+  private:
+    /** @brief File descriptor. */
+    int fd;
+};
+
+/**
+ * @class RootDir
+ * @brief Directory opened once, all paths inside it are resolved relative to
+ *        its descriptor and can't escape it.
+ *
+ * Paths are resolved with openat2(2): RESOLVE_BENEATH rejects symlinks and
+ * ".." leading outside the directory, RESOLVE_IN_ROOT (chroot mode) resolves
+ * absolute symlinks relative to the directory, as on a mounted image.
+ * Magic links (/proc/PID/fd/N) are rejected in both modes.
+ * On kernels without openat2 each component is opened with openat(2) and
+ * symlinks are not followed at all.
+ */
+class RootDir
+{
+  public:
+    /**
+     * @brief Constructor: open directory.
+     *
+     * @param[in] path path to the directory
+     * @param[in] chroot resolve absolute symlinks inside the directory,
+     *                   otherwise such symlinks are rejected
+     *
+     * @throw std::system_error in case of errors
+     */
+    explicit RootDir(const std::filesystem::path& path, bool chroot = false);
+
+    ~RootDir();
+
+    RootDir(const RootDir&) = delete;
+    RootDir& operator=(const RootDir&) = delete;
+
+    /**
+     * @brief Get path to the directory.
+     *
+     * @return path to the directory
+     */
+    const std::filesystem::path& path() const
+    {
+        return dirPath;
+    }
+
+    /**
+     * @brief Get descriptor of the directory.
+     *
+     * @return file descriptor
+     */
+    int fd() const
+    {
+        return dirFd;
+    }
+
+    /**
+     * @brief Open file inside the directory.
+     *
+     * @param[in] rel relative path to the file
+     * @param[in] flags open flags (O_CLOEXEC is added)
+     * @param[in] mode permissions of created file
+     *
+     * @return file descriptor or -1 on errors (errno is set)
+     */
+    int open(const std::filesystem::path& rel, int flags,
+             mode_t mode = 0) const;
+
+    /**
+     * @brief Check if file exists (last symlink is not followed).
+     *
+     * @param[in] rel relative path to the file
+     *
+     * @return true if file exists
+     */
+    bool exists(const std::filesystem::path& rel) const;
+
+    /**
+     * @brief Open directory, create it and its missing parents.
+     *
+     * @param[in] rel relative path to the directory
+     *
+     * @throw std::system_error in case of errors
+     *
+     * @return descriptor of the directory
+     */
+    int makeDirs(const std::filesystem::path& rel) const;
+
+    /**
+     * @brief Replace file atomically and durably: write the data to a new
+     *        temporary file next to it, fsync, rename over the file and
+     *        fsync the directory. The temporary file is removed on errors.
+     *
+     * @param[in] rel relative path to the file, missing parents are created
+     * @param[in] data pointer to the file content
+     * @param[in] size size of the file content
+     * @param[in] mode permissions of the file
+     *
+     * @throw std::system_error in case of errors
+     */
+    void replaceFile(const std::filesystem::path& rel, const void* data,
+                     size_t size, mode_t mode) const;
+
+    /**
+     * @brief Create new file with unique name (NAME.tmp.XXXXXX), which is
+     *        renamed to NAME when complete.
+     *
+     * @param[in] dirFd descriptor of the directory
+     * @param[in] name final name of the file
+     * @param[in] mode permissions of the file
+     * @param[out] tmpName name of the created file
+     *
+     * @return descriptor of the file opened for writing or -1 on errors
+     *         (errno is set)
+     */
+    static int createTemp(int dirFd, const std::string& name, mode_t mode,
+                          std::string& tmpName);
+
+    /**
+     * @brief Check if file name is a name of the temporary file created by
+     *        createTemp.
+     *
+     * @param[in] name file name
+     *
+     * @return true if name has format NAME.tmp.XXXXXX
+     */
+    static bool isTemp(const std::string& name);
+
+    /**
+     * @brief Open directory entry without following symlinks: regular files
+     *        and directories are opened for reading, other entries
+     *        (symlinks, devices, sockets) are opened with O_PATH.
+     *
+     * @param[in] dirFd descriptor of the parent directory
+     * @param[in] name name of the entry
+     *
+     * @return file descriptor or -1 on errors (errno is set)
+     */
+    static int openEntry(int dirFd, const char* name);
+
+    /**
+     * @brief Get sorted list of directory entries.
+     *
+     * @param[in] fd descriptor of the directory opened for reading
+     * @param[in] path path to the directory (for error messages)
+     *
+     * @throw std::system_error in case of errors
+     *
+     * @return names of the entries (without "." and "..")
+     */
+    static std::vector<std::string> list(int fd,
+                                         const std::filesystem::path& path);
+
+    /**
+     * @brief Create hard link to the opened file.
+     *
+     * @param[in] fd descriptor of the file
+     * @param[in] dirFd descriptor of the directory for the new link
+     * @param[in] name name of the new link
+     *
+     * @return 0 on success, -1 on errors (errno is set)
+     */
+    static int link(int fd, int dirFd, const char* name);
+
+  private:
+    /** @brief Path to the directory. */
+    std::filesystem::path dirPath;
+    /** @brief Directory descriptor. */
+    int dirFd;
+    /** @brief Resolve flags for openat2. */
+    unsigned long long resolve;
+};
@@ -0,0 +1,504 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "accounts_cache.hpp"
+#include "progress.hpp"
+#include "service.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+/** @brief Max length of the request line. */
+static constexpr size_t maxRequest = 4096;
+/** @brief Timeout for sending events to a client that doesn't read them. */
+static constexpr time_t sendTimeout = 5;
+
+/**
+ * @struct Service::Client
+ * @brief Client connection.
+ */
+struct Service::Client
+{
+    /**
+     * @brief Constructor.
+     *
+     * @param[in] fd connected socket
+     */
+    explicit Client(int fd) : fd(fd)
+    {}
+
+    ~Client()
+    {
+        close(fd);
+    }
+
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+
+    /**
+     * @brief Send event to the client, errors are ignored: the job is
+     *        executed even if the client is gone. After the first failed
+     *        or timed out send the client is dead: nothing is sent to it
+     *        anymore and the connection is shut down, so the job doesn't
+     *        wait for a client that doesn't read events.
+     *
+     * @param[in] event event line without line feed
+     */
+    void send(std::string event)
+    {
+        std::replace(event.begin(), event.end(), '\n', ' ');
+        event += '\n';
+        std::lock_guard<std::mutex> lock(mutex);
+        const char* ptr = event.data();
+        size_t left = event.size();
+        while (left && !dead)
+        {
+            const ssize_t rc = ::send(fd, ptr, left, MSG_NOSIGNAL);
+            if (rc < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (rc <= 0)
+            {
+                // the main loop sees the hang up and drops the client
+                dead = true;
+                ::shutdown(fd, SHUT_RDWR);
+                break;
+            }
+            ptr += rc;
+            left -= rc;
+        }
+    }
+
+    /** @brief Connected socket. */
+    int fd;
+    /** @brief Received data that is not a complete line yet. */
+    std::string input;
+    /** @brief Guard for sending events from different threads. */
+    std::mutex mutex;
+    /** @brief Sending failed, the client is dropped. */
+    bool dead = false;
+};
+
+/**
+ * @class JobSink
+ * @brief Sends progress reports of the job to the client.
+ */
+class JobSink : public ProgressSink
+{
+  public:
+    /**
+     * @brief Constructor.
+     *
+     * @param[in] send function to send event to the client
+     */
+    explicit JobSink(std::function<void(const std::string&)> send) :
+        send(std::move(send))
+    {}
+
+    void update(const Status& status) override
+    {
+        std::string event = status.phase;
+        for (const uint64_t num :
+             {status.bytes, status.totalBytes,
+              static_cast<uint64_t>(status.entries),
+              static_cast<uint64_t>(status.totalEntries)})
+        {
+            event += ' ';
+            event += std::to_string(num);
+        }
+        event += ' ';
+        event += std::to_string(status.finished ? 0 : status.eta);
+        if (!status.item.empty() && !status.finished)
+        {
+            event += ' ';
+            event += status.item;
+        }
+        send(event);
+    }
+
+  private:
+    /** @brief Function to send event to the client. */
+    std::function<void(const std::string&)> send;
+};
+
+/**
+ * @brief Check that the peer of the connection is root or the user of the
+ *        service.
+ *
+ * @param[in] fd connected socket
+ *
+ * @return true if the peer is allowed to send requests
+ */
+static bool isTrusted(int fd)
+{
+    ucred cred = {};
+    socklen_t len = sizeof(cred);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 &&
+           len == sizeof(cred) && (cred.uid == 0 || cred.uid == geteuid());
+}
+
+/**
+ * @brief Fill Unix socket address.
+ *
+ * @param[in] path path to the socket
+ *
+ * @throw std::invalid_argument if path is too long
+ *
+ * @return socket address
+ */
+static sockaddr_un socketAddress(const fs::path& path)
+{
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.native().size() >= sizeof(addr.sun_path))
+    {
+        std::string err = "Socket path is too long: ";
+        err += path;
+        throw std::invalid_argument(err);
+    }
+    strcpy(addr.sun_path, path.c_str());
+    return addr;
+}
+
+Service::Service(const Backup& proto, const fs::path& socketPath) :
+    proto(proto), socketPath(socketPath),
+    filesCache(std::make_shared<AccountsCache>())
+{
+    const sockaddr_un addr = socketAddress(socketPath);
+    const auto sa = reinterpret_cast<const sockaddr*>(&addr);
+
+    // socket of the crashed instance is removed, the running one is kept
+    struct stat st;
+    if (lstat(socketPath.c_str(), &st) == 0)
+    {
+        const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        const bool running =
+            fd != -1 && S_ISSOCK(st.st_mode) &&
+            (connect(fd, sa, sizeof(addr)) == 0 || errno != ECONNREFUSED);
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        if (running || !S_ISSOCK(st.st_mode))
+        {
+            std::string err = "Socket is in use: ";
+            err += socketPath;
+            throw std::runtime_error(err);
+        }
+        unlink(socketPath.c_str());
+    }
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd == -1)
+    {
+        throw std::system_error(errno, std::system_category(), "socket");
+    }
+    // the socket must never be accessible by other users, even for a
+    // moment between bind() and chmod()
+    const mode_t mask = umask(S_IRWXG | S_IRWXO);
+    const int rc = bind(listenFd, sa, sizeof(addr));
+    umask(mask);
+    if (rc != 0 || chmod(socketPath.c_str(), S_IRUSR | S_IWUSR) != 0 ||
+        listen(listenFd, SOMAXCONN) != 0 ||
+        pipe2(wakeFd, O_CLOEXEC | O_NONBLOCK) != 0)
+    {
+        const int err = errno;
+        close(listenFd);
+        unlink(socketPath.c_str());
+        throw std::system_error(err, std::system_category(), socketPath);
+    }
+}
+
+Service::~Service()
+{
+    close(listenFd);
+    unlink(socketPath.c_str());
+    close(wakeFd[0]);
+    close(wakeFd[1]);
+}
+
+void Service::run()
+{
+    std::thread thread(&Service::worker, this);
+    std::vector<std::shared_ptr<Client>> clients;
+    try
+    {
+        while (true)
+        {
+            std::vector<pollfd> fds;
+            fds.push_back({wakeFd[0], POLLIN, 0});
+            fds.push_back({listenFd, POLLIN, 0});
+            for (const auto& it : clients)
+            {
+                fds.push_back({it->fd, POLLIN, 0});
+            }
+            if (poll(fds.data(), fds.size(), -1) < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::system_error(errno, std::system_category(), "poll");
+            }
+            if (fds[0].revents)
+            {
+                break;
+            }
+
+            // clients are checked before accepting new ones: indexes of
+            // poll descriptors must match the list
+            for (size_t i = clients.size(); i-- > 0;)
+            {
+                if (fds[i + 2].revents && !receive(clients[i]))
+                {
+                    clients.erase(clients.begin() + i);
+                }
+            }
+
+            if (fds[1].revents & POLLIN)
+            {
+                const int fd =
+                    accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+                if (fd != -1 && !isTrusted(fd))
+                {
+                    static const char denied[] =
+                        "error 0 Permission denied\n";
+                    send(fd, denied, sizeof(denied) - 1,
+                         MSG_NOSIGNAL | MSG_DONTWAIT);
+                    close(fd);
+                }
+                else if (fd != -1)
+                {
+                    const timeval tv = {sendTimeout, 0};
+                    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+                    clients.push_back(std::make_shared<Client>(fd));
+                }
+            }
+        }
+    }
+    catch (...)
+    {
+        shutdown();
+        thread.join();
+        throw;
+    }
+    shutdown();
+    thread.join();
+}
+
+void Service::stop()
+{
+    // write() is async-signal-safe
+    const char stopByte = 0;
+    if (write(wakeFd[1], &stopByte, 1) < 0)
+    {
+        // pipe is full: stop is already requested
+    }
+}
+
+bool Service::receive(const std::shared_ptr<Client>& client)
+{
+    char buf[1024];
+    const ssize_t rc = recv(client->fd, buf, sizeof(buf), 0);
+    if (rc <= 0)
+    {
+        return rc < 0 && errno == EINTR;
+    }
+    client->input.append(buf, rc);
+
+    size_t pos;
+    while ((pos = client->input.find('\n')) != std::string::npos)
+    {
+        submit(client, client->input.substr(0, pos));
+        client->input.erase(0, pos + 1);
+    }
+    if (client->input.size() > maxRequest)
+    {
+        client->send("error 0 Request is too long");
+        return false;
+    }
+    return true;
+}
+
+void Service::submit(const std::shared_ptr<Client>& client,
+                     const std::string& request)
+{
+    std::istringstream fields(request);
+    std::string op;
+    if (!(fields >> op))
+    {
+        return; // empty line
+    }
+    std::vector<fs::path> args;
+    fs::path arg;
+    while (fields >> arg)
+    {
+        args.push_back(arg);
+    }
+    if (op == "cancel" && args.size() == 1)
+    {
+        cancel(client, args[0]);
+        return;
+    }
+    if ((op != "backup" && op != "restore") || args.empty() ||
+        args.size() > 3 || args[0].empty())
+    {
+        client->send("error 0 Invalid request, expected "
+                     "\"backup|restore ARCHIVE [ROOT_FS [RO_FS]]\" or "
+                     "\"cancel ID\"");
+        return;
+    }
+
+    Job job;
+    job.archiveFile = args[0];
+    job.rootFs = args.size() > 1 ? args[1] : proto.rootFs;
+    job.readOnlyFs = args.size() > 2 ? args[2] : proto.readOnlyFs;
+    job.restore = op == "restore";
+    job.client = client;
+    job.cancel = std::make_shared<CancelToken>();
+
+    size_t ahead;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job.id = ++lastId;
+        ahead = queue.size() + (runningId != 0);
+    }
+    // events are never sent under the lock, a slow client must not block
+    // the worker; the job is queued after the event, so "started" can't
+    // outrun it (jobs are submitted by this thread only)
+    client->send("queued " + std::to_string(job.id) + ' ' +
+                 std::to_string(ahead));
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.push_back(std::move(job));
+    cond.notify_one();
+}
+
+void Service::cancel(const std::shared_ptr<Client>& client,
+                     const std::string& jobId)
+{
+    std::shared_ptr<Client> owner;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (runningId && std::to_string(runningId) == jobId)
+        {
+            // the job reports error when it stops
+            runningCancel->cancel();
+            return;
+        }
+        const auto it = std::find_if(
+            queue.begin(), queue.end(), [&jobId](const Job& job) {
+                return std::to_string(job.id) == jobId;
+            });
+        if (it != queue.end())
+        {
+            owner = it->client;
+            queue.erase(it);
+        }
+    }
+    if (owner)
+    {
+        owner->send("error " + jobId + ' ' + Cancelled().what());
+    }
+    else
+    {
+        client->send("error 0 Job not found: " + jobId);
+    }
+}
+
+void Service::worker()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        cond.wait(lock, [this]() { return stopping || !queue.empty(); });
+        if (queue.empty())
+        {
+            break;
+        }
+        Job job = std::move(queue.front());
+        queue.pop_front();
+        if (stopping)
+        {
+            lock.unlock();
+            job.client->send("error " + std::to_string(job.id) +
+                             " Service is stopped");
+            lock.lock();
+            continue;
+        }
+        runningId = job.id;
+        runningCancel = job.cancel;
+        lock.unlock();
+        execute(job);
+        lock.lock();
+        runningId = 0;
+        runningCancel.reset();
+    }
+}
+
+void Service::execute(const Job& job) const
+{
+    using Clock = std::chrono::steady_clock;
+    static const char* modes[] = {"memory", "staged", "streaming"};
+
+    const Clock::time_point start = Clock::now();
+    const std::string id = std::to_string(job.id);
+    Client& client = *job.client;
+    client.send("started " + id);
+    try
+    {
+        Backup backup(proto);
+        backup.unattendedMode = true;
+        backup.verbose = false;
+        backup.accountsCache = filesCache;
+        backup.archiveFile = job.archiveFile;
+        backup.rootFs = job.rootFs;
+        backup.readOnlyFs = job.readOnlyFs;
+        backup.progressSink =
+            std::make_shared<JobSink>([&client, &id](const std::string& ev) {
+                client.send("progress " + id + ' ' + ev);
+            });
+        backup.cancel = job.cancel;
+        if (job.restore)
+        {
+            backup.restore();
+        }
+        else
+        {
+            backup.backup();
+        }
+        const auto time = std::chrono::duration_cast<std::chrono::milliseconds>(
+                              Clock::now() - start)
+                              .count();
+        client.send("done " + id + ' ' +
+                    modes[static_cast<size_t>(backup.mode())] + ' ' +
+                    std::to_string(time));
+    }
+    catch (const std::exception& ex)
+    {
+        client.send("error " + id + ' ' + ex.what());
+    }
+}
+
+void Service::shutdown()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    cond.notify_one();
+}
@@ -0,0 +1,174 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#pragma once
+
+#include "backup.hpp"
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/**
+ * @class Service
+ * @brief Resident backup service listening on a Unix socket.
+ *
+ * Each line sent by a client is a request:
+ *   backup|restore ARCHIVE [ROOT_FS [RO_FS]]
+ *   cancel ID
+ * Requests of all clients are queued and executed one at a time in order of
+ * arrival, each job uses its own copy of the prototype settings. Parsed RO
+ * accounts files and os-release of the root FS are kept between jobs.
+ * The service reports state of the job to the client that sent it:
+ *   queued ID JOBS_AHEAD
+ *   started ID
+ *   progress ID PHASE BYTES TOTAL_BYTES ENTRIES TOTAL_ENTRIES ETA [ITEM]
+ *   done ID MODE TIME_MS
+ *   error ID MESSAGE
+ * Totals are 0 if unknown, ETA is in seconds, -1 if unknown. Invalid request
+ * is reported as error with ID 0.
+ * The socket is accessible by the owner only, connections of processes of
+ * other users (except root) are rejected.
+ */
+class Service
+{
+  public:
+    /**
+     * @brief Constructor: create listening socket.
+     *
+     * @param[in] proto prototype with settings for all jobs
+     * @param[in] socketPath path to the Unix socket
+     *
+     * @throw std::exception in case of errors or if another instance of the
+     *        service is listening on the socket
+     */
+    Service(const Backup& proto, const std::filesystem::path& socketPath);
+
+    ~Service();
+
+    Service(const Service&) = delete;
+    Service& operator=(const Service&) = delete;
+
+    /**
+     * @brief Serve clients until the service is stopped. The running job is
+     *        completed before return, queued jobs are rejected.
+     *
+     * @throw std::system_error in case of errors
+     */
+    void run();
+
+    /**
+     * @brief Stop the service, can be called from a signal handler.
+     */
+    void stop();
+
+    /**
+     * @brief Get cache of parsed files shared between jobs.
+     *
+     * @return cache instance
+     */
+    const AccountsCache& cache() const
+    {
+        return *filesCache;
+    }
+
+  private:
+    /** @brief Client connection. */
+    struct Client;
+
+    /**
+     * @struct Job
+     * @brief Queued request.
+     */
+    struct Job
+    {
+        /** @brief Job identifier. */
+        size_t id;
+        /** @brief Restore operation, otherwise backup. */
+        bool restore;
+        /** @brief Path to the archive file. */
+        std::filesystem::path archiveFile;
+        /** @brief Path to the root file system. */
+        std::filesystem::path rootFs;
+        /** @brief Path to the read only file system. */
+        std::filesystem::path readOnlyFs;
+        /** @brief Client that sent the request. */
+        std::shared_ptr<Client> client;
+        /** @brief Cancellation token of the job. */
+        std::shared_ptr<CancelToken> cancel;
+    };
+
+    /**
+     * @brief Handle data received from the client.
+     *
+     * @param[in] client client connection
+     *
+     * @return false if connection must be closed
+     */
+    bool receive(const std::shared_ptr<Client>& client);
+
+    /**
+     * @brief Parse request and put the job to the queue.
+     *
+     * @param[in] client client connection
+     * @param[in] request request line
+     */
+    void submit(const std::shared_ptr<Client>& client,
+                const std::string& request);
+
+    /**
+     * @brief Cancel running job or remove queued one.
+     *
+     * @param[in] client client connection
+     * @param[in] jobId job identifier
+     */
+    void cancel(const std::shared_ptr<Client>& client,
+                const std::string& jobId);
+
+    /**
+     * @brief Execute queued jobs until the service is stopped.
+     */
+    void worker();
+
+    /**
+     * @brief Execute single job.
+     *
+     * @param[in] job job description
+     */
+    void execute(const Job& job) const;
+
+    /**
+     * @brief Stop worker thread.
+     */
+    void shutdown();
+
+  private:
+    /** @brief Prototype with settings for all jobs. */
+    const Backup& proto;
+    /** @brief Path to the Unix socket. */
+    std::filesystem::path socketPath;
+    /** @brief Listening socket. */
+    int listenFd = -1;
+    /** @brief Pipe used to wake up the main loop on stop. */
+    int wakeFd[2] = {-1, -1};
+    /** @brief Cache of parsed RO accounts files and os-release. */
+    std::shared_ptr<AccountsCache> filesCache;
+    /** @brief Queued jobs. */
+    std::deque<Job> queue;
+    /** @brief Identifier of the last job. */
+    size_t lastId = 0;
+    /** @brief Identifier of the running job, 0 if worker is idle. */
+    size_t runningId = 0;
+    /** @brief Cancellation token of the running job. */
+    std::shared_ptr<CancelToken> runningCancel;
+    /** @brief Service is stopping. */
+    bool stopping = false;
+    /** @brief Guard for queue and worker state. */
+    std::mutex mutex;
+    /** @brief Signal for the worker thread. */
+    std::condition_variable cond;
+};
@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "throttle.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+Throttle::Throttle(uint64_t rate, uint64_t burst) :
+    bytesPerSec(rate), capacity(static_cast<double>(burst ? burst : rate)),
+    tokens(capacity), lastRefill(Clock::now())
+{
+    if (!rate)
+    {
+        throw std::invalid_argument("Rate limit must be greater than zero");
+    }
+}
+
+void Throttle::consume(uint64_t bytes)
+{
+    std::chrono::duration<double> delay{};
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        const Clock::time_point now = Clock::now();
+        const std::chrono::duration<double> elapsed = now - lastRefill;
+        lastRefill = now;
+        tokens = std::min(capacity, tokens + elapsed.count() * bytesPerSec);
+
+        // take tokens in advance, the debt is paid by waiting
+        tokens -= static_cast<double>(bytes);
+        if (tokens < 0)
+        {
+            delay = std::chrono::duration<double>(-tokens / bytesPerSec);
+        }
+    }
+
+    if (delay.count() > 0)
+    {
+        std::this_thread::sleep_for(delay);
+    }
+}
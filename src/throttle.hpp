@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+/**
+ * @class Throttle
+ * @brief I/O throughput limiter (token bucket).
+ *
+ * The limiter is shared between all read and write paths, callers report
+ * the number of bytes they are going to process and get suspended if the
+ * rate limit is exceeded.
+ */
+class Throttle
+{
+  public:
+    /**
+     * @brief Constructor.
+     *
+     * @param[in] rate max throughput in bytes per second
+     * @param[in] burst max number of bytes that can be processed without
+     *                  delay, 0 to use rate value (one second of I/O)
+     */
+    explicit Throttle(uint64_t rate, uint64_t burst = 0);
+
+    /**
+     * @brief Take tokens from the bucket, wait if there are not enough.
+     *
+     * @param[in] bytes number of bytes to process
+     */
+    void consume(uint64_t bytes);
+
+    /**
+     * @brief Get rate limit.
+     *
+     * @return max throughput in bytes per second
+     */
+    uint64_t rate() const
+    {
+        return bytesPerSec;
+    }
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    /** @brief Max throughput in bytes per second. */
+    const uint64_t bytesPerSec;
+    /** @brief Capacity of the bucket. */
+    const double capacity;
+    /** @brief Tokens available, negative value means debt. */
+    double tokens;
+    /** @brief Time of the last refill. */
+    Clock::time_point lastRefill;
+    /** @brief Mutex to protect bucket state. */
+    std::mutex mutex;
+};
@@ -0,0 +1,267 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "tokenizer.hpp"
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/** @brief Line separator. */
+static constexpr char lineFeed = '\n';
+/** @brief Size of the block processed by vector kernels. */
+static constexpr size_t blockSize = 64;
+
+/**
+ * @struct Offsets
+ * @brief Output of the scanner.
+ */
+struct Offsets
+{
+    /**
+     * @brief Register separator.
+     *
+     * @param[in] text source text
+     * @param[in] pos offset of the separator
+     */
+    void add(const char* text, size_t pos)
+    {
+        fields.push_back(pos);
+        if (text[pos] == lineFeed)
+        {
+            lines.push_back(fields.size());
+        }
+    }
+
+    /** @brief Offsets of separators. */
+    std::vector<size_t>& fields;
+    /** @brief Number of separators at the end of each line. */
+    std::vector<size_t>& lines;
+};
+
+/**
+ * @brief Find separators with byte by byte loop.
+ *
+ * @param[in] text source text
+ * @param[in] begin offset to start from
+ * @param[in] end offset to stop at
+ * @param[in] delimiter delimiter between fields
+ * @param[out] out found offsets
+ */
+static void scanPortable(const char* text, size_t begin, size_t end,
+                         char delimiter, Offsets& out)
+{
+    for (size_t pos = begin; pos < end; ++pos)
+    {
+        if (text[pos] == delimiter || text[pos] == lineFeed)
+        {
+            out.add(text, pos);
+        }
+    }
+}
+
+#if defined(__x86_64__)
+/**
+ * @brief Register all separators marked in the bitmap.
+ *
+ * @param[in] text source text
+ * @param[in] base offset of the block
+ * @param[in] mask bitmap of separators, bit N is byte N of the block
+ * @param[out] out found offsets
+ */
+static inline void addMask(const char* text, size_t base, uint64_t mask,
+                           Offsets& out)
+{
+    while (mask)
+    {
+        out.add(text, base + __builtin_ctzll(mask));
+        mask &= mask - 1;
+    }
+}
+
+/**
+ * @brief Find separators with SSE2 instructions.
+ *
+ * @param[in] text source text
+ * @param[in] size size of the text
+ * @param[in] delimiter delimiter between fields
+ * @param[out] out found offsets
+ */
+static void scanSse2(const char* text, size_t size, char delimiter,
+                     Offsets& out)
+{
+    const __m128i lf = _mm_set1_epi8(lineFeed);
+    const __m128i dl = _mm_set1_epi8(delimiter);
+
+    size_t pos = 0;
+    for (; pos + blockSize <= size; pos += blockSize)
+    {
+        uint64_t mask = 0;
+        for (size_t i = 0; i < blockSize / 16; ++i)
+        {
+            const __m128i v = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(text + pos + i * 16));
+            const __m128i eq =
+                _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, dl));
+            mask |= static_cast<uint64_t>(_mm_movemask_epi8(eq)) << (i * 16);
+        }
+        addMask(text, pos, mask, out);
+    }
+    scanPortable(text, pos, size, delimiter, out);
+}
+#elif defined(__ARM_NEON)
+/**
+ * @brief Find separators with NEON instructions.
+ *
+ * @param[in] text source text
+ * @param[in] size size of the text
+ * @param[in] delimiter delimiter between fields
+ * @param[out] out found offsets
+ */
+static void scanNeon(const char* text, size_t size, char delimiter,
+                     Offsets& out)
+{
+    const uint8x16_t lf = vdupq_n_u8(lineFeed);
+    const uint8x16_t dl = vdupq_n_u8(delimiter);
+
+    size_t pos = 0;
+    for (; pos + blockSize <= size; pos += blockSize)
+    {
+        for (size_t i = 0; i < blockSize / 16; ++i)
+        {
+            const size_t base = pos + i * 16;
+            const uint8x16_t v =
+                vld1q_u8(reinterpret_cast<const uint8_t*>(text + base));
+            const uint8x16_t eq = vorrq_u8(vceqq_u8(v, lf), vceqq_u8(v, dl));
+            // no movemask on NEON: narrow each byte to 4 bits
+            const uint8x8_t nibbles =
+                vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+            uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+            mask &= 0x8888888888888888ull;
+            while (mask)
+            {
+                out.add(text, base + (__builtin_ctzll(mask) >> 2));
+                mask &= mask - 1;
+            }
+        }
+    }
+    scanPortable(text, pos, size, delimiter, out);
+}
+#endif
+
+/** @brief Pointer to the implementation function. */
+using KernelFn = void (*)(const char*, size_t, char, Offsets&);
+
+/**
+ * @brief Find separators with byte by byte loop.
+ *
+ * @param[in] text source text
+ * @param[in] size size of the text
+ * @param[in] delimiter delimiter between fields
+ * @param[out] out found offsets
+ */
+static void scanText(const char* text, size_t size, char delimiter,
+                     Offsets& out)
+{
+    scanPortable(text, 0, size, delimiter, out);
+}
+
+/**
+ * @brief Get implementation function.
+ *
+ * @param[in] kernel implementation type
+ *
+ * @return pointer to the function, nullptr if not supported by the CPU
+ */
+static KernelFn getKernel(Tokenizer::Kernel kernel)
+{
+    switch (kernel)
+    {
+        case Tokenizer::Kernel::portable:
+            return scanText;
+#if defined(__x86_64__)
+        case Tokenizer::Kernel::sse2:
+            return scanSse2; // part of the x86-64 base
+#elif defined(__ARM_NEON)
+        case Tokenizer::Kernel::neon:
+            return scanNeon; // enabled by the compiler flags (-mfpu=neon)
+#endif
+        default:
+            return nullptr;
+    }
+}
+
+Tokenizer::Tokenizer(std::string_view text, char delimiter) :
+    Tokenizer(kernel(), text, delimiter)
+{}
+
+Tokenizer::Tokenizer(Kernel kernel, std::string_view text, char delimiter) :
+    text(text)
+{
+    const KernelFn fn = getKernel(kernel);
+    if (!fn)
+    {
+        std::string err = "Tokenizer implementation is not supported: ";
+        err += name(kernel);
+        throw std::invalid_argument(err);
+    }
+
+    // rough estimate for account files: ~40 bytes per line, 7 fields
+    fieldEnds.reserve(text.size() / 6 + 1);
+    lineEnds.reserve(text.size() / 40 + 1);
+
+    Offsets out{fieldEnds, lineEnds};
+    fn(text.data(), text.size(), delimiter, out);
+
+    // the last line without line feed
+    if (!text.empty() && text.back() != lineFeed)
+    {
+        fieldEnds.push_back(text.size());
+        lineEnds.push_back(fieldEnds.size());
+    }
+}
+
+Tokenizer::Kernel Tokenizer::kernel()
+{
+    for (const Kernel it : {Kernel::neon, Kernel::sse2})
+    {
+        if (getKernel(it))
+        {
+            return it;
+        }
+    }
+    return Kernel::portable;
+}
+
+std::vector<Tokenizer::Kernel> Tokenizer::kernels()
+{
+    std::vector<Kernel> list;
+    for (const Kernel it : {Kernel::portable, Kernel::sse2, Kernel::neon})
+    {
+        if (getKernel(it))
+        {
+            list.push_back(it);
+        }
+    }
+    return list;
+}
+
+const char* Tokenizer::name(Kernel kernel)
+{
+    switch (kernel)
+    {
+        case Kernel::portable:
+            return "portable";
+        case Kernel::sse2:
+            return "sse2";
+        case Kernel::neon:
+            return "neon";
+    }
+    return "unknown";
+}
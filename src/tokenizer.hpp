@@ -0,0 +1,165 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+/**
+ * @class Tokenizer
+ * @brief Splitter of a text buffer into lines and fields.
+ *
+ * The whole buffer is scanned at once for line feeds and field delimiters,
+ * only offsets of the found separators are stored, so lines and fields are
+ * views of the source text, which must outlive the tokenizer. The scanner
+ * is chosen at runtime: SSE2 on x86, NEON on ARM (ARMv7 with NEON enabled
+ * and ARMv8), byte loop on other CPUs.
+ */
+class Tokenizer
+{
+  public:
+    /**
+     * @brief Scanner implementations.
+     */
+    enum class Kernel
+    {
+        /** Byte by byte loop. */
+        portable,
+        /** x86 SSE2 compare of 64 bytes per iteration. */
+        sse2,
+        /** ARM NEON compare of 64 bytes per iteration. */
+        neon
+    };
+
+    /**
+     * @class Line
+     * @brief Single line split into fields.
+     */
+    class Line
+    {
+      public:
+        /**
+         * @brief Constructor.
+         *
+         * @param[in] text source text
+         * @param[in] begin offset of the line in the text
+         * @param[in] ends offsets of fields ends in the text
+         * @param[in] count number of fields
+         */
+        Line(const char* text, size_t begin, const size_t* ends,
+             size_t count) :
+            text(text),
+            begin(begin), ends(ends), count(count)
+        {}
+
+        /**
+         * @brief Get number of fields.
+         *
+         * @return number of fields, at least 1
+         */
+        size_t size() const
+        {
+            return count;
+        }
+
+        /**
+         * @brief Get field value.
+         *
+         * @param[in] index field index
+         *
+         * @return field value
+         */
+        std::string_view operator[](size_t index) const
+        {
+            const size_t start = index ? ends[index - 1] + 1 : begin;
+            return std::string_view(text + start, ends[index] - start);
+        }
+
+      private:
+        /** @brief Source text. */
+        const char* text;
+        /** @brief Offset of the line in the text. */
+        size_t begin;
+        /** @brief Offsets of fields ends. */
+        const size_t* ends;
+        /** @brief Number of fields. */
+        size_t count;
+    };
+
+    /**
+     * @brief Constructor: split text with the fastest implementation.
+     *
+     * @param[in] text source text
+     * @param[in] delimiter delimiter between fields
+     */
+    Tokenizer(std::string_view text, char delimiter);
+
+    /**
+     * @brief Constructor: split text with specified implementation.
+     *
+     * @param[in] kernel implementation to use
+     * @param[in] text source text
+     * @param[in] delimiter delimiter between fields
+     *
+     * @throw std::invalid_argument if implementation is not supported
+     */
+    Tokenizer(Kernel kernel, std::string_view text, char delimiter);
+
+    /**
+     * @brief Get number of lines.
+     *
+     * @return number of lines, the last one may have no line feed
+     */
+    size_t size() const
+    {
+        return lineEnds.size();
+    }
+
+    /**
+     * @brief Get line.
+     *
+     * @param[in] index line index
+     *
+     * @return line split into fields
+     */
+    Line operator[](size_t index) const
+    {
+        const size_t first = index ? lineEnds[index - 1] : 0;
+        const size_t begin = first ? fieldEnds[first - 1] + 1 : 0;
+        return Line(text.data(), begin, fieldEnds.data() + first,
+                    lineEnds[index] - first);
+    }
+
+    /**
+     * @brief Get implementation used by default.
+     *
+     * @return fastest implementation supported by the CPU
+     */
+    static Kernel kernel();
+
+    /**
+     * @brief Get all implementations supported by the CPU.
+     *
+     * @return list of implementations
+     */
+    static std::vector<Kernel> kernels();
+
+    /**
+     * @brief Get name of the implementation.
+     *
+     * @param[in] kernel implementation
+     *
+     * @return name of the implementation
+     */
+    static const char* name(Kernel kernel);
+
+  private:
+    /** @brief Source text. */
+    std::string_view text;
+    /** @brief Offsets of separators (end of each field). */
+    std::vector<size_t> fieldEnds;
+    /** @brief Index in fieldEnds after the last field of each line. */
+    std::vector<size_t> lineEnds;
+};
@@ -10,7 +10,8 @@ TEST(AccountEntryTest, Invalid)
     ASSERT_THROW(AccountEntry<2>(":d"), std::runtime_error);
     ASSERT_THROW(AccountEntry<2>("a:b:c:d"), std::runtime_error);
     ASSERT_THROW(AccountEntry<10>("a:b:c:d"), std::runtime_error);
-    ASSERT_THROW(AccountEntry<2>("65536:").getNumber(0), std::out_of_range);
+    ASSERT_THROW(AccountEntry<2>("4294967296:").getNumber(0),
+                 std::out_of_range);
     ASSERT_THROW(AccountEntry<2>("nan:").getNumber(0), std::invalid_argument);
     ASSERT_THROW(AccountEntry<2>("a:").getNumber(1), std::invalid_argument);
     ASSERT_THROW(AccountEntry<2>("a:b").get(10), std::out_of_range);
@@ -59,6 +60,9 @@ TEST(AccountEntryTest, Group)
     EXPECT_EQ(cfg.getMembers(), "x1,y2,z3");
     cfg.setMembers("a3,b2,c1");
     EXPECT_EQ(cfg.getMembers(), "a3,b2,c1");
+    cfg.setMembers(",a,,b,");
+    EXPECT_EQ(cfg.getMemberList(),
+              std::vector<std::string_view>({"a", "b"}));
 }
 
 TEST(AccountEntryTest, Passwd)
@@ -67,6 +71,42 @@ TEST(AccountEntryTest, Passwd)
     EXPECT_EQ(cfg.name(), "name");
     EXPECT_EQ(cfg.uid(), 1001);
     EXPECT_EQ(cfg.gid(), 1002);
+
+    // 32-bit IDs
+    cfg = PasswdEntry("big:x:4294967294:100000::/:/bin/sh");
+    EXPECT_EQ(cfg.uid(), 4294967294);
+    EXPECT_EQ(cfg.gid(), 100000);
+}
+
+TEST(AccountEntryTest, Schema)
+{
+    static_assert(PasswdEntry::fieldUid == 2);
+    static_assert(PasswdEntry::fieldGid == 3);
+    static_assert(GroupEntry::fieldMembers == 3);
+    static_assert(fieldPosition(PasswdSchema::fields, "shell") == 6);
+
+    // numeric fields are validated on load
+    try
+    {
+        PasswdEntry("name:x:1x:0::/:/bin/sh");
+        FAIL() << "Exception expected";
+    }
+    catch (const std::runtime_error& ex)
+    {
+        EXPECT_STREQ(ex.what(), "Invalid value of field uid: 1x");
+    }
+    EXPECT_THROW(PasswdEntry("name:x:1:4294967296::/:/bin/sh"),
+                 std::runtime_error);
+    EXPECT_THROW(GroupEntry("name:x::"), std::runtime_error);
+
+    auto cfg = GroupEntry("name:x:1:");
+    EXPECT_THROW(cfg.set(GroupEntry::fieldGid, "-1"), std::runtime_error);
+    EXPECT_EQ(cfg.gid(), 1);
+    cfg.set(GroupEntry::fieldGid, "42");
+    EXPECT_EQ(cfg.gid(), 42);
+
+    // empty dates of shadow entry are allowed
+    EXPECT_NO_THROW(ShadowEntry("user:!:::::::"));
 }
 
 TEST(AccountEntryTest, Shadow)
@@ -74,3 +114,16 @@ TEST(AccountEntryTest, Shadow)
     auto cfg = ShadowEntry("news:*:18422:0:99999:7:::");
     EXPECT_EQ(cfg.name(), "news");
 }
+
+TEST(AccountEntryTest, Tokenized)
+{
+    const Tokenizer lines("name::123:x1,y2,z3\n:a:b:c\na:b:c\n", ':');
+    ASSERT_EQ(lines.size(), 3);
+    auto cfg = AccountEntry<4>(lines[0]);
+    EXPECT_EQ(cfg.name(), "name");
+    EXPECT_EQ(cfg.get(1), "");
+    EXPECT_EQ(cfg.getNumber(2), 123);
+    EXPECT_EQ(cfg.get(3), "x1,y2,z3");
+    ASSERT_THROW(AccountEntry<4>{lines[1]}, std::runtime_error);
+    ASSERT_THROW(AccountEntry<4>{lines[2]}, std::runtime_error);
+}
@@ -77,6 +77,35 @@ TEST(AccountListTest, LoadEmpty)
     fs::remove(inFile);
 }
 
+TEST(AccountListTest, Arena)
+{
+    const fs::path inFile = fs::temp_directory_path() / "account_list_test";
+    const std::string longValue(100, 'x');
+    std::ofstream file(inFile);
+    file << "a:" << longValue << "\n";
+    file << "b:2\n";
+    file.close();
+
+    List copy{{"c:3"}, {"d:4"}, {"e:5"}};
+    {
+        List l;
+        l.load(inFile);
+        ASSERT_EQ(l.size(), 2);
+        l.get("b")->set(1, longValue + longValue);
+        l.push_back(copy[0]);
+
+        // copies of the entries don't depend on the arena of the list
+        List moved(std::move(l));
+        copy = moved;
+    }
+    ASSERT_EQ(copy.size(), 3);
+    EXPECT_EQ(copy.get("a")->get(1), longValue);
+    EXPECT_EQ(copy.get("b")->get(1), longValue + longValue);
+    EXPECT_TRUE(copy.get("c"));
+
+    fs::remove(inFile);
+}
+
 TEST(AccountListTest, Save)
 {
     const fs::path outFile = fs::temp_directory_path() / "account_list_test";
@@ -0,0 +1,190 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "account_entry.hpp"
+#include "account_list.hpp"
+#include "tokenizer.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+using Passwd = AccountList<PasswdEntry>;
+
+/** @brief Number of lines in the test file. */
+static constexpr size_t lineCount = 100000;
+
+/** @brief Number of memory allocations. */
+static size_t allocations = 0;
+
+void* operator new(size_t size)
+{
+    ++allocations;
+    void* ptr = malloc(size ? size : 1);
+    if (!ptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+// default memory resource of pmr strings uses aligned allocation
+void* operator new(size_t size, std::align_val_t align)
+{
+    ++allocations;
+    const size_t al = static_cast<size_t>(align);
+    void* ptr = aligned_alloc(al, (size + al - 1) / al * al);
+    if (!ptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept
+{
+    free(ptr);
+}
+
+/**
+ * @brief Count memory allocations of the function.
+ *
+ * @param[in] fn function to check
+ *
+ * @return number of allocations
+ */
+static size_t countAllocations(const std::function<size_t()>& fn)
+{
+    const size_t before = allocations;
+    fn();
+    return allocations - before;
+}
+
+/**
+ * @brief Measure throughput of the function.
+ *
+ * @param[in] size size of the text processed by a single call
+ * @param[in] fn function to measure, returns number of parsed lines
+ *
+ * @return throughput in MiB/s
+ */
+static double measure(size_t size, const std::function<size_t()>& fn)
+{
+    using Clock = std::chrono::steady_clock;
+    const auto minTime = std::chrono::milliseconds(500);
+
+    uint64_t total = 0;
+    size_t lines = 0;
+    const Clock::time_point start = Clock::now();
+    Clock::duration elapsed;
+    do
+    {
+        lines += fn();
+        total += size;
+        elapsed = Clock::now() - start;
+    } while (elapsed < minTime);
+
+    // prevent optimizing out
+    if (lines == 42)
+    {
+        puts("");
+    }
+
+    const double sec = std::chrono::duration<double>(elapsed).count();
+    return total / sec / (1024 * 1024);
+}
+
+/**
+ * @brief Measure the function and print result.
+ *
+ * @param[in] name name of the method
+ * @param[in] size size of the text processed by a single call
+ * @param[in] fn function to measure, returns number of parsed lines
+ */
+static void print(const std::string& name, size_t size,
+                  const std::function<size_t()>& fn)
+{
+    const size_t allocs = countAllocations(fn);
+    const double mibs = measure(size, fn);
+    const double lines = mibs * 1024 * 1024 / size * lineCount;
+    printf("%-24s %8.0f MiB/s %8.2f Mlines/s %10zu allocs\n", name.c_str(),
+           mibs, lines / 1000000, allocs);
+}
+
+/** @brief Benchmark entry point. */
+int main()
+{
+    std::string text;
+    for (size_t i = 0; i < lineCount; ++i)
+    {
+        const std::string name = "user" + std::to_string(i);
+        const std::string id = std::to_string(1000 + i % 60000);
+        text += name + ":x:" + id + ':' + id + ":Test account " + name +
+                ",,,:/home/" + name + ":/usr/sbin/nologin\n";
+    }
+    const fs::path file = fs::temp_directory_path() / "accounts_bench";
+    std::ofstream(file) << text;
+
+    printf("passwd: %zu lines, %zu bytes\n", lineCount, text.size());
+
+    print("getline", text.size(), [&text]() {
+        std::istringstream in(text);
+        std::vector<PasswdEntry> list;
+        std::string line;
+        while (std::getline(in, line))
+        {
+            list.emplace_back(line);
+        }
+        return list.size();
+    });
+
+    for (const auto& kernel : Tokenizer::kernels())
+    {
+        const std::string name = Tokenizer::name(kernel);
+        print("split " + name, text.size(), [&text, kernel]() {
+            return Tokenizer(kernel, text, ':').size();
+        });
+        print("split+parse " + name, text.size(), [&text, kernel]() {
+            const Tokenizer lines(kernel, text, ':');
+            std::vector<PasswdEntry> list;
+            list.reserve(lines.size());
+            for (size_t i = 0; i < lines.size(); ++i)
+            {
+                list.emplace_back(lines[i]);
+            }
+            return list.size();
+        });
+    }
+
+    print("AccountList::load", text.size(), [&file]() {
+        Passwd list;
+        list.load(file);
+        return list.size();
+    });
+
+    fs::remove(file);
+
+    return EXIT_SUCCESS;
+}
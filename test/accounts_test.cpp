@@ -2,7 +2,9 @@
 // Copyright (C) 2020 YADRO
 
 #include "accounts.hpp"
+#include "accounts_cache.hpp"
 
+#include <chrono>
 #include <fstream>
 
 #include <gtest/gtest.h>
@@ -78,6 +80,97 @@ TEST_F(AccountsTest, Backup)
     compareConfigs(tmpDir, dataDir / "backup_good");
 }
 
+TEST_F(AccountsTest, Cache)
+{
+    AccountsCache cache;
+    for (size_t i = 0; i < 3; ++i)
+    {
+        fs::remove_all(tmpDir);
+        Accounts acc(rwRoot, tmpDir, roRoot, nullptr, &cache);
+        acc.backup();
+        compareConfigs(tmpDir, dataDir / "backup_good");
+    }
+    // group, passwd and shadow from RO FS are parsed once
+    EXPECT_EQ(cache.misses(), 3);
+    EXPECT_EQ(cache.hits(), 6);
+}
+
+TEST_F(AccountsTest, CacheReplace)
+{
+    const fs::path file = tmpDir / "file";
+    fs::create_directories(tmpDir);
+    std::ofstream(file) << "first";
+
+    AccountsCache cache;
+    const std::function<void(std::string&, const fs::path&)> parse =
+        [](std::string& data, const fs::path& path) {
+            std::ifstream(path) >> data;
+        };
+    const auto first = cache.get(file, parse);
+    EXPECT_EQ(*cache.get(file, parse), "first");
+    EXPECT_EQ(cache.misses(), 1);
+
+    // changed file replaces the entry, old data is released by the cache
+    std::ofstream(file) << "second!";
+    EXPECT_EQ(*cache.get(file, parse), "second!");
+    EXPECT_EQ(cache.misses(), 2);
+    EXPECT_EQ(cache.size(), 1);
+    EXPECT_EQ(first.use_count(), 1);
+
+    // failed parsing is not cached
+    const std::function<void(std::string&, const fs::path&)> fail =
+        [](std::string&, const fs::path&) {
+            throw std::runtime_error("parse error");
+        };
+    std::ofstream(file) << "third";
+    EXPECT_THROW(cache.get(file, fail), std::runtime_error);
+    EXPECT_EQ(*cache.get(file, parse), "third");
+}
+
+TEST_F(AccountsTest, PersistentCache)
+{
+    const fs::path cacheDir = tmpDir / "cache";
+    const fs::path roCopy = tmpDir / "ro";
+    fs::create_directories(tmpDir);
+    fs::copy(roRoot, roCopy, fs::copy_options::recursive);
+
+    // restore creates the cache, the second one uses it
+    for (size_t i = 0; i < 2; ++i)
+    {
+        const fs::path dst = tmpDir / ("dst" + std::to_string(i));
+        AccountsCache cache;
+        Accounts acc(dataDir / "backup_good", dst, roCopy, nullptr, &cache);
+        acc.setCacheDir(cacheDir);
+        acc.restore();
+        compareConfigs(dst, rwRoot);
+        EXPECT_EQ(cache.misses(), i ? 0 : 3);
+    }
+    ASSERT_EQ(std::distance(fs::directory_iterator(cacheDir),
+                            fs::directory_iterator()),
+              1);
+
+    // changed RO file invalidates the cache
+    std::ofstream(roCopy / "etc/shadow", std::ios::app)
+        << "sysuser:*:18000:0:99999:7:::\n";
+    AccountsCache cache;
+    Accounts acc(rwRoot, tmpDir / "bk", roCopy, nullptr, &cache);
+    acc.setCacheDir(cacheDir);
+    acc.backup();
+    EXPECT_EQ(cache.misses(), 3);
+
+    // corrupted cache is ignored
+    const fs::path cacheFile = fs::directory_iterator(cacheDir)->path();
+    std::fstream(cacheFile, std::ios::in | std::ios::out | std::ios::binary)
+        .seekp(20)
+        .put('X');
+    AccountsCache cache2;
+    Accounts acc2(dataDir / "backup_good", tmpDir / "dst", roCopy, nullptr,
+                  &cache2);
+    acc2.setCacheDir(cacheDir);
+    acc2.restore();
+    EXPECT_EQ(cache2.misses(), 3);
+}
+
 TEST_F(AccountsTest, RestoreGood)
 {
     Accounts acc(dataDir / "backup_good", tmpDir, roRoot);
@@ -88,6 +181,209 @@ TEST_F(AccountsTest, RestoreGood)
     EXPECT_EQ(p, fs::perms::owner_read | fs::perms::owner_write);
 }
 
+TEST_F(AccountsTest, RestoreSymlink)
+{
+    const fs::path outside = tmpDir / "outside";
+
+    // accounts file symlinked out of the root FS is replaced, not followed
+    fs::create_directories(tmpDir / "etc");
+    std::ofstream(outside) << "keep";
+    fs::permissions(outside, fs::perms::owner_all | fs::perms::others_all);
+    fs::create_symlink(outside, tmpDir / "etc/shadow");
+    Accounts acc(dataDir / "backup_good", tmpDir, roRoot);
+    acc.restore();
+    compareConfigs(tmpDir, rwRoot);
+    EXPECT_FALSE(fs::is_symlink(tmpDir / "etc/shadow"));
+
+    std::ifstream file(outside);
+    EXPECT_EQ(std::string(std::istreambuf_iterator<char>(file), {}), "keep");
+    EXPECT_EQ(fs::status(outside).permissions(),
+              fs::perms::owner_all | fs::perms::others_all);
+}
+
+TEST_F(AccountsTest, RestoreUsers)
+{
+    fs::create_directories(tmpDir / "etc");
+    for (const auto& it : Accounts::files())
+    {
+        fs::copy_file(roRoot / it, tmpDir / it);
+    }
+
+    Accounts acc(dataDir / "backup_good", tmpDir, roRoot);
+    acc.setUsers({"dude"});
+    acc.restore();
+
+    std::ifstream passwd(tmpDir / "etc/passwd");
+    const std::string users((std::istreambuf_iterator<char>(passwd)),
+                            std::istreambuf_iterator<char>());
+    EXPECT_NE(users.find("\ndude:"), std::string::npos);
+    EXPECT_EQ(users.find("\noper:"), std::string::npos);
+    EXPECT_NE(users.find("\nadmin:"), std::string::npos);
+
+    std::ifstream group(tmpDir / "etc/group");
+    const std::string groups((std::istreambuf_iterator<char>(group)),
+                             std::istreambuf_iterator<char>());
+    EXPECT_NE(groups.find("priv-user:x:1002:admin,dude\n"), std::string::npos);
+
+    Accounts missing(dataDir / "backup_good", tmpDir, roRoot);
+    missing.setUsers({"nobody-here"});
+    EXPECT_THROW(missing.restore(), std::runtime_error);
+}
+
+TEST_F(AccountsTest, RestoreGroupPolicy)
+{
+    fs::create_directories(tmpDir / "etc");
+    for (const auto& it : Accounts::files())
+    {
+        fs::copy_file(roRoot / it, tmpDir / it);
+    }
+    // current members of web group differ from RO
+    std::ifstream roGroup(roRoot / "etc/group");
+    std::string data((std::istreambuf_iterator<char>(roGroup)),
+                     std::istreambuf_iterator<char>());
+    const std::string web = "\nweb:x:1004:root\n";
+    ASSERT_NE(data.find(web), std::string::npos);
+    data.replace(data.find(web), web.size(), "\nweb:x:1004:root,extra\n");
+    std::ofstream(tmpDir / "etc/group") << data;
+
+    Accounts acc(dataDir / "backup_good", tmpDir, roRoot);
+    EXPECT_THROW(acc.setGroupPolicies({{"root", MemberSet::Policy::unite}}),
+                 std::invalid_argument);
+    acc.setGroupPolicies({{"web", MemberSet::Policy::apply},
+                          {"ipmi", MemberSet::Policy::unite}});
+    acc.restore();
+
+    std::ifstream group(tmpDir / "etc/group");
+    const std::string groups((std::istreambuf_iterator<char>(group)),
+                             std::istreambuf_iterator<char>());
+    EXPECT_NE(groups.find("\nweb:x:1004:admin,dude,extra,oper,root\n"),
+              std::string::npos)
+        << groups;
+    EXPECT_NE(groups.find("\nipmi:x:1003:admin,dude,oper,root\n"),
+              std::string::npos);
+    // default policy: members from the backup as is
+    EXPECT_NE(groups.find("\npriv-user:x:1002:admin,oper,dude\n"),
+              std::string::npos);
+}
+
+TEST_F(AccountsTest, ExtraFiles)
+{
+    const fs::path bk = tmpDir / "bk";
+    const fs::path dst = tmpDir / "dst";
+    const fs::path keys = "home/dude/.ssh/authorized_keys";
+
+    Accounts backup(rwRoot, bk, roRoot);
+    backup.backup();
+
+    // build-in groups and users are not in the backup
+    std::ifstream gshadow(bk / "etc/gshadow");
+    const std::string groups((std::istreambuf_iterator<char>(gshadow)),
+                             std::istreambuf_iterator<char>());
+    EXPECT_EQ(groups.find("priv-admin:"), 0);
+    EXPECT_EQ(groups.find("nogroup:"), std::string::npos);
+    EXPECT_NE(groups.find("\nweb:!::root,admin,oper,dude\n"),
+              std::string::npos);
+    compareFiles(bk / "etc/subuid", rwRoot / "etc/subuid");
+    compareFiles(bk / "etc/subgid", rwRoot / "etc/subgid");
+    compareFiles(bk / keys, rwRoot / keys);
+    EXPECT_FALSE(fs::exists(bk / "home/root"));
+
+    Accounts restore(bk, dst, roRoot);
+    restore.restore();
+    for (const auto& it : Accounts::files())
+    {
+        compareFiles(dst / it, rwRoot / it);
+    }
+    // group password and administrators differ from RO ones
+    std::ifstream restored(dst / "etc/gshadow");
+    const std::string rstGroups((std::istreambuf_iterator<char>(restored)),
+                                std::istreambuf_iterator<char>());
+    EXPECT_NE(rstGroups.find("\npriv-operator:$6$grp$hash:oper:admin,oper\n"),
+              std::string::npos);
+    compareFiles(dst / keys, rwRoot / keys);
+    EXPECT_EQ(fs::status(dst / keys.parent_path()).permissions(),
+              fs::perms::owner_all);
+
+    // unchanged keys are not written
+    const fs::file_time_type mtime =
+        fs::last_write_time(dst / keys) - std::chrono::hours(1);
+    fs::last_write_time(dst / keys, mtime);
+    Accounts again(bk, dst, roRoot);
+    again.restore();
+    EXPECT_EQ(fs::last_write_time(dst / keys), mtime);
+
+    // changed keys of the same size are written
+    std::string content;
+    {
+        std::ifstream file(dst / keys);
+        content.assign(std::istreambuf_iterator<char>(file), {});
+    }
+    ASSERT_FALSE(content.empty());
+    content[0] = content[0] == 'x' ? 'y' : 'x';
+    std::ofstream(dst / keys) << content;
+    fs::last_write_time(dst / keys, mtime);
+    Accounts changed(bk, dst, roRoot);
+    changed.restore();
+    compareFiles(dst / keys, rwRoot / keys);
+
+    // old backups have no optional files
+    Accounts old(dataDir / "backup_good", tmpDir / "old", roRoot);
+    old.restore();
+    EXPECT_FALSE(fs::exists(tmpDir / "old/etc/gshadow"));
+
+    EXPECT_TRUE(Accounts::isAccountsFile("etc/subgid"));
+    EXPECT_TRUE(Accounts::isAccountsFile(keys));
+    EXPECT_FALSE(Accounts::isAccountsFile("etc/hostname"));
+}
+
+TEST_F(AccountsTest, RestoreUsersNoGshadow)
+{
+    const fs::path bk = tmpDir / "bk";
+    const fs::path dst = tmpDir / "dst";
+
+    Accounts backup(rwRoot, bk, roRoot);
+    backup.backup();
+
+    // the target has no gshadow while RO image and backup have it
+    fs::create_directories(dst / "etc");
+    for (const auto& it : Accounts::files())
+    {
+        if (it != "etc/gshadow")
+        {
+            fs::copy_file(roRoot / it, dst / it);
+        }
+    }
+    Accounts restore(bk, dst, roRoot);
+    restore.setUsers({"dude"});
+    ASSERT_NO_THROW(restore.restore());
+
+    std::ifstream gshadow(dst / "etc/gshadow");
+    const std::string groups((std::istreambuf_iterator<char>(gshadow)),
+                             std::istreambuf_iterator<char>());
+    EXPECT_NE(groups.find("\nweb:!::dude\n"), std::string::npos) << groups;
+}
+
+TEST_F(AccountsTest, KeysOfBuiltInUsers)
+{
+    const fs::path dst = tmpDir / "dst";
+    const fs::path outside = tmpDir / "outside";
+
+    // passwd of the source lists root with the keys in its home
+    fs::create_directories(dst);
+    Accounts acc(rwRoot, dst, roRoot);
+    acc.restore();
+    EXPECT_TRUE(fs::exists(dst / "home/dude/.ssh/authorized_keys"));
+    EXPECT_FALSE(fs::exists(dst / "home/root"));
+
+    // symlinked home directory can't lead out of the root FS
+    fs::remove_all(dst / "home/dude");
+    fs::create_directories(outside);
+    fs::create_symlink(outside, dst / "home/dude");
+    Accounts again(rwRoot, dst, roRoot);
+    EXPECT_THROW(again.restore(), std::system_error);
+    EXPECT_FALSE(fs::exists(outside / ".ssh"));
+}
+
 TEST_F(AccountsTest, RestoreExceeded)
 {
     Accounts acc(dataDir / "backup_exceeded", tmpDir, roRoot);
@@ -0,0 +1,543 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "archive.hpp"
+#include "crypto.hpp"
+#include "dictionary.hpp"
+#include "root_dir.hpp"
+
+#include <fcntl.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+
+#include <gtest/gtest.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * @class ArchiveTest
+ * @brief Tests for tar.gz reader/writer.
+ */
+class ArchiveTest : public ::testing::Test
+{
+  protected:
+    void SetUp() override
+    {
+        fs::remove_all(tmpDir);
+        fs::create_directories(srcDir / "dir/subdir");
+        writeFile(srcDir / "file", "file content\n");
+        writeFile(srcDir / "dir/subdir/file", std::string(100000, 'x'));
+        writeFile(srcDir / "dir" / longName, "long name\n");
+        fs::create_symlink("../file", srcDir / "dir/link");
+    }
+
+    void TearDown() override
+    {
+        fs::remove_all(tmpDir);
+    }
+
+    void writeFile(const fs::path& path, const std::string& data) const
+    {
+        std::ofstream file(path);
+        file << data;
+    }
+
+    std::string readFile(const fs::path& path) const
+    {
+        std::ifstream file(path);
+        return std::string((std::istreambuf_iterator<char>(file)),
+                           std::istreambuf_iterator<char>());
+    }
+
+    BlockCodec::Index loadIndex() const
+    {
+        BlockCodec::Index index;
+        const int fd = open(arcFile.c_str(), O_RDONLY);
+        const bool loaded =
+            BlockCodec::Index::load(fd, fs::file_size(arcFile), index);
+        close(fd);
+        EXPECT_TRUE(loaded);
+        return index;
+    }
+
+    void corruptBlock(const BlockCodec::Index& index, size_t num) const
+    {
+        // stored block with invalid length
+        uint64_t offset = index.offset;
+        for (size_t i = 0; i < num; ++i)
+        {
+            offset += index.blocks[i].first;
+        }
+        std::fstream file(arcFile, std::ios::in | std::ios::out);
+        file.seekp(offset);
+        const std::string zeros(index.blocks[num].first, '\0');
+        file.write(zeros.data(), zeros.size());
+    }
+
+    const fs::path tmpDir = fs::temp_directory_path() / "archive_test";
+    const fs::path srcDir = tmpDir / "src";
+    const fs::path dstDir = tmpDir / "dst";
+    const fs::path arcFile = tmpDir / "test.tar.gz";
+    const std::string longName = std::string(120, 'n');
+};
+
+TEST_F(ArchiveTest, WriteRead)
+{
+    ArchiveWriter writer(arcFile);
+    writer.add(srcDir, ".");
+    writer.addTree(srcDir / "dir", "dir");
+    writer.add(srcDir / "file", "top/file");
+    writer.finish();
+    EXPECT_EQ(writer.size(), fs::file_size(arcFile));
+
+    ArchiveReader reader(arcFile, 1024);
+    reader.extract(dstDir);
+
+    EXPECT_EQ(readFile(dstDir / "top/file"), "file content\n");
+    EXPECT_EQ(readFile(dstDir / "dir/subdir/file"), std::string(100000, 'x'));
+    EXPECT_EQ(readFile(dstDir / "dir" / longName), "long name\n");
+    EXPECT_TRUE(fs::is_symlink(dstDir / "dir/link"));
+    EXPECT_EQ(fs::read_symlink(dstDir / "dir/link"), "../file");
+    EXPECT_FALSE(fs::exists(dstDir / "file"));
+}
+
+TEST_F(ArchiveTest, IoEngine)
+{
+    const auto io = IoEngine::create();
+    ArchiveWriter writer(arcFile);
+    writer.setIoEngine(io.get());
+    writer.addTree(srcDir, ".");
+    writer.finish();
+
+    ArchiveReader reader(arcFile, 1024);
+    reader.extract(dstDir);
+
+    EXPECT_EQ(readFile(dstDir / "file"), "file content\n");
+    EXPECT_EQ(readFile(dstDir / "dir/subdir/file"), std::string(100000, 'x'));
+    EXPECT_EQ(readFile(dstDir / "dir" / longName), "long name\n");
+    EXPECT_EQ(fs::read_symlink(dstDir / "dir/link"), "../file");
+}
+
+TEST_F(ArchiveTest, TarCompatible)
+{
+    ArchiveWriter writer(arcFile);
+    writer.add(srcDir, ".");
+    writer.addTree(srcDir / "dir", "dir");
+    writer.finish();
+
+    // extract with system tar
+    fs::create_directories(dstDir);
+    std::string cmd = "tar xzf ";
+    cmd += arcFile;
+    cmd += " -C ";
+    cmd += dstDir;
+    ASSERT_EQ(system(cmd.c_str()), 0);
+    EXPECT_EQ(readFile(dstDir / "dir/subdir/file"), std::string(100000, 'x'));
+    EXPECT_EQ(readFile(dstDir / "dir" / longName), "long name\n");
+
+    // create with system tar
+    fs::remove(arcFile);
+    fs::remove_all(dstDir);
+    cmd = "tar czf ";
+    cmd += arcFile;
+    cmd += " -C ";
+    cmd += srcDir;
+    cmd += " .";
+    ASSERT_EQ(system(cmd.c_str()), 0);
+    EXPECT_EQ(ArchiveReader::contentSize(arcFile) % 512, 0);
+
+    ArchiveReader reader(arcFile, 1024);
+    reader.extract(dstDir);
+    EXPECT_EQ(readFile(dstDir / "file"), "file content\n");
+    EXPECT_EQ(readFile(dstDir / "dir" / longName), "long name\n");
+}
+
+TEST_F(ArchiveTest, Parallel)
+{
+    // compressible content of several blocks
+    std::string big;
+    for (size_t i = 0; big.size() < BlockCodec::blockSize * 5; ++i)
+    {
+        big += "line " + std::to_string(i * 7919 % 100003) + '\n';
+    }
+    writeFile(srcDir / "dir/big", big);
+
+    const Dictionary dict(std::vector<uint8_t>(1024, 'x'));
+    for (const Dictionary* it : {static_cast<const Dictionary*>(nullptr),
+                                 &dict})
+    {
+        fs::remove(arcFile);
+        ArchiveWriter writer(arcFile);
+        writer.setDictionary(it);
+        writer.setThreads(4);
+        writer.addTree(srcDir, ".");
+        writer.finish();
+        EXPECT_EQ(writer.size(), fs::file_size(arcFile));
+        EXPECT_THROW(writer.setThreads(2), std::logic_error);
+
+        for (const size_t threads : {1, 4})
+        {
+            fs::remove_all(dstDir);
+            ArchiveReader reader(arcFile, 1024);
+            reader.setDictionary(it);
+            reader.setThreads(threads);
+            reader.extract(dstDir);
+            EXPECT_EQ(readFile(dstDir / "dir/big"), big);
+            EXPECT_EQ(readFile(dstDir / "file"), "file content\n");
+        }
+
+        ArchiveReader reader(arcFile, 1024);
+        reader.setDictionary(it);
+        EXPECT_EQ(reader.unpack().size(),
+                  ArchiveReader::contentSize(arcFile));
+    }
+
+    // gzip tools skip the table of blocks
+    fs::remove(arcFile);
+    {
+        ArchiveWriter writer(arcFile);
+        writer.setThreads(4);
+        writer.addTree(srcDir, ".");
+        writer.finish();
+    }
+    EXPECT_EQ(system(("gzip -t " + arcFile.string()).c_str()), 0);
+    fs::remove_all(dstDir);
+    fs::create_directories(dstDir);
+    ASSERT_EQ(system(("tar xzf " + arcFile.string() + " -C " +
+                      dstDir.string())
+                         .c_str()),
+              0);
+    EXPECT_EQ(readFile(dstDir / "dir/big"), big);
+
+    const BlockCodec::Index index = loadIndex();
+    ASSERT_GT(index.blocks.size(), 5);
+    corruptBlock(index, 1);
+    fs::remove_all(dstDir);
+    ArchiveReader corrupted(arcFile, 1024);
+    corrupted.setThreads(4);
+    EXPECT_THROW(corrupted.extract(dstDir), std::runtime_error);
+}
+
+TEST_F(ArchiveTest, Seek)
+{
+    // incompressible data, blocks of the file are stored as is
+    std::string noise;
+    uint32_t seed = 1;
+    while (noise.size() < BlockCodec::blockSize * 8)
+    {
+        seed = seed * 1103515245 + 12345;
+        noise += static_cast<char>(seed >> 24);
+    }
+    writeFile(srcDir / "noise", noise);
+    {
+        ArchiveWriter writer(arcFile);
+        writer.add(srcDir / "noise", "noise");
+        writer.add(srcDir / "dir/subdir/file", "dir/subdir/file");
+        writer.add(srcDir / "file", "file");
+        writer.finish();
+    }
+    const BlockCodec::Index index = loadIndex();
+    EXPECT_NE(index.toc.find("=./dir/subdir/file\n"), std::string::npos);
+    ASSERT_GT(index.blocks.size(), 8);
+    corruptBlock(index, 5);
+
+    // blocks of the skipped file are not decompressed
+    for (const char* name : {"file", "dir/subdir/file"})
+    {
+        fs::remove_all(dstDir);
+        ArchiveReader reader(arcFile, 1024);
+        reader.extract(dstDir, 0,
+                       [name](const fs::path& rel) { return rel == name; });
+        EXPECT_TRUE(fs::exists(dstDir / name));
+        EXPECT_FALSE(fs::exists(dstDir / "noise"));
+    }
+    EXPECT_EQ(readFile(dstDir / "dir/subdir/file"), std::string(100000, 'x'));
+
+    fs::remove_all(dstDir);
+    ArchiveReader reader(arcFile, 1024);
+    EXPECT_THROW(reader.extract(dstDir), std::runtime_error);
+}
+
+TEST_F(ArchiveTest, ParallelResume)
+{
+    writeFile(srcDir / "big", std::string(BlockCodec::blockSize * 3, 'b'));
+
+    ArchiveWriter::State state;
+    {
+        ArchiveWriter writer(arcFile);
+        writer.setThreads(4);
+        writer.add(srcDir / "big", "big");
+        state = writer.checkpoint();
+        EXPECT_EQ(state.offset, fs::file_size(arcFile));
+        writer.addTree(srcDir / "dir", "lost");
+    }
+
+    ArchiveWriter writer(arcFile, state);
+    writer.addTree(srcDir / "dir", "dir");
+    writer.finish();
+    EXPECT_EQ(system(("gzip -t " + arcFile.string()).c_str()), 0);
+
+    ArchiveReader reader(arcFile, 1024);
+    reader.setThreads(4);
+    reader.extract(dstDir);
+    EXPECT_EQ(readFile(dstDir / "big").size(), BlockCodec::blockSize * 3);
+    EXPECT_EQ(readFile(dstDir / "dir/subdir/file"), std::string(100000, 'x'));
+    EXPECT_FALSE(fs::exists(dstDir / "lost"));
+}
+
+TEST_F(ArchiveTest, Memory)
+{
+    ArchiveWriter writer(1024 * 1024);
+    writer.addTree(srcDir, ".");
+    writer.finish();
+    EXPECT_FALSE(writer.data().empty());
+    EXPECT_EQ(writer.data().size(), writer.size());
+    EXPECT_FALSE(fs::exists(arcFile));
+}
+
+TEST_F(ArchiveTest, Limits)
+{
+    ArchiveWriter writer(100);
+    EXPECT_THROW(
+        {
+            writer.addTree(srcDir, ".");
+            writer.finish();
+        },
+        std::runtime_error);
+
+    ArchiveWriter file(arcFile);
+    file.addTree(srcDir, ".");
+    file.finish();
+    ArchiveReader reader(arcFile, 1024);
+    EXPECT_THROW(reader.extract(dstDir, 1000), std::runtime_error);
+}
+
+TEST_F(ArchiveTest, UnsafeName)
+{
+    std::string cmd = "cd ";
+    cmd += srcDir;
+    cmd += " && tar czPf ";
+    cmd += arcFile;
+    cmd += " ../src/file";
+    ASSERT_EQ(system(cmd.c_str()), 0);
+
+    ArchiveReader reader(arcFile, 1024);
+    EXPECT_THROW(reader.extract(dstDir), std::runtime_error);
+    EXPECT_FALSE(fs::exists(tmpDir / "dst/../file"));
+}
+
+TEST_F(ArchiveTest, Invalid)
+{
+    writeFile(arcFile, "not an archive");
+    EXPECT_THROW(ArchiveReader::contentSize(arcFile), std::runtime_error);
+    ArchiveReader reader(arcFile, 1024);
+    EXPECT_THROW(reader.extract(dstDir), std::runtime_error);
+}
+
+TEST_F(ArchiveTest, Encrypted)
+{
+    const fs::path keyFile = tmpDir / "key";
+    writeFile(keyFile, std::string(CryptoKey::keySize, 'k'));
+    const CryptoKey key = CryptoKey::fromKeyFile(keyFile);
+
+    ArchiveWriter writer(arcFile);
+    writer.setKey(&key);
+    writer.addTree(srcDir, ".");
+    writer.finish();
+    EXPECT_EQ(writer.size(), fs::file_size(arcFile));
+    EXPECT_GT(ArchiveReader::contentSize(arcFile), 100000);
+
+    EXPECT_THROW(ArchiveReader(arcFile, 1024), std::runtime_error);
+
+    ArchiveReader reader(arcFile, 1024, &key);
+    reader.extract(dstDir);
+    EXPECT_EQ(readFile(dstDir / "dir/subdir/file"), std::string(100000, 'x'));
+
+    // modified archive must be rejected
+    {
+        std::fstream file(arcFile, std::ios::in | std::ios::out);
+        file.seekp(-20, std::ios::end);
+        file.put('\0');
+    }
+    fs::remove_all(dstDir);
+    ArchiveReader modified(arcFile, 1024, &key);
+    EXPECT_THROW(modified.extract(dstDir), std::runtime_error);
+
+    // truncated archive must be rejected
+    fs::resize_file(arcFile, fs::file_size(arcFile) - 100);
+    fs::remove_all(dstDir);
+    ArchiveReader truncated(arcFile, 1024, &key);
+    EXPECT_THROW(truncated.extract(dstDir), std::runtime_error);
+}
+
+TEST_F(ArchiveTest, Metadata)
+{
+    fs::create_hard_link(srcDir / "file", srcDir / "dir/hardlink");
+    const bool xattrs =
+        setxattr((srcDir / "file").c_str(), "user.test", "a\nb=c", 5, 0) == 0;
+    fs::permissions(srcDir / "file", fs::perms::owner_read,
+                    fs::perm_options::replace);
+    const timespec ts[2] = {{0, UTIME_OMIT}, {1600000000, 123456789}};
+    utimensat(AT_FDCWD, (srcDir / "file").c_str(), ts, 0);
+    utimensat(AT_FDCWD, (srcDir / "dir").c_str(), ts, 0);
+
+    ArchiveWriter writer(arcFile);
+    writer.addTree(srcDir, ".");
+    writer.finish();
+
+    // hard link is stored without content
+    const std::string list = "tar tvf " + arcFile.string();
+    FILE* pipe = popen(list.c_str(), "r");
+    ASSERT_NE(pipe, nullptr);
+    char line[512];
+    bool linked = false;
+    while (fgets(line, sizeof(line), pipe))
+    {
+        linked |= strstr(line, "./file link to ./dir/hardlink") != nullptr;
+    }
+    pclose(pipe);
+    EXPECT_TRUE(linked);
+
+    ArchiveReader reader(arcFile, 1024);
+    reader.extract(dstDir);
+    const Metadata file = Metadata::load(dstDir / "file");
+    EXPECT_EQ(file.mode & 07777, 0400);
+    EXPECT_EQ(file.mtime.tv_sec, 1600000000);
+    EXPECT_EQ(file.mtime.tv_nsec, 123456789);
+    EXPECT_EQ(file.nlink, 2);
+    EXPECT_EQ(file.inode, Metadata::load(dstDir / "dir/hardlink").inode);
+    EXPECT_EQ(Metadata::load(dstDir / "dir").mtime.tv_nsec, 123456789);
+    if (xattrs)
+    {
+        ASSERT_EQ(file.xattrs.size(), 1);
+        EXPECT_EQ(file.xattrs[0].second, std::string("a\nb=c", 5));
+    }
+}
+
+TEST_F(ArchiveTest, Filter)
+{
+    ArchiveWriter writer(arcFile);
+    writer.addTree(srcDir, ".");
+    writer.finish();
+
+    // checksums of skipped files are not verified
+    ArchiveReader reader(arcFile, 1024);
+    reader.extract(dstDir, 0, [](const fs::path& rel) {
+        return rel == "file" || rel == "dir";
+    });
+    EXPECT_EQ(readFile(dstDir / "file"), "file content\n");
+    EXPECT_TRUE(fs::is_directory(dstDir / "dir"));
+    EXPECT_FALSE(fs::exists(dstDir / "dir/subdir/file"));
+    EXPECT_FALSE(fs::exists(dstDir / "dir" / longName));
+}
+
+TEST_F(ArchiveTest, FilterHardLink)
+{
+    fs::create_hard_link(srcDir / "file", srcDir / "dir/hardlink");
+    ArchiveWriter writer(arcFile);
+    writer.addTree(srcDir, ".");
+    writer.finish();
+
+    // "./file" is stored as a link to "./dir/hardlink", which is rejected
+    ArchiveReader reader(arcFile, 1024);
+    EXPECT_NO_THROW(reader.extract(
+        dstDir, 0, [](const fs::path& rel) { return rel == "file"; }));
+    EXPECT_FALSE(fs::exists(dstDir / "file"));
+    EXPECT_FALSE(fs::exists(dstDir / "dir/hardlink"));
+}
+
+TEST_F(ArchiveTest, SymlinkEscape)
+{
+    // symlink to outside followed by entry inside it
+    const fs::path outside = tmpDir / "outside";
+    fs::create_directories(outside);
+    fs::create_directory_symlink(outside, srcDir / "escape");
+    ArchiveWriter writer(arcFile);
+    writer.add(srcDir / "escape", "escape");
+    writer.add(srcDir / "file", "escape/file");
+    writer.finish();
+
+    ArchiveReader reader(arcFile, 1024);
+    EXPECT_THROW(reader.extract(dstDir), std::system_error);
+    EXPECT_TRUE(fs::is_symlink(dstDir / "escape"));
+    EXPECT_FALSE(fs::exists(outside / "file"));
+
+    // the same for the root directory
+    const RootDir root(srcDir);
+    ArchiveWriter rootWriter(0);
+    EXPECT_THROW(rootWriter.addTree(root, "escape/file", "file"),
+                 std::system_error);
+}
+
+TEST_F(ArchiveTest, Checksum)
+{
+    ArchiveWriter writer(arcFile);
+    writer.addTree(srcDir, ".");
+    writer.finish();
+
+    // modify file content inside valid gzip stream
+    const fs::path tarFile = tmpDir / "test.tar";
+    ASSERT_EQ(system(("gzip -dc " + arcFile.string() + " > " +
+                      tarFile.string())
+                         .c_str()),
+              0);
+    std::string tar = readFile(tarFile);
+    const size_t pos = tar.find("file content");
+    ASSERT_NE(pos, std::string::npos);
+    tar[pos] = 'F';
+    writeFile(tarFile, tar);
+    fs::remove(arcFile);
+    ASSERT_EQ(system(("gzip -c " + tarFile.string() + " > " +
+                      arcFile.string())
+                         .c_str()),
+              0);
+
+    ArchiveReader reader(arcFile, 1024);
+    EXPECT_THROW(reader.extract(dstDir), std::runtime_error);
+}
+
+TEST_F(ArchiveTest, Resume)
+{
+    const Dictionary dict(std::vector<uint8_t>(1024, 'x'));
+    for (const Dictionary* it : {static_cast<const Dictionary*>(nullptr),
+                                 &dict})
+    {
+        fs::remove(arcFile);
+        fs::remove_all(dstDir);
+
+        ArchiveWriter::State state;
+        {
+            ArchiveWriter writer(arcFile);
+            writer.setDictionary(it);
+            writer.add(srcDir / "file", "file");
+            state = writer.checkpoint();
+            EXPECT_EQ(state.offset, fs::file_size(arcFile));
+            // interrupted: data after the durable point is lost
+            writer.addTree(srcDir / "dir", "lost");
+        }
+
+        ArchiveWriter writer(arcFile, state);
+        writer.addTree(srcDir / "dir", "dir");
+        writer.finish();
+        EXPECT_EQ(writer.size(), fs::file_size(arcFile));
+
+        ArchiveReader reader(arcFile, 1024);
+        reader.setDictionary(it);
+        reader.extract(dstDir);
+        EXPECT_EQ(readFile(dstDir / "file"), "file content\n");
+        EXPECT_EQ(readFile(dstDir / "dir/subdir/file"),
+                  std::string(100000, 'x'));
+        EXPECT_FALSE(fs::exists(dstDir / "lost"));
+        if (!it)
+        {
+            // trailer of the resumed gzip stream
+            EXPECT_EQ(system(("gzip -t " + arcFile.string()).c_str()), 0);
+        }
+    }
+
+    ArchiveWriter memory(1024 * 1024);
+    EXPECT_THROW(memory.checkpoint(), std::logic_error);
+}
@@ -2,10 +2,20 @@
 // Copyright (C) 2020 YADRO
 
 #include "backup.hpp"
+#include "catalog.hpp"
+#include "checkpoint.hpp"
 #include "manifest.hpp"
+#include "progress.hpp"
+#include "root_dir.hpp"
 
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <csignal>
 #include <fstream>
 #include <set>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -39,10 +49,24 @@ class BackupTest : public ::testing::Test
 
         fs::remove_all(tmpDir);
         fs::create_directories(tmpDir);
+
+        const char* env = getenv("TMPDIR");
+        if (env)
+        {
+            oldTmp = env;
+        }
     }
 
     void TearDown() override
     {
+        if (oldTmp.empty())
+        {
+            unsetenv("TMPDIR");
+        }
+        else
+        {
+            setenv("TMPDIR", oldTmp.c_str(), 1);
+        }
         fs::remove_all(tmpDir);
     }
 
@@ -72,6 +96,7 @@ class BackupTest : public ::testing::Test
     fs::path dataDir;
     fs::path rwRoot; // root FS with new users
     fs::path roRoot; // RO partition (/run/initramfs/ro)
+    std::string oldTmp; // TMPDIR of the test process
 };
 
 TEST_F(BackupTest, BackupFull)
@@ -193,3 +218,634 @@ TEST_F(BackupTest, Restore)
         }
     }
 }
+
+TEST_F(BackupTest, BackupModes)
+{
+    const fs::path arc = tmpDir / "backup.tar.gz";
+
+    Backup bk;
+    bk.unattendedMode = true;
+    bk.archiveFile = arc;
+    bk.rootFs = rwRoot;
+    bk.readOnlyFs = roRoot;
+
+    bk.backup();
+    EXPECT_EQ(bk.mode(), Preflight::Mode::memory);
+    for (const auto& it : fs::directory_iterator(tmpDir))
+    {
+        EXPECT_FALSE(RootDir::isTemp(it.path().filename())) << it.path();
+    }
+    const std::set<std::string> expect = fileList(arc);
+    fs::remove(arc);
+
+    bk.maxMemory = 0;
+    bk.backup();
+    EXPECT_EQ(bk.mode(), Preflight::Mode::staged);
+    EXPECT_EQ(fileList(arc), expect);
+    fs::remove(arc);
+
+    bk.maxTmp = 4096;
+    bk.backup();
+    EXPECT_EQ(bk.mode(), Preflight::Mode::streaming);
+    EXPECT_EQ(fileList(arc), expect);
+    fs::remove(arc);
+
+    bk.maxTmp = 10;
+    EXPECT_THROW(bk.backup(), std::runtime_error);
+    EXPECT_FALSE(fs::exists(arc));
+}
+
+/**
+ * @class GrowSink
+ * @brief Progress sink that makes the file bigger when archiving starts.
+ */
+class GrowSink : public ProgressSink
+{
+  public:
+    GrowSink(const fs::path& file, size_t size) : file(file), size(size) {}
+
+    void update(const Status& status) override
+    {
+        if (status.phase == "archive" && size)
+        {
+            std::string data;
+            uint32_t seed = 1;
+            while (data.size() < size)
+            {
+                seed = seed * 1103515245 + 12345;
+                data += static_cast<char>(seed >> 24);
+            }
+            std::ofstream(file) << data;
+            size = 0;
+        }
+    }
+
+    const fs::path file;
+    size_t size;
+};
+
+TEST_F(BackupTest, MemoryFallback)
+{
+    const fs::path arc = tmpDir / "backup.tar.gz";
+    const fs::path rw = tmpDir / "rw";
+
+    fs::copy(rwRoot, rw, fs::copy_options::recursive);
+
+    Backup bk;
+    bk.unattendedMode = true;
+    bk.archiveFile = arc;
+    bk.rootFs = rw;
+    bk.readOnlyFs = roRoot;
+    bk.maxMemory = 64 * 1024;
+    const auto sink =
+        std::make_shared<GrowSink>(rw / "etc/hostname", 128 * 1024);
+    bk.progressSink = sink;
+
+    // the archive doesn't fit in memory, it is written to the file
+    bk.backup();
+    EXPECT_EQ(bk.mode(), Preflight::Mode::streaming);
+    EXPECT_FALSE(fs::exists(arc.string() + ".new"));
+    EXPECT_GT(fs::file_size(arc), bk.maxMemory);
+    EXPECT_EQ(fileList(arc).count("/etc/hostname"), 1);
+    EXPECT_EQ(system(("gzip -t " + arc.string()).c_str()), 0);
+}
+
+TEST_F(BackupTest, StagedNoReplace)
+{
+    const fs::path arc = tmpDir / "backup.tar.gz";
+
+    Backup bk;
+    bk.unattendedMode = true;
+    bk.archiveFile = arc;
+    bk.rootFs = rwRoot;
+    bk.readOnlyFs = roRoot;
+    bk.maxMemory = 0;
+    // the file appears while the staged archive is written
+    bk.progressSink = std::make_shared<GrowSink>(arc, 3);
+
+    EXPECT_THROW(bk.backup(), std::system_error);
+    EXPECT_EQ(bk.mode(), Preflight::Mode::staged);
+    EXPECT_EQ(fs::file_size(arc), 3);
+    // no temporary files are left next to the archive
+    for (const auto& it : fs::directory_iterator(tmpDir))
+    {
+        EXPECT_FALSE(RootDir::isTemp(it.path().filename())) << it.path();
+    }
+}
+
+TEST_F(BackupTest, RestoreSelective)
+{
+    const fs::path arc = tmpDir / "backup.tar.gz";
+    const fs::path root = tmpDir / "root";
+
+    Backup bk;
+    bk.unattendedMode = true;
+    bk.archiveFile = arc;
+    bk.rootFs = rwRoot;
+    bk.readOnlyFs = roRoot;
+    bk.backup();
+
+    bk.rootFs = root;
+    bk.onlyFiles.push_back("/etc/host*");
+    fs::create_directories(root / "etc");
+    fs::create_symlink(rwRoot / "etc/os-release", root / "etc/os-release");
+    bk.restore();
+
+    EXPECT_TRUE(fs::exists(root / "etc/hostname"));
+    EXPECT_FALSE(fs::exists(root / "etc/machine-id"));
+    EXPECT_FALSE(fs::exists(root / "etc/passwd"));
+
+    bk.onlyFiles.clear();
+    bk.onlyUsers.insert("unknown");
+    EXPECT_THROW(bk.restore(), std::runtime_error);
+}
+
+TEST_F(BackupTest, DryRun)
+{
+    const fs::path arc = tmpDir / "backup.tar.gz";
+    const fs::path root = tmpDir / "root";
+    const fs::path reportFile = tmpDir / "report.json";
+
+    Backup bk;
+    bk.unattendedMode = true;
+    bk.archiveFile = arc;
+    bk.rootFs = rwRoot;
+    bk.readOnlyFs = roRoot;
+    bk.backup();
+
+    fs::create_directories(root / "etc");
+    fs::create_symlink(rwRoot / "etc/os-release", root / "etc/os-release");
+    for (const char* it : {"etc/passwd", "etc/group", "etc/shadow"})
+    {
+        fs::copy_file(roRoot / it, root / it);
+    }
+    std::ofstream(root / "etc/hostname") << "other\n";
+    // same content, but modification time will be restored
+    fs::copy(rwRoot / "etc/dropbear", root / "etc/dropbear",
+             fs::copy_options::recursive);
+
+    // checkpoint of the interrupted restore of the same archive
+    fs::path interrupted;
+    {
+        const auto cp = Checkpoint::create("restore", arc);
+        cp->save();
+        interrupted = cp->dir();
+    }
+
+    FILE* out = fopen(reportFile.c_str(), "w");
+    ASSERT_NE(out, nullptr);
+    bk.rootFs = root;
+    bk.verbose = false;
+    bk.report = std::make_shared<Report>(Report::Format::json, out);
+    bk.restore();
+    fclose(out);
+
+    // the interrupted restore can still be resumed
+    const auto cp = Checkpoint::find("restore", arc);
+    ASSERT_TRUE(cp);
+    EXPECT_EQ(cp->dir(), interrupted);
+    cp->remove();
+
+    // nothing is changed
+    EXPECT_FALSE(fs::exists(root / "etc/machine-id"));
+    std::ifstream hostname(root / "etc/hostname");
+    std::string line;
+    std::getline(hostname, line);
+    EXPECT_EQ(line, "other");
+
+    std::ifstream report(reportFile);
+    const std::string json((std::istreambuf_iterator<char>(report)),
+                           std::istreambuf_iterator<char>());
+    EXPECT_NE(json.find("{\"type\":\"file\",\"path\":\"etc/hostname\","
+                        "\"change\":\"modify\"}"),
+              std::string::npos);
+    EXPECT_NE(json.find("{\"type\":\"file\",\"path\":\"etc/machine-id\","
+                        "\"change\":\"add\"}"),
+              std::string::npos);
+    EXPECT_NE(json.find("{\"type\":\"metadata\","
+                        "\"path\":\"etc/dropbear/dropbear_rsa_host_key\","
+                        "\"attrs\":\"mtime"),
+              std::string::npos);
+    EXPECT_EQ(json.find("\"path\":\"etc/dropbear/dropbear_rsa_host_key\","
+                        "\"change\""),
+              std::string::npos);
+    EXPECT_NE(json.find("{\"type\":\"user\",\"name\":\"dude\","
+                        "\"change\":\"add\"}"),
+              std::string::npos);
+    EXPECT_NE(json.find("{\"type\":\"group\",\"name\":\"priv-user\","
+                        "\"change\":\"modify\"}"),
+              std::string::npos);
+    EXPECT_EQ(json.find("\"name\":\"root\""), std::string::npos);
+}
+
+TEST_F(BackupTest, RestoreLimit)
+{
+    const fs::path arc = tmpDir / "backup.tar.gz";
+
+    Backup bk;
+    bk.unattendedMode = true;
+    bk.archiveFile = arc;
+    bk.rootFs = rwRoot;
+    bk.readOnlyFs = roRoot;
+    bk.backup();
+
+    bk.rootFs = tmpDir;
+    bk.maxTmp = 1024;
+    EXPECT_THROW(bk.restore(), std::runtime_error);
+}
+
+TEST_F(BackupTest, Encrypted)
+{
+    const fs::path arc = tmpDir / "backup.tar.gz";
+    const fs::path passFile = tmpDir / "pass";
+    std::ofstream(passFile) << "secret\n";
+
+    Backup bk;
+    bk.unattendedMode = true;
+    bk.archiveFile = arc;
+    bk.rootFs = rwRoot;
+    bk.readOnlyFs = roRoot;
+    bk.key = std::make_shared<const CryptoKey>(
+        CryptoKey::fromPassphraseFile(passFile));
+    bk.backup();
+
+    // not a plain tar.gz
+    EXPECT_NE(system(("tar tzf " + arc.string() + " >/dev/null 2>&1").c_str()),
+              0);
+
+    bk.rootFs = tmpDir;
+    fs::create_directory(tmpDir / "etc");
+    fs::create_symlink(rwRoot / "etc/os-release", tmpDir / "etc/os-release");
+    bk.restore();
+    EXPECT_TRUE(fs::exists(tmpDir / "etc/machine-id"));
+
+    std::ofstream(passFile) << "wrong\n";
+    bk.key = std::make_shared<const CryptoKey>(
+        CryptoKey::fromPassphraseFile(passFile));
+    EXPECT_THROW(bk.restore(), std::runtime_error);
+}
+
+TEST_F(BackupTest, Delta)
+{
+    const fs::path arc = tmpDir / "backup.tar.gz";
+    const fs::path rw = tmpDir / "rw";
+    const fs::path ro = tmpDir / "ro";
+    const fs::path network = "etc/systemd/network/10-big.network";
+
+    fs::copy(rwRoot, rw, fs::copy_options::recursive);
+    fs::copy(roRoot, ro, fs::copy_options::recursive);
+    std::string text;
+    for (int i = 0; i < 1000; ++i)
+    {
+        text += "Option" + std::to_string(i) + "=value\n";
+    }
+    fs::create_directories((ro / network).parent_path());
+    std::ofstream(ro / network) << text;
+    const std::string base = text;
+    text.replace(5000, 5, "other");
+    std::ofstream(rw / network) << text;
+
+    Backup bk;
+    bk.unattendedMode = true;
+    bk.archiveFile = arc;
+    bk.rootFs = rw;
+    bk.readOnlyFs = ro;
+    bk.deltaMode = true;
+    bk.backup();
+
+    const std::set<std::string> files = fileList(arc);
+    EXPECT_EQ(files.count("/" + network.string()), 0);
+    EXPECT_EQ(files.count("/.delta/" + network.string()), 1);
+
+    const fs::path dst = tmpDir / "dst";
+    bk.rootFs = dst;
+    fs::create_directories(dst / "etc");
+    fs::copy(rw / "etc/os-release", dst / "etc/os-release");
+    bk.restore();
+
+    std::ifstream restored(dst / network);
+    EXPECT_EQ(std::string(std::istreambuf_iterator<char>(restored), {}),
+              text);
+    EXPECT_FALSE(fs::exists(dst / ".delta"));
+
+    // base file changed: the file is skipped, the rest is restored
+    std::ofstream(ro / network) << "new";
+    std::ofstream(dst / network) << "current";
+    fs::remove(dst / "etc/hostname");
+    bk.restore();
+    std::ifstream kept(dst / network);
+    EXPECT_EQ(std::string(std::istreambuf_iterator<char>(kept), {}),
+              "current");
+    EXPECT_TRUE(fs::exists(dst / "etc/hostname"));
+
+    // delta file is not selected for restore
+    fs::remove(dst / "etc/hostname");
+    bk.onlyFiles.push_back("/etc/hostname");
+    bk.restore();
+    EXPECT_TRUE(fs::exists(dst / "etc/hostname"));
+
+    // reconstructed file is not written through a symlink from the archive
+    const fs::path unpacked = tmpDir / "unpacked";
+    const fs::path outside = tmpDir / "outside";
+    fs::create_directories(unpacked);
+    fs::create_directories(outside / "network");
+    std::string cmd = "tar xzf " + arc.string() + " -C " + unpacked.string() +
+                      " ./bmc.manifest ./.delta";
+    ASSERT_EQ(system(cmd.c_str()), 0);
+    fs::create_directories(unpacked / "etc");
+    fs::create_symlink(outside, unpacked / "etc/systemd");
+    std::ofstream(ro / network) << base;
+    cmd = "tar czf " + arc.string() + " -C " + unpacked.string() +
+          " ./bmc.manifest ./.delta ./etc";
+    ASSERT_EQ(system(cmd.c_str()), 0);
+    bk.onlyFiles.clear();
+    EXPECT_THROW(bk.restore(), std::exception);
+    EXPECT_FALSE(fs::exists(outside / "network/10-big.network"));
+}
+
+TEST_F(BackupTest, Resume)
+{
+    const fs::path arc = tmpDir / "backup.tar.gz";
+    const fs::path tmp = tmpDir / "tmp";
+    fs::create_directories(tmp);
+    // isolate temporary directories of the test
+    setenv("TMPDIR", tmp.c_str(), 1);
+
+    Backup bk;
+    bk.unattendedMode = true;
+    bk.archiveFile = arc;
+    bk.rootFs = rwRoot;
+    bk.readOnlyFs = roRoot;
+    bk.maxMemory = 0;
+    bk.resume = true;
+    bk.backup();
+    const std::set<std::string> expect = fileList(arc);
+    const uintmax_t size = fs::file_size(arc);
+    fs::remove(arc);
+
+    for (const uint64_t maxTmp : {0, 4096})
+    {
+        // crash on writing the end of the archive (checksums)
+        bk.maxTmp = maxTmp;
+        const pid_t pid = fork();
+        ASSERT_NE(pid, -1);
+        if (pid == 0)
+        {
+            const rlimit limit = {size - 64, size - 64};
+            setrlimit(RLIMIT_FSIZE, &limit);
+            signal(SIGXFSZ, SIG_DFL);
+            try
+            {
+                bk.backup();
+            }
+            catch (...)
+            {}
+            _exit(EXIT_SUCCESS);
+        }
+        int status = 0;
+        ASSERT_EQ(waitpid(pid, &status, 0), pid);
+        ASSERT_TRUE(WIFSIGNALED(status));
+        EXPECT_FALSE(fs::is_empty(tmp));
+
+        bk.backup();
+        EXPECT_EQ(bk.mode(), maxTmp ? Preflight::Mode::streaming
+                                    : Preflight::Mode::staged);
+        EXPECT_EQ(fileList(arc), expect);
+        EXPECT_EQ(system(("gzip -t " + arc.string()).c_str()), 0);
+        EXPECT_TRUE(fs::is_empty(tmp));
+        fs::remove(arc);
+    }
+
+    // interrupted backup without resume starts from scratch
+    bk.maxTmp = 0;
+    const pid_t pid = fork();
+    ASSERT_NE(pid, -1);
+    if (pid == 0)
+    {
+        const rlimit limit = {size - 64, size - 64};
+        setrlimit(RLIMIT_FSIZE, &limit);
+        signal(SIGXFSZ, SIG_DFL);
+        bk.backup();
+        _exit(EXIT_SUCCESS);
+    }
+    int status = 0;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    bk.resume = false;
+    // rejected run keeps the checkpoint
+    std::ofstream(arc) << "existing";
+    EXPECT_THROW(bk.backup(), std::runtime_error);
+    EXPECT_FALSE(fs::is_empty(tmp));
+    fs::remove(arc);
+    bk.backup();
+    EXPECT_EQ(fileList(arc), expect);
+    EXPECT_TRUE(fs::is_empty(tmp));
+}
+
+TEST_F(BackupTest, Rotate)
+{
+    const fs::path dir = tmpDir / "archives";
+    fs::create_directories(dir);
+
+    Backup bk;
+    bk.unattendedMode = true;
+    bk.rootFs = rwRoot;
+    bk.readOnlyFs = roRoot;
+    bk.archiveFile = dir / "first.tar.gz";
+    bk.backup();
+    std::ofstream(dir / "notes.txt") << "not an archive";
+
+    // catalog is created on the first use, then updated by backup
+    bk.list(dir);
+    ASSERT_TRUE(Catalog::exists(dir));
+    bk.archiveFile = dir / "second.tar.gz";
+    bk.backup();
+    const Catalog catalog(dir);
+    ASSERT_EQ(catalog.entries().size(), 2);
+    EXPECT_EQ(catalog.latest()->name, "second.tar.gz");
+    EXPECT_EQ(catalog.latest()->osVersion, Manifest(rwRoot).osVersion());
+
+    // restore of the latest archive
+    bk.archiveFile = dir;
+    bk.rootFs = tmpDir / "dst";
+    fs::create_directories(bk.rootFs / "etc");
+    fs::copy(rwRoot / "etc/os-release", bk.rootFs / "etc/os-release");
+    bk.restore();
+    EXPECT_EQ(bk.archiveFile, dir / "second.tar.gz");
+    EXPECT_TRUE(fs::exists(bk.rootFs / "etc/machine-id"));
+
+    EXPECT_THROW(bk.rotate(dir), std::invalid_argument);
+    bk.keepDaily = 1;
+    bk.rotate(dir);
+    EXPECT_FALSE(fs::exists(dir / "first.tar.gz"));
+    EXPECT_TRUE(fs::exists(dir / "second.tar.gz"));
+    EXPECT_TRUE(fs::exists(dir / "notes.txt"));
+    EXPECT_EQ(Catalog(dir).entries().size(), 1);
+}
+
+TEST_F(BackupTest, Inspect)
+{
+    Backup bk;
+    bk.unattendedMode = true;
+    bk.archiveFile = tmpDir / "backup.tar.gz";
+    bk.rootFs = rwRoot;
+    bk.readOnlyFs = roRoot;
+    bk.backup();
+
+    testing::internal::CaptureStdout();
+    bk.inspect(bk.archiveFile);
+    const std::string out = testing::internal::GetCapturedStdout();
+    EXPECT_NE(out.find("Version:  " + Manifest(rwRoot).osVersion() + '\n'),
+              std::string::npos);
+    EXPECT_NE(out.find("\n  bmc.manifest\n"), std::string::npos);
+    EXPECT_NE(out.find("\n  etc/passwd\n"), std::string::npos);
+
+    EXPECT_THROW(bk.inspect(tmpDir / "missing.tar.gz"), std::exception);
+}
+
+/**
+ * @class CancelSink
+ * @brief Progress sink that cancels operation at the specified phase.
+ */
+class CancelSink : public ProgressSink
+{
+  public:
+    CancelSink(CancelToken& token, const std::string& phase) :
+        token(token), phase(phase)
+    {}
+
+    void update(const Status& status) override
+    {
+        reports.push_back(status);
+        if (status.phase == phase)
+        {
+            token.cancel();
+        }
+    }
+
+    CancelToken& token;
+    const std::string phase;
+    std::vector<Status> reports;
+};
+
+TEST_F(BackupTest, Progress)
+{
+    const fs::path arc = tmpDir / "backup.tar.gz";
+    auto token = std::make_shared<CancelToken>();
+    auto sink = std::make_shared<CancelSink>(*token, "");
+
+    Backup bk;
+    bk.unattendedMode = true;
+    bk.archiveFile = arc;
+    bk.rootFs = rwRoot;
+    bk.readOnlyFs = roRoot;
+    bk.progressSink = sink;
+    bk.cancel = token;
+    bk.backup();
+
+    ASSERT_FALSE(sink->reports.empty());
+    EXPECT_EQ(sink->reports.front().phase, "prepare");
+    const ProgressSink::Status& last = sink->reports.back();
+    EXPECT_EQ(last.phase, "archive");
+    EXPECT_TRUE(last.finished);
+    EXPECT_EQ(last.entries, last.totalEntries);
+    EXPECT_GT(last.bytes, 0);
+    EXPECT_EQ(last.eta, 0);
+
+    sink->reports.clear();
+    bk.rootFs = tmpDir / "dst";
+    fs::create_directories(bk.rootFs / "etc");
+    fs::copy(rwRoot / "etc/os-release", bk.rootFs / "etc/os-release");
+    bk.restore();
+    EXPECT_EQ(sink->reports.front().phase, "extract");
+    EXPECT_EQ(sink->reports.front().totalBytes, fs::file_size(arc));
+    EXPECT_EQ(sink->reports.back().phase, "restore");
+    EXPECT_EQ(sink->reports.back().entries, sink->reports.back().totalEntries);
+}
+
+TEST_F(BackupTest, Cancel)
+{
+    const fs::path arc = tmpDir / "backup.tar.gz";
+    const fs::path tmp = tmpDir / "tmp";
+    fs::create_directories(tmp);
+    // isolate temporary directories of the test
+    setenv("TMPDIR", tmp.c_str(), 1);
+
+    // temporary data is removed with the Backup instance
+    for (const uint64_t maxMemory : {1024 * 1024, 0})
+    {
+        {
+            auto token = std::make_shared<CancelToken>();
+            Backup bk;
+            bk.unattendedMode = true;
+            bk.archiveFile = arc;
+            bk.rootFs = rwRoot;
+            bk.readOnlyFs = roRoot;
+            bk.maxMemory = maxMemory;
+            bk.progressSink = std::make_shared<CancelSink>(*token, "archive");
+            bk.cancel = token;
+            EXPECT_THROW(bk.backup(), Cancelled);
+        }
+        EXPECT_FALSE(fs::exists(arc));
+        EXPECT_TRUE(fs::is_empty(tmp));
+    }
+
+    auto bk = std::make_unique<Backup>();
+    bk->unattendedMode = true;
+    bk->archiveFile = arc;
+    bk->rootFs = rwRoot;
+    bk->readOnlyFs = roRoot;
+    bk->backup();
+
+    // nothing is changed if restore is cancelled before the first entry
+    auto token = std::make_shared<CancelToken>();
+    const fs::path dst = tmpDir / "dst";
+    fs::create_directories(dst / "etc");
+    fs::copy(rwRoot / "etc/os-release", dst / "etc/os-release");
+    bk->rootFs = dst;
+    bk->progressSink = std::make_shared<CancelSink>(*token, "restore");
+    bk->cancel = token;
+    EXPECT_THROW(bk->restore(), Cancelled);
+    bk.reset();
+    EXPECT_FALSE(fs::exists(dst / "etc/passwd"));
+    EXPECT_FALSE(fs::exists(dst / "etc/machine-id"));
+    EXPECT_TRUE(fs::is_empty(tmp));
+}
+
+TEST_F(BackupTest, MachineMismatch)
+{
+    const fs::path arc = tmpDir / "backup.tar.gz";
+    const fs::path root = tmpDir / "root";
+
+    Backup bk;
+    bk.unattendedMode = true;
+    bk.archiveFile = arc;
+    bk.rootFs = rwRoot;
+    bk.readOnlyFs = roRoot;
+    bk.backup();
+
+    fs::create_directories(root / "etc");
+    std::ifstream in(rwRoot / "etc/os-release");
+    std::ofstream out(root / "etc/os-release");
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.find("OPENBMC_TARGET_MACHINE=") == 0)
+        {
+            line = "OPENBMC_TARGET_MACHINE=\"other\"";
+        }
+        out << line << '\n';
+    }
+    out.close();
+
+    // the archive is rejected before it is extracted
+    auto token = std::make_shared<CancelToken>();
+    auto sink = std::make_shared<CancelSink>(*token, "");
+    bk.rootFs = root;
+    bk.progressSink = sink;
+    EXPECT_THROW(bk.restore(), std::runtime_error);
+    for (const auto& it : sink->reports)
+    {
+        EXPECT_NE(it.phase, "extract");
+    }
+    EXPECT_FALSE(fs::exists(root / "etc/hostname"));
+}
@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "batch.hpp"
+
+#include <fstream>
+
+#include <gtest/gtest.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * @class BatchTest
+ * @brief Tests for batch mode.
+ */
+class BatchTest : public ::testing::Test
+{
+  protected:
+    void SetUp() override
+    {
+        fs::remove_all(tmpDir);
+        fs::create_directories(tmpDir);
+    }
+
+    void TearDown() override
+    {
+        fs::remove_all(tmpDir);
+    }
+
+    void writeFile(const fs::path& path, const std::string& data) const
+    {
+        std::ofstream file(path);
+        file << data;
+    }
+
+    const fs::path tmpDir = fs::temp_directory_path() / "batch_test";
+    const fs::path jobFile = tmpDir / "jobs";
+    const fs::path rwRoot = fs::path(TEST_DATA_DIR) / "full/rw";
+    const fs::path roRoot = fs::path(TEST_DATA_DIR) / "full/ro";
+};
+
+TEST_F(BatchTest, Load)
+{
+    writeFile(jobFile, "# comment\n"
+                       "\n"
+                       "backup /a.tar.gz /root /ro\n"
+                       "  restore \"/b c.tar.gz\" /root2 /ro2\n");
+    const auto jobs = Batch::load(jobFile);
+    ASSERT_EQ(jobs.size(), 2);
+    EXPECT_FALSE(jobs[0].restore);
+    EXPECT_EQ(jobs[0].archiveFile, "/a.tar.gz");
+    EXPECT_EQ(jobs[0].rootFs, "/root");
+    EXPECT_EQ(jobs[0].readOnlyFs, "/ro");
+    EXPECT_TRUE(jobs[1].restore);
+    EXPECT_EQ(jobs[1].archiveFile, "/b c.tar.gz");
+    EXPECT_EQ(jobs[1].rootFs, "/root2");
+    EXPECT_EQ(jobs[1].readOnlyFs, "/ro2");
+
+    writeFile(jobFile, "backup /a.tar.gz /root\n");
+    EXPECT_THROW(Batch::load(jobFile), std::runtime_error);
+    writeFile(jobFile, "copy /a.tar.gz /root /ro\n");
+    EXPECT_THROW(Batch::load(jobFile), std::runtime_error);
+    writeFile(jobFile, "backup /a.tar.gz /root /ro extra\n");
+    EXPECT_THROW(Batch::load(jobFile), std::runtime_error);
+}
+
+TEST_F(BatchTest, Run)
+{
+    const Backup proto;
+    const Batch batch(proto, 3);
+
+    std::vector<Batch::Job> jobs;
+    for (size_t i = 0; i < 5; ++i)
+    {
+        const fs::path arc = tmpDir / ("backup" + std::to_string(i) + ".tgz");
+        jobs.push_back({false, arc, rwRoot, roRoot});
+    }
+    jobs.push_back({false, tmpDir / "missing.tgz", rwRoot, tmpDir / "none"});
+    auto results = batch.run(jobs);
+    ASSERT_EQ(results.size(), jobs.size());
+    for (size_t i = 0; i < 5; ++i)
+    {
+        EXPECT_TRUE(results[i].error.empty()) << results[i].error;
+        EXPECT_TRUE(fs::exists(jobs[i].archiveFile));
+    }
+    EXPECT_FALSE(results.back().error.empty());
+
+    // restore to copies of the root FS
+    jobs.clear();
+    for (size_t i = 0; i < 2; ++i)
+    {
+        const fs::path root = tmpDir / ("root" + std::to_string(i));
+        fs::copy(rwRoot, root, fs::copy_options::recursive);
+        const fs::path arc = tmpDir / ("backup" + std::to_string(i) + ".tgz");
+        jobs.push_back({true, arc, root, roRoot});
+    }
+    results = batch.run(jobs);
+    for (const auto& it : results)
+    {
+        EXPECT_TRUE(it.error.empty()) << it.error;
+    }
+    EXPECT_TRUE(fs::exists(tmpDir / "root1/etc/passwd"));
+}
@@ -0,0 +1,191 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "block_codec.hpp"
+#include "dictionary.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include <gtest/gtest.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * @brief Create data of the block.
+ *
+ * @param[in] index index of the block
+ * @param[in] size size of the data
+ *
+ * @return block data
+ */
+static std::vector<uint8_t> makeData(size_t index, size_t size)
+{
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i < size; ++i)
+    {
+        data[i] = static_cast<uint8_t>('a' + (i / 7 + index) % 26);
+    }
+    return data;
+}
+
+TEST(BlockCodecTest, Stream)
+{
+    const Dictionary dict(std::vector<uint8_t>(1024, 'a'));
+    for (const Dictionary* it : {static_cast<const Dictionary*>(nullptr),
+                                 &dict})
+    {
+        const bool adler = it != nullptr;
+        constexpr size_t count = 10;
+        BlockCodec compressor(3, it);
+        std::vector<uint8_t> plain;
+        for (size_t i = 0; i < count; ++i)
+        {
+            const std::vector<uint8_t> data = makeData(i, 1000 + i);
+            plain.insert(plain.end(), data.begin(), data.end());
+            compressor.compress(makeData(i, 1000 + i), i == 0,
+                                i == count - 1);
+        }
+
+        // concatenated blocks are a single deflate stream
+        std::vector<BlockCodec::Block> packed;
+        std::vector<uint8_t> stream;
+        uint32_t check = adler ? 1 : 0;
+        BlockCodec::Block block;
+        while (compressor.next(block, true))
+        {
+            check = BlockCodec::combine(check, block.check, block.size, adler);
+            stream.insert(stream.end(), block.data.begin(), block.data.end());
+            packed.push_back(block);
+        }
+        ASSERT_EQ(packed.size(), count);
+        EXPECT_TRUE(compressor.empty());
+        EXPECT_EQ(check, adler ? adler32(1, plain.data(), plain.size())
+                               : crc32(0, plain.data(), plain.size()));
+
+        std::vector<uint8_t> unpacked(plain.size());
+        z_stream zs{};
+        ASSERT_EQ(inflateInit2(&zs, -15), Z_OK);
+        if (it)
+        {
+            inflateSetDictionary(&zs, it->data().data(), it->data().size());
+        }
+        zs.next_in = stream.data();
+        zs.avail_in = stream.size();
+        zs.next_out = unpacked.data();
+        zs.avail_out = unpacked.size();
+        EXPECT_EQ(inflate(&zs, Z_FINISH), Z_STREAM_END);
+        inflateEnd(&zs);
+        EXPECT_EQ(unpacked, plain);
+
+        // each block can be decompressed separately
+        BlockCodec decompressor(3, it);
+        for (size_t i = 0; i < count; ++i)
+        {
+            decompressor.decompress(std::move(packed[i].data),
+                                    packed[i].size, i == 0, i == count - 1);
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            ASSERT_TRUE(decompressor.next(block, true));
+            EXPECT_EQ(block.data, makeData(i, 1000 + i));
+        }
+        EXPECT_FALSE(decompressor.next(block, true));
+    }
+}
+
+TEST(BlockCodecTest, Corrupted)
+{
+    BlockCodec::Block block =
+        BlockCodec::compressBlock(makeData(0, 1000), false, nullptr, false);
+    EXPECT_THROW(
+        BlockCodec::decompressBlock(block.data, 999, false, nullptr, false),
+        std::runtime_error);
+    EXPECT_THROW(
+        BlockCodec::decompressBlock(block.data, 1000, true, nullptr, false),
+        std::runtime_error);
+    EXPECT_THROW(BlockCodec::decompressBlock(block.data,
+                                             BlockCodec::blockSize + 1,
+                                             false, nullptr, false),
+                 std::runtime_error);
+
+    BlockCodec codec(2, nullptr);
+    block.data.resize(block.data.size() / 2);
+    codec.decompress(std::move(block.data), 1000, true, false);
+    EXPECT_THROW(codec.next(block, true), std::runtime_error);
+}
+
+TEST(BlockCodecTest, Index)
+{
+    const fs::path file = fs::temp_directory_path() / "block_codec_test";
+    BlockCodec::Index index;
+    index.offset = 10;
+    index.blocks = {{100, 200}, {300, 400}, {2, 0}};
+    index.toc = "23 0000000000000000=./\n";
+    const std::vector<uint8_t> table = index.encode();
+    index.toc.clear();
+    const std::vector<uint8_t> plain = index.encode();
+    {
+        std::ofstream out(file, std::ios::binary);
+        out << "prefix";
+        out.write(reinterpret_cast<const char*>(table.data()), table.size());
+        out << "suffix";
+        out.write(reinterpret_cast<const char*>(plain.data()), plain.size());
+    }
+
+    const int fd = open(file.c_str(), O_RDONLY);
+    ASSERT_NE(fd, -1);
+    BlockCodec::Index loaded;
+    EXPECT_TRUE(BlockCodec::Index::load(fd, fs::file_size(file), loaded));
+    EXPECT_TRUE(loaded.toc.empty());
+    const uint64_t end = fs::file_size(file) - plain.size() - 6;
+    EXPECT_FALSE(BlockCodec::Index::load(fd, end + 1, loaded));
+    EXPECT_TRUE(BlockCodec::Index::load(fd, end, loaded));
+    close(fd);
+    fs::remove(file);
+
+    EXPECT_EQ(loaded.toc, "23 0000000000000000=./\n");
+    EXPECT_EQ(loaded.offset, 10);
+    EXPECT_EQ(loaded.blocks, index.blocks);
+    EXPECT_EQ(loaded.size().first, 402);
+    EXPECT_EQ(loaded.size().second, 600);
+}
+
+TEST(BlockCodecTest, IndexOversized)
+{
+    // sizes of the table are limited, so a crafted archive can't force
+    // a huge allocation
+    const fs::path file = fs::temp_directory_path() / "block_codec_test";
+    const uint32_t maxPacked = static_cast<uint32_t>(
+        BlockCodec::compressedBound(BlockCodec::blockSize));
+    const std::vector<std::pair<uint32_t, uint32_t>> tables[] = {
+        {{100, BlockCodec::blockSize}, {maxPacked, BlockCodec::blockSize}},
+        {{100, BlockCodec::blockSize + 1}},
+        {{100, 0xffffffff}},
+        {{maxPacked + 1, 100}},
+    };
+    for (size_t i = 0; i < std::size(tables); ++i)
+    {
+        BlockCodec::Index index;
+        index.offset = 10;
+        index.blocks = tables[i];
+        const std::vector<uint8_t> table = index.encode();
+        {
+            std::ofstream out(file, std::ios::binary);
+            out.write(reinterpret_cast<const char*>(table.data()),
+                      table.size());
+        }
+        const int fd = open(file.c_str(), O_RDONLY);
+        ASSERT_NE(fd, -1);
+        BlockCodec::Index loaded;
+        EXPECT_EQ(BlockCodec::Index::load(fd, table.size(), loaded), i == 0)
+            << "table " << i;
+        close(fd);
+    }
+    fs::remove(file);
+}
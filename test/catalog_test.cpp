@@ -0,0 +1,172 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "catalog.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <fstream>
+#include <stdexcept>
+
+#include <gtest/gtest.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * @class CatalogTest
+ * @brief Tests for catalog of archives.
+ */
+class CatalogTest : public ::testing::Test
+{
+  protected:
+    void SetUp() override
+    {
+        fs::remove_all(tmpDir);
+        fs::create_directories(tmpDir);
+    }
+
+    void TearDown() override
+    {
+        fs::remove_all(tmpDir);
+    }
+
+    /**
+     * @brief Create archive file with specified modification time.
+     *
+     * @param[in] name file name
+     * @param[in] time modification time
+     */
+    void createFile(const std::string& name, time_t time) const
+    {
+        std::ofstream(tmpDir / name) << name;
+        const timespec times[2] = {{time, 0}, {time, 0}};
+        utimensat(AT_FDCWD, (tmpDir / name).c_str(), times, 0);
+    }
+
+    /**
+     * @brief Indexer that accepts *.tar.gz files.
+     *
+     * @param[in] file path to the file
+     * @param[out] entry catalog entry
+     */
+    static void indexer(const fs::path& file, Catalog::Entry& entry)
+    {
+        if (file.string().find(".tar.gz") == std::string::npos)
+        {
+            throw std::runtime_error("Not an archive");
+        }
+        entry.hostName = "host";
+        entry.osVersion = "v1.0";
+    }
+
+    /**
+     * @brief Get local time.
+     *
+     * @param[in] day day of January 2024 (1 is Monday)
+     * @param[in] hour hour
+     *
+     * @return time
+     */
+    static time_t localTime(int day, int hour)
+    {
+        tm local = {};
+        local.tm_year = 124;
+        local.tm_mday = day;
+        local.tm_hour = hour;
+        local.tm_isdst = -1;
+        return mktime(&local);
+    }
+
+    const fs::path tmpDir = fs::temp_directory_path() / "catalog_test";
+};
+
+TEST_F(CatalogTest, SaveLoad)
+{
+    createFile("new.tar.gz", localTime(2, 12));
+    createFile("old.tar.gz", localTime(1, 12));
+
+    Catalog catalog(tmpDir);
+    EXPECT_FALSE(Catalog::exists(tmpDir));
+    EXPECT_FALSE(catalog.latest());
+    Catalog::Entry entry;
+    entry.name = "new.tar.gz";
+    entry.hostName = "host\tname";
+    catalog.add(entry);
+    entry.name = "old.tar.gz";
+    entry.hostName.clear();
+    entry.osVersion = "v2.0";
+    catalog.add(entry);
+    catalog.save();
+    EXPECT_TRUE(Catalog::exists(tmpDir));
+
+    const Catalog loaded(tmpDir);
+    const auto& entries = loaded.entries();
+    ASSERT_EQ(entries.size(), 2);
+    EXPECT_EQ(entries[0].name, "old.tar.gz");
+    EXPECT_EQ(entries[0].osVersion, "v2.0");
+    EXPECT_EQ(entries[0].hostName, "");
+    EXPECT_EQ(entries[0].size, 10);
+    EXPECT_EQ(entries[0].mtime.tv_sec, localTime(1, 12));
+    EXPECT_EQ(entries[0].hash.size(), 64);
+    EXPECT_EQ(loaded.latest()->name, "new.tar.gz");
+    EXPECT_EQ(loaded.latest()->hostName, "host name");
+}
+
+TEST_F(CatalogTest, Update)
+{
+    createFile("a.tar.gz", localTime(1, 12));
+    createFile("b.tar.gz", localTime(2, 12));
+    createFile("notes.txt", localTime(3, 12));
+    // archive being written
+    createFile("c.tar.gz.tmp.aB3xYz", localTime(3, 12));
+
+    Catalog catalog(tmpDir);
+    EXPECT_TRUE(catalog.update(indexer));
+    ASSERT_EQ(catalog.entries().size(), 2);
+    EXPECT_EQ(catalog.latest()->name, "b.tar.gz");
+    EXPECT_EQ(catalog.latest()->hostName, "host");
+    EXPECT_FALSE(catalog.update(indexer));
+
+    fs::remove(tmpDir / "b.tar.gz");
+    createFile("a.tar.gz", localTime(4, 12));
+    EXPECT_TRUE(catalog.update(indexer));
+    ASSERT_EQ(catalog.entries().size(), 1);
+    EXPECT_EQ(catalog.latest()->mtime.tv_sec, localTime(4, 12));
+}
+
+TEST_F(CatalogTest, Expired)
+{
+    createFile("0-10.tar.gz", localTime(1, 10));
+    createFile("0-12.tar.gz", localTime(1, 12));
+    createFile("1.tar.gz", localTime(2, 12));
+    createFile("2.tar.gz", localTime(3, 12));
+    createFile("8.tar.gz", localTime(9, 12));
+    createFile("9.tar.gz", localTime(10, 12));
+
+    Catalog catalog(tmpDir);
+    catalog.update(indexer);
+
+    const auto names = [](const std::vector<Catalog::Entry>& entries) {
+        std::vector<std::string> list;
+        for (const auto& it : entries)
+        {
+            list.push_back(it.name);
+        }
+        return list;
+    };
+
+    using List = std::vector<std::string>;
+    EXPECT_EQ(names(catalog.expired(2, 0)),
+              (List{"0-10.tar.gz", "0-12.tar.gz", "1.tar.gz", "2.tar.gz"}));
+    EXPECT_EQ(names(catalog.expired(0, 2)),
+              (List{"0-10.tar.gz", "0-12.tar.gz", "1.tar.gz", "8.tar.gz"}));
+    EXPECT_EQ(names(catalog.expired(2, 2)),
+              (List{"0-10.tar.gz", "0-12.tar.gz", "1.tar.gz"}));
+    EXPECT_EQ(names(catalog.expired(10, 0)), List{"0-10.tar.gz"});
+    EXPECT_THROW(catalog.expired(0, 0), std::invalid_argument);
+
+    catalog.remove("0-10.tar.gz");
+    EXPECT_FALSE(fs::exists(tmpDir / "0-10.tar.gz"));
+    EXPECT_EQ(catalog.entries().size(), 5);
+}
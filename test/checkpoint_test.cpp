@@ -0,0 +1,137 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "checkpoint.hpp"
+
+#include <cstdlib>
+#include <fstream>
+
+#include <gtest/gtest.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * @class CheckpointTest
+ * @brief Tests for checkpoints of interrupted operations.
+ */
+class CheckpointTest : public ::testing::Test
+{
+  protected:
+    void SetUp() override
+    {
+        fs::remove_all(tmpDir);
+        fs::create_directories(tmpDir);
+        // isolate temporary directories of the test
+        const char* env = getenv("TMPDIR");
+        if (env)
+        {
+            oldTmp = env;
+        }
+        setenv("TMPDIR", tmpDir.c_str(), 1);
+    }
+
+    void TearDown() override
+    {
+        if (oldTmp.empty())
+        {
+            unsetenv("TMPDIR");
+        }
+        else
+        {
+            setenv("TMPDIR", oldTmp.c_str(), 1);
+        }
+        fs::remove_all(tmpDir);
+    }
+
+    const fs::path tmpDir = fs::temp_directory_path() / "checkpoint_test";
+    std::string oldTmp;
+};
+
+TEST_F(CheckpointTest, SaveLoad)
+{
+    std::unique_ptr<Checkpoint> cp = Checkpoint::create("backup", "arc");
+    const fs::path dir = cp->dir();
+    EXPECT_EQ(dir.parent_path(), tmpDir);
+    EXPECT_TRUE(fs::is_directory(dir));
+    EXPECT_EQ(cp->archiveFile, fs::absolute("arc"));
+
+    cp->mode = Preflight::Mode::staged;
+    cp->limit = 1234;
+    cp->total = 5678;
+    cp->steps = {"prepare", "etc/hostname"};
+    cp->deltas = {"etc/big"};
+    cp->archive.offset = 42;
+    cp->archive.tarSize = 1024;
+    cp->archive.check = 0xdeadbeef;
+    cp->archive.zlibFormat = true;
+    cp->archive.names = {"./", "./etc/", "./new\nline"};
+    cp->archive.checksums = "1 ./a\n2 ./b\n";
+    cp->save();
+
+    // locked by the running operation
+    EXPECT_FALSE(Checkpoint::find("backup", "arc"));
+
+    cp.reset();
+    EXPECT_FALSE(Checkpoint::find("restore", "arc"));
+    EXPECT_FALSE(Checkpoint::find("backup", "other"));
+    cp = Checkpoint::find("backup", "arc");
+    ASSERT_TRUE(cp);
+    EXPECT_EQ(cp->dir(), dir);
+    EXPECT_EQ(cp->mode, Preflight::Mode::staged);
+    EXPECT_EQ(cp->limit, 1234);
+    EXPECT_EQ(cp->total, 5678);
+    EXPECT_TRUE(cp->isDone("prepare"));
+    EXPECT_TRUE(cp->isDone("etc/hostname"));
+    EXPECT_FALSE(cp->isDone("archive"));
+    EXPECT_EQ(cp->deltas, std::set<fs::path>{"etc/big"});
+    EXPECT_EQ(cp->archive.offset, 42);
+    EXPECT_EQ(cp->archive.tarSize, 1024);
+    EXPECT_EQ(cp->archive.check, 0xdeadbeef);
+    EXPECT_TRUE(cp->archive.zlibFormat);
+    EXPECT_EQ(cp->archive.names,
+              (std::set<std::string>{"./", "./etc/", "./new\nline"}));
+    EXPECT_EQ(cp->archive.checksums, "1 ./a\n2 ./b\n");
+
+    std::ofstream(dir.string() + ".tar.gz") << "staged";
+    cp->remove();
+    EXPECT_TRUE(fs::is_empty(tmpDir));
+}
+
+TEST_F(CheckpointTest, Reclaim)
+{
+    // interrupted operation with checkpoint
+    std::unique_ptr<Checkpoint> cp = Checkpoint::create("backup", "arc");
+    const fs::path saved = cp->dir();
+    cp->save();
+    cp.reset();
+    // interrupted operation without checkpoint
+    cp = Checkpoint::create("backup", "arc");
+    const fs::path unsaved = cp->dir();
+    std::ofstream(unsaved.string() + ".tar.gz") << "staged";
+    cp.reset();
+    // running operation
+    cp = Checkpoint::create("restore", "arc");
+    const fs::path running = cp->dir();
+    // file of removed directory
+    const fs::path orphan = tmpDir / "backup_abc123.tar.gz";
+    std::ofstream(orphan) << "orphan";
+    // unrelated files
+    fs::create_directories(tmpDir / "backup_dir");
+    std::ofstream(tmpDir / "backup_xyz789");
+
+    Checkpoint::reclaim("backup", "other");
+    EXPECT_TRUE(fs::exists(saved));
+    EXPECT_TRUE(fs::exists(saved.string() + ".checkpoint"));
+    EXPECT_FALSE(fs::exists(unsaved));
+    EXPECT_FALSE(fs::exists(unsaved.string() + ".tar.gz"));
+    EXPECT_TRUE(fs::exists(running));
+    EXPECT_FALSE(fs::exists(orphan));
+    EXPECT_TRUE(fs::exists(tmpDir / "backup_dir"));
+    EXPECT_TRUE(fs::exists(tmpDir / "backup_xyz789"));
+
+    // new run of the same operation supersedes the interrupted one
+    Checkpoint::reclaim("backup", "arc");
+    EXPECT_FALSE(fs::exists(saved));
+    EXPECT_FALSE(fs::exists(saved.string() + ".checkpoint"));
+    EXPECT_TRUE(fs::exists(running));
+}
@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "checksum.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+/**
+ * @brief Measure throughput of the checksum implementation.
+ *
+ * @param[in] kernel implementation to check
+ * @param[in] data data to process
+ * @param[in] block size of the single update call
+ *
+ * @return throughput in MiB/s
+ */
+static double measure(Checksum::Kernel kernel,
+                      const std::vector<uint8_t>& data, size_t block)
+{
+    using Clock = std::chrono::steady_clock;
+    const auto minTime = std::chrono::milliseconds(200);
+
+    uint64_t total = 0;
+    uint32_t crc = 0;
+    const Clock::time_point start = Clock::now();
+    Clock::duration elapsed;
+    do
+    {
+        for (size_t pos = 0; pos + block <= data.size(); pos += block)
+        {
+            crc = Checksum::update(kernel, crc, data.data() + pos, block);
+            total += block;
+        }
+        elapsed = Clock::now() - start;
+    } while (elapsed < minTime);
+
+    // prevent optimizing out
+    if (crc == 0x12345678)
+    {
+        puts("");
+    }
+
+    const double sec = std::chrono::duration<double>(elapsed).count();
+    return total / sec / (1024 * 1024);
+}
+
+/** @brief Benchmark entry point. */
+int main()
+{
+    std::vector<uint8_t> data(4 * 1024 * 1024);
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        data[i] = static_cast<uint8_t>(i * 31 + (i >> 8));
+    }
+
+    printf("%-16s %12s %12s %12s\n", "kernel", "64 B", "4 KiB", "1 MiB");
+    for (const auto& kernel : Checksum::kernels())
+    {
+        printf("%-16s", Checksum::name(kernel));
+        for (size_t block : {64, 4096, 1024 * 1024})
+        {
+            printf(" %7.0f MiB/s", measure(kernel, data, block));
+        }
+        printf("%s\n", kernel == Checksum::kernel() ? " (default)" : "");
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "checksum.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <gtest/gtest.h>
+
+TEST(ChecksumTest, KnownValues)
+{
+    const char* check = "123456789";
+    EXPECT_EQ(Checksum::update(0, check, strlen(check)), 0xe3069283);
+    EXPECT_EQ(Checksum::update(0, nullptr, 0), 0);
+
+    const std::vector<uint8_t> zeros(32, 0);
+    EXPECT_EQ(Checksum::update(0, zeros.data(), zeros.size()), 0x8a9136aa);
+}
+
+TEST(ChecksumTest, Kernels)
+{
+    const std::vector<Checksum::Kernel> kernels = Checksum::kernels();
+    ASSERT_FALSE(kernels.empty());
+    EXPECT_EQ(kernels.front(), Checksum::Kernel::portable);
+    EXPECT_NE(std::find(kernels.begin(), kernels.end(), Checksum::kernel()),
+              kernels.end());
+
+    std::vector<uint8_t> data(20000);
+    uint32_t seed = 1;
+    for (auto& it : data)
+    {
+        seed = seed * 1103515245 + 12345;
+        it = static_cast<uint8_t>(seed >> 16);
+    }
+
+    // all kernels must produce the same result for any offset/size,
+    // including split updates
+    for (size_t offset : {0, 1, 3, 7})
+    {
+        for (size_t size : {0, 1, 7, 8, 9, 100, 1535, 1536, 1537, 4608, 19990})
+        {
+            const uint8_t* ptr = data.data() + offset;
+            const uint32_t expect = Checksum::update(
+                Checksum::Kernel::portable, 0, ptr, size);
+            for (const auto& kernel : kernels)
+            {
+                EXPECT_EQ(Checksum::update(kernel, 0, ptr, size), expect)
+                    << Checksum::name(kernel) << " " << offset << " " << size;
+                const size_t half = size / 2;
+                const uint32_t crc = Checksum::update(kernel, 0, ptr, half);
+                EXPECT_EQ(
+                    Checksum::update(kernel, crc, ptr + half, size - half),
+                    expect)
+                    << Checksum::name(kernel) << " " << offset << " " << size;
+            }
+        }
+    }
+}
+
+TEST(ChecksumTest, Unsupported)
+{
+    const std::vector<Checksum::Kernel> kernels = Checksum::kernels();
+    for (const auto kernel :
+         {Checksum::Kernel::sse42, Checksum::Kernel::pclmul,
+          Checksum::Kernel::armv8})
+    {
+        if (std::find(kernels.begin(), kernels.end(), kernel) == kernels.end())
+        {
+            EXPECT_THROW(Checksum::update(kernel, 0, "", 0),
+                         std::invalid_argument);
+        }
+    }
+}
@@ -0,0 +1,150 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "crypto.hpp"
+
+#include <fstream>
+
+#include <gtest/gtest.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * @class CryptoTest
+ * @brief Tests for archive encryption.
+ */
+class CryptoTest : public ::testing::Test
+{
+  protected:
+    void SetUp() override
+    {
+        fs::remove_all(tmpDir);
+        fs::create_directories(tmpDir);
+        std::ofstream(keyFile) << std::string(CryptoKey::keySize, 'k');
+        std::ofstream(passFile) << "secret\n";
+        for (size_t i = 0; i < data.size(); ++i)
+        {
+            data[i] = static_cast<uint8_t>(i * 7);
+        }
+    }
+
+    void TearDown() override
+    {
+        fs::remove_all(tmpDir);
+    }
+
+    /**
+     * @brief Encrypt data.
+     */
+    std::vector<uint8_t> encrypt(const CryptoKey& key) const
+    {
+        std::vector<uint8_t> out;
+        Encryptor enc(key);
+        // split input to check frame assembling
+        enc.update(data.data(), 1000, out);
+        enc.update(data.data() + 1000, data.size() - 1000, out);
+        enc.finish(data.size(), out);
+        EXPECT_LE(out.size(), Encryptor::bound(data.size()));
+        return out;
+    }
+
+    /**
+     * @brief Decrypt data.
+     */
+    std::vector<uint8_t> decrypt(const CryptoKey& key,
+                                 const std::vector<uint8_t>& enc) const
+    {
+        std::vector<uint8_t> out;
+        std::vector<uint8_t> frame;
+        Decryptor dec(key, enc.data());
+        size_t pos = Decryptor::headerSize;
+        bool last = false;
+        while (!last)
+        {
+            const size_t size = dec.frameSize(&enc[pos], last);
+            pos += Decryptor::prefixSize;
+            if (pos + size > enc.size())
+            {
+                throw std::runtime_error("truncated");
+            }
+            const uint8_t* footer = last ? &enc[pos + size] : nullptr;
+            dec.open(&enc[pos], size, footer, frame);
+            out.insert(out.end(), frame.begin(), frame.end());
+            pos += size;
+        }
+        EXPECT_EQ(pos + Decryptor::footerSize, enc.size());
+        return out;
+    }
+
+    const fs::path tmpDir = fs::temp_directory_path() / "crypto_test";
+    const fs::path keyFile = tmpDir / "key";
+    const fs::path passFile = tmpDir / "pass";
+    std::vector<uint8_t> data = std::vector<uint8_t>(200000);
+};
+
+TEST_F(CryptoTest, KeyFile)
+{
+    const CryptoKey key = CryptoKey::fromKeyFile(keyFile);
+    EXPECT_FALSE(key.isPassphrase());
+    const std::vector<uint8_t> enc = encrypt(key);
+    EXPECT_TRUE(Decryptor::isEncrypted(enc.data(), enc.size()));
+    EXPECT_EQ(decrypt(key, enc), data);
+
+    // each encryption uses unique nonce
+    EXPECT_NE(encrypt(key), enc);
+
+    std::ofstream(keyFile) << "short";
+    EXPECT_THROW(CryptoKey::fromKeyFile(keyFile), std::runtime_error);
+    EXPECT_THROW(CryptoKey::fromKeyFile(tmpDir / "not/exist"),
+                 std::system_error);
+}
+
+TEST_F(CryptoTest, Passphrase)
+{
+    const CryptoKey key = CryptoKey::fromPassphraseFile(passFile);
+    EXPECT_TRUE(key.isPassphrase());
+    const std::vector<uint8_t> enc = encrypt(key);
+    EXPECT_EQ(decrypt(key, enc), data);
+
+    std::ofstream(passFile) << "wrong\n";
+    const CryptoKey wrong = CryptoKey::fromPassphraseFile(passFile);
+    EXPECT_THROW(decrypt(wrong, enc), std::runtime_error);
+
+    // key type mismatch
+    EXPECT_THROW(decrypt(CryptoKey::fromKeyFile(keyFile), enc),
+                 std::runtime_error);
+
+    std::ofstream(passFile) << "\n";
+    EXPECT_THROW(CryptoKey::fromPassphraseFile(passFile), std::runtime_error);
+}
+
+TEST_F(CryptoTest, Tamper)
+{
+    const CryptoKey key = CryptoKey::fromKeyFile(keyFile);
+    const std::vector<uint8_t> enc = encrypt(key);
+
+    // header, data, tag and footer are authenticated
+    for (size_t pos : {size_t(20), size_t(100), size_t(70000),
+                       enc.size() - Decryptor::footerSize - 1,
+                       enc.size() - 1})
+    {
+        std::vector<uint8_t> bad = enc;
+        bad[pos] ^= 1;
+        EXPECT_THROW(decrypt(key, bad), std::runtime_error) << pos;
+    }
+}
+
+TEST_F(CryptoTest, Truncate)
+{
+    const CryptoKey key = CryptoKey::fromKeyFile(keyFile);
+    std::vector<uint8_t> enc = encrypt(key);
+
+    // drop the last frame, the previous one is not marked as last
+    bool last;
+    Decryptor dec(key, enc.data());
+    const size_t first = Decryptor::headerSize + Decryptor::prefixSize +
+                         dec.frameSize(&enc[Decryptor::headerSize], last);
+    ASSERT_FALSE(last);
+    enc.resize(first);
+    EXPECT_THROW(decrypt(key, enc), std::runtime_error);
+}
@@ -0,0 +1,85 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "delta.hpp"
+
+#include <gtest/gtest.h>
+
+/**
+ * @brief Generate pseudo-random text.
+ *
+ * @param[in] size size of the text
+ * @param[in] seed random seed
+ *
+ * @return text
+ */
+static std::vector<uint8_t> generate(size_t size, uint32_t seed)
+{
+    std::vector<uint8_t> data(size);
+    for (auto& it : data)
+    {
+        seed = seed * 1103515245 + 12345;
+        it = 'a' + (seed >> 16) % 26;
+    }
+    return data;
+}
+
+TEST(DeltaTest, Similar)
+{
+    const std::vector<uint8_t> base = generate(100000, 1);
+    std::vector<uint8_t> target = base;
+    target[500] = '#';
+    target.erase(target.begin() + 20000, target.begin() + 20100);
+    const std::vector<uint8_t> ins = generate(300, 2);
+    target.insert(target.begin() + 70000, ins.begin(), ins.end());
+
+    const std::vector<uint8_t> delta = Delta::create(base, target);
+    EXPECT_LT(delta.size(), 2000);
+    EXPECT_EQ(Delta::apply(base, delta), target);
+}
+
+TEST(DeltaTest, Different)
+{
+    const std::vector<uint8_t> base = generate(5000, 1);
+    const std::vector<uint8_t> target = generate(3000, 2);
+    const std::vector<uint8_t> delta = Delta::create(base, target);
+    EXPECT_GT(delta.size(), target.size());
+    EXPECT_EQ(Delta::apply(base, delta), target);
+}
+
+TEST(DeltaTest, Small)
+{
+    const std::vector<uint8_t> empty;
+    const std::vector<uint8_t> data = generate(10, 1);
+    EXPECT_EQ(Delta::apply(empty, Delta::create(empty, empty)), empty);
+    EXPECT_EQ(Delta::apply(empty, Delta::create(empty, data)), data);
+    EXPECT_EQ(Delta::apply(data, Delta::create(data, empty)), empty);
+    EXPECT_EQ(Delta::apply(data, Delta::create(data, data)), data);
+}
+
+TEST(DeltaTest, Invalid)
+{
+    const std::vector<uint8_t> base = generate(10000, 1);
+    std::vector<uint8_t> target = base;
+    target[5000] = '#';
+    std::vector<uint8_t> delta = Delta::create(base, target);
+
+    // another base
+    std::vector<uint8_t> other = base;
+    other[0] = '#';
+    EXPECT_THROW(Delta::apply(other, delta), std::runtime_error);
+
+    // corrupted delta
+    delta.back() ^= 1;
+    EXPECT_THROW(Delta::apply(base, delta), std::runtime_error);
+    delta.resize(delta.size() / 2);
+    EXPECT_THROW(Delta::apply(base, delta), std::runtime_error);
+    EXPECT_THROW(Delta::apply(base, {1, 2, 3}), std::runtime_error);
+}
+
+TEST(DeltaTest, Hash)
+{
+    EXPECT_EQ(
+        Delta::hash({}),
+        "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+}
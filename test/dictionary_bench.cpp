@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "archive.hpp"
+#include "dictionary.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+namespace fs = std::filesystem;
+
+/** @brief Test data sets (backups of different systems). */
+static const char* dataSets[] = {
+    "accounts/backup_good", "accounts/backup_exceeded",
+    "accounts/backup_badgid", "accounts/backup_baduid",
+    "accounts/ro",          "accounts/rw",
+    "full/ro",              "full/rw",
+    "manifest",
+};
+
+/**
+ * @brief Create archive in memory.
+ *
+ * @param[in] dir source directory
+ * @param[in] dict compression dictionary, nullptr to use gzip
+ *
+ * @return size of the archive
+ */
+static uint64_t compress(const fs::path& dir, const Dictionary* dict)
+{
+    ArchiveWriter writer(16 * 1024 * 1024);
+    writer.setDictionary(dict);
+    writer.addTree(dir, ".");
+    writer.finish();
+    return writer.size();
+}
+
+/**
+ * @brief Measure compression of all data sets.
+ *
+ * @param[in] dict compression dictionary, nullptr to use gzip
+ * @param[out] size total size of the archives
+ *
+ * @return number of archives created per second
+ */
+static double measure(const Dictionary* dict, uint64_t& size)
+{
+    using Clock = std::chrono::steady_clock;
+    const auto minTime = std::chrono::milliseconds(500);
+
+    size_t count = 0;
+    const Clock::time_point start = Clock::now();
+    Clock::duration elapsed;
+    do
+    {
+        size = 0;
+        for (const char* it : dataSets)
+        {
+            size += compress(fs::path(TEST_DATA_DIR) / it, dict);
+            ++count;
+        }
+        elapsed = Clock::now() - start;
+    } while (elapsed < minTime);
+
+    return count / std::chrono::duration<double>(elapsed).count();
+}
+
+/** @brief Benchmark entry point. */
+int main()
+{
+    // dictionary is trained on the same data set: in real life it is trained
+    // on backups of the same platform, which are very similar
+    std::vector<std::vector<uint8_t>> samples;
+    const fs::path tmpFile = fs::temp_directory_path() / "dictionary_bench";
+    for (const char* it : dataSets)
+    {
+        fs::remove(tmpFile);
+        ArchiveWriter writer(tmpFile);
+        writer.addTree(fs::path(TEST_DATA_DIR) / it, ".");
+        writer.finish();
+        ArchiveReader reader(tmpFile, 64 * 1024);
+        samples.push_back(reader.unpack());
+    }
+    fs::remove(tmpFile);
+    const Dictionary dict = Dictionary::train(samples);
+
+    uint64_t plainSize;
+    uint64_t dictSize;
+    const double plainRate = measure(nullptr, plainSize);
+    const double dictRate = measure(&dict, dictSize);
+
+    printf("%-10s %10s %14s\n", "mode", "size", "archives/s");
+    printf("%-10s %10llu %14.0f\n", "gzip",
+           static_cast<unsigned long long>(plainSize), plainRate);
+    printf("%-10s %10llu %14.0f\n", "dictionary",
+           static_cast<unsigned long long>(dictSize), dictRate);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,151 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "archive.hpp"
+#include "crypto.hpp"
+#include "dictionary.hpp"
+
+#include <zlib.h>
+
+#include <fstream>
+
+#include <gtest/gtest.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * @class DictionaryTest
+ * @brief Tests for compression dictionary.
+ */
+class DictionaryTest : public ::testing::Test
+{
+  protected:
+    void SetUp() override
+    {
+        fs::remove_all(tmpDir);
+        fs::create_directories(tmpDir);
+    }
+
+    void TearDown() override
+    {
+        fs::remove_all(tmpDir);
+    }
+
+    std::string readFile(const fs::path& path) const
+    {
+        std::ifstream file(path);
+        return std::string((std::istreambuf_iterator<char>(file)),
+                           std::istreambuf_iterator<char>());
+    }
+
+    // create archive from test data and get its uncompressed content
+    std::vector<uint8_t> sample(const fs::path& dir) const
+    {
+        const fs::path file = tmpDir / "sample.tar.gz";
+        ArchiveWriter writer(file);
+        writer.addTree(dir, ".");
+        writer.finish();
+        ArchiveReader reader(file, 1024);
+        std::vector<uint8_t> data = reader.unpack();
+        fs::remove(file);
+        return data;
+    }
+
+    // train dictionary on test data except accounts/rw
+    Dictionary train() const
+    {
+        std::vector<std::vector<uint8_t>> samples;
+        for (const char* it :
+             {"accounts/backup_good", "accounts/backup_exceeded",
+              "accounts/backup_badgid", "accounts/backup_baduid",
+              "accounts/ro", "full/rw", "manifest"})
+        {
+            samples.push_back(sample(dataDir / it));
+        }
+        return Dictionary::train(samples);
+    }
+
+    const fs::path dataDir = TEST_DATA_DIR;
+    const fs::path tmpDir = fs::temp_directory_path() / "dictionary_test";
+    const fs::path arcFile = tmpDir / "test.tar.gz";
+    const fs::path dstDir = tmpDir / "dst";
+};
+
+TEST_F(DictionaryTest, Train)
+{
+    const Dictionary dict = train();
+    EXPECT_FALSE(dict.data().empty());
+    EXPECT_LE(dict.data().size(), Dictionary::defaultSize);
+    EXPECT_EQ(dict.id(), adler32(adler32(0, nullptr, 0), dict.data().data(),
+                                 static_cast<uInt>(dict.data().size())));
+
+    const fs::path dictFile = tmpDir / "dict";
+    dict.save(dictFile);
+    const Dictionary loaded = Dictionary::load(dictFile);
+    EXPECT_EQ(loaded.id(), dict.id());
+    EXPECT_EQ(loaded.data(), dict.data());
+}
+
+TEST_F(DictionaryTest, Invalid)
+{
+    EXPECT_THROW(Dictionary(std::vector<uint8_t>()), std::invalid_argument);
+    EXPECT_THROW(Dictionary(std::vector<uint8_t>(Dictionary::maxSize + 1)),
+                 std::invalid_argument);
+    EXPECT_THROW(Dictionary::train({std::vector<uint8_t>(10)}),
+                 std::runtime_error);
+    EXPECT_THROW(Dictionary::load(tmpDir / "nonexistent"), std::system_error);
+}
+
+TEST_F(DictionaryTest, Archive)
+{
+    const fs::path srcDir = dataDir / "accounts/rw";
+    const Dictionary dict = train();
+
+    ArchiveWriter plain(1024 * 1024);
+    plain.addTree(srcDir, ".");
+    plain.finish();
+
+    ArchiveWriter writer(arcFile);
+    writer.setDictionary(&dict);
+    writer.addTree(srcDir, ".");
+    writer.finish();
+    EXPECT_LT(writer.size(), plain.size());
+    EXPECT_EQ(ArchiveReader::contentSize(arcFile), sample(srcDir).size());
+
+    // dictionary is referenced by ID
+    ArchiveReader noDict(arcFile, 1024);
+    EXPECT_THROW(noDict.extract(dstDir), std::runtime_error);
+
+    const Dictionary other(std::vector<uint8_t>(100, 'x'));
+    ArchiveReader wrongDict(arcFile, 1024);
+    wrongDict.setDictionary(&other);
+    EXPECT_THROW(wrongDict.extract(dstDir), std::runtime_error);
+
+    fs::remove_all(dstDir);
+    ArchiveReader reader(arcFile, 1024);
+    reader.setDictionary(&dict);
+    reader.extract(dstDir);
+    EXPECT_EQ(readFile(dstDir / "etc/passwd"), readFile(srcDir / "etc/passwd"));
+    EXPECT_EQ(readFile(dstDir / "etc/shadow"), readFile(srcDir / "etc/shadow"));
+}
+
+TEST_F(DictionaryTest, Encrypted)
+{
+    const fs::path srcDir = dataDir / "full/rw";
+    const Dictionary dict = train();
+    const fs::path keyFile = tmpDir / "key";
+    std::ofstream(keyFile) << std::string(CryptoKey::keySize, 'k');
+    const CryptoKey key = CryptoKey::fromKeyFile(keyFile);
+
+    ArchiveWriter writer(arcFile);
+    writer.setKey(&key);
+    writer.setDictionary(&dict);
+    writer.addTree(srcDir, ".");
+    writer.finish();
+
+    ArchiveReader reader(arcFile, 100, &key);
+    reader.setDictionary(&dict);
+    reader.extract(dstDir);
+    EXPECT_EQ(readFile(dstDir / "etc/hostname"),
+              readFile(srcDir / "etc/hostname"));
+}
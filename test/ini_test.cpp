@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "ini.hpp"
+
+#include <fstream>
+
+#include <gtest/gtest.h>
+
+namespace fs = std::filesystem;
+
+TEST(IniTest, Sections)
+{
+    const fs::path iniFile = fs::temp_directory_path() / "ini_test";
+    std::ofstream file(iniFile);
+    file << "# comment\n";
+    file << "common = \"value\"\n";
+    file << "\n";
+    file << "[first]\n";
+    file << "key=1\n";
+    file << "; key=2\n";
+    file << "[ second ]\n";
+    file << "key=3\n";
+    file.close();
+
+    const auto common = parseIni(iniFile);
+    ASSERT_EQ(common.size(), 1);
+    EXPECT_EQ(common.at("common"), "value");
+
+    const auto first = parseIni(iniFile, "first");
+    ASSERT_EQ(first.size(), 1);
+    EXPECT_EQ(first.at("key"), "1");
+
+    const auto second = parseIni(iniFile, "second");
+    ASSERT_EQ(second.size(), 1);
+    EXPECT_EQ(second.at("key"), "3");
+
+    EXPECT_TRUE(parseIni(iniFile, "third").empty());
+
+    fs::remove(iniFile);
+
+    ASSERT_THROW(parseIni(iniFile), std::runtime_error);
+}
@@ -0,0 +1,186 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "archive.hpp"
+#include "io_engine.hpp"
+#include "metadata.hpp"
+#include "root_dir.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+/** @brief Number of directories in the test tree. */
+static constexpr size_t dirCount = 40;
+/** @brief Number of files in each directory. */
+static constexpr size_t filesPerDir = 100;
+
+/**
+ * @brief Create tree of small files (typical configuration files).
+ *
+ * @param[in] root path to the root directory
+ *
+ * @return total size of the files
+ */
+static uint64_t createTree(const fs::path& root)
+{
+    uint64_t total = 0;
+    for (size_t dir = 0; dir < dirCount; ++dir)
+    {
+        const fs::path path = root / ("dir" + std::to_string(dir));
+        fs::create_directories(path);
+        for (size_t file = 0; file < filesPerDir; ++file)
+        {
+            const size_t size = 256 + (dir * filesPerDir + file) * 37 % 4096;
+            std::ofstream(path / ("file" + std::to_string(file)))
+                << std::string(size, static_cast<char>('a' + file % 26));
+            total += size;
+        }
+    }
+    return total;
+}
+
+/**
+ * @brief Open all files of the tree, get their status and read content.
+ *
+ * @param[in] root root directory
+ * @param[in] io I/O engine, nullptr to process files one by one
+ *
+ * @return total size of the read data
+ */
+static uint64_t readTree(const RootDir& root, IoEngine* io)
+{
+    uint64_t total = 0;
+    std::vector<uint8_t> buf(IoEngine::smallFileSize);
+    for (size_t dir = 0; dir < dirCount; ++dir)
+    {
+        const std::string path = "src/dir" + std::to_string(dir);
+        const FileHandle dirFd(root.open(path, O_RDONLY | O_DIRECTORY));
+        const std::vector<std::string> names =
+            RootDir::list(dirFd.get(), path);
+        if (io)
+        {
+            for (size_t pos = 0; pos < names.size();
+                 pos += IoEngine::batchSize)
+            {
+                FileBatch batch(*io);
+                for (size_t i = pos;
+                     i < std::min(names.size(), pos + IoEngine::batchSize);
+                     ++i)
+                {
+                    batch.files.emplace_back().name = names[i];
+                }
+                io->read(dirFd.get(), batch.files);
+                for (const auto& it : batch.files)
+                {
+                    total += it.data.size();
+                }
+            }
+            continue;
+        }
+        for (const auto& it : names)
+        {
+            const FileHandle fd(RootDir::openEntry(dirFd.get(), it.c_str()));
+            struct statx stx;
+            statx(fd.get(), "", AT_EMPTY_PATH, STATX_BASIC_STATS, &stx);
+            const ssize_t len = pread(fd.get(), buf.data(), stx.stx_size, 0);
+            total += len > 0 ? len : 0;
+        }
+    }
+    return total;
+}
+
+/**
+ * @brief Measure number of runs per second.
+ *
+ * @param[in] fn function to run
+ *
+ * @return runs per second
+ */
+template <class F>
+static double measure(F fn)
+{
+    using Clock = std::chrono::steady_clock;
+    const auto minTime = std::chrono::milliseconds(500);
+
+    size_t count = 0;
+    const Clock::time_point start = Clock::now();
+    Clock::duration elapsed;
+    do
+    {
+        fn();
+        ++count;
+        elapsed = Clock::now() - start;
+    } while (elapsed < minTime);
+
+    return count / std::chrono::duration<double>(elapsed).count();
+}
+
+/** @brief Benchmark entry point. */
+int main()
+{
+    const fs::path tmpDir = fs::temp_directory_path() / "io_bench";
+    fs::remove_all(tmpDir);
+    const uint64_t size = createTree(tmpDir / "src");
+    fs::create_directories(tmpDir / "dst");
+    const RootDir srcRoot(tmpDir);
+    const RootDir dstRoot(tmpDir / "dst");
+    const size_t files = dirCount * filesPerDir;
+    const double mib = static_cast<double>(size) / (1024 * 1024);
+
+    printf("%zu files, %.1f MiB (page cache is warm)\n", files, mib);
+    printf("%-8s %21s %21s %21s\n", "engine", "read", "archive", "copy");
+    for (const char* name : {"none", "sync", "threads", "uring"})
+    {
+        std::unique_ptr<IoEngine> io;
+        if (strcmp(name, "none") != 0)
+        {
+            try
+            {
+                io = IoEngine::create(name);
+            }
+            catch (const std::exception& ex)
+            {
+                printf("%-8s %s\n", name, ex.what());
+                continue;
+            }
+        }
+
+        const double read = measure([&]() {
+            if (readTree(srcRoot, io.get()) != size)
+            {
+                throw std::runtime_error("Unexpected size of data");
+            }
+        });
+        const double archive = measure([&]() {
+            ArchiveWriter writer(0);
+            writer.setIoEngine(io.get());
+            writer.addTree(srcRoot, "src", ".");
+            writer.finish();
+        });
+        const double copy = measure([&]() {
+            fs::remove_all(tmpDir / "dst/src");
+            Metadata::copy(srcRoot, "src", dstRoot, "src", io.get());
+        });
+
+        printf("%-8s", name);
+        for (const double rate : {read, archive, copy})
+        {
+            printf(" %6.0f file/s %5.0f MiB/s", rate * files, rate * mib);
+        }
+        puts("");
+    }
+
+    fs::remove_all(tmpDir);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,145 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "io_engine.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <fstream>
+
+#include <gtest/gtest.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * @class IoEngineTest
+ * @brief Tests for batched I/O, parametrized by engine name.
+ */
+class IoEngineTest : public ::testing::TestWithParam<const char*>
+{
+  protected:
+    void SetUp() override
+    {
+        fs::remove_all(tmpDir);
+        fs::create_directories(tmpDir / "dir");
+        std::ofstream(tmpDir / "small") << "small file\n";
+        std::ofstream(tmpDir / "empty");
+        std::ofstream(tmpDir / "big") << std::string(100000, 'x');
+        fs::create_symlink("small", tmpDir / "link");
+
+        try
+        {
+            io = IoEngine::create(GetParam());
+        }
+        catch (const std::runtime_error&)
+        {
+            // io_uring is not supported by the kernel
+        }
+        dirFd = open(tmpDir.c_str(), O_RDONLY | O_DIRECTORY);
+    }
+
+    void TearDown() override
+    {
+        close(dirFd);
+        fs::remove_all(tmpDir);
+    }
+
+    const fs::path tmpDir = fs::temp_directory_path() / "io_engine_test";
+    std::unique_ptr<IoEngine> io;
+    int dirFd = -1;
+};
+
+TEST_P(IoEngineTest, Read)
+{
+    if (!io)
+    {
+        GTEST_SKIP();
+    }
+    if (GetParam() != std::string("auto"))
+    {
+        EXPECT_STREQ(io->name(), GetParam());
+    }
+
+    FileBatch batch(*io);
+    for (const char* name : {"small", "empty", "big", "link", "dir", "none"})
+    {
+        batch.files.emplace_back().name = name;
+    }
+    io->read(dirFd, batch.files);
+    const auto& files = batch.files;
+
+    ASSERT_EQ(files[0].error, 0);
+    EXPECT_TRUE(files[0].loaded);
+    EXPECT_EQ(std::string(files[0].data.begin(), files[0].data.end()),
+              "small file\n");
+    EXPECT_EQ(files[0].stx.stx_size, 11);
+
+    ASSERT_EQ(files[1].error, 0);
+    EXPECT_TRUE(files[1].loaded);
+    EXPECT_TRUE(files[1].data.empty());
+
+    ASSERT_EQ(files[2].error, 0);
+    EXPECT_FALSE(files[2].loaded);
+    EXPECT_EQ(files[2].stx.stx_size, 100000);
+    char buf[4] = {};
+    EXPECT_EQ(::read(files[2].fd, buf, sizeof(buf)), 4);
+
+    ASSERT_EQ(files[3].error, 0);
+    EXPECT_TRUE(S_ISLNK(files[3].stx.stx_mode));
+    EXPECT_FALSE(files[3].loaded);
+
+    ASSERT_EQ(files[4].error, 0);
+    EXPECT_TRUE(S_ISDIR(files[4].stx.stx_mode));
+
+    EXPECT_EQ(files[5].error, ENOENT);
+    EXPECT_EQ(files[5].fd, -1);
+}
+
+TEST_P(IoEngineTest, Write)
+{
+    if (!io)
+    {
+        GTEST_SKIP();
+    }
+
+    std::vector<IoEngine::File> files;
+    for (size_t i = 0; i < IoEngine::batchSize * 2 + 1; ++i)
+    {
+        auto& file = files.emplace_back();
+        file.name = "file" + std::to_string(i);
+        file.data.assign(i * 100, static_cast<uint8_t>(i));
+        file.mode = 0600;
+    }
+    files.emplace_back().name = "link";
+    io->write(dirFd, files);
+    EXPECT_EQ(files.back().error, ELOOP);
+    files.pop_back();
+    io->close(files);
+
+    for (const auto& it : files)
+    {
+        ASSERT_EQ(it.error, 0);
+        EXPECT_EQ(it.fd, -1);
+        const fs::path path = tmpDir / it.name;
+        EXPECT_EQ(fs::file_size(path), it.data.size());
+        EXPECT_EQ(fs::status(path).permissions(),
+                  fs::perms::owner_read | fs::perms::owner_write);
+    }
+    std::ifstream in(tmpDir / "file3");
+    EXPECT_EQ(in.get(), 3);
+}
+
+TEST(IoEngine, Create)
+{
+    EXPECT_THROW(IoEngine::create("none"), std::invalid_argument);
+    EXPECT_STREQ(IoEngine::create("sync")->name(), "sync");
+    EXPECT_STREQ(IoEngine::create("threads")->name(), "threads");
+    const std::string name = IoEngine::create()->name();
+    EXPECT_TRUE(name == "uring" || name == "threads");
+}
+
+INSTANTIATE_TEST_SUITE_P(Engines, IoEngineTest,
+                         ::testing::Values("sync", "threads", "uring",
+                                           "auto"));
@@ -0,0 +1,107 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "member_set.hpp"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using Names = std::vector<std::string>;
+
+/**
+ * @brief Create large set of names.
+ *
+ * @param[in] first index of the first name
+ * @param[in] count number of names
+ * @param[in] step step between indexes
+ *
+ * @return set of names
+ */
+static MemberSet makeSet(size_t first, size_t count, size_t step)
+{
+    Names names;
+    for (size_t i = 0; i < count; ++i)
+    {
+        names.push_back("user" + std::to_string(first + i * step));
+    }
+    return MemberSet(names);
+}
+
+TEST(MemberSetTest, Create)
+{
+    const MemberSet set(Names{"c", "a", "b", "a", "c"});
+    EXPECT_EQ(set.size(), 3);
+    EXPECT_EQ(set.toString(), "a,b,c");
+    EXPECT_TRUE(set.contains("b"));
+    EXPECT_FALSE(set.contains("d"));
+    EXPECT_TRUE(MemberSet().empty());
+    EXPECT_EQ(MemberSet().toString(), "");
+}
+
+TEST(MemberSetTest, Operations)
+{
+    const MemberSet a(Names{"a", "b", "c"});
+    const MemberSet b(Names{"b", "c", "d"});
+    EXPECT_EQ(MemberSet::unite(a, b).toString(), "a,b,c,d");
+    EXPECT_EQ(MemberSet::intersect(a, b).toString(), "b,c");
+    EXPECT_EQ(MemberSet::subtract(a, b).toString(), "a");
+    EXPECT_EQ(MemberSet::subtract(b, a).toString(), "d");
+    EXPECT_EQ(MemberSet::unite(a, MemberSet()), a);
+    EXPECT_TRUE(MemberSet::intersect(a, MemberSet()).empty());
+}
+
+TEST(MemberSetTest, Merge)
+{
+    const MemberSet ro(Names{"root", "admin"});
+    const MemberSet backup(Names{"root", "oper"});
+    const MemberSet current(Names{"root", "admin", "dude"});
+
+    using Policy = MemberSet::Policy;
+    EXPECT_EQ(MemberSet::merge(Policy::replace, ro, backup, current),
+              backup);
+    EXPECT_EQ(MemberSet::merge(Policy::unite, ro, backup, current)
+                  .toString(),
+              "admin,oper,root");
+    // admin is removed and oper is added in the backup, dude is kept
+    EXPECT_EQ(MemberSet::merge(Policy::apply, ro, backup, current)
+                  .toString(),
+              "dude,oper,root");
+
+    EXPECT_EQ(MemberSet::policy("replace"), Policy::replace);
+    EXPECT_EQ(MemberSet::policy("union"), Policy::unite);
+    EXPECT_EQ(MemberSet::policy("apply"), Policy::apply);
+    EXPECT_THROW(MemberSet::policy("merge"), std::invalid_argument);
+}
+
+TEST(MemberSetTest, LargeGroups)
+{
+    constexpr size_t count = 200000;
+    const MemberSet even = makeSet(0, count, 2);
+    const MemberSet odd = makeSet(1, count, 2);
+    const MemberSet low = makeSet(0, count, 1);
+
+    const auto start = std::chrono::steady_clock::now();
+
+    const MemberSet all = MemberSet::unite(even, odd);
+    EXPECT_EQ(all.size(), 2 * count);
+    EXPECT_EQ(MemberSet::intersect(all, low), low);
+    EXPECT_EQ(MemberSet::subtract(all, odd), even);
+    EXPECT_TRUE(MemberSet::intersect(even, odd).empty());
+
+    // backup removes odd RO members and adds even ones above RO range,
+    // current members are odd ones
+    const MemberSet merged =
+        MemberSet::merge(MemberSet::Policy::apply, low, even, odd);
+    EXPECT_FALSE(merged.contains("user0"));
+    EXPECT_FALSE(merged.contains("user1"));
+    EXPECT_TRUE(merged.contains("user" + std::to_string(count)));
+    EXPECT_TRUE(merged.contains("user" + std::to_string(2 * count - 1)));
+    EXPECT_EQ(merged, makeSet(count, count, 1));
+
+    // linear merges take milliseconds, quadratic ones would take minutes
+    EXPECT_LT(std::chrono::steady_clock::now() - start,
+              std::chrono::seconds(10));
+}
@@ -0,0 +1,162 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "io_engine.hpp"
+#include "metadata.hpp"
+#include "root_dir.hpp"
+#include "throttle.hpp"
+
+#include <fcntl.h>
+#include <sys/xattr.h>
+
+#include <chrono>
+#include <fstream>
+
+#include <gtest/gtest.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * @class MetadataTest
+ * @brief Tests for file metadata handling.
+ */
+class MetadataTest : public ::testing::Test
+{
+  protected:
+    void SetUp() override
+    {
+        fs::remove_all(tmpDir);
+        fs::create_directories(srcDir / "dir");
+        std::ofstream(srcDir / "dir/file") << "file content\n";
+        fs::create_hard_link(srcDir / "dir/file", srcDir / "dir/hardlink");
+        fs::create_symlink("file", srcDir / "dir/symlink");
+        fs::permissions(srcDir / "dir/file", fs::perms::owner_read,
+                        fs::perm_options::replace);
+        xattrs = setxattr((srcDir / "dir/file").c_str(), "user.test", "value",
+                          5, 0) == 0;
+
+        const timespec ts[2] = {{0, UTIME_OMIT}, {1600000000, 123456789}};
+        utimensat(AT_FDCWD, (srcDir / "dir/file").c_str(), ts, 0);
+        utimensat(AT_FDCWD, (srcDir / "dir").c_str(), ts, 0);
+    }
+
+    void TearDown() override
+    {
+        fs::remove_all(tmpDir);
+    }
+
+    const fs::path tmpDir = fs::temp_directory_path() / "metadata_test";
+    const fs::path srcDir = tmpDir / "src";
+    const fs::path dstDir = tmpDir / "dst";
+    bool xattrs = false; // file system supports user attributes
+};
+
+TEST_F(MetadataTest, Load)
+{
+    const Metadata meta = Metadata::load(srcDir / "dir/file");
+    EXPECT_TRUE(S_ISREG(meta.mode));
+    EXPECT_EQ(meta.mode & 07777, 0400);
+    EXPECT_EQ(meta.size, 13);
+    EXPECT_EQ(meta.nlink, 2);
+    EXPECT_EQ(meta.mtime.tv_sec, 1600000000);
+    EXPECT_EQ(meta.mtime.tv_nsec, 123456789);
+    EXPECT_EQ(meta.inode, Metadata::load(srcDir / "dir/hardlink").inode);
+    if (xattrs)
+    {
+        ASSERT_EQ(meta.xattrs.size(), 1);
+        EXPECT_EQ(meta.xattrs[0].first, "user.test");
+        EXPECT_EQ(meta.xattrs[0].second, "value");
+    }
+
+    EXPECT_TRUE(S_ISLNK(Metadata::load(srcDir / "dir/symlink").mode));
+    EXPECT_THROW(Metadata::load(srcDir / "none"), std::system_error);
+}
+
+TEST_F(MetadataTest, Copy)
+{
+    // existing file is overwritten, other files are kept
+    fs::create_directories(dstDir / "dir");
+    std::ofstream(dstDir / "dir/file") << "old";
+    std::ofstream(dstDir / "dir/other") << "other";
+
+    Metadata::copy(srcDir, dstDir);
+
+    const Metadata file = Metadata::load(dstDir / "dir/file");
+    EXPECT_EQ(file.mode & 07777, 0400);
+    EXPECT_EQ(file.size, 13);
+    EXPECT_EQ(file.mtime.tv_sec, 1600000000);
+    EXPECT_EQ(file.mtime.tv_nsec, 123456789);
+    EXPECT_EQ(file.xattrs.size(), xattrs ? 1 : 0);
+    EXPECT_EQ(file.inode, Metadata::load(dstDir / "dir/hardlink").inode);
+    EXPECT_EQ(Metadata::load(dstDir / "dir").mtime.tv_nsec, 123456789);
+    EXPECT_EQ(fs::read_symlink(dstDir / "dir/symlink"), "file");
+    EXPECT_TRUE(fs::exists(dstDir / "dir/other"));
+}
+
+TEST_F(MetadataTest, CopyBatched)
+{
+    std::ofstream(srcDir / "dir/small") << "small";
+    fs::permissions(srcDir / "dir/small", fs::perms::owner_all,
+                    fs::perm_options::replace);
+    const timespec ts[2] = {{0, UTIME_OMIT}, {1600000000, 123456789}};
+    utimensat(AT_FDCWD, (srcDir / "dir").c_str(), ts, 0);
+    // destination of different type is replaced
+    fs::create_directories(dstDir / "src/dir/small/sub");
+
+    const auto io = IoEngine::create();
+    const RootDir srcRoot(tmpDir);
+    const RootDir dstRoot(dstDir);
+    Metadata::copy(srcRoot, "src", dstRoot, "src", io.get());
+
+    const fs::path dir = dstDir / "src/dir";
+    std::ifstream in(dir / "small");
+    std::string content;
+    in >> content;
+    EXPECT_EQ(content, "small");
+    EXPECT_EQ(fs::status(dir / "small").permissions(), fs::perms::owner_all);
+    const Metadata file = Metadata::load(dir / "file");
+    EXPECT_EQ(file.mode & 07777, 0400);
+    EXPECT_EQ(file.mtime.tv_nsec, 123456789);
+    EXPECT_EQ(file.inode, Metadata::load(dir / "hardlink").inode);
+    EXPECT_EQ(Metadata::load(dir).mtime.tv_nsec, 123456789);
+    EXPECT_EQ(fs::read_symlink(dir / "symlink"), "file");
+}
+
+TEST_F(MetadataTest, CopyThrottle)
+{
+    std::ofstream(srcDir / "dir/big") << std::string(5000, 'x');
+    std::ofstream(srcDir / "big") << std::string(5000, 'x');
+    fs::create_directories(dstDir);
+
+    const auto io = IoEngine::create();
+    const RootDir srcRoot(tmpDir);
+    const RootDir dstRoot(dstDir);
+    for (IoEngine* engine : {static_cast<IoEngine*>(nullptr), io.get()})
+    {
+        Throttle throttle(40000, 1);
+        const auto start = std::chrono::steady_clock::now();
+        Metadata::copy(srcRoot, "src", dstRoot, "src", engine, &throttle);
+        // read and write of 10013 bytes at 40000 bytes/sec
+        EXPECT_GE(std::chrono::steady_clock::now() - start,
+                  std::chrono::milliseconds(450));
+        EXPECT_EQ(fs::file_size(dstDir / "src/dir/big"), 5000);
+    }
+}
+
+TEST_F(MetadataTest, CopySync)
+{
+    const auto io = IoEngine::create();
+    const RootDir srcRoot(tmpDir);
+    const RootDir dstRoot(dstDir.parent_path());
+    for (IoEngine* engine : {static_cast<IoEngine*>(nullptr), io.get()})
+    {
+        fs::remove_all(dstDir);
+        Metadata::copy(srcRoot, "src", dstRoot, "dst/copy", engine, nullptr,
+                       true);
+        const fs::path dir = dstDir / "copy/dir";
+        EXPECT_EQ(fs::file_size(dir / "file"), 13);
+        EXPECT_EQ(Metadata::load(dir / "file").inode,
+                  Metadata::load(dir / "hardlink").inode);
+        EXPECT_EQ(fs::read_symlink(dir / "symlink"), "file");
+    }
+}
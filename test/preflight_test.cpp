@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "archive.hpp"
+#include "preflight.hpp"
+
+#include <fstream>
+
+#include <gtest/gtest.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * @class PreflightTest
+ * @brief Tests for resources estimation.
+ */
+class PreflightTest : public ::testing::Test
+{
+  protected:
+    void SetUp() override
+    {
+        fs::remove_all(tmpDir);
+        fs::create_directories(tmpDir / "data/dir");
+        std::ofstream(tmpDir / "data/file") << std::string(10000, 'x');
+        std::ofstream(tmpDir / "data/dir/file") << std::string(20000, 'x');
+    }
+
+    void TearDown() override
+    {
+        fs::remove_all(tmpDir);
+    }
+
+    const fs::path tmpDir = fs::temp_directory_path() / "preflight_test";
+};
+
+TEST_F(PreflightTest, Estimate)
+{
+    Preflight pf(0, 0);
+    EXPECT_EQ(pf.tempSize(), 0);
+    const uint64_t empty = pf.archiveSize();
+
+    pf.addData(tmpDir / "data", "data");
+    EXPECT_EQ(pf.tempSize(), 0);
+    EXPECT_EQ(pf.dataSize(), 30000);
+    EXPECT_GE(pf.archiveSize(), empty + 30000);
+
+    pf.addTemp(tmpDir / "data/file", "file");
+    pf.addTemp(tmpDir / "not/exist", "exist");
+    EXPECT_EQ(pf.tempSize(), 10000);
+    EXPECT_EQ(pf.dataSize(), 40000);
+
+    EXPECT_THROW(pf.addData(tmpDir / "not/exist", "exist"), std::system_error);
+}
+
+TEST_F(PreflightTest, ArchiveBound)
+{
+    // many small incompressible files: PAX headers, table of contents and
+    // checksums take a noticeable part of the archive
+    const fs::path dir = tmpDir / "data/long";
+    fs::create_directories(dir);
+    uint32_t seed = 1;
+    for (size_t i = 0; i < 300; ++i)
+    {
+        std::string data;
+        while (data.size() < 1000 + i)
+        {
+            seed = seed * 1103515245 + 12345;
+            data += static_cast<char>(seed >> 24);
+        }
+        std::ofstream(dir / (std::to_string(i) + std::string(50, 'n')))
+            << data;
+    }
+
+    Preflight pf(0, 0);
+    pf.addData(tmpDir / "data", "data");
+    const fs::path file = tmpDir / "archive.tar.gz";
+    {
+        ArchiveWriter archive(file);
+        archive.addTree(tmpDir / "data", "data");
+        archive.finish();
+    }
+    EXPECT_LE(fs::file_size(file), pf.archiveSize());
+
+    // archive of the estimated size fits in memory
+    ArchiveWriter archive(pf.archiveSize());
+    EXPECT_NO_THROW(archive.addTree(tmpDir / "data", "data"));
+    EXPECT_NO_THROW(archive.finish());
+}
+
+TEST_F(PreflightTest, BackupMode)
+{
+    const uint64_t big = 1024 * 1024;
+
+    Preflight mem(big, 0);
+    mem.addData(tmpDir / "data", "data");
+    EXPECT_EQ(mem.backup(tmpDir, tmpDir), Preflight::Mode::memory);
+
+    Preflight staged(0, 0);
+    staged.addData(tmpDir / "data", "data");
+    EXPECT_EQ(staged.backup(tmpDir, tmpDir), Preflight::Mode::staged);
+
+    Preflight stream(0, 20000);
+    stream.addData(tmpDir / "data", "data");
+    stream.addTemp(tmpDir / "data/file", "file");
+    EXPECT_EQ(stream.backup(tmpDir, tmpDir), Preflight::Mode::streaming);
+
+    Preflight fail(big, 1000);
+    fail.addTemp(tmpDir / "data/file", "file");
+    EXPECT_THROW(fail.backup(tmpDir, tmpDir), std::runtime_error);
+}
+
+TEST_F(PreflightTest, FreeSpace)
+{
+    EXPECT_GT(Preflight::freeSpace(tmpDir), 0);
+    EXPECT_THROW(Preflight::freeSpace(tmpDir / "not/exist"),
+                 std::system_error);
+}
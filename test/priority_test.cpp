@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "io_engine.hpp"
+#include "priority.hpp"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <set>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+namespace fs = std::filesystem;
+
+/** @brief ioprio_get(2) target: single thread. */
+static constexpr int ioprioWhoProcess = 1;
+/** @brief Encoded best-effort class (2) with level 6. */
+static constexpr long ioprioBe6 = 2 << 13 | 6;
+
+TEST(PriorityTest, InvalidIo)
+{
+    ASSERT_THROW(setIoPriority(""), std::invalid_argument);
+    ASSERT_THROW(setIoPriority("low"), std::invalid_argument);
+    ASSERT_THROW(setIoPriority("be:8"), std::invalid_argument);
+    ASSERT_THROW(setIoPriority("be:x"), std::invalid_argument);
+    ASSERT_THROW(setIoPriority("idle:1"), std::invalid_argument);
+}
+
+TEST(PriorityTest, InvalidCpu)
+{
+    ASSERT_THROW(setCpuPriority(-21), std::invalid_argument);
+    ASSERT_THROW(setCpuPriority(20), std::invalid_argument);
+}
+
+TEST(PriorityTest, Io)
+{
+    EXPECT_NO_THROW(setIoPriority("be:4"));
+}
+
+TEST(PriorityTest, IoEngineThreads)
+{
+    // I/O priority is a property of the thread, pool threads get the
+    // priority of the thread that creates the engine
+    const auto tasks = []() {
+        std::set<std::string> names;
+        for (const auto& it : fs::directory_iterator("/proc/self/task"))
+        {
+            names.insert(it.path().filename());
+        }
+        return names;
+    };
+    std::thread([&]() {
+        setIoPriority("be:6");
+        const auto before = tasks();
+        const auto io = IoEngine::create("threads");
+        const auto after = tasks();
+        size_t pool = 0;
+        for (const auto& it : after)
+        {
+            if (!before.count(it))
+            {
+                const long prio = syscall(SYS_ioprio_get, ioprioWhoProcess,
+                                          std::stoi(it));
+                EXPECT_EQ(prio, ioprioBe6) << "thread " << it;
+                ++pool;
+            }
+        }
+        EXPECT_NE(pool, 0);
+    }).join();
+}
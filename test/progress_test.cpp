@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "progress.hpp"
+
+#include <cstdlib>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+/**
+ * @class Sink
+ * @brief Progress sink that keeps all reports.
+ */
+class Sink : public ProgressSink
+{
+  public:
+    void update(const Status& status) override
+    {
+        reports.push_back(status);
+    }
+
+    std::vector<Status> reports;
+};
+
+TEST(ProgressTest, Report)
+{
+    Sink sink;
+    Progress progress(&sink, nullptr);
+
+    progress.begin("archive", 100, 2);
+    ASSERT_EQ(sink.reports.size(), 1);
+    EXPECT_EQ(sink.reports[0].phase, "archive");
+    EXPECT_EQ(sink.reports[0].eta, -1);
+
+    // byte counters are reported with limited rate
+    progress.addBytes(30);
+    progress.addBytes(20);
+    EXPECT_EQ(sink.reports.size(), 1);
+    progress.addEntry("etc/hostname");
+    ASSERT_EQ(sink.reports.size(), 2);
+    EXPECT_EQ(sink.reports[1].bytes, 50);
+    EXPECT_EQ(sink.reports[1].totalBytes, 100);
+    EXPECT_EQ(sink.reports[1].entries, 1);
+    EXPECT_EQ(sink.reports[1].totalEntries, 2);
+    EXPECT_EQ(sink.reports[1].item, "etc/hostname");
+    EXPECT_GE(sink.reports[1].eta, 0);
+    EXPECT_FALSE(sink.reports[1].finished);
+
+    progress.finish();
+    EXPECT_TRUE(sink.reports.back().finished);
+    EXPECT_EQ(sink.reports.back().eta, 0);
+
+    // new phase resets counters
+    progress.begin("restore", 0, 0);
+    progress.addEntry("accounts");
+    EXPECT_EQ(sink.reports.back().bytes, 0);
+    EXPECT_EQ(sink.reports.back().entries, 1);
+    EXPECT_EQ(sink.reports.back().eta, -1);
+}
+
+TEST(ProgressTest, Cancel)
+{
+    CancelToken token;
+    Progress progress(nullptr, &token);
+    progress.begin("archive", 0, 0);
+    progress.addBytes(1);
+    EXPECT_FALSE(token.cancelled());
+
+    token.cancel();
+    EXPECT_TRUE(token.cancelled());
+    EXPECT_THROW(progress.addBytes(1), Cancelled);
+    EXPECT_THROW(progress.addEntry("etc"), Cancelled);
+    EXPECT_THROW(progress.begin("restore", 0, 0), Cancelled);
+    EXPECT_NO_THROW(progress.finish());
+}
+
+TEST(ProgressTest, Bar)
+{
+    char* data = nullptr;
+    size_t size = 0;
+    FILE* out = open_memstream(&data, &size);
+    ASSERT_TRUE(out);
+
+    ProgressBar bar(out);
+    ProgressSink::Status status;
+    status.phase = "archive";
+    status.bytes = 512;
+    status.totalBytes = 1024;
+    status.eta = 65;
+    status.item = "etc/hostname";
+    bar.update(status);
+    status.finished = true;
+    bar.update(status);
+    fclose(out);
+
+    const std::string text(data, size);
+    free(data);
+    EXPECT_EQ(text,
+              "\rarchive  [############            ]  50% 512B/1.0K ETA 1:05 "
+              "etc/hostname\033[K"
+              "\rarchive  [########################] 100% 512B/1.0K\033[K\n");
+}
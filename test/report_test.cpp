@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "report.hpp"
+
+#include <cstdlib>
+
+#include <gtest/gtest.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * @brief Create report of fixed changes.
+ *
+ * @param[in] format output format
+ *
+ * @return report text
+ */
+static std::string createReport(Report::Format format)
+{
+    char* buf = nullptr;
+    size_t size = 0;
+    FILE* out = open_memstream(&buf, &size);
+
+    Report report(format, out);
+    report.begin("backup \"1\".tar.gz");
+    report.file("etc/hostname", Report::Change::modify);
+    report.perms("etc/machine-id",
+                 fs::perms::owner_read | fs::perms::owner_write,
+                 fs::perms::owner_read);
+    report.metadata("etc/hosts", "owner,mtime");
+    report.account("user", "dude", Report::Change::add);
+    report.finish();
+
+    fclose(out);
+    const std::string text(buf, size);
+    free(buf);
+    return text;
+}
+
+TEST(ReportTest, Json)
+{
+    EXPECT_EQ(createReport(Report::Format::json),
+              "{\"archive\":\"backup \\\"1\\\".tar.gz\",\"changes\":[\n"
+              "{\"type\":\"file\",\"path\":\"etc/hostname\","
+              "\"change\":\"modify\"},\n"
+              "{\"type\":\"perms\",\"path\":\"etc/machine-id\","
+              "\"from\":\"0600\",\"to\":\"0400\"},\n"
+              "{\"type\":\"metadata\",\"path\":\"etc/hosts\","
+              "\"attrs\":\"owner,mtime\"},\n"
+              "{\"type\":\"user\",\"name\":\"dude\",\"change\":\"add\"}\n"
+              "],\"summary\":{\"files\":1,\"perms\":1,\"metadata\":1,"
+              "\"accounts\":1}}\n");
+}
+
+TEST(ReportTest, Text)
+{
+    EXPECT_EQ(createReport(Report::Format::text),
+              "Changes to apply from backup file backup \"1\".tar.gz:\n"
+              "  modify  file      etc/hostname\n"
+              "  chmod   file      etc/machine-id 0600 -> 0400\n"
+              "  modify  metadata  etc/hosts (owner,mtime)\n"
+              "  add     user      dude\n"
+              "Files: 1, permissions: 1, metadata: 1, accounts: 1\n");
+}
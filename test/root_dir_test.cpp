@@ -0,0 +1,153 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "root_dir.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+
+#include <gtest/gtest.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * @class RootDirTest
+ * @brief Tests for path resolution inside the root directory.
+ */
+class RootDirTest : public ::testing::Test
+{
+  protected:
+    void SetUp() override
+    {
+        fs::remove_all(tmpDir);
+        fs::create_directories(rootDir / "etc");
+        std::ofstream(rootDir / "etc/file") << "inside\n";
+        std::ofstream(tmpDir / "file") << "outside\n";
+        fs::create_symlink("../../file", rootDir / "etc/escape");
+        fs::create_symlink("/etc/file", rootDir / "absolute");
+        fs::create_symlink("file", rootDir / "etc/relative");
+    }
+
+    void TearDown() override
+    {
+        fs::remove_all(tmpDir);
+    }
+
+    /**
+     * @brief Read first line of the opened file.
+     *
+     * @param[in] fd file descriptor
+     *
+     * @return first line of the file
+     */
+    static std::string readLine(int fd)
+    {
+        char buf[64] = {};
+        const ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+        std::string line(buf, len > 0 ? len : 0);
+        return line.substr(0, line.find('\n'));
+    }
+
+    const fs::path tmpDir = fs::temp_directory_path() / "root_dir_test";
+    const fs::path rootDir = tmpDir / "root";
+};
+
+TEST_F(RootDirTest, Beneath)
+{
+    const RootDir root(rootDir);
+
+    const FileHandle file(root.open("etc/relative", O_RDONLY));
+    ASSERT_NE(file.get(), -1);
+    EXPECT_EQ(readLine(file.get()), "inside");
+
+    EXPECT_EQ(root.open("etc/escape", O_RDONLY), -1);
+    EXPECT_EQ(root.open("absolute", O_RDONLY), -1);
+    EXPECT_EQ(root.open("../file", O_RDONLY), -1);
+    EXPECT_EQ(root.open(tmpDir / "file", O_RDONLY), -1);
+
+    EXPECT_TRUE(root.exists("absolute"));
+    EXPECT_TRUE(root.exists("etc/file"));
+    EXPECT_FALSE(root.exists("etc/missing"));
+}
+
+TEST_F(RootDirTest, Chroot)
+{
+    const RootDir root(rootDir, true);
+
+    const FileHandle absolute(root.open("absolute", O_RDONLY));
+    ASSERT_NE(absolute.get(), -1);
+    EXPECT_EQ(readLine(absolute.get()), "inside");
+
+    // ".." can't go above the root, as in chroot
+    const FileHandle escape(root.open("etc/escape", O_RDONLY));
+    if (escape.get() != -1)
+    {
+        EXPECT_NE(readLine(escape.get()), "outside");
+    }
+}
+
+TEST_F(RootDirTest, MakeDirs)
+{
+    const RootDir root(rootDir);
+
+    const FileHandle dir(root.makeDirs("etc/a/b"));
+    ASSERT_NE(dir.get(), -1);
+    EXPECT_TRUE(fs::is_directory(rootDir / "etc/a/b"));
+
+    fs::create_directory_symlink(tmpDir, rootDir / "link");
+    EXPECT_THROW(root.makeDirs("link/dir"), std::system_error);
+    EXPECT_FALSE(fs::exists(tmpDir / "dir"));
+}
+
+TEST_F(RootDirTest, List)
+{
+    const FileHandle dir(open(rootDir.c_str(), O_RDONLY | O_DIRECTORY));
+    ASSERT_NE(dir.get(), -1);
+    const std::vector<std::string> expect = {"absolute", "etc"};
+    EXPECT_EQ(RootDir::list(dir.get(), rootDir), expect);
+}
+
+TEST_F(RootDirTest, Link)
+{
+    const RootDir root(rootDir);
+
+    const FileHandle file(RootDir::openEntry(root.fd(), "absolute"));
+    ASSERT_NE(file.get(), -1);
+    struct stat st;
+    ASSERT_EQ(fstat(file.get(), &st), 0);
+    EXPECT_TRUE(S_ISLNK(st.st_mode));
+
+    const FileHandle target(root.open("etc/file", O_PATH));
+    ASSERT_NE(target.get(), -1);
+    ASSERT_EQ(RootDir::link(target.get(), root.fd(), "hardlink"), 0);
+    EXPECT_TRUE(fs::equivalent(rootDir / "hardlink", rootDir / "etc/file"));
+}
+
+TEST_F(RootDirTest, ReplaceFile)
+{
+    const RootDir root(rootDir);
+
+    const std::string data = "replaced\n";
+    root.replaceFile("new/file", data.data(), data.size(), 0640);
+    std::ifstream file(rootDir / "new/file");
+    std::string line;
+    std::getline(file, line);
+    EXPECT_EQ(line, "replaced");
+    EXPECT_EQ(fs::status(rootDir / "new/file").permissions(),
+              fs::perms::owner_read | fs::perms::owner_write |
+                  fs::perms::group_read);
+    EXPECT_EQ(std::distance(fs::directory_iterator(rootDir / "new"),
+                            fs::directory_iterator()),
+              1);
+
+    // symlink is replaced, not followed
+    root.replaceFile("etc/escape", data.data(), data.size(), 0600);
+    EXPECT_TRUE(
+        fs::is_regular_file(fs::symlink_status(rootDir / "etc/escape")));
+    std::ifstream outside(tmpDir / "file");
+    std::getline(outside, line);
+    EXPECT_EQ(line, "outside");
+}
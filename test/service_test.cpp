@@ -0,0 +1,317 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "accounts_cache.hpp"
+#include "service.hpp"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * @class ServiceTest
+ * @brief Tests for backup service.
+ */
+class ServiceTest : public ::testing::Test
+{
+  protected:
+    void SetUp() override
+    {
+        fs::remove_all(tmpDir);
+        fs::create_directories(tmpDir);
+        proto.readOnlyFs = roRoot;
+        service = std::make_unique<Service>(proto, socketPath);
+        thread = std::thread([this]() { service->run(); });
+    }
+
+    void TearDown() override
+    {
+        service->stop();
+        thread.join();
+        service.reset();
+        fs::remove_all(tmpDir);
+    }
+
+    /**
+     * @brief Connect to the service.
+     *
+     * @return connected socket
+     */
+    int connectService() const
+    {
+        const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, socketPath.c_str());
+        if (connect(fd, reinterpret_cast<const sockaddr*>(&addr),
+                    sizeof(addr)) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+        const timeval tv = {10, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        return fd;
+    }
+
+    /**
+     * @brief Send requests and receive events until the specified number
+     *        of jobs is finished.
+     *
+     * @param[in] fd connected socket
+     * @param[in] requests request lines
+     * @param[in] jobs number of jobs to wait for
+     *
+     * @return received events
+     */
+    static std::vector<std::string> call(int fd, const std::string& requests,
+                                         size_t jobs)
+    {
+        EXPECT_EQ(send(fd, requests.data(), requests.size(), 0),
+                  static_cast<ssize_t>(requests.size()));
+        std::vector<std::string> events;
+        std::string input;
+        char buf[256];
+        while (jobs)
+        {
+            const ssize_t rc = recv(fd, buf, sizeof(buf), 0);
+            if (rc < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (rc <= 0)
+            {
+                break;
+            }
+            input.append(buf, rc);
+            size_t pos;
+            while ((pos = input.find('\n')) != std::string::npos)
+            {
+                events.push_back(input.substr(0, pos));
+                input.erase(0, pos + 1);
+                if (events.back().compare(0, 5, "done ") == 0 ||
+                    events.back().compare(0, 6, "error ") == 0)
+                {
+                    --jobs;
+                }
+            }
+        }
+        return events;
+    }
+
+    /**
+     * @brief Find event in the list.
+     *
+     * @param[in] events list of events
+     * @param[in] prefix beginning of the event
+     *
+     * @return index of the event, -1 if not found
+     */
+    static int find(const std::vector<std::string>& events,
+                    const std::string& prefix)
+    {
+        for (size_t i = 0; i < events.size(); ++i)
+        {
+            if (events[i].compare(0, prefix.size(), prefix) == 0)
+            {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+
+    const fs::path tmpDir = fs::temp_directory_path() / "service_test";
+    const fs::path socketPath = tmpDir / "backup.sock";
+    const fs::path rwRoot = fs::path(TEST_DATA_DIR) / "full/rw";
+    const fs::path roRoot = fs::path(TEST_DATA_DIR) / "full/ro";
+    Backup proto;
+    std::unique_ptr<Service> service;
+    std::thread thread;
+};
+
+TEST_F(ServiceTest, BackupRestore)
+{
+    const int fd = connectService();
+    ASSERT_NE(fd, -1);
+
+    const fs::path arc = tmpDir / "backup.tar.gz";
+    auto events = call(fd, "backup " + arc.string() + ' ' +
+                               rwRoot.string() + '\n', 1);
+    ASSERT_FALSE(events.empty());
+    EXPECT_EQ(events.front(), "queued 1 0");
+    EXPECT_EQ(events[1], "started 1");
+    EXPECT_NE(find(events, "progress 1 prepare "), -1);
+    EXPECT_NE(find(events, "progress 1 archive "), -1);
+    EXPECT_NE(find(events, "progress 1 archive 0 "), -1);
+    EXPECT_NE(std::find_if(events.begin(), events.end(),
+                           [](const std::string& ev) {
+                               return ev.size() > 13 &&
+                                      ev.compare(ev.size() - 13, 13,
+                                                 " etc/hostname") == 0;
+                           }),
+              events.end());
+    EXPECT_EQ(events.back().compare(0, 7, "done 1 "), 0) << events.back();
+    EXPECT_TRUE(fs::exists(arc));
+
+    const fs::path root = tmpDir / "root";
+    fs::copy(rwRoot, root, fs::copy_options::recursive);
+    events = call(fd, "restore \"" + arc.string() + "\" " + root.string() +
+                          ' ' + roRoot.string() + '\n', 1);
+    EXPECT_NE(find(events, "progress 2 extract "), -1);
+    EXPECT_NE(find(events, "progress 2 restore 0 0 1 "), -1); // accounts
+    EXPECT_EQ(events.back().compare(0, 7, "done 2 "), 0) << events.back();
+
+    // os-release and RO accounts files are parsed once
+    const size_t misses = service->cache().misses();
+    events = call(fd, "backup " + (tmpDir / "2.tar.gz").string() + ' ' +
+                          rwRoot.string() + '\n', 1);
+    EXPECT_EQ(events.back().compare(0, 7, "done 3 "), 0) << events.back();
+    EXPECT_EQ(service->cache().misses(), misses);
+    EXPECT_GT(service->cache().hits(), 0);
+
+    close(fd);
+}
+
+TEST_F(ServiceTest, Serialize)
+{
+    const int fd1 = connectService();
+    const int fd2 = connectService();
+    ASSERT_NE(fd1, -1);
+    ASSERT_NE(fd2, -1);
+
+    std::string requests;
+    for (const char* name : {"1.tar.gz", "2.tar.gz"})
+    {
+        requests += "backup " + (tmpDir / name).string() + ' ' +
+                    rwRoot.string() + '\n';
+    }
+    const auto events = call(fd1, requests, 2);
+    EXPECT_NE(find(events, "queued 2 1"), -1);
+    // the second job starts after the first one
+    EXPECT_GT(find(events, "started 2"), find(events, "done 1"));
+    EXPECT_NE(find(events, "done 2"), -1);
+
+    // the same archive: error is reported to the second client
+    const auto failed = call(fd2,
+                             "backup " + (tmpDir / "1.tar.gz").string() + ' ' +
+                                 rwRoot.string() + '\n',
+                             1);
+    EXPECT_EQ(failed.back().compare(0, 8, "error 3 "), 0) << failed.back();
+
+    close(fd1);
+    close(fd2);
+}
+
+TEST_F(ServiceTest, Errors)
+{
+    const int fd = connectService();
+    ASSERT_NE(fd, -1);
+
+    auto events = call(fd, "\ncopy a b\n", 1);
+    ASSERT_EQ(events.size(), 1);
+    EXPECT_EQ(events[0].compare(0, 8, "error 0 "), 0);
+    events = call(fd, "backup a b c d\n", 1);
+    EXPECT_EQ(events[0].compare(0, 8, "error 0 "), 0);
+    events = call(fd, "restore " + (tmpDir / "none").string() + '\n', 1);
+    EXPECT_EQ(events.back().compare(0, 24, "error 1 File not found: "), 0)
+        << events.back();
+
+    // another instance on the same socket
+    EXPECT_THROW(Service(proto, socketPath), std::runtime_error);
+
+    close(fd);
+}
+
+TEST_F(ServiceTest, Cancel)
+{
+    const int fd = connectService();
+    ASSERT_NE(fd, -1);
+
+    std::string requests;
+    for (const char* name : {"1.tar.gz", "2.tar.gz"})
+    {
+        requests += "backup " + (tmpDir / name).string() + ' ' +
+                    rwRoot.string() + '\n';
+    }
+    requests += "cancel 2\n";
+    const auto events = call(fd, requests, 2);
+    EXPECT_NE(find(events, "done 1 "), -1);
+    EXPECT_NE(find(events, "error 2 Operation cancelled"), -1);
+    EXPECT_EQ(find(events, "started 2"), -1);
+    EXPECT_FALSE(fs::exists(tmpDir / "2.tar.gz"));
+
+    EXPECT_EQ(call(fd, "cancel 42\n", 1).back(), "error 0 Job not found: 42");
+
+    close(fd);
+}
+
+TEST_F(ServiceTest, ClientGone)
+{
+    // the job is executed without the client, which is dropped after the
+    // first failed event
+    const int fd1 = connectService();
+    ASSERT_NE(fd1, -1);
+    const std::string request = "backup " + (tmpDir / "1.tar.gz").string() +
+                                ' ' + rwRoot.string() + '\n';
+    ASSERT_EQ(send(fd1, request.data(), request.size(), 0),
+              static_cast<ssize_t>(request.size()));
+    close(fd1);
+
+    const int fd2 = connectService();
+    ASSERT_NE(fd2, -1);
+    const auto events = call(fd2,
+                             "backup " + (tmpDir / "2.tar.gz").string() + ' ' +
+                                 rwRoot.string() + '\n',
+                             1);
+    EXPECT_EQ(events.back().compare(0, 7, "done 2 "), 0) << events.back();
+    EXPECT_TRUE(fs::exists(tmpDir / "1.tar.gz"));
+    close(fd2);
+}
+
+TEST_F(ServiceTest, Permissions)
+{
+    EXPECT_EQ(fs::status(socketPath).permissions(),
+              fs::perms::owner_read | fs::perms::owner_write);
+    if (geteuid() != 0)
+    {
+        GTEST_SKIP();
+    }
+
+    // clients of other users are rejected even if the socket is accessible
+    fs::permissions(socketPath, fs::perms::all);
+    const pid_t pid = fork();
+    ASSERT_NE(pid, -1);
+    if (pid == 0)
+    {
+        bool denied = false;
+        if (setuid(65534) == 0)
+        {
+            const int fd = connectService();
+            const std::string request = "backup " +
+                                        (tmpDir / "1.tar.gz").string() +
+                                        ' ' + rwRoot.string() + '\n';
+            char buf[64] = {};
+            denied = fd != -1 &&
+                     send(fd, request.data(), request.size(),
+                          MSG_NOSIGNAL) >= 0 &&
+                     recv(fd, buf, sizeof(buf) - 1, 0) > 0 &&
+                     strcmp(buf, "error 0 Permission denied\n") == 0;
+        }
+        _exit(denied ? 0 : 1);
+    }
+    int status = 0;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    EXPECT_FALSE(fs::exists(tmpDir / "1.tar.gz"));
+}
@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "throttle.hpp"
+
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using Clock = std::chrono::steady_clock;
+
+TEST(ThrottleTest, Invalid)
+{
+    ASSERT_THROW(Throttle(0), std::invalid_argument);
+}
+
+TEST(ThrottleTest, Burst)
+{
+    Throttle throttle(1000);
+    const Clock::time_point start = Clock::now();
+    throttle.consume(1000);
+    EXPECT_LT(Clock::now() - start, std::chrono::milliseconds(100));
+}
+
+TEST(ThrottleTest, Rate)
+{
+    Throttle throttle(10000, 1);
+    const Clock::time_point start = Clock::now();
+    for (int i = 0; i < 10; ++i)
+    {
+        throttle.consume(500);
+    }
+    // 5000 bytes at 10000 bytes/sec
+    EXPECT_GE(Clock::now() - start, std::chrono::milliseconds(450));
+}
+
+TEST(ThrottleTest, Shared)
+{
+    Throttle throttle(10000, 1);
+    const Clock::time_point start = Clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i)
+    {
+        threads.emplace_back([&throttle]() { throttle.consume(1000); });
+    }
+    for (auto& it : threads)
+    {
+        it.join();
+    }
+    // 4000 bytes at 10000 bytes/sec
+    EXPECT_GE(Clock::now() - start, std::chrono::milliseconds(350));
+}
@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright (C) 2020 YADRO
+
+#include "tokenizer.hpp"
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+/**
+ * @brief Split text to lines and fields.
+ *
+ * @param[in] kernel implementation to use
+ * @param[in] text source text
+ *
+ * @return list of lines
+ */
+static std::vector<std::vector<std::string>> split(Tokenizer::Kernel kernel,
+                                                   const std::string& text)
+{
+    std::vector<std::vector<std::string>> lines;
+    const Tokenizer tokens(kernel, text, ':');
+    for (size_t i = 0; i < tokens.size(); ++i)
+    {
+        const Tokenizer::Line line = tokens[i];
+        std::vector<std::string> fields;
+        for (size_t j = 0; j < line.size(); ++j)
+        {
+            fields.emplace_back(line[j]);
+        }
+        lines.push_back(fields);
+    }
+    return lines;
+}
+
+TEST(TokenizerTest, Split)
+{
+    using Lines = std::vector<std::vector<std::string>>;
+    for (const auto& kernel : Tokenizer::kernels())
+    {
+        SCOPED_TRACE(Tokenizer::name(kernel));
+        EXPECT_TRUE(split(kernel, "").empty());
+        EXPECT_EQ(split(kernel, "a"), Lines({{"a"}}));
+        EXPECT_EQ(split(kernel, "a:b\n"), Lines({{"a", "b"}}));
+        EXPECT_EQ(split(kernel, "a:b\nc:d"), Lines({{"a", "b"}, {"c", "d"}}));
+        EXPECT_EQ(split(kernel, ":\n\nx::"),
+                  Lines({{"", ""}, {""}, {"x", "", ""}}));
+    }
+}
+
+TEST(TokenizerTest, Kernels)
+{
+    // lines of different length cross the vector block boundaries
+    std::string text;
+    for (size_t i = 0; i < 1000; ++i)
+    {
+        text += "user" + std::to_string(i) + ':' + std::string(i % 70, 'x') +
+                ":" + std::to_string(i * 7) + (i % 3 ? "\n" : ":\n");
+    }
+    text += "tail:";
+
+    const auto expect = split(Tokenizer::Kernel::portable, text);
+    ASSERT_EQ(expect.size(), 1001);
+    EXPECT_EQ(expect[2], std::vector<std::string>({"user2", "xx", "14"}));
+    for (const auto& kernel : Tokenizer::kernels())
+    {
+        EXPECT_EQ(split(kernel, text), expect) << Tokenizer::name(kernel);
+    }
+    EXPECT_EQ(Tokenizer(text, ':').size(), expect.size());
+}
@@ -0,0 +1,26 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+# Copyright (C) 2020 YADRO
+
+"""Generate C++ source with compression dictionary embedded as byte array."""
+
+import sys
+
+if len(sys.argv) != 3:
+    sys.exit('Usage: {} DICT_FILE OUTPUT_FILE'.format(sys.argv[0]))
+
+with open(sys.argv[1], 'rb') as f:
+    data = f.read()
+if not data or len(data) > 32 * 1024:
+    sys.exit('Invalid size of compression dictionary: {}'.format(sys.argv[1]))
+
+with open(sys.argv[2], 'w') as f:
+    f.write('// Generated by embed_dictionary.py, do not edit.\n\n')
+    f.write('#include <cstddef>\n#include <cstdint>\n\n')
+    f.write('extern const uint8_t embeddedDictionary[] = {\n')
+    for i in range(0, len(data), 12):
+        f.write('   ' + ''.join(' 0x{:02x},'.format(b)
+                                for b in data[i:i + 12]) + '\n')
+    f.write('};\n')
+    f.write('extern const size_t embeddedDictionarySize =\n'
+            '    sizeof(embeddedDictionary);\n')